@@ -0,0 +1,4 @@
+; Must fail to link: "assembler -b -o out main.s plus.s minus.s duplicate.s"
+; reports that symbol done is defined in both minus.s and duplicate.s
+        .global done
+done:   halt
@@ -0,0 +1,27 @@
+; test12.s written with labels: "assembler -b labels.s out" gives the
+; same image as "assembler -b ../test12.s out"
+        movi.d r0 3
+        movi.d r1 5
+        movi.d r2 -5
+        movi.d r6 sub_minus     ; absolute: instruction index << 2 = 60
+        jsrr r6
+        add.d r5 r5 r0
+        jsr done
+sub_plus: add.d r5 r5 r0
+        add.d r5 r5 r0
+        add.d r5 r5 r0
+        add.d r5 r5 r0
+        add.d r5 r5 r0
+        add.d r5 r5 r0
+        add.d r3 r0 r1
+        jsr done
+sub_minus: add.d r5 r5 r2
+        add.d r5 r5 r2
+        add.d r5 r5 r2
+        add.d r5 r5 r2
+        add.d r5 r5 r2
+        add.d r5 r5 r2
+        add.d r3 r0 r2
+        add.d r4 r0 r1
+        ret
+done:   halt
@@ -0,0 +1,12 @@
+; labels.s split into three modules; main.s holds the entry point:
+;   assembler -b -o out main.s plus.s minus.s
+; gives the same image as ../test12.s. So do the objects of
+; "assembler -c main.s plus.s minus.s" linked with -o in that order.
+        .extern sub_minus done
+        movi.d r0 3
+        movi.d r1 5
+        movi.d r2 -5
+        movi.d r6 sub_minus     ; absolute, in minus.s
+        jsrr r6
+        add.d r5 r5 r0
+        jsr done                ; PC-relative, in minus.s
@@ -0,0 +1,12 @@
+; Third module of main.s
+        .global sub_minus done
+sub_minus: add.d r5 r5 r2
+        add.d r5 r5 r2
+        add.d r5 r5 r2
+        add.d r5 r5 r2
+        add.d r5 r5 r2
+        add.d r5 r5 r2
+        add.d r3 r0 r2
+        add.d r4 r0 r1
+        ret
+done:   halt
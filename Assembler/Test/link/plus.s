@@ -0,0 +1,11 @@
+; Second module of main.s
+        .global sub_plus
+        .extern done
+sub_plus: add.d r5 r5 r0
+        add.d r5 r5 r0
+        add.d r5 r5 r0
+        add.d r5 r5 r0
+        add.d r5 r5 r0
+        add.d r5 r5 r0
+        add.d r3 r0 r1
+        jsr done
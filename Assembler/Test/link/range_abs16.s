@@ -0,0 +1,8 @@
+; Must fail to link: "assembler -b range_abs16.s out" reports that
+; symbol table is out of range of the 16-bit immediate; data addresses
+; above 65535 cannot be loaded with movi.d
+        movi.d r1 table
+        ldw r2 r1 0
+        halt
+        .org 70000
+table:  .word 1 2 3
@@ -0,0 +1,6 @@
+#!/bin/sh
+# Must fail to link: "sh range_pc16.sh [assembler]" generates a brnzp to
+# far, which is 32768 instructions past the next one, and assembles it.
+# The assembler reports that far is out of range of the 16-bit immediate;
+# a PC-relative branch reaches at most 32767 past the next instruction.
+{ echo "brnzp far"; yes halt | head -n 32768; echo "far: halt"; } > /tmp/range_pc16.s && "${1:-../../assembler}" -b /tmp/range_pc16.s /tmp/range_pc16.out
@@ -0,0 +1,5 @@
+; Must fail to link: "assembler -b -o out main.s undefined.s" reports
+;   Error: undefined symbol done referenced in main.s
+; and the same for sub_minus; nothing defines them.
+        .global sub_plus
+sub_plus: halt
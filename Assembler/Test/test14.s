@@ -0,0 +1,27 @@
+; Saturating 1.11.4 arithmetic: results clamp to [-2048.0, 2047.9375],
+; which --dump prints as -2048 and 2047.94
+; Loops 40 times so the threaded, block and jit engines compile it;
+; check with: simulator --engine=E --verify (and --jit-verify)
+        movi.d r1 40
+loop:   movi.f r8 2000.0f
+        movi.f r9 100.5f
+        add.f r10 r8 r9          ; r10 = 2047.9375 (2100.5 saturates)
+        addi.f r11 r8 60.0f      ; r11 = 2047.9375 (2060.0 saturates)
+        movi.f r12 -2000.0f
+        addi.f r12 r12 -100.0f   ; r12 = -2048.0 (-2100.0 saturates)
+        add.f r13 r12 r12        ; r13 = -2048.0
+        movi.f r14 -1.5f
+        add.f r14 r14 r9         ; r14 = 99.0 (no saturation)
+        vcompmovi v1 0 1500.0f
+        vcompmovi v1 1 -1500.0f
+        vcompmovi v1 2 1000.0f
+        vcompmovi v1 3 -2000.0f
+        vcompmovi v2 0 1000.0f
+        vcompmovi v2 1 -1000.0f
+        vcompmovi v2 2 -300.0f
+        vcompmovi v2 3 100.0f
+        vadd v3 v1 v2            ; v3 = (2047.9375, -2048.0, 700.0, -1900.0)
+        vadd v4 v3 v3            ; v4 = (2047.9375, -2048.0, 1400.0, -2048.0)
+        addi.d r1 r1 -1
+        brp loop
+        halt
@@ -0,0 +1,49 @@
+; Matrix stack: rotate, scale, translate, nested pushmatrix/popmatrix,
+; popmatrix on an empty stack and loadidentity. Vector lanes 1-3 are
+; x, y, z; the expected vertex of each setvertex is in its comment.
+; Loops 40 times so the threaded, block and jit engines compile it;
+; check with: simulator --engine=E --verify (and --jit-verify), and
+; --checkpoint-every N --checkpoint FILE followed by --restore FILE
+        vmovi v0 0.0f
+        vcompmovi v0 1 10.0f     ; v0 = (10, 0, 0)
+        vmovi v1 0.0f
+        vcompmovi v1 1 100.0f
+        vcompmovi v1 2 50.0f     ; v1 = (100, 50, 0)
+        vmovi v2 90.0f
+        vmovi v3 2.0f
+        vmovi v4 5.0f
+        vmovi v6 30.0f
+        vmovi v7 0.0f
+        vcompmovi v7 1 100.0f    ; v7 = (100, 0, 0)
+        vmovi v8 -30.0f
+        vmovi v9 -1.0f
+        movi.d r0 40
+loop:   loadidentity
+        beginprimitive 1
+        translate v1
+        rotate v2
+        scale v3
+        setvertex v0             ; (100, 70)
+        pushmatrix
+        translate v4
+        setvertex v0             ; (90, 80)
+        pushmatrix
+        scale v3
+        setvertex v0             ; (90, 100)
+        popmatrix
+        setvertex v0             ; (90, 80)
+        popmatrix
+        setvertex v0             ; (100, 70)
+        loadidentity
+        rotate v6
+        setvertex v7             ; (86, 50)
+        rotate v8
+        setvertex v7             ; (100, 0)
+        popmatrix                ; empty stack: ignored
+        loadidentity
+        scale v9
+        setvertex v0             ; (-10, 0)
+        endprimitive
+        addi.d r0 r0 -1
+        brp loop
+        halt
@@ -24,11 +24,21 @@ endprimitive
 vmovi v5 1.0f 
 movi.d r0 10
 movi.d r1 -1 
+addi.f r10 r10 1.0f
+vcompmov v5 1 r10
+vcompmov v5 2 r10
+pushmatrix
 translate v5 
+beginprimitive 0 
+setvertex v0
+setvertex v1
+setcolor v3   
+endprimitive
+popmatrix
 flush
 draw
 add.d r0 r0 r1 
-brp -5 
+brp -15 
 flush 
 vcompmov v3 2 r9
 beginprimitive 0 
@@ -1,98 +1,145 @@
 #include <iostream>
-#include <bitset>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
+#include <unordered_map>
+#include <charconv>
+#include <limits>
 #include <stdint.h>
 #include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
 #include <limits.h>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "assembler.h"
+#include "linker.h"
+#include "../program_image.h"
 
 using namespace std;
 
-const char *g_scalar_register_names[NUM_SCALAR_REGISTER] = {
-  "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+#define OP_TABLE_ENTRY(mnemonic, opcode) {mnemonic, opcode},
+struct OpTableProperties g_op_tables[NUM_OPS] = {
+  OP_TABLE(OP_TABLE_ENTRY)
 };
+#undef OP_TABLE_ENTRY
 
-const char *g_vector_register_names[NUM_VECTOR_REGISTER] = {
-  "v0",   "v1",   "v2",   "v3",   "v4",   "v5",   "v6",   "v7",   "v8",   "v9",   "v10",  "v11",  "v12",  "v13",  "v14",  "v15",
-  "v16",  "v17",  "v18",  "v19",  "v20",  "v21",  "v22",  "v23",  "v24",  "v25",  "v26",  "v27",  "v28",  "v29",  "v30",  "v31",
-  "v32",  "v33",  "v34",  "v35",  "v36",  "v37",  "v38",  "v39",  "v40",  "v41",  "v42",  "v43",  "v44",  "v45",  "v46",  "v47",
-  "v48",  "v49",  "v50",  "v51",  "v52",  "v53",  "v54",  "v55",  "v56",  "v57",  "v58",  "v59",  "v60",  "v61",  "v62",  "v63"
-};
+////////////////////////////////////////////////////////////////////////
+// desc: FNV-1a hash of a mnemonic. constexpr so that GetOpcode() can use
+//       it for case labels: two mnemonics with the same hash would be
+//       duplicate cases and fail to compile, so the switch is a perfect
+//       hash checked by the compiler.
+////////////////////////////////////////////////////////////////////////
+static constexpr uint32_t HashMnemonic(const char *str, const size_t length)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++)
+    hash = (hash ^ (uint8_t)str[i]) * 16777619u;
+  return hash;
+}
 
-struct OpTableProperties g_op_tables[NUM_OPS] = {
-  {"add.d",            OP_ADD_D          }, 
-  {"addi.d",           OP_ADDI_D         },
-  {"add.f",            OP_ADD_F          },
-  {"addi.f",           OP_ADDI_F         },
-  {"vadd",             OP_VADD           },
-  {"and.d",            OP_AND_D          }, 
-  {"andi.d",           OP_ANDI_D         },
-  {"mov",              OP_MOV            },
-  {"movi.d",           OP_MOVI_D         },
-  {"movi.f",           OP_MOVI_F         },
-  {"vmov",             OP_VMOV           },
-  {"vmovi",            OP_VMOVI          },
-  {"cmp",              OP_CMP            },
-  {"cmpi",             OP_CMPI           },
-  {"vcompmov",         OP_VCOMPMOV       },
-  {"vcompmovi",        OP_VCOMPMOVI      },
-  {"ldb",              OP_LDB            },
-  {"ldw",              OP_LDW            },
-  {"stb",              OP_STB            },
-  {"stw",              OP_STW            },
-  {"setvertex",        OP_SETVERTEX      },
-  {"setcolor",         OP_SETCOLOR       },
-  {"rotate",           OP_ROTATE         },
-  {"translate",        OP_TRANSLATE      },
-  {"scale",            OP_SCALE          },
-  {"pushmatrix",       OP_PUSHMATRIX     },
-  {"popmatrix",        OP_POPMATRIX      },
-  {"beginprimitive",   OP_BEGINPRIMITIVE },
-  {"endprimitive",     OP_ENDPRIMITIVE   },
-  {"loadidentity",     OP_LOADIDENTITY   },
-  {"flush",            OP_FLUSH          },
-  {"draw",             OP_DRAW           },
-  {"brn",              OP_BRN            },
-  {"brz",              OP_BRZ            },
-  {"brp",              OP_BRP            },
-  {"brnz",             OP_BRNZ           },
-  {"brnp",             OP_BRNP           },
-  {"brzp",             OP_BRZP           },
-  {"brnzp",            OP_BRNZP          },
-  {"jmp",              OP_JMP            },
-  {"ret",              OP_RET            },
-  {"jsr",              OP_JSR            },
-  {"jsrr",             OP_JSRR           },
-  {"halt",             OP_HALT           }, 
-};
-		  
-static int GetOpcode(string str) 
+static int GetOpcode(const string_view str)
+{
+  const char *mnemonic = NULL;
+  int opcode = -1;
+  switch (HashMnemonic(str.data(), str.size())) {
+#define OP_TABLE_CASE(name, op) \
+    case HashMnemonic(name, sizeof(name) - 1): mnemonic = name; opcode = op; break;
+    OP_TABLE(OP_TABLE_CASE)
+#undef OP_TABLE_CASE
+    default:
+      return -1;
+  }
+  // a string that is not a mnemonic can still land on one's hash
+  return str.compare(mnemonic) == 0 ? opcode : -1;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Parse a register name: the prefix letter followed by a decimal
+//       index without leading zeros ("r7", "v63")
+// output: the index, or -1 if str does not name one of num_registers
+////////////////////////////////////////////////////////////////////////
+static int ParseRegisterIdx(const string_view str, const char prefix, const int num_registers)
+{
+  const size_t length = str.size();
+  if (length < 2 || length > 3 || str[0] != prefix)
+    return -1;
+  if (length == 3 && str[1] == '0')
+    return -1;
+
+  int idx = 0;
+  for (size_t i = 1; i < length; i++) {
+    if (str[i] < '0' || str[i] > '9')
+      return -1;
+    idx = idx * 10 + (str[i] - '0');
+  }
+  return idx < num_registers ? idx : -1;
+}
+
+static int GetScalarRegisterIdx(const string_view str)
 {
-	for (int i=0; i < NUM_OPS; i++) 
-    if (str.compare(g_op_tables[i].mnemonic) == 0)
-      return g_op_tables[i].opcode;
-	
-  return -1;
+  return ParseRegisterIdx(str, 'r', NUM_SCALAR_REGISTER);
 }
 
-static int GetScalarRegisterIdx(string str)
+static int GetVectorRegisterIdx(const string_view str)
 {
-	for (int i = 0; i < NUM_SCALAR_REGISTER; i++) 
-    if (str.compare(g_scalar_register_names[i]) == 0)
-      return i;
+  return ParseRegisterIdx(str, 'v', NUM_VECTOR_REGISTER);
+}
 
-	return -1;
+////////////////////////////////////////////////////////////////////////
+// desc: Parse a decimal integer the way "istream >> int" does: optional
+//       sign, digits, anything after them ignored. value is 0 if there are
+//       no digits and saturates on overflow.
+// output: false if str does not start with a number or it overflows
+////////////////////////////////////////////////////////////////////////
+static bool ParseInteger(const string_view str, int &value)
+{
+  const char *first = str.data();
+  const char *last = first + str.size();
+  if (first != last && *first == '+')
+    first++;
+  value = 0;
+  if (first == last || *first == '+')
+    return false;
+
+  from_chars_result result = from_chars(first, last, value);
+  if (result.ec == errc::result_out_of_range) {
+    value = *first == '-' ? INT_MIN : INT_MAX;
+    return false;
+  }
+  return result.ec == errc();
 }
 
-static int GetVectorRegisterIdx(string str) 
+////////////////////////////////////////////////////////////////////////
+// desc: Parse a decimal floating-point number the way "istream >> float"
+//       does (no inf / nan); value is 0 if there is no number
+// output: false if str does not start with a number or it overflows
+////////////////////////////////////////////////////////////////////////
+static bool ParseFloat(const string_view str, float &value)
 {
-	for (int i = 0; i < NUM_VECTOR_REGISTER; i++) 
-    if (str.compare(g_vector_register_names[i]) == 0)
-      return i;
+  const char *first = str.data();
+  const char *last = first + str.size();
+  if (first != last && *first == '+')
+    first++;
+  value = 0;
+  const char *digits = first != last && *first == '-' ? first + 1 : first;
+  if (digits == last || (*digits != '.' && (*digits < '0' || *digits > '9')))
+    return false;
 
-	return -1;
+  from_chars_result result = from_chars(first, last, value);
+  if (result.ec == errc::result_out_of_range) {
+    value = *first == '-' ? -numeric_limits<float>::max() : numeric_limits<float>::max();
+    return false;
+  }
+  return result.ec == errc();
 }
 
 #define FLOAT_TO_FIXED187(n) ((int)((n) * (float)(1<<(7)))) & 0xffff
@@ -181,48 +228,391 @@ static uint16_t EncodeFloatingPointNumberToBinary(float value)
 #endif 
 
 
-int main(int argc, char** argv) 
+////////////////////////////////////////////////////////////////////////
+// desc: Write the assembled program as a binary image (see program_image.h)
+////////////////////////////////////////////////////////////////////////
+static bool WriteBinaryImage(ofstream &outfile, const vector<uint32_t> &code,
+                             const vector<unsigned char> &data, const uint32_t data_address)
 {
-  if (argc != 3) {
-    cerr << "Usage: " << argv[0] << " <input> <output>" << endl; 
-    return 1;
+  ProgramImageHeader header;
+  memcpy(header.magic, PROGRAM_IMAGE_MAGIC, PROGRAM_IMAGE_MAGIC_SIZE);
+  header.version = PROGRAM_IMAGE_VERSION;
+  header.code_offset = PROGRAM_IMAGE_HEADER_SIZE;
+  header.code_count = code.size();
+  header.data_offset = data.empty() ? 0 : header.code_offset + header.code_count * 4;
+  header.data_size = data.size();
+  header.data_address = data.empty() ? 0 : data_address;
+
+  vector<unsigned char> image(PROGRAM_IMAGE_HEADER_SIZE + code.size() * 4 + data.size());
+  EncodeProgramImageHeader(header, &image[0]);
+  for (size_t i = 0; i < code.size(); i++)
+    WriteLE32(&image[header.code_offset + i * 4], code[i]);
+  if (!data.empty())
+    memcpy(&image[header.data_offset], &data[0], data.size());
+
+  outfile.write((const char *)&image[0], image.size());
+  return outfile.good();
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Write the assembled program in the text format, 32 '0'/'1'
+//       characters per instruction, with a single write
+////////////////////////////////////////////////////////////////////////
+static bool WriteTextImage(ofstream &outfile, const vector<uint32_t> &code)
+{
+  string text(code.size() * 32, '0');
+  for (size_t i = 0; i < code.size(); i++)
+    for (int bit = 0; bit < 32; bit++)
+      if (code[i] & (0x80000000u >> bit))
+        text[i * 32 + bit] = '1';
+
+  outfile.write(text.data(), text.size());
+  return outfile.good();
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Map the source file read-only; an empty file gives size 0
+// output: false if the file cannot be opened or mapped
+////////////////////////////////////////////////////////////////////////
+static bool MapSource(const char *path, const char *&source, size_t &size, ostream &err)
+{
+  source = NULL;
+  size = 0;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    err << "Error: Failed to open input file " << path << endl;
+    return false;
   }
 
-  ifstream infile(argv[1]);
-  ofstream outfile(argv[2]);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    err << "Error: Failed to stat input file " << path << endl;
+    close(fd);
+    return false;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return true;
+  }
 
-  if (!infile) {
-    cerr << "Error: Failed to open input file " << argv[1] << endl;
-    return 1;
+  void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    err << "Error: Failed to map input file " << path << endl;
+    return false;
   }
+  madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+  source = (const char *)mapped;
+  size = st.st_size;
+  return true;
+}
 
-  if (!outfile) {
-    cerr << "ERROR: Failed to open output file " << argv[2] << endl;
-    return 1;
+static void UnmapSource(const char *source, const size_t size)
+{
+  if (source != NULL)
+    munmap((void *)source, size);
+}
+
+static inline bool IsSpace(const char c)
+{
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Split the next source line into whitespace-separated tokens,
+//       which point into the source. The line ends at a newline or a
+//       NUL, and a token starting with ';' comments out the rest of it;
+//       tokens past MAX_ARG_NUM are dropped and the unused entries of
+//       tokens are left empty.
+// input: cursor: start of the line, advanced to the start of the next
+// output: the number of tokens, or -1 when the assembly should stop
+////////////////////////////////////////////////////////////////////////
+static int NextLine(const char *&cursor, const char *end, string_view *tokens)
+{
+  if (cursor == end)
+    return -1;
+
+  const char *line = cursor;
+  const char *newline = (const char *)memchr(line, '\n', end - line);
+  const char *line_end = newline != NULL ? newline : end;
+  cursor = newline != NULL ? newline + 1 : end;
+  const char *nul = (const char *)memchr(line, '\0', line_end - line);
+  if (nul != NULL)
+    line_end = nul;
+
+  // Some text editors tend to insert null, newline or end-of-file character at the end.
+  // This should not be parsed otherwise it will emit invalid opcode error message.
+  if (line == line_end || *line == (char)EOF)
+    return -1;
+
+  int num_tokens = 0;
+  const char *trav = line;
+  while (num_tokens < MAX_ARG_NUM) {
+    while (trav != line_end && IsSpace(*trav))
+      trav++;
+    if (trav == line_end || *trav == ';')
+      break;
+    const char *token = trav;
+    while (trav != line_end && !IsSpace(*trav))
+      trav++;
+    tokens[num_tokens++] = string_view(token, trav - token);
+  }
+  for (int i = num_tokens; i < MAX_ARG_NUM && !tokens[i].empty(); i++)
+    tokens[i] = string_view();
+  return num_tokens;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Assembly state of one source file. Symbols are collected into
+// module->symbols; every instruction operand that names a symbol gets
+// a relocation, which LinkModules() resolves once the code is placed.
+////////////////////////////////////////////////////////////////////////
+typedef struct SymbolState_ {
+  bool defined;
+  bool external;             // declared .extern
+  int line;                  // first reference, for "undefined symbol"
+} SymbolState;
+
+typedef struct SourceState_ {
+  const char *path;
+  int line;
+  ostream *err;
+  ObjectModule *module;
+  uint32_t data_location;
+  unordered_map<string, int> symbol_idx;   // name -> index in module->symbols
+  vector<SymbolState> symbols;             // parallel to module->symbols
+  vector<int> pending_labels;              // label the next instruction or data
+} SourceState;
+
+static ostream &SourceError(SourceState &state)
+{
+  return *state.err << "Error: " << state.path << ":" << state.line << ": ";
+}
+
+static bool IsSymbolName(const string_view str)
+{
+  if (str.empty() || !(isalpha((unsigned char)str[0]) || str[0] == '_'))
+    return false;
+  for (size_t i = 1; i < str.size(); i++)
+    if (!(isalnum((unsigned char)str[i]) || str[i] == '_' || str[i] == '.'))
+      return false;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Find a symbol of the source, adding it as undefined if new
+////////////////////////////////////////////////////////////////////////
+static int FindSymbol(SourceState &state, const string_view name)
+{
+  string key(name);
+  unordered_map<string, int>::iterator it = state.symbol_idx.find(key);
+  if (it != state.symbol_idx.end())
+    return it->second;
+
+  ObjectSymbol symbol;
+  symbol.name = key;
+  symbol.value = 0;
+  symbol.section = SECTION_UNDEFINED;
+  symbol.global = false;
+  SymbolState symbol_state = {false, false, state.line};
+  const int idx = state.module->symbols.size();
+  state.module->symbols.push_back(symbol);
+  state.symbols.push_back(symbol_state);
+  state.symbol_idx[key] = idx;
+  return idx;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Give the pending labels their section and value
+////////////////////////////////////////////////////////////////////////
+static void PlaceLabels(SourceState &state, const int section, const uint32_t value)
+{
+  for (size_t i = 0; i < state.pending_labels.size(); i++) {
+    ObjectSymbol &symbol = state.module->symbols[state.pending_labels[i]];
+    symbol.section = section;
+    symbol.value = value;
+  }
+  state.pending_labels.clear();
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Define "name:" at the next instruction or data value
+// output: false if the name is invalid or already taken
+////////////////////////////////////////////////////////////////////////
+static bool DefineLabel(SourceState &state, const string_view name)
+{
+  if (!IsSymbolName(name)) {
+    SourceError(state) << "invalid label " << name << ":" << endl;
+    return false;
+  }
+  const int idx = FindSymbol(state, name);
+  if (state.symbols[idx].defined || state.symbols[idx].external) {
+    SourceError(state) << "symbol " << name << " is already "
+                       << (state.symbols[idx].defined ? "defined" : "declared .extern") << endl;
+    return false;
+  }
+  state.symbols[idx].defined = true;
+  state.pending_labels.push_back(idx);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Value of a 16-bit immediate operand. A symbol leaves the field
+//       0 and records a relocation of the given type for the
+//       instruction being assembled.
+////////////////////////////////////////////////////////////////////////
+static int ImmediateOperand(SourceState &state, const string_view token, const int type)
+{
+  if (!IsSymbolName(token)) {
+    int value;
+    ParseInteger(token, value);
+    return value;
+  }
+  ObjectRelocation relocation;
+  relocation.offset = state.module->code.size();
+  relocation.type = type;
+  relocation.symbol = FindSymbol(state, token);
+  state.module->relocations.push_back(relocation);
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Handle a directive. The data section is one contiguous range
+//       of data memory starting at the lowest .org address.
+//       .org <address>        set the data location counter
+//       .byte <value> ...     emit 8-bit values
+//       .word <value> ...     emit 16-bit little-endian values
+//       .global <symbol> ...  export symbols defined in this source
+//       .extern <symbol> ...  import symbols defined by another source
+// output: false on error
+////////////////////////////////////////////////////////////////////////
+static bool AssembleDirective(SourceState &state, const string_view *tokens, const int num_tokens)
+{
+  vector<unsigned char> &data = state.module->data;
+  uint32_t &data_address = state.module->data_address;
+  uint32_t &data_location = state.data_location;
+  int integer_value;
+
+  if (tokens[0] == ".global" || tokens[0] == ".extern") {
+    const bool global = tokens[0] == ".global";
+    for (int i = 1; i < num_tokens; i++) {
+      if (!IsSymbolName(tokens[i])) {
+        SourceError(state) << "invalid symbol " << tokens[i] << " for " << tokens[0] << endl;
+        return false;
+      }
+      const int idx = FindSymbol(state, tokens[i]);
+      if (global)
+        state.module->symbols[idx].global = true;
+      else
+        state.symbols[idx].external = true;
+      if (state.module->symbols[idx].global && state.symbols[idx].external) {
+        SourceError(state) << "symbol " << tokens[i] << " is both .global and .extern" << endl;
+        return false;
+      }
+      if (state.symbols[idx].defined && state.symbols[idx].external) {
+        SourceError(state) << "symbol " << tokens[i] << " is defined in this source" << endl;
+        return false;
+      }
+    }
+    return true;
   }
 
-  char buffer[MAX_LINE_SIZE] = {0,};
-  string tokens[MAX_ARG_NUM];
-  while (infile.getline(buffer, sizeof(buffer)))
+  if (tokens[0].compare(".org") == 0) {
+    if (num_tokens != 2 || !ParseInteger(tokens[1], integer_value) || integer_value < 0) {
+      SourceError(state) << "invalid .org address" << endl;
+      return false;
+    }
+    uint32_t address = integer_value;
+    if (data.empty()) {
+      data_address = address;
+    }
+    else if (address < data_address) {
+      data.insert(data.begin(), data_address - address, 0);
+      data_address = address;
+    }
+    data_location = address;
+    return true;
+  }
+
+  int size;
+  if (tokens[0].compare(".byte") == 0)
+    size = 1;
+  else if (tokens[0].compare(".word") == 0)
+    size = 2;
+  else {
+    SourceError(state) << "invalid directive " << tokens[0] << endl;
+    return false;
+  }
+
+  if (data.empty())
+    data_address = data_location;
+  PlaceLabels(state, SECTION_DATA, data_location);
+
+  for (int i = 1; i < num_tokens; i++) {
+    if (!ParseInteger(tokens[i], integer_value)) {
+      SourceError(state) << "invalid value " << tokens[i] << " for " << tokens[0] << endl;
+      return false;
+    }
+    uint32_t offset = data_location - data_address;
+    if (data.size() < offset + size)
+      data.resize(offset + size, 0);
+    data[offset] = integer_value & 0xFF;
+    if (size == 2)
+      data[offset + 1] = (integer_value >> 8) & 0xFF;
+    data_location += size;
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Assemble one source into a relocatable module
+// input: path: for messages; source, size: the source text
+// output: false on error, reported on err
+////////////////////////////////////////////////////////////////////////
+static bool AssembleSource(const char *path, const char *source, const size_t size,
+                           ObjectModule &module, ostream &err)
+{
+  SourceState state;
+  state.path = path;
+  state.line = 0;
+  state.err = &err;
+  state.module = &module;
+  state.data_location = 0;
+  module.name = path;
+  module.data_address = 0;
+
+  const char *cursor = source;
+  const char *source_end = source + size;
+  string_view line_tokens[MAX_ARG_NUM];
+  int num_tokens;
+  while ((num_tokens = NextLine(cursor, source_end, line_tokens)) >= 0)
   {
-    // Some text editors tend to insert null, newline or end-of-file character at the end.
-    // This should not be parsed otherwise it will emit invalid opcode error message.
-    if (buffer[0] == (char)NULL || buffer[0] == EOF || buffer[0] == '\n')
-      break;
+    state.line++;
 
-    istringstream istr(string(buffer), ios_base::out);
+    // "label:" prefixes name the next instruction or data value
+    string_view *tokens = line_tokens;
+    while (num_tokens > 0 && tokens[0].size() > 1 && tokens[0].back() == ':') {
+      if (!DefineLabel(state, tokens[0].substr(0, tokens[0].size() - 1)))
+        return false;
+      tokens++;
+      num_tokens--;
+    }
+    if (num_tokens == 0)
+      continue;
 
-    for (int trav = 0; trav < MAX_ARG_NUM; trav++)
-      if (!(istr >> tokens[trav]))
-        break;
+    if (tokens[0][0] == '.') {
+      if (!AssembleDirective(state, tokens, num_tokens))
+        return false;
+      continue;
+    }
 
+    vector<uint32_t> &code = module.code;
+    PlaceLabels(state, SECTION_CODE, code.size());
     uint32_t instruction = 0;
     int opcode = GetOpcode(tokens[0]);
     if (opcode == -1) {
-      cerr << "Error: invalid opcode " << tokens[0] << endl; 
-      infile.close();
-      outfile.close();
-      return 1;
+      SourceError(state) << "invalid opcode " << tokens[0] << endl; 
+      return false;
     }
 
     instruction = opcode << 24;	
@@ -248,14 +638,14 @@ int main(int argc, char** argv)
       case OP_STW:
         instruction = instruction | ((GetScalarRegisterIdx(tokens[1])<<20)&0x00F00000);
         instruction = instruction | ((GetScalarRegisterIdx(tokens[2])<<16)&0x000F0000);
-        istringstream(tokens[3]) >> integer_value;
+        integer_value = ImmediateOperand(state, tokens[3], RELOC_ABS16);
         instruction = instruction | (((int16_t)integer_value)&0x0000FFFF);
         break;
 
       case OP_ADDI_F:
         instruction = instruction | ((GetScalarRegisterIdx(tokens[1])<<20)&0x00F00000);
         instruction = instruction | ((GetScalarRegisterIdx(tokens[2])<<16)&0x000F0000);
-        istringstream(tokens[3]) >> float_value;
+        ParseFloat(tokens[3], float_value);
         instruction = instruction | (EncodeFloatingPointNumberToBinary(float_value)&0x0000FFFF);
         break;
 
@@ -272,13 +662,13 @@ int main(int argc, char** argv)
 
       case OP_MOVI_D:
         instruction = instruction | ((GetScalarRegisterIdx(tokens[1])<<16)&0x000F0000);
-        istringstream(tokens[2]) >> integer_value;
+        integer_value = ImmediateOperand(state, tokens[2], RELOC_ABS16);
         instruction = instruction | (((int16_t)integer_value)&0x0000FFFF);
         break;
 
       case OP_MOVI_F:
         instruction = instruction | ((GetScalarRegisterIdx(tokens[1])<<16)&0x000F0000);
-        istringstream(tokens[2]) >> float_value;
+        ParseFloat(tokens[2], float_value);
         instruction = instruction | (EncodeFloatingPointNumberToBinary(float_value)&0x0000FFFF);
         break;
 
@@ -289,7 +679,7 @@ int main(int argc, char** argv)
 
       case OP_VMOVI:
         instruction = instruction | ((GetVectorRegisterIdx(tokens[1])<<16)&0x003F0000);
-        istringstream(tokens[2]) >> float_value;
+        ParseFloat(tokens[2], float_value);
         instruction = instruction | (EncodeFloatingPointNumberToBinary(float_value)&0x0000FFFF);
         break;
 
@@ -300,22 +690,22 @@ int main(int argc, char** argv)
 
       case OP_CMPI:
         instruction = instruction | ((GetScalarRegisterIdx(tokens[1])<<16)&0x000F0000);
-        istringstream(tokens[2]) >> integer_value;
+        integer_value = ImmediateOperand(state, tokens[2], RELOC_ABS16);
         instruction = instruction | (((int16_t)integer_value)&0x0000FFFF);
         break;
 
       case OP_VCOMPMOV:
         instruction = instruction | ((GetVectorRegisterIdx(tokens[1])<<16)&0x003F0000);
-        istringstream(tokens[2]) >> integer_value;
+        ParseInteger(tokens[2], integer_value);
         instruction = instruction | ((integer_value<<22)&0x00C00000);
         instruction = instruction | ((GetScalarRegisterIdx(tokens[3])<< 8)&0x00000F00);
         break;
 
       case OP_VCOMPMOVI:
         instruction = instruction | ((GetVectorRegisterIdx(tokens[1])<<16)&0x003F0000);
-        istringstream(tokens[2]) >> integer_value;
+        ParseInteger(tokens[2], integer_value);
         instruction = instruction | ((integer_value<<22)&0x00C00000);
-        istringstream(tokens[3]) >> float_value;
+        ParseFloat(tokens[3], float_value);
         instruction = instruction | (EncodeFloatingPointNumberToBinary(float_value)&0x0000FFFF);
         break;
 
@@ -330,19 +720,19 @@ int main(int argc, char** argv)
         break;
 
       case OP_BEGINPRIMITIVE:
-        istringstream(tokens[1]) >> integer_value;
+        ParseInteger(tokens[1], integer_value);
         instruction = instruction | ((integer_value<<16)&0x000F0000);
         break;
 
       case OP_JSR:
-        istringstream(tokens[1]) >> integer_value;
+        integer_value = ImmediateOperand(state, tokens[1], RELOC_PC16);
         instruction = instruction | ((integer_value)&0x0000FFFF);
         break;
 
       case OP_JMP:
       //case OP_RET:
       case OP_JSRR:
-        if (tokens[0].compare("ret") == 0)
+        if (tokens[0] == "ret")
           instruction = instruction | ((0x07<<16)&0x000F0000);
         else
           instruction = instruction | ((GetScalarRegisterIdx(tokens[1])<<16)&0x000F0000);
@@ -363,7 +753,7 @@ int main(int argc, char** argv)
       case OP_BRNP:
       case OP_BRZP:
       case OP_BRNZP:
-        istringstream(tokens[1]) >> integer_value;
+        integer_value = ImmediateOperand(state, tokens[1], RELOC_PC16);
         instruction = instruction | (((int16_t)integer_value)&0x0000FFFF);
         break;
 
@@ -371,12 +761,307 @@ int main(int argc, char** argv)
         break;
     }
 
-    bitset<sizeof(uint32_t)*CHAR_BIT> bits(instruction);
-    outfile << bits;
+    code.push_back(instruction);
+  }
+  PlaceLabels(state, SECTION_CODE, module.code.size());
+
+  bool ok = true;
+  for (size_t i = 0; i < module.symbols.size(); i++) {
+    const SymbolState &symbol = state.symbols[i];
+    if (symbol.defined || symbol.external)
+      continue;
+    state.line = symbol.line;
+    if (module.symbols[i].global)
+      SourceError(state) << ".global symbol " << module.symbols[i].name << " is not defined" << endl;
+    else
+      SourceError(state) << "undefined symbol " << module.symbols[i].name << endl;
+    ok = false;
+  }
+  return ok;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Parallel assembly: one job per input, taken in turn by the
+// g_num_workers threads
+////////////////////////////////////////////////////////////////////////
+typedef struct AssemblyJob_ {
+  const char *path;
+  ObjectModule module;
+  string errors;
+  bool ok;
+} AssemblyJob;
+
+static vector<AssemblyJob> g_jobs;
+static int g_next_job = 0;
+static bool g_write_objects = false;     // -c: write <input>.o
+static const char *g_cache_dir = NULL;   // -k: reuse modules of unchanged sources
+static uint64_t g_cache_salt;            // hash of the opcode table and versions
+
+////////////////////////////////////////////////////////////////////////
+// desc: Object file path for a source: ".s" replaced by ".o", or ".o"
+//       appended
+////////////////////////////////////////////////////////////////////////
+static string ObjectPath(const string &path)
+{
+  if (path.size() > 2 && path.compare(path.size() - 2, 2, ".s") == 0)
+    return path.substr(0, path.size() - 2) + ".o";
+  return path + ".o";
+}
+
+////////////////////////////////////////////////////////////////////////
+// Reassembly cache (-k <dir>)
+//
+// The module assembled from a source is kept in <dir> as an object file
+// named after a hash of the source text. The hash is salted with the
+// opcode table and the cache and object file versions, so changing the
+// assembler invalidates the whole cache. Entries are written to a
+// temporary file and renamed, so concurrent assemblers sharing a cache
+// never see a partial entry; unreadable entries are reassembled.
+////////////////////////////////////////////////////////////////////////
+#define ASSEMBLER_CACHE_VERSION 1    // bump when the same source would assemble differently
+
+// FNV-1a, a 64-bit word at a time with the tail bytewise
+static uint64_t HashBytes(uint64_t hash, const void *data, const size_t size)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, p + i, 8);
+    hash = (hash ^ word) * 0x100000001b3ULL;
+  }
+  for (; i < size; i++)
+    hash = (hash ^ p[i]) * 0x100000001b3ULL;
+  return hash;
+}
+
+static uint64_t HashAssembler()
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  const uint32_t versions[2] = {ASSEMBLER_CACHE_VERSION, OBJECT_FILE_VERSION};
+  hash = HashBytes(hash, versions, sizeof(versions));
+  for (int i = 0; i < NUM_OPS; i++) {
+    hash = HashBytes(hash, g_op_tables[i].mnemonic.c_str(), g_op_tables[i].mnemonic.size() + 1);
+    hash = HashBytes(hash, &g_op_tables[i].opcode, sizeof(g_op_tables[i].opcode));
   }
+  return hash;
+}
+
+static string CachePath(const char *source, const size_t size)
+{
+  ostringstream path;
+  path << g_cache_dir << "/" << hex << setw(16) << setfill('0')
+       << HashBytes(g_cache_salt, source, size) << dec << "-" << size << ".o";
+  return path.str();
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Load the cached module at path
+// output: false if there is no usable entry
+////////////////////////////////////////////////////////////////////////
+static bool ReadCachedModule(const string &path, ObjectModule &module)
+{
+  ostringstream ignored;
+  const char *image;
+  size_t size;
+  if (!MapSource(path.c_str(), image, size, ignored))
+    return false;
+  bool ok = size > 0 && DecodeObjectFile((const unsigned char *)image, size, module, ignored);
+  UnmapSource(image, size);
+  return ok;
+}
 
-  infile.close();
+static void WriteCachedModule(const string &path, const ObjectModule &module, const int job)
+{
+  ostringstream temp_path;
+  temp_path << path << ".tmp" << getpid() << "-" << job;
+  vector<unsigned char> image = EncodeObjectFile(module);
+  ofstream outfile(temp_path.str().c_str(), ios_base::out | ios_base::binary);
+  outfile.write((const char *)&image[0], image.size());
   outfile.close();
+  if (outfile.fail() || rename(temp_path.str().c_str(), path.c_str()) != 0)
+    unlink(temp_path.str().c_str());
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Assemble the job's source, or read it if it is an object file,
+//       and with -c write the object file. With -k, an unchanged source
+//       is taken from the cache instead of being assembled.
+////////////////////////////////////////////////////////////////////////
+static void RunAssemblyJob(AssemblyJob &job)
+{
+  ostringstream err;
+  const char *source;
+  size_t size;
+  job.ok = MapSource(job.path, source, size, err);
+  if (job.ok) {
+    job.module.name = job.path;
+    if (size >= OBJECT_FILE_MAGIC_SIZE && memcmp(source, OBJECT_FILE_MAGIC, OBJECT_FILE_MAGIC_SIZE) == 0) {
+      if (g_write_objects) {
+        err << "Error: " << job.path << " is already an object file" << endl;
+        job.ok = false;
+      }
+      else
+        job.ok = DecodeObjectFile((const unsigned char *)source, size, job.module, err);
+    }
+    else if (g_cache_dir == NULL)
+      job.ok = AssembleSource(job.path, source, size, job.module, err);
+    else {
+      const string cache_path = CachePath(source, size);
+      if (!ReadCachedModule(cache_path, job.module)) {
+        job.ok = AssembleSource(job.path, source, size, job.module, err);
+        if (job.ok)
+          WriteCachedModule(cache_path, job.module, &job - &g_jobs[0]);
+      }
+      job.module.name = job.path;
+    }
+    UnmapSource(source, size);
+  }
+
+  if (job.ok && g_write_objects) {
+    const string path = ObjectPath(job.path);
+    vector<unsigned char> image = EncodeObjectFile(job.module);
+    ofstream outfile(path.c_str(), ios_base::out | ios_base::binary);
+    outfile.write((const char *)&image[0], image.size());
+    outfile.close();
+    if (outfile.fail()) {
+      err << "Error: Failed to write output file " << path << endl;
+      job.ok = false;
+    }
+  }
+  job.errors = err.str();
+}
+
+static void *AssemblyWorkerMain(void *)
+{
+  const int num_jobs = g_jobs.size();
+  int job;
+  while ((job = __atomic_fetch_add(&g_next_job, 1, __ATOMIC_RELAXED)) < num_jobs)
+    RunAssemblyJob(g_jobs[job]);
+  return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Run every job on num_threads threads (0: one per CPU) and
+//       report errors in input order
+// output: false if a job failed
+////////////////////////////////////////////////////////////////////////
+static bool RunAssemblyJobs(int num_threads)
+{
+  if (num_threads <= 0)
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+  if (num_threads > (int)g_jobs.size())
+    num_threads = g_jobs.size();
+
+  vector<pthread_t> workers;
+  for (int i = 1; i < num_threads; i++) {
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, AssemblyWorkerMain, NULL) != 0)
+      break;
+    workers.push_back(worker);
+  }
+  AssemblyWorkerMain(NULL);
+  for (size_t i = 0; i < workers.size(); i++)
+    pthread_join(workers[i], NULL);
+
+  bool ok = true;
+  for (size_t i = 0; i < g_jobs.size(); i++) {
+    cerr << g_jobs[i].errors;
+    ok = ok && g_jobs[i].ok;
+  }
+  return ok;
+}
+
+static void PrintUsage(const char *name)
+{
+  cerr << "Usage: " << name << " [-b] [-k <dir>] <input> <output>" << endl; 
+  cerr << "       " << name << " [-b] [-j <threads>] [-k <dir>] -o <output> <input>..." << endl;
+  cerr << "       " << name << " -c [-j <threads>] [-k <dir>] <input>..." << endl;
+  cerr << "  -b: emit a binary program image instead of the text format" << endl;
+  cerr << "  -o: assemble the sources and link them with any object files into one" << endl;
+  cerr << "      program; the first input holds the entry point" << endl;
+  cerr << "  -c: assemble each source to a relocatable object file (.s replaced by .o)" << endl;
+  cerr << "  -j: number of sources assembled in parallel (default: one per CPU)" << endl;
+  cerr << "  -k: cache assembled sources in <dir> and reuse them while unchanged" << endl;
+}
+
+int main(int argc, char** argv) 
+{
+  bool binary_output = false;
+  const char *output_path = NULL;
+  int num_threads = 0;
+  vector<const char *> inputs;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-b") == 0)
+      binary_output = true;
+    else if (strcmp(argv[i], "-c") == 0)
+      g_write_objects = true;
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      output_path = argv[++i];
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+      num_threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+      g_cache_dir = argv[++i];
+    else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+    else
+      inputs.push_back(argv[i]);
+  }
+
+  // assembler [-b] <input> <output>
+  if (!g_write_objects && output_path == NULL && inputs.size() == 2) {
+    output_path = inputs[1];
+    inputs.pop_back();
+  }
+  if (inputs.empty() || (g_write_objects ? output_path != NULL || binary_output : output_path == NULL)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  if (g_cache_dir != NULL) {
+    if (mkdir(g_cache_dir, 0777) != 0 && errno != EEXIST) {
+      cerr << "Error: Failed to create cache directory " << g_cache_dir << endl;
+      return 1;
+    }
+    g_cache_salt = HashAssembler();
+  }
+
+  g_jobs.resize(inputs.size());
+  for (size_t i = 0; i < inputs.size(); i++)
+    g_jobs[i].path = inputs[i];
+  if (!RunAssemblyJobs(num_threads))
+    return 1;
+  if (g_write_objects)
+    return 0;
+
+  vector<ObjectModule> modules(g_jobs.size());
+  for (size_t i = 0; i < g_jobs.size(); i++)
+    swap(modules[i], g_jobs[i].module);
+  vector<uint32_t> code;
+  vector<unsigned char> data;
+  uint32_t data_address;
+  if (!LinkModules(modules, code, data, data_address, cerr))
+    return 1;
+  if (!binary_output && !data.empty()) {
+    cerr << "Error: data directives require binary output (-b)" << endl;
+    return 1;
+  }
+
+  ofstream outfile(output_path, binary_output ? ios_base::out | ios_base::binary : ios_base::out);
+  if (!outfile) {
+    cerr << "ERROR: Failed to open output file " << output_path << endl;
+    return 1;
+  }
+
+  bool written = binary_output ? WriteBinaryImage(outfile, code, data, data_address)
+                               : WriteTextImage(outfile, code);
+  outfile.close();
+  if (!written || outfile.fail()) {
+    cerr << "Error: Failed to write output file " << output_path << endl;
+    return 1;
+  }
 
   return 0;
 }
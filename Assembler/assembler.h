@@ -4,13 +4,63 @@
 #include <string>
 
 #define MAX_ARG_NUM 50
-#define MAX_LINE_SIZE 1024
 
 #define NUM_SCALAR_REGISTER 16
 #define NUM_VECTOR_REGISTER 64
 
 #define NUM_OPS 44
 
+////////////////////////////////////////////////////////////////////////
+// Mnemonic table: X(mnemonic, opcode) for every instruction. Expanded
+// into g_op_tables and into the GetOpcode() switch, so the two cannot
+// drift apart.
+////////////////////////////////////////////////////////////////////////
+#define OP_TABLE(X)                        \
+  X("add.d",           OP_ADD_D          ) \
+  X("addi.d",          OP_ADDI_D         ) \
+  X("add.f",           OP_ADD_F          ) \
+  X("addi.f",          OP_ADDI_F         ) \
+  X("vadd",            OP_VADD           ) \
+  X("and.d",           OP_AND_D          ) \
+  X("andi.d",          OP_ANDI_D         ) \
+  X("mov",             OP_MOV            ) \
+  X("movi.d",          OP_MOVI_D         ) \
+  X("movi.f",          OP_MOVI_F         ) \
+  X("vmov",            OP_VMOV           ) \
+  X("vmovi",           OP_VMOVI          ) \
+  X("cmp",             OP_CMP            ) \
+  X("cmpi",            OP_CMPI           ) \
+  X("vcompmov",        OP_VCOMPMOV       ) \
+  X("vcompmovi",       OP_VCOMPMOVI      ) \
+  X("ldb",             OP_LDB            ) \
+  X("ldw",             OP_LDW            ) \
+  X("stb",             OP_STB            ) \
+  X("stw",             OP_STW            ) \
+  X("setvertex",       OP_SETVERTEX      ) \
+  X("setcolor",        OP_SETCOLOR       ) \
+  X("rotate",          OP_ROTATE         ) \
+  X("translate",       OP_TRANSLATE      ) \
+  X("scale",           OP_SCALE          ) \
+  X("pushmatrix",      OP_PUSHMATRIX     ) \
+  X("popmatrix",       OP_POPMATRIX      ) \
+  X("beginprimitive",  OP_BEGINPRIMITIVE ) \
+  X("endprimitive",    OP_ENDPRIMITIVE   ) \
+  X("loadidentity",    OP_LOADIDENTITY   ) \
+  X("flush",           OP_FLUSH          ) \
+  X("draw",            OP_DRAW           ) \
+  X("brn",             OP_BRN            ) \
+  X("brz",             OP_BRZ            ) \
+  X("brp",             OP_BRP            ) \
+  X("brnz",            OP_BRNZ           ) \
+  X("brnp",            OP_BRNP           ) \
+  X("brzp",            OP_BRZP           ) \
+  X("brnzp",           OP_BRNZP          ) \
+  X("jmp",             OP_JMP            ) \
+  X("ret",             OP_RET            ) \
+  X("jsr",             OP_JSR            ) \
+  X("jsrr",            OP_JSRR           ) \
+  X("halt",            OP_HALT           )
+
 struct OpTableProperties {
   std::string mnemonic;
   int opcode;
@@ -0,0 +1,237 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <stdint.h>
+#include <cstring>
+#include "linker.h"
+#include "../program_image.h"
+
+using namespace std;
+
+vector<unsigned char> EncodeObjectFile(const ObjectModule &module)
+{
+  string strings;
+  vector<uint32_t> name_offsets;
+  for (size_t i = 0; i < module.symbols.size(); i++) {
+    name_offsets.push_back(strings.size());
+    strings += module.symbols[i].name;
+    strings += '\0';
+  }
+
+  const size_t code_offset = OBJECT_FILE_HEADER_SIZE;
+  const size_t data_offset = code_offset + module.code.size() * 4;
+  const size_t symbol_offset = data_offset + module.data.size();
+  const size_t relocation_offset = symbol_offset + module.symbols.size() * OBJECT_FILE_SYMBOL_SIZE;
+  const size_t string_offset = relocation_offset + module.relocations.size() * OBJECT_FILE_RELOCATION_SIZE;
+
+  vector<unsigned char> image(string_offset + strings.size());
+  unsigned char *out = &image[0];
+  memcpy(out, OBJECT_FILE_MAGIC, OBJECT_FILE_MAGIC_SIZE);
+  WriteLE32(out + 8, OBJECT_FILE_VERSION);
+  WriteLE32(out + 12, module.code.size());
+  WriteLE32(out + 16, module.data.size());
+  WriteLE32(out + 20, module.data_address);
+  WriteLE32(out + 24, module.symbols.size());
+  WriteLE32(out + 28, module.relocations.size());
+  WriteLE32(out + 32, strings.size());
+
+  for (size_t i = 0; i < module.code.size(); i++)
+    WriteLE32(out + code_offset + i * 4, module.code[i]);
+  if (!module.data.empty())
+    memcpy(out + data_offset, &module.data[0], module.data.size());
+  for (size_t i = 0; i < module.symbols.size(); i++) {
+    const ObjectSymbol &symbol = module.symbols[i];
+    unsigned char *entry = out + symbol_offset + i * OBJECT_FILE_SYMBOL_SIZE;
+    WriteLE32(entry, name_offsets[i]);
+    WriteLE32(entry + 4, symbol.value);
+    WriteLE32(entry + 8, symbol.section | (symbol.global ? SYMBOL_GLOBAL : 0));
+  }
+  for (size_t i = 0; i < module.relocations.size(); i++) {
+    const ObjectRelocation &relocation = module.relocations[i];
+    unsigned char *entry = out + relocation_offset + i * OBJECT_FILE_RELOCATION_SIZE;
+    WriteLE32(entry, relocation.offset);
+    WriteLE32(entry + 4, relocation.type);
+    WriteLE32(entry + 8, relocation.symbol);
+  }
+  if (!strings.empty())
+    memcpy(out + string_offset, strings.data(), strings.size());
+  return image;
+}
+
+bool DecodeObjectFile(const unsigned char *image, const size_t size, ObjectModule &module,
+                      ostream &err)
+{
+  if (size < OBJECT_FILE_HEADER_SIZE ||
+      memcmp(image, OBJECT_FILE_MAGIC, OBJECT_FILE_MAGIC_SIZE) != 0) {
+    err << "Error: " << module.name << " is not an object file" << endl;
+    return false;
+  }
+  if (ReadLE32(image + 8) != OBJECT_FILE_VERSION) {
+    err << "Error: " << module.name << " has unsupported object file version "
+        << ReadLE32(image + 8) << endl;
+    return false;
+  }
+
+  const uint64_t code_count = ReadLE32(image + 12);
+  const uint64_t data_size = ReadLE32(image + 16);
+  const uint64_t symbol_count = ReadLE32(image + 24);
+  const uint64_t relocation_count = ReadLE32(image + 28);
+  const uint64_t string_size = ReadLE32(image + 32);
+  const uint64_t code_offset = OBJECT_FILE_HEADER_SIZE;
+  const uint64_t data_offset = code_offset + code_count * 4;
+  const uint64_t symbol_offset = data_offset + data_size;
+  const uint64_t relocation_offset = symbol_offset + symbol_count * OBJECT_FILE_SYMBOL_SIZE;
+  const uint64_t string_offset = relocation_offset + relocation_count * OBJECT_FILE_RELOCATION_SIZE;
+  if (string_offset + string_size != size) {
+    err << "Error: " << module.name << " is truncated or corrupt" << endl;
+    return false;
+  }
+
+  module.code.resize(code_count);
+  for (uint64_t i = 0; i < code_count; i++)
+    module.code[i] = ReadLE32(image + code_offset + i * 4);
+  module.data.assign(image + data_offset, image + data_offset + data_size);
+  module.data_address = ReadLE32(image + 20);
+
+  const char *strings = (const char *)image + string_offset;
+  module.symbols.resize(symbol_count);
+  for (uint64_t i = 0; i < symbol_count; i++) {
+    const unsigned char *entry = image + symbol_offset + i * OBJECT_FILE_SYMBOL_SIZE;
+    const uint32_t name_offset = ReadLE32(entry);
+    const uint32_t flags = ReadLE32(entry + 8);
+    if (name_offset >= string_size || memchr(strings + name_offset, '\0', string_size - name_offset) == NULL ||
+        (flags & SYMBOL_SECTION_MASK) > SECTION_DATA) {
+      err << "Error: " << module.name << " has a corrupt symbol table" << endl;
+      return false;
+    }
+    ObjectSymbol &symbol = module.symbols[i];
+    symbol.name = strings + name_offset;
+    symbol.value = ReadLE32(entry + 4);
+    symbol.section = flags & SYMBOL_SECTION_MASK;
+    symbol.global = (flags & SYMBOL_GLOBAL) != 0;
+  }
+
+  module.relocations.resize(relocation_count);
+  for (uint64_t i = 0; i < relocation_count; i++) {
+    const unsigned char *entry = image + relocation_offset + i * OBJECT_FILE_RELOCATION_SIZE;
+    ObjectRelocation &relocation = module.relocations[i];
+    relocation.offset = ReadLE32(entry);
+    relocation.type = ReadLE32(entry + 4);
+    relocation.symbol = ReadLE32(entry + 8);
+    if (relocation.offset >= code_count || relocation.symbol >= symbol_count ||
+        (relocation.type != RELOC_PC16 && relocation.type != RELOC_ABS16)) {
+      err << "Error: " << module.name << " has a corrupt relocation table" << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool ByDataAddress(const ObjectModule *a, const ObjectModule *b)
+{
+  return a->data_address < b->data_address;
+}
+
+bool LinkModules(const vector<ObjectModule> &modules, vector<uint32_t> &code,
+                 vector<unsigned char> &data, uint32_t &data_address, ostream &err)
+{
+  bool ok = true;
+
+  ///////////////////////////////////////////////////////////////
+  // Place the code and collect the global symbols
+  ///////////////////////////////////////////////////////////////
+  vector<uint32_t> code_base(modules.size());
+  map<string, pair<size_t, size_t> > globals;   // name -> (module, symbol)
+  code.clear();
+  for (size_t m = 0; m < modules.size(); m++) {
+    code_base[m] = code.size();
+    code.insert(code.end(), modules[m].code.begin(), modules[m].code.end());
+    for (size_t s = 0; s < modules[m].symbols.size(); s++) {
+      const ObjectSymbol &symbol = modules[m].symbols[s];
+      if (!symbol.global || symbol.section == SECTION_UNDEFINED)
+        continue;
+      map<string, pair<size_t, size_t> >::iterator it = globals.find(symbol.name);
+      if (it != globals.end()) {
+        err << "Error: symbol " << symbol.name << " is defined in both "
+            << modules[it->second.first].name << " and " << modules[m].name << endl;
+        ok = false;
+        continue;
+      }
+      globals[symbol.name] = make_pair(m, s);
+    }
+  }
+
+  ///////////////////////////////////////////////////////////////
+  // Merge the data sections at their addresses
+  ///////////////////////////////////////////////////////////////
+  vector<const ObjectModule *> sections;
+  for (size_t m = 0; m < modules.size(); m++)
+    if (!modules[m].data.empty())
+      sections.push_back(&modules[m]);
+  sort(sections.begin(), sections.end(), ByDataAddress);
+  data.clear();
+  data_address = sections.empty() ? 0 : sections[0]->data_address;
+  for (size_t i = 0; i < sections.size(); i++) {
+    const uint64_t offset = sections[i]->data_address - data_address;
+    if (i > 0 && offset < data.size()) {
+      err << "Error: data of " << sections[i]->name << " overlaps data of "
+          << sections[i - 1]->name << endl;
+      ok = false;
+      continue;
+    }
+    data.resize(offset, 0);
+    data.insert(data.end(), sections[i]->data.begin(), sections[i]->data.end());
+  }
+
+  ///////////////////////////////////////////////////////////////
+  // Patch the 16-bit immediate of every relocated instruction
+  ///////////////////////////////////////////////////////////////
+  set<pair<size_t, uint32_t> > reported;       // undefined (module, symbol), reported once
+  for (size_t m = 0; m < modules.size(); m++) {
+    for (size_t r = 0; r < modules[m].relocations.size(); r++) {
+      const ObjectRelocation &relocation = modules[m].relocations[r];
+      size_t module = m;
+      const ObjectSymbol *symbol = &modules[m].symbols[relocation.symbol];
+      if (symbol->section == SECTION_UNDEFINED) {
+        map<string, pair<size_t, size_t> >::iterator it = globals.find(symbol->name);
+        if (it == globals.end()) {
+          if (reported.insert(make_pair(m, relocation.symbol)).second)
+            err << "Error: undefined symbol " << symbol->name << " referenced in " << modules[m].name << endl;
+          ok = false;
+          continue;
+        }
+        module = it->second.first;
+        symbol = &modules[module].symbols[it->second.second];
+      }
+
+      const int64_t pc = code_base[m] + relocation.offset;
+      int64_t value;
+      if (relocation.type == RELOC_PC16) {
+        if (symbol->section != SECTION_CODE) {
+          err << "Error: data symbol " << symbol->name << " used as a branch target in "
+              << modules[m].name << endl;
+          ok = false;
+          continue;
+        }
+        value = (int64_t)code_base[module] + symbol->value - (pc + 1);
+      }
+      else if (symbol->section == SECTION_CODE)
+        value = ((int64_t)code_base[module] + symbol->value) << 2;
+      else
+        value = symbol->value;
+
+      const int64_t max_value = relocation.type == RELOC_PC16 ? INT16_MAX : UINT16_MAX;
+      if (value < INT16_MIN || value > max_value) {
+        err << "Error: symbol " << symbol->name << " is out of range of the 16-bit immediate in "
+            << modules[m].name << endl;
+        ok = false;
+        continue;
+      }
+      code[pc] = (code[pc] & 0xFFFF0000) | (value & 0xFFFF);
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,33 @@
+#ifndef __LINKER_H
+#define __LINKER_H
+
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+#include "object_file.h"
+
+////////////////////////////////////////////////////////////////////////
+// desc: Serialize module as an object file (see object_file.h)
+// output: the file contents
+////////////////////////////////////////////////////////////////////////
+std::vector<unsigned char> EncodeObjectFile(const ObjectModule &module);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Parse an object file; module.name must already be set
+// output: false if the file is truncated or malformed, reported on err
+////////////////////////////////////////////////////////////////////////
+bool DecodeObjectFile(const unsigned char *image, const size_t size, ObjectModule &module,
+                      std::ostream &err);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Link modules into one program. Code is concatenated in order,
+//       so modules[0] holds the entry point; data sections are merged at
+//       their addresses and must not overlap. Global symbols resolve the
+//       other modules' .extern references.
+// output: false on undefined or duplicate symbols, overlapping data or a
+//         relocation out of range, reported on err
+////////////////////////////////////////////////////////////////////////
+bool LinkModules(const std::vector<ObjectModule> &modules, std::vector<uint32_t> &code,
+                 std::vector<unsigned char> &data, uint32_t &data_address, std::ostream &err);
+
+#endif // __LINKER_H
@@ -0,0 +1,75 @@
+#ifndef __OBJECT_FILE_H
+#define __OBJECT_FILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////
+// Relocatable object file written by "assembler -c" and read back by the
+// link step. All fields are little-endian.
+//
+//   offset  size  field
+//   0       8     magic "3220XOBJ"
+//   8       4     version (OBJECT_FILE_VERSION)
+//   12      4     code_count: number of 32-bit instruction words
+//   16      4     data_size: size of the data section in bytes
+//   20      4     data_address: data memory address of the data section
+//   24      4     symbol_count
+//   28      4     relocation_count
+//   32      4     string_size: bytes of symbol names
+//
+// followed by the code words, the data bytes, symbol_count symbols of 12
+// bytes (name offset in the strings, value, flags), relocation_count
+// relocations of 12 bytes (instruction index, type, symbol index) and the
+// NUL-terminated symbol names.
+//
+// Code is relocatable: the linker places the modules' code one after the
+// other in command-line order. Data is placed at its .org address, as in
+// a program image, so data symbols are absolute.
+////////////////////////////////////////////////////////////////////////
+
+#define OBJECT_FILE_MAGIC "3220XOBJ"
+#define OBJECT_FILE_MAGIC_SIZE 8
+#define OBJECT_FILE_VERSION 1
+#define OBJECT_FILE_HEADER_SIZE 36
+#define OBJECT_FILE_SYMBOL_SIZE 12
+#define OBJECT_FILE_RELOCATION_SIZE 12
+
+enum SymbolSection {
+  SECTION_UNDEFINED = 0,   // .extern, defined by another module
+  SECTION_CODE = 1,        // value is an instruction index in the module
+  SECTION_DATA = 2,        // value is a data memory address
+};
+
+#define SYMBOL_SECTION_MASK 0x3
+#define SYMBOL_GLOBAL 0x4
+
+enum RelocationType {
+  RELOC_PC16 = 0,          // 16-bit field = target - (instruction + 1): br*, jsr
+  RELOC_ABS16 = 1,         // 16-bit field = data address, or instruction index << 2
+};
+
+typedef struct ObjectSymbol_ {
+  std::string name;
+  uint32_t value;
+  int section;
+  bool global;
+} ObjectSymbol;
+
+typedef struct ObjectRelocation_ {
+  uint32_t offset;         // instruction index in the module
+  int type;
+  uint32_t symbol;         // index in ObjectModule::symbols
+} ObjectRelocation;
+
+typedef struct ObjectModule_ {
+  std::string name;        // source or object path, for messages
+  std::vector<uint32_t> code;
+  std::vector<unsigned char> data;
+  uint32_t data_address;
+  std::vector<ObjectSymbol> symbols;
+  std::vector<ObjectRelocation> relocations;
+} ObjectModule;
+
+#endif // __OBJECT_FILE_H
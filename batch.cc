@@ -0,0 +1,445 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "simulator.h"
+#include "loader.h"
+#include "batch.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////
+// One manifest line and, once executed, its result
+////////////////////////////////////////////////////////////////////////
+typedef struct BatchRun_ {
+  string program;
+  string memory_image;      // empty if none
+  uint32_t memory_address;
+  string register_image;    // empty if none
+  int program_index;        // into g_batch_programs
+
+  bool ok;
+  string error;
+  uint64_t instruction_count;
+  uint64_t state_hash;
+} BatchRun;
+
+////////////////////////////////////////////////////////////////////////
+// A distinct program and memory image of the manifest, loaded and
+// decoded once; its runs fork from the snapshot
+////////////////////////////////////////////////////////////////////////
+typedef struct BatchProgram_ {
+  MachineSnapshot snapshot;
+  string error;             // empty if loaded
+} BatchProgram;
+
+////////////////////////////////////////////////////////////////////////
+// Per-worker run queue: the owner takes from the front, thieves from
+// the back
+////////////////////////////////////////////////////////////////////////
+typedef struct WorkQueue_ {
+  pthread_mutex_t lock;
+  deque<int> runs;
+} WorkQueue;
+
+static vector<BatchRun> g_batch_runs;
+static vector<BatchProgram> g_batch_programs;
+static vector<WorkQueue> g_work_queues;
+static BatchOptions g_batch_options;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Parse the manifest (format in batch.h)
+// output: false on a syntax error or unreadable file
+////////////////////////////////////////////////////////////////////////
+static bool ReadManifest(const char *path, vector<BatchRun> &runs)
+{
+  ifstream file(path);
+  if (!file) {
+    cerr << "Error: cannot open manifest " << path << endl;
+    return false;
+  }
+
+  string line;
+  for (int line_number = 1; getline(file, line); line_number++) {
+    istringstream fields(line);
+    BatchRun run;
+    if (!(fields >> run.program) || run.program[0] == '#')
+      continue;
+    run.memory_address = 0;
+    run.program_index = -1;
+    run.ok = false;
+    run.instruction_count = 0;
+    run.state_hash = 0;
+
+    string field;
+    while (fields >> field) {
+      if (field.compare(0, 7, "memory=") == 0) {
+        run.memory_image = field.substr(7);
+        size_t at = run.memory_image.rfind('@');
+        if (at != string::npos) {
+          char *end;
+          run.memory_address = strtoul(run.memory_image.c_str() + at + 1, &end, 0);
+          if (*end != '\0' || at + 1 == run.memory_image.size()) {
+            cerr << "Error: " << path << ":" << line_number << ": bad address in " << field << endl;
+            return false;
+          }
+          run.memory_image.resize(at);
+        }
+      }
+      else if (field.compare(0, 10, "registers=") == 0) {
+        run.register_image = field.substr(10);
+      }
+      else {
+        cerr << "Error: " << path << ":" << line_number << ": unknown field " << field << endl;
+        return false;
+      }
+    }
+    runs.push_back(run);
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Copy a raw memory image into machine memory at address
+// output: false with error set if the file is unreadable or does not fit
+////////////////////////////////////////////////////////////////////////
+static bool LoadMemoryImage(const string &path, const uint32_t address, Machine &machine,
+                            string &error)
+{
+  ifstream file(path.c_str(), ios::binary);
+  if (!file) {
+    error = "cannot open memory image " + path;
+    return false;
+  }
+  vector<char> bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+  if (bytes.size() > machine.memory.size ||
+      !WriteDataMemory(machine.memory, address, bytes.empty() ? NULL : &bytes[0], bytes.size())) {
+    error = "memory image " + path + " does not fit in data memory";
+    return false;
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Apply a register image (format in batch.h)
+// output: false with error set on an unreadable file or bad line
+////////////////////////////////////////////////////////////////////////
+static bool LoadRegisterImage(const string &path, Machine &machine, string &error)
+{
+  ifstream file(path.c_str());
+  if (!file) {
+    error = "cannot open register image " + path;
+    return false;
+  }
+
+  string line;
+  for (int line_number = 1; getline(file, line); line_number++) {
+    istringstream fields(line);
+    string name;
+    if (!(fields >> name) || name[0] == '#')
+      continue;
+
+    int num_values = name[0] == 'v' ? NUM_VECTOR_ELEMENTS : 1;
+    long values[NUM_VECTOR_ELEMENTS];
+    bool ok = true;
+    for (int i = 0; i < num_values && ok; i++) {
+      string value;
+      char *end;
+      ok = (bool)(fields >> value);
+      if (ok) {
+        values[i] = strtol(value.c_str(), &end, 0);
+        ok = *end == '\0';
+      }
+    }
+
+    char *end;
+    long idx = strtol(name.c_str() + 1, &end, 10);
+    bool indexed = name.size() > 1 && *end == '\0';
+    if (ok && name == "cc")
+      machine.condition_code_register.int_value = values[0];
+    else if (ok && name[0] == 'r' && indexed && idx >= 0 && idx < NUM_SCALAR_REGISTER)
+      machine.scalar_registers[idx].int_value = values[0];
+    else if (ok && name[0] == 'v' && indexed && idx >= 0 && idx < NUM_VECTOR_REGISTER)
+      for (int i = 0; i < NUM_VECTOR_ELEMENTS; i++)
+        machine.vector_registers[idx].element[i].int_value = Fixed1114Bits(values[i]);
+    else {
+      ostringstream message;
+      message << path << ":" << line_number << ": bad register line";
+      error = message.str();
+      return false;
+    }
+  }
+  return true;
+}
+
+static inline uint64_t HashBytes(uint64_t hash, const void *data, const size_t size)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ p[i]) * 0x100000001b3ULL;
+  return hash;
+}
+
+// Same mixing a 64-bit word at a time, for data memory
+static inline uint64_t HashWords(uint64_t hash, const void *data, const size_t size)
+{
+  for (size_t i = 0; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, (const unsigned char *)data + i, 8);
+    hash = (hash ^ word) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: FNV-1a style hash of the architectural state, to compare runs
+////////////////////////////////////////////////////////////////////////
+static uint64_t HashMachineState(const Machine &machine)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  hash = HashBytes(hash, &machine.condition_code_register, sizeof(machine.condition_code_register));
+  hash = HashBytes(hash, machine.scalar_registers, sizeof(machine.scalar_registers));
+  hash = HashBytes(hash, machine.vector_registers, sizeof(machine.vector_registers));
+  hash = HashBytes(hash, machine.gpu_vertex_registers, sizeof(machine.gpu_vertex_registers));
+  hash = HashBytes(hash, &machine.gpu_status_register, sizeof(machine.gpu_status_register));
+  hash = HashBytes(hash, &machine.transform.depth, sizeof(machine.transform.depth));
+  hash = HashBytes(hash, machine.transform.matrix, sizeof(machine.transform.matrix[0]) * (machine.transform.depth + 1));
+  // Only pages holding non-zero bytes, so the hash does not depend on
+  // the memory size or on which pages were merely stored zeros
+  const uint32_t num_pages = machine.memory.size >> MEMORY_PAGE_SHIFT;
+  for (uint32_t page = NextWrittenPage(machine.memory, 0); page < num_pages;
+       page = NextWrittenPage(machine.memory, page + 1)) {
+    const unsigned char *bytes = machine.memory.bytes + ((size_t)page << MEMORY_PAGE_SHIFT);
+    int i = 0;
+    while (i < MEMORY_PAGE_SIZE && bytes[i] == 0)
+      i++;
+    if (i == MEMORY_PAGE_SIZE)
+      continue;
+    hash = HashBytes(hash, &page, sizeof(page));
+    hash = HashWords(hash, bytes, MEMORY_PAGE_SIZE);
+  }
+  return hash;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Load and decode every distinct program and memory image of
+//       g_batch_runs once into g_batch_programs, on a scratch machine
+// output: false if the scratch machine cannot be created
+////////////////////////////////////////////////////////////////////////
+static bool LoadBatchPrograms(const uint32_t memory_size)
+{
+  Machine *machine = NewMachine(memory_size);
+  if (machine == NULL)
+    return false;
+
+  map<string, int> program_indexes;
+  g_batch_programs.clear();
+  for (size_t i = 0; i < g_batch_runs.size(); i++) {
+    BatchRun &run = g_batch_runs[i];
+    ostringstream key;
+    key << run.program << '\0' << run.memory_image << '\0' << run.memory_address;
+    map<string, int>::iterator it = program_indexes.find(key.str());
+    if (it != program_indexes.end()) {
+      run.program_index = it->second;
+      continue;
+    }
+    run.program_index = g_batch_programs.size();
+    program_indexes[key.str()] = run.program_index;
+    g_batch_programs.push_back(BatchProgram());
+    BatchProgram &program = g_batch_programs.back();
+
+    ResetMachine(*machine);
+    vector<uint32_t> instructions;
+    if (!LoadProgram(run.program.c_str(), instructions, machine->memory)) {
+      program.error = "cannot load program";
+      continue;
+    }
+    if (!run.memory_image.empty() &&
+        !LoadMemoryImage(run.memory_image, run.memory_address, *machine, program.error))
+      continue;
+    machine->trace_ops.reserve(instructions.size());
+    for (size_t j = 0; j < instructions.size(); j++)
+      machine->trace_ops.push_back(DecodeInstruction(instructions[j]));
+    TakeSnapshot(*machine, program.snapshot);
+  }
+
+  DeleteMachine(machine);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Fork, run and record one manifest entry on the calling worker's
+//       machine (g_machine)
+////////////////////////////////////////////////////////////////////////
+static void ExecuteRun(BatchRun &run)
+{
+  const BatchProgram &program = g_batch_programs[run.program_index];
+  if (!program.error.empty()) {
+    run.error = program.error;
+    return;
+  }
+
+  Machine &machine = *g_machine;
+  ForkMachine(machine, program.snapshot);
+  if (!run.register_image.empty() && !LoadRegisterImage(run.register_image, machine, run.error))
+    return;
+
+  if (g_batch_options.verify)
+    run.ok = VerifyEngine(g_batch_options.engine, g_batch_options.jit_verify);
+  else
+    run.ok = RunEngine(g_batch_options.engine, g_batch_options.jit_verify);
+  if (run.ok && machine.fault != FAULT_NONE)
+    run.ok = false;
+  else if (!run.ok && g_batch_options.verify)
+    run.error = "engine state differs from the reference interpreter";
+  if (!run.ok && run.error.empty()) {
+    if (machine.fault == FAULT_MEMORY) {
+      ostringstream error;
+      error << "data access out of range at PC " << machine.fault_pc << ": address "
+            << machine.fault_address;
+      run.error = error.str();
+    }
+    else
+      run.error = "engine stopped abnormally";
+  }
+  run.instruction_count = machine.instruction_count;
+  run.state_hash = HashMachineState(machine);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Take the next run from the worker's own queue, or steal the
+//       last run of another worker
+// output: false once every queue is empty
+////////////////////////////////////////////////////////////////////////
+static bool TakeRun(const int worker, int &run)
+{
+  const int num_workers = g_work_queues.size();
+  for (int i = 0; i < num_workers; i++) {
+    WorkQueue &queue = g_work_queues[(worker + i) % num_workers];
+    pthread_mutex_lock(&queue.lock);
+    bool found = !queue.runs.empty();
+    if (found && i == 0) {
+      run = queue.runs.front();
+      queue.runs.pop_front();
+    }
+    else if (found) {
+      run = queue.runs.back();
+      queue.runs.pop_back();
+    }
+    pthread_mutex_unlock(&queue.lock);
+    if (found)
+      return true;
+  }
+  return false;
+}
+
+static void *BatchWorkerMain(void *arg)
+{
+  const int worker = (int)(intptr_t)arg;
+  g_machine = NewMachine(g_batch_options.memory_size);
+
+  int run;
+  while (TakeRun(worker, run)) {
+    if (g_machine == NULL)
+      g_batch_runs[run].error = "cannot map data memory";
+    else
+      ExecuteRun(g_batch_runs[run]);
+  }
+
+  if (g_machine != NULL)
+    DeleteMachine(g_machine);
+  g_machine = NULL;
+  return NULL;
+}
+
+bool RunBatch(const char *manifest_path, const BatchOptions &options)
+{
+  g_batch_runs.clear();
+  if (!ReadManifest(manifest_path, g_batch_runs))
+    return false;
+  if (g_batch_runs.empty()) {
+    cerr << "Error: manifest " << manifest_path << " lists no programs" << endl;
+    return false;
+  }
+
+  g_batch_options = options;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (!LoadBatchPrograms(options.memory_size))
+    return false;
+
+  const int num_runs = g_batch_runs.size();
+  int num_workers = options.num_threads;
+  if (num_workers <= 0)
+    num_workers = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+  if (num_workers > num_runs)
+    num_workers = num_runs;
+
+  ///////////////////////////////////////////////////////////////
+  // Deal contiguous slices of the manifest to the workers
+  ///////////////////////////////////////////////////////////////
+  g_work_queues = vector<WorkQueue>(num_workers);
+  for (int i = 0; i < num_workers; i++) {
+    pthread_mutex_init(&g_work_queues[i].lock, NULL);
+    for (int run = (long)num_runs * i / num_workers; run < (long)num_runs * (i + 1) / num_workers; run++)
+      g_work_queues[i].runs.push_back(run);
+  }
+
+
+  vector<pthread_t> workers;
+  for (int i = 0; i < num_workers; i++) {
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, BatchWorkerMain, (void *)(intptr_t)i) != 0) {
+      cerr << "Error: cannot start batch worker threads" << endl;
+      break;
+    }
+    workers.push_back(worker);
+  }
+  // Runs left on a queue whose worker failed to start are stolen by the others
+  if (workers.empty()) {
+    Machine *machine = g_machine;
+    BatchWorkerMain((void *)0);
+    g_machine = machine;
+  }
+  for (size_t i = 0; i < workers.size(); i++)
+    pthread_join(workers[i], NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  for (int i = 0; i < num_workers; i++)
+    pthread_mutex_destroy(&g_work_queues[i].lock);
+
+  ///////////////////////////////////////////////////////////////
+  // Report in manifest order
+  ///////////////////////////////////////////////////////////////
+  int num_failed = 0;
+  unsigned long long total_instructions = 0;
+  for (int i = 0; i < num_runs; i++) {
+    const BatchRun &run = g_batch_runs[i];
+    cout << "run " << i << " " << run.program << ": ";
+    if (run.ok) {
+      char hash[17];
+      snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)run.state_hash);
+      cout << "ok instructions=" << run.instruction_count << " state=" << hash << "\n";
+    } else {
+      cout << "FAILED " << run.error << "\n";
+      num_failed++;
+    }
+    total_instructions += run.instruction_count;
+  }
+
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+  cout << "Batch: " << num_runs << " runs, " << num_runs - num_failed << " ok, "
+       << num_failed << " failed, " << total_instructions << " instructions in "
+       << seconds << " s on " << (workers.empty() ? 1 : workers.size()) << " threads" << endl;
+  return num_failed == 0;
+}
@@ -0,0 +1,47 @@
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include "simulator.h"
+
+////////////////////////////////////////////////////////////////////////
+// Batch mode (--batch MANIFEST)
+//
+// Every non-empty manifest line not starting with '#' is one run:
+//
+//   <program> [memory=<file>[@<address>]] [registers=<file>]
+//
+//   program    program image or text file, as for a single run
+//   memory     raw bytes copied into data memory at address (default 0)
+//              after the program's own data section
+//   registers  text lines "r<N> <value>", "v<N> <x> <y> <z> <w>" or
+//              "cc <value>"; values are decimal or 0x hex
+//
+// The same program may appear on several lines with different inputs.
+// Each distinct program and memory image is loaded and decoded once into
+// a MachineSnapshot that its runs fork from. Runs are spread over a pool
+// of worker threads, each owning one Machine; idle workers steal runs
+// from the back of busy workers' queues. Results are printed in manifest
+// order:
+//
+//   run <i> <program>: ok instructions=<n> state=<hash>
+//   run <i> <program>: FAILED <reason>
+//
+// where hash is the FNV-1a hash of the final registers and non-zero
+// memory pages, followed by a "Batch:" summary line.
+////////////////////////////////////////////////////////////////////////
+
+typedef struct BatchOptions_ {
+  Engine engine;
+  bool verify;        // compare every run against the reference interpreter
+  bool jit_verify;
+  int num_threads;    // 0: one per online CPU
+  uint32_t memory_size;
+} BatchOptions;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Run every program of the manifest and print the results
+// output: false if the manifest is invalid or any run failed
+////////////////////////////////////////////////////////////////////////
+bool RunBatch(const char *manifest_path, const BatchOptions &options);
+
+#endif // __BATCH_H
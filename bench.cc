@@ -0,0 +1,324 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+#include "simulator.h"
+#include "bench.h"
+
+using namespace std;
+
+#define BENCH_ITERATIONS 30000   // loop counts stay positive 16-bit values
+#define CALL_DEPTH 8
+
+////////////////////////////////////////////////////////////////////////
+// One generated program and its best time on the current engine
+////////////////////////////////////////////////////////////////////////
+typedef struct BenchProgram_ {
+  string name;
+  vector<uint32_t> code;
+  uint64_t instruction_count;
+  double seconds;
+} BenchProgram;
+
+////////////////////////////////////////////////////////////////////////
+// Instruction encoders, one per operand layout of DecodeInstruction()
+////////////////////////////////////////////////////////////////////////
+static uint32_t EncodeRRR(const int opcode, const int rd, const int rs, const int rt)
+{
+  return opcode << 24 | rd << 20 | rs << 16 | rt << 8;
+}
+
+static uint32_t EncodeRRI(const int opcode, const int rd, const int rs, const int imm)
+{
+  return opcode << 24 | rd << 20 | rs << 16 | (imm & 0xFFFF);
+}
+
+// MOV, CMP, VMOV, SETVERTEX, SETCOLOR (registers at bits 16 and 8)
+static uint32_t EncodeRR(const int opcode, const int rd, const int rs)
+{
+  return opcode << 24 | rd << 16 | rs << 8;
+}
+
+// MOVI, CMPI, VMOVI, JMP (register at bit 16)
+static uint32_t EncodeRI(const int opcode, const int rd, const int imm)
+{
+  return opcode << 24 | rd << 16 | (imm & 0xFFFF);
+}
+
+static uint32_t EncodeVVV(const int opcode, const int vd, const int vs, const int vt)
+{
+  return opcode << 24 | vd << 16 | vs << 8 | vt;
+}
+
+// VCOMPMOV with a scalar register, VCOMPMOVI with an immediate
+static uint32_t EncodeVCompMov(const int opcode, const int vd, const int idx, const int operand)
+{
+  return opcode << 24 | idx << 22 | vd << 16 | (opcode == OP_VCOMPMOV ? operand << 8 : operand & 0xFFFF);
+}
+
+// Branches, JSR, FLUSH, DRAW, HALT
+static uint32_t EncodeI(const int opcode, const int imm)
+{
+  return opcode << 24 | (imm & 0xFFFF);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Append a loop running body iterations times: r0 counts down,
+//       r1 holds -1
+////////////////////////////////////////////////////////////////////////
+static void EmitLoop(vector<uint32_t> &code, const vector<uint32_t> &body, const int iterations)
+{
+  code.push_back(EncodeRI(OP_MOVI_D, 0, iterations));
+  code.push_back(EncodeRI(OP_MOVI_D, 1, -1));
+  const int loop_start = code.size();
+  code.insert(code.end(), body.begin(), body.end());
+  code.push_back(EncodeRRR(OP_ADD_D, 0, 0, 1));
+  code.push_back(EncodeI(OP_BRP, loop_start - ((int)code.size() + 1)));
+}
+
+static BenchProgram LoopProgram(const string &name, const vector<uint32_t> &prologue,
+                                const vector<uint32_t> &body)
+{
+  BenchProgram program;
+  program.name = name;
+  program.code = prologue;
+  EmitLoop(program.code, body, BENCH_ITERATIONS);
+  program.code.push_back(EncodeI(OP_HALT, 0));
+  return program;
+}
+
+static BenchProgram AluWorkload()
+{
+  vector<uint32_t> body;
+  for (int i = 0; i < 4; i++) {
+    body.push_back(EncodeRRR(OP_ADD_D, 2, 2, 3));
+    body.push_back(EncodeRRI(OP_ADDI_D, 3, 3, 3));
+    body.push_back(EncodeRRR(OP_AND_D, 4, 2, 3));
+    body.push_back(EncodeRRI(OP_ANDI_D, 5, 4, 0x0FFF));
+    body.push_back(EncodeRR(OP_MOV, 6, 5));
+    body.push_back(EncodeRI(OP_MOVI_D, 3, 7));
+    body.push_back(EncodeRR(OP_CMP, 2, 6));
+    body.push_back(EncodeRI(OP_CMPI, 4, 100));
+  }
+  return LoopProgram("alu", vector<uint32_t>(), body);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: r2 walks a 64 KiB buffer 32 bytes per iteration, incrementing
+//       its words and copying one byte
+////////////////////////////////////////////////////////////////////////
+static BenchProgram LoadStoreWorkload()
+{
+  vector<uint32_t> body;
+  for (int i = 0; i < 8; i++) {
+    body.push_back(EncodeRRI(OP_LDW, 3, 2, 2 * i));
+    body.push_back(EncodeRRI(OP_ADDI_D, 3, 3, 1));
+    body.push_back(EncodeRRI(OP_STW, 3, 2, 2 * i));
+  }
+  body.push_back(EncodeRRI(OP_LDB, 4, 2, 16));
+  body.push_back(EncodeRRI(OP_STB, 4, 2, 17));
+  body.push_back(EncodeRRI(OP_ADDI_D, 2, 2, 32));
+  body.push_back(EncodeRRI(OP_ANDI_D, 2, 2, 0xFFE0));
+  return LoopProgram("load_store", vector<uint32_t>(), body);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Each iteration calls f1; f1..f7 save LR at their own slot of
+//       memory, call the next function and return, f8 counts in r2
+////////////////////////////////////////////////////////////////////////
+static BenchProgram CallReturnWorkload()
+{
+  vector<uint32_t> body(1);
+  BenchProgram program = LoopProgram("call_return", vector<uint32_t>(), body);
+  vector<uint32_t> &code = program.code;
+  const int call = 2;   // the body's jsr, after the loop setup
+  code[call] = EncodeI(OP_JSR, code.size() - (call + 1));
+
+  for (int depth = 1; depth < CALL_DEPTH; depth++) {
+    code.push_back(EncodeRRI(OP_STW, LR_IDX, 12, 2 * depth));
+    code.push_back(EncodeI(OP_JSR, 2));
+    code.push_back(EncodeRRI(OP_LDW, LR_IDX, 12, 2 * depth));
+    code.push_back(EncodeRI(OP_JMP, LR_IDX, 0));
+  }
+  code.push_back(EncodeRRI(OP_ADDI_D, 2, 2, 1));
+  code.push_back(EncodeRI(OP_JMP, LR_IDX, 0));
+  return program;
+}
+
+static BenchProgram VectorWorkload()
+{
+  vector<uint32_t> body;
+  for (int i = 0; i < 4; i++) {
+    body.push_back(EncodeRI(OP_VMOVI, 2, 16));
+    body.push_back(EncodeVCompMov(OP_VCOMPMOV, 2, 1, 3));
+    body.push_back(EncodeVCompMov(OP_VCOMPMOVI, 3, 2, 32));
+    body.push_back(EncodeVVV(OP_VADD, 4, 2, 3));
+    body.push_back(EncodeRR(OP_VMOV, 5, 4));
+    body.push_back(EncodeVVV(OP_VADD, 6, 5, 4));
+    body.push_back(EncodeVVV(OP_VADD, 2, 2, 6));
+    body.push_back(EncodeRR(OP_VMOV, 3, 6));
+  }
+  return LoopProgram("vector", vector<uint32_t>(), body);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Flush, then set the color and draw one 5x5 pixel triangle
+////////////////////////////////////////////////////////////////////////
+static BenchProgram GraphicsWorkload()
+{
+  vector<uint32_t> prologue;
+  prologue.push_back(EncodeRI(OP_BEGINPRIMITIVE, 1, 0));
+  for (int i = 0; i < 3; i++)
+    prologue.push_back(EncodeVCompMov(OP_VCOMPMOVI, 1, i, (64 * (i + 1)) << 4));
+
+  static const int vertices[3][2] = { { 10, 10 }, { 14, 10 }, { 10, 14 } };
+  vector<uint32_t> body;
+  body.push_back(EncodeI(OP_FLUSH, 0));
+  body.push_back(EncodeRR(OP_SETCOLOR, 1, 0));
+  for (int i = 0; i < 3; i++) {
+    body.push_back(EncodeVCompMov(OP_VCOMPMOVI, 0, 1, vertices[i][0] << 4));
+    body.push_back(EncodeVCompMov(OP_VCOMPMOVI, 0, 2, vertices[i][1] << 4));
+    body.push_back(EncodeRR(OP_SETVERTEX, 0, 0));
+  }
+  body.push_back(EncodeI(OP_DRAW, 0));
+  return LoopProgram("graphics", prologue, body);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: The instructions timed one by one. r12 stays 0, so memory
+//       operands address the first bytes of memory.
+////////////////////////////////////////////////////////////////////////
+static void OpcodePrograms(vector<BenchProgram> &programs)
+{
+  static const struct {
+    const char *name;
+    uint32_t instruction;
+  } opcodes[] = {
+    { "add.d", EncodeRRR(OP_ADD_D, 2, 3, 4) },
+    { "addi.d", EncodeRRI(OP_ADDI_D, 2, 3, 1) },
+    { "and.d", EncodeRRR(OP_AND_D, 2, 3, 4) },
+    { "andi.d", EncodeRRI(OP_ANDI_D, 2, 3, 0xFF) },
+    { "mov", EncodeRR(OP_MOV, 2, 3) },
+    { "movi.d", EncodeRI(OP_MOVI_D, 2, 5) },
+    { "movi.f", EncodeRI(OP_MOVI_F, 2, 16) },
+    { "cmp", EncodeRR(OP_CMP, 2, 3) },
+    { "cmpi", EncodeRI(OP_CMPI, 2, 5) },
+    { "ldb", EncodeRRI(OP_LDB, 2, 12, 0) },
+    { "ldw", EncodeRRI(OP_LDW, 2, 12, 0) },
+    { "stb", EncodeRRI(OP_STB, 3, 12, 0) },
+    { "stw", EncodeRRI(OP_STW, 3, 12, 2) },
+    { "brnzp", EncodeI(OP_BRNZP, 0) },
+    { "vadd", EncodeVVV(OP_VADD, 2, 3, 4) },
+    { "vmov", EncodeRR(OP_VMOV, 2, 3) },
+    { "vmovi", EncodeRI(OP_VMOVI, 2, 16) },
+    { "vcompmov", EncodeVCompMov(OP_VCOMPMOV, 2, 1, 3) },
+    { "vcompmovi", EncodeVCompMov(OP_VCOMPMOVI, 2, 1, 16) },
+    { "setvertex", EncodeRR(OP_SETVERTEX, 2, 0) },
+    { "setcolor", EncodeRR(OP_SETCOLOR, 2, 0) },
+  };
+
+  // Loop overhead every opcode program is measured against
+  programs.push_back(LoopProgram("", vector<uint32_t>(), vector<uint32_t>()));
+  for (size_t i = 0; i < sizeof(opcodes) / sizeof(opcodes[0]); i++)
+    programs.push_back(LoopProgram(opcodes[i].name, vector<uint32_t>(),
+                                   vector<uint32_t>(BENCH_OPCODE_COPIES, opcodes[i].instruction)));
+}
+
+static const char *EngineName(const Engine engine)
+{
+  switch (engine) {
+    case ENGINE_INTERP:   return "interp";
+    case ENGINE_THREADED: return "threaded";
+    case ENGINE_BLOCK:    return "block";
+    default:              return "jit";
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Decode program onto g_machine and record its fastest run
+// output: false if a run did not halt
+////////////////////////////////////////////////////////////////////////
+static bool TimeProgram(const Engine engine, BenchProgram &program)
+{
+  ResetMachine(*g_machine);
+  for (size_t i = 0; i < program.code.size(); i++)
+    g_machine->trace_ops.push_back(DecodeInstruction(program.code[i]));
+  MachineSnapshot snapshot;
+  TakeSnapshot(*g_machine, snapshot);
+
+  program.seconds = 0;
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    ForkMachine(*g_machine, snapshot);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ok = RunEngine(engine, false);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (!ok || g_machine->fault != FAULT_NONE || !g_machine->program_halt) {
+      cerr << "Error: benchmark program " << (program.name.empty() ? "loop" : program.name)
+           << " did not halt on --engine=" << EngineName(engine) << endl;
+      return false;
+    }
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    if (run == 0 || seconds < program.seconds)
+      program.seconds = seconds;
+  }
+  program.instruction_count = g_machine->instruction_count;
+  return true;
+}
+
+bool RunBench(const vector<Engine> &engines)
+{
+  Machine *machine = g_machine;
+  g_machine = NewMachine(DEFAULT_MEMORY_SIZE);
+  if (g_machine == NULL) {
+    g_machine = machine;
+    return false;
+  }
+
+  bool ok = true;
+  cout << "{\n  \"engines\": [";
+  for (size_t e = 0; e < engines.size() && ok; e++) {
+    vector<BenchProgram> workloads;
+    workloads.push_back(AluWorkload());
+    workloads.push_back(LoadStoreWorkload());
+    workloads.push_back(CallReturnWorkload());
+    workloads.push_back(VectorWorkload());
+    workloads.push_back(GraphicsWorkload());
+    vector<BenchProgram> opcodes;
+    OpcodePrograms(opcodes);
+    for (size_t i = 0; i < workloads.size() && ok; i++)
+      ok = TimeProgram(engines[e], workloads[i]);
+    for (size_t i = 0; i < opcodes.size() && ok; i++)
+      ok = TimeProgram(engines[e], opcodes[i]);
+    if (!ok)
+      break;
+
+    cout << (e == 0 ? "\n" : ",\n");
+    cout << "    {\n      \"engine\": \"" << EngineName(engines[e]) << "\",\n";
+    cout << "      \"workloads\": [\n";
+    for (size_t i = 0; i < workloads.size(); i++) {
+      const BenchProgram &w = workloads[i];
+      cout << "        { \"name\": \"" << w.name << "\", \"instructions\": " << w.instruction_count
+           << ", \"seconds\": " << w.seconds
+           << ", \"mips\": " << w.instruction_count / w.seconds * 1e-6
+           << ", \"ns_per_instruction\": " << w.seconds * 1e9 / w.instruction_count
+           << " }" << (i + 1 < workloads.size() ? ",\n" : "\n");
+    }
+    cout << "      ],\n      \"opcodes\": [\n";
+    const BenchProgram &loop = opcodes[0];
+    for (size_t i = 1; i < opcodes.size(); i++) {
+      double ns = (opcodes[i].seconds - loop.seconds) * 1e9 /
+                  ((double)BENCH_ITERATIONS * BENCH_OPCODE_COPIES);
+      cout << "        { \"name\": \"" << opcodes[i].name << "\", \"ns\": " << (ns > 0 ? ns : 0)
+           << " }" << (i + 1 < opcodes.size() ? ",\n" : "\n");
+    }
+    cout << "      ]\n    }";
+    cout.flush();
+  }
+  cout << "\n  ]\n}" << endl;
+
+  DeleteMachine(g_machine);
+  g_machine = machine;
+  return ok;
+}
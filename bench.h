@@ -0,0 +1,42 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include "simulator.h"
+
+////////////////////////////////////////////////////////////////////////
+// Benchmark mode (--bench, "make bench")
+//
+// Generates synthetic programs in memory and times each engine on them
+// with tracing and context dumps off. Every program is decoded once and
+// run BENCH_RUNS times from a fork of it; the fastest run counts.
+//
+//   workloads  alu          scalar arithmetic, logic, moves and compares
+//              load_store   ldw/stw/ldb/stb streaming over 64 KiB of memory
+//              call_return  jsr chains 8 deep, saving LR in memory, and ret
+//              vector       vadd, vmov, vmovi, vcompmov, vcompmovi
+//              graphics     setvertex, setcolor and draw of small triangles
+//   opcodes    a loop of BENCH_OPCODE_COPIES copies of one instruction,
+//              less the same loop with an empty body: the time one
+//              instruction adds to a run
+//
+// Results go to stdout as JSON:
+//
+//   { "engines": [ { "engine": "interp",
+//                    "workloads": [ { "name": ..., "instructions": ...,
+//                                     "seconds": ..., "mips": ...,
+//                                     "ns_per_instruction": ... }, ... ],
+//                    "opcodes": [ { "name": "add.d", "ns": ... }, ... ] },
+//                  ... ] }
+////////////////////////////////////////////////////////////////////////
+#define BENCH_RUNS 3
+#define BENCH_OPCODE_COPIES 64
+
+////////////////////////////////////////////////////////////////////////
+// desc: Benchmark the given engines on a machine of its own and print
+//       the JSON report
+// output: false if the machine cannot be created or a program did not
+//         halt
+////////////////////////////////////////////////////////////////////////
+bool RunBench(const std::vector<Engine> &engines);
+
+#endif // __BENCH_H
@@ -0,0 +1,111 @@
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+using namespace std;
+
+#define BODY_START 3         // index of the first body instruction
+#define MAX_INSTRUCTIONS (1 << 22)
+
+static uint32_t g_seed = 3220;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Deterministic pseudo random number in [0, range)
+////////////////////////////////////////////////////////////////////////
+static int Random(const int range)
+{
+  g_seed = g_seed * 1103515245 + 12345;
+  return (g_seed >> 8) % range;
+}
+
+static void PrintUsage(const char *name)
+{
+  cerr << "Usage: " << name << " [-n instructions] [-r repeat] [-seed N]" << endl;
+  cerr << "  Writes to stdout an assembly program whose loop body is n random scalar" << endl;
+  cerr << "  ALU, compare, load and store instructions (default 1000000, at most " << MAX_INSTRUCTIONS << ")," << endl;
+  cerr << "  executed repeat times (default 10). The loop jumps back through a register," << endl;
+  cerr << "  so the body is not limited by the 16-bit branch offset." << endl;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Random register among r2..r6, r8..r11: r0/r1 count the loop,
+//       r7 is LR, r12 the memory base, r13 the loop address, r15 the PC
+////////////////////////////////////////////////////////////////////////
+static int RandomRegister()
+{
+  static const int registers[] = { 2, 3, 4, 5, 6, 8, 9, 10, 11 };
+  return registers[Random(sizeof(registers) / sizeof(registers[0]))];
+}
+
+static void EmitBodyInstruction()
+{
+  const int rd = RandomRegister();
+  const int rs = RandomRegister();
+  const int rt = RandomRegister();
+  switch (Random(8)) {
+    case 0:
+      cout << "add.d r" << rd << " r" << rs << " r" << rt << endl;
+      break;
+    case 1:
+      cout << "addi.d r" << rd << " r" << rs << " " << Random(64) - 32 << endl;
+      break;
+    case 2:
+      cout << "and.d r" << rd << " r" << rs << " r" << rt << endl;
+      break;
+    case 3:
+      cout << "andi.d r" << rd << " r" << rs << " " << Random(4096) << endl;
+      break;
+    case 4:
+      cout << "mov r" << rd << " r" << rs << endl;
+      break;
+    case 5:
+      cout << "cmp r" << rs << " r" << rt << endl;
+      break;
+    case 6:
+      cout << "ldw r" << rd << " r12 " << Random(1024) * 4 << endl;
+      break;
+    default:
+      cout << "stw r" << rs << " r12 " << Random(1024) * 4 << endl;
+      break;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int num_instructions = 1000000;
+  int repeat = 10;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc && strcmp(argv[i], "-n") == 0)
+      num_instructions = atoi(argv[++i]);
+    else if (i + 1 < argc && strcmp(argv[i], "-r") == 0)
+      repeat = atoi(argv[++i]);
+    else if (i + 1 < argc && strcmp(argv[i], "-seed") == 0)
+      g_seed = atoi(argv[++i]);
+    else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_instructions < 1 || num_instructions > MAX_INSTRUCTIONS || repeat < 1 || repeat > 32767) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  ///////////////////////////////////////////////////////////////
+  // r0 counts loop iterations down, r1 holds -1, r13 the byte
+  // address of the body
+  ///////////////////////////////////////////////////////////////
+  cout << "movi.d r0 " << repeat << endl;
+  cout << "movi.d r1 -1" << endl;
+  cout << "movi.d r13 " << BODY_START * 4 << endl;
+
+  for (int i = 0; i < num_instructions; i++)
+    EmitBodyInstruction();
+
+  cout << "add.d r0 r0 r1" << endl;
+  cout << "brz 1" << endl;
+  cout << "jmp r13" << endl;
+  cout << "halt" << endl;
+  return 0;
+}
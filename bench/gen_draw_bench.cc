@@ -0,0 +1,106 @@
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+using namespace std;
+
+#define MAX_TRIANGLES 1800   // keeps the loop branch offset within 16 bits
+#define COLOR_EVERY 8        // triangles drawn between setcolor
+
+static uint32_t g_seed = 3220;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Deterministic pseudo random number in [0, range)
+////////////////////////////////////////////////////////////////////////
+static int Random(const int range)
+{
+  g_seed = g_seed * 1103515245 + 12345;
+  return (g_seed >> 8) % range;
+}
+
+static void PrintUsage(const char *name)
+{
+  cerr << "Usage: " << name << " [-n triangles] [-r repeat] [-s max_size] [-seed N]" << endl;
+  cerr << "  Writes to stdout an assembly program that draws n random filled" << endl;
+  cerr << "  triangles (default 1000, at most " << MAX_TRIANGLES << ") of up to max_size" << endl;
+  cerr << "  pixels (default 96), flushing and redrawing them repeat times (default 20)." << endl;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Emit the instructions loading one vertex into v0 and issuing
+//       setvertex; returns the number of instructions emitted
+////////////////////////////////////////////////////////////////////////
+static int EmitVertex(const int x, const int y)
+{
+  cout << "movi.f r8 " << x << ".0f" << endl;
+  cout << "movi.f r9 " << y << ".0f" << endl;
+  cout << "vcompmov v0 1 r8" << endl;
+  cout << "vcompmov v0 2 r9" << endl;
+  cout << "setvertex v0" << endl;
+  return 5;
+}
+
+int main(int argc, char **argv)
+{
+  int num_triangles = 1000;
+  int repeat = 20;
+  int max_size = 96;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc && strcmp(argv[i], "-n") == 0)
+      num_triangles = atoi(argv[++i]);
+    else if (i + 1 < argc && strcmp(argv[i], "-r") == 0)
+      repeat = atoi(argv[++i]);
+    else if (i + 1 < argc && strcmp(argv[i], "-s") == 0)
+      max_size = atoi(argv[++i]);
+    else if (i + 1 < argc && strcmp(argv[i], "-seed") == 0)
+      g_seed = atoi(argv[++i]);
+    else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_triangles < 1 || num_triangles > MAX_TRIANGLES || repeat < 1 || repeat > 32767 ||
+      max_size < 1 || max_size > 480) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  ///////////////////////////////////////////////////////////////
+  // r0 counts loop iterations down, r1 holds -1
+  ///////////////////////////////////////////////////////////////
+  cout << "movi.d r0 " << repeat << endl;
+  cout << "movi.d r1 -1" << endl;
+  cout << "vmovi v0 0.0f" << endl;
+  cout << "vmovi v3 0.0f" << endl;
+  cout << "beginprimitive 1" << endl;
+
+  int body_size = 0;
+  cout << "flush" << endl;
+  body_size++;
+  for (int i = 0; i < num_triangles; i++) {
+    if (i % COLOR_EVERY == 0) {
+      cout << "movi.f r10 " << Random(256) << ".0f" << endl;
+      cout << "movi.f r11 " << Random(256) << ".0f" << endl;
+      cout << "movi.f r12 " << Random(256) << ".0f" << endl;
+      cout << "vcompmov v3 0 r10" << endl;
+      cout << "vcompmov v3 1 r11" << endl;
+      cout << "vcompmov v3 2 r12" << endl;
+      cout << "setcolor v3" << endl;
+      body_size += 7;
+    }
+    // Coordinates stay on screen: setvertex does not sign-extend them
+    int x = Random(640 - max_size + 1);
+    int y = Random(480 - max_size + 1);
+    for (int j = 0; j < 3; j++)
+      body_size += EmitVertex(x + Random(max_size), y + Random(max_size));
+    cout << "draw" << endl;
+    body_size++;
+  }
+  cout << "add.d r0 r0 r1" << endl;
+  body_size++;
+  cout << "brp " << -(body_size + 1) << endl;
+  cout << "endprimitive" << endl;
+  cout << "halt" << endl;
+  return 0;
+}
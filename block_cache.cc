@@ -0,0 +1,683 @@
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include <string.h>
+#include "simulator.h"
+#include "checkpoint.h"
+#include "block_cache.h"
+#include "jit_x86.h"
+
+using namespace std;
+
+#define MAX_BLOCK_SIZE 256
+
+////////////////////////////////////////////////////////////////////////
+// How control leaves a block
+////////////////////////////////////////////////////////////////////////
+enum BlockExit {
+  X_FALLTHROUGH = 0,  // size limit or end of program, continue at exit_pc
+  X_BR,               // conditional branch
+  X_CMP_BR,           // fused cmp + conditional branch
+  X_CMPI_BR,          // fused cmpi + conditional branch
+  X_BRA,              // brnzp
+  X_JMP,
+  X_JSR,
+  X_JSRR,
+  X_HALT,
+  X_GENERIC,          // ExecuteInstruction(), then continue at R15
+};
+
+////////////////////////////////////////////////////////////////////////
+// 1. ops: straight-line body
+// 2. exit, exit_pc: how the block ends and the index of that instruction
+//                   (the next instruction for X_FALLTHROUGH)
+// 3. num_insts: instructions covered, including the exit
+// 4. mask, target: condition mask and absolute target of a branch
+// 5. src1, src2, imm: operands of a fused compare or register jump
+// 6. exec_count, native: JIT profiling counter and compiled body
+////////////////////////////////////////////////////////////////////////
+typedef struct Block_ {
+  vector<BlockOp> ops;
+  BlockExit exit;
+  int exit_pc;
+  int num_insts;
+  int mask;
+  int target;
+  const int *src1;
+  const int *src2;
+  int imm;
+  unsigned int exec_count;
+  JitBlockFn native;
+} Block;
+
+////////////////////////////////////////////////////////////////////////
+// (memory index, previous byte) for every store, used to roll back an
+// interpreted block body during JIT verification
+////////////////////////////////////////////////////////////////////////
+typedef vector< pair<int, unsigned char> > UndoLog;
+
+static inline int *ScalarOperand(const int idx)
+{
+  return &g_machine->scalar_registers[idx].int_value;
+}
+
+static inline int *VectorOperand(const int idx)
+{
+  return &g_machine->vector_registers[idx].element[0].int_value;
+}
+
+static inline bool SetsConditionCode(const int kind)
+{
+  return kind <= K_CMPI;
+}
+
+static inline bool AccessesMemory(const int kind)
+{
+  return (kind >= K_LDB && kind <= K_LDW_NOCC) || kind == K_STB || kind == K_STW;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Translate a straight-line instruction into a body op
+// output: false if the instruction ends the block
+////////////////////////////////////////////////////////////////////////
+static bool TranslateBodyOp(const TraceOp &trace_op, BlockOp &op)
+{
+  for (int i = VectorOperandSlots(trace_op.opcode); i < 3; i++)
+    if (trace_op.scalar_registers[i] == PC_IDX)
+      return false;
+
+  const uint8_t *sr = trace_op.scalar_registers;
+  const uint8_t *vr = trace_op.vector_registers;
+
+  op.imm = trace_op.int_value;
+  op.dst = NULL;
+  op.src1 = NULL;
+  op.src2 = NULL;
+
+  switch ((uint8_t)trace_op.opcode) {
+    case OP_ADD_D:
+    case OP_ADD_F:
+      op.kind = trace_op.opcode == OP_ADD_D ? K_ADD : K_ADD_F;
+      op.dst = ScalarOperand(sr[0]);
+      op.src1 = ScalarOperand(sr[1]);
+      op.src2 = ScalarOperand(sr[2]);
+      return true;
+    case OP_ADDI_D:
+    case OP_ADDI_F:
+      op.kind = trace_op.opcode == OP_ADDI_D ? K_ADDI : K_ADDI_F;
+      op.dst = ScalarOperand(sr[0]);
+      op.src1 = ScalarOperand(sr[1]);
+      return true;
+    case OP_AND_D:
+      op.kind = K_AND;
+      op.dst = ScalarOperand(sr[0]);
+      op.src1 = ScalarOperand(sr[1]);
+      op.src2 = ScalarOperand(sr[2]);
+      return true;
+    case OP_ANDI_D:
+      op.kind = K_ANDI;
+      op.dst = ScalarOperand(sr[0]);
+      op.src1 = ScalarOperand(sr[1]);
+      return true;
+    case OP_MOV:
+      op.kind = K_MOV;
+      op.dst = ScalarOperand(sr[0]);
+      op.src1 = ScalarOperand(sr[1]);
+      return true;
+    case OP_MOVI_D:
+    case OP_MOVI_F:
+      op.kind = K_MOVI;
+      op.dst = ScalarOperand(sr[0]);
+      return true;
+    case OP_LDB:
+    case OP_LDW:
+      op.kind = trace_op.opcode == OP_LDB ? K_LDB : K_LDW;
+      op.dst = ScalarOperand(sr[0]);
+      op.src1 = ScalarOperand(sr[1]);
+      return true;
+    case OP_CMP:
+      op.kind = K_CMP;
+      op.src1 = ScalarOperand(sr[1]);
+      op.src2 = ScalarOperand(sr[2]);
+      return true;
+    case OP_CMPI:
+      op.kind = K_CMPI;
+      op.src1 = ScalarOperand(sr[1]);
+      return true;
+    case OP_STB:
+    case OP_STW:
+      op.kind = trace_op.opcode == OP_STB ? K_STB : K_STW;
+      op.src1 = ScalarOperand(sr[1]);
+      op.src2 = ScalarOperand(sr[0]);
+      return true;
+    case OP_VADD:
+      op.kind = K_VADD;
+      op.dst = VectorOperand(vr[0]);
+      op.src1 = VectorOperand(vr[1]);
+      op.src2 = VectorOperand(vr[2]);
+      return true;
+    case OP_VMOV:
+      op.kind = K_VMOV;
+      op.dst = VectorOperand(vr[0]);
+      op.src1 = VectorOperand(vr[1]);
+      return true;
+    case OP_VMOVI:
+      op.kind = K_VMOVI;
+      op.dst = VectorOperand(vr[0]);
+      return true;
+    case OP_VCOMPMOV:
+      op.kind = K_VCOMPMOV;
+      op.dst = VectorOperand(vr[0]) + trace_op.idx;
+      op.src1 = ScalarOperand(sr[1]);
+      return true;
+    case OP_VCOMPMOVI:
+      op.kind = K_VCOMPMOVI;
+      op.dst = VectorOperand(vr[0]) + trace_op.idx;
+      return true;
+    default:
+      return false;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Fuse four vcompmov/vcompmovi at ops[i..i+3] if they write every
+//       lane of the same vector register
+////////////////////////////////////////////////////////////////////////
+static bool FuseVectorSet(const vector<BlockOp> &ops, const size_t i, BlockOp &fused)
+{
+  if (i + NUM_VECTOR_ELEMENTS > ops.size())
+    return false;
+
+  int *base = NULL;
+  int lanes_written = 0;
+  fused.kind = K_VSET4;
+  for (int j = 0; j < NUM_VECTOR_ELEMENTS; j++) {
+    const BlockOp &op = ops[i + j];
+    if (op.kind != K_VCOMPMOV && op.kind != K_VCOMPMOVI)
+      return false;
+    // lanes are element[0..3] of one register, 4 ints apart per register
+    int lane = (op.dst - VectorOperand(0)) % NUM_VECTOR_ELEMENTS;
+    int *reg = op.dst - lane;
+    if (base == NULL)
+      base = reg;
+    if (reg != base || (lanes_written & (1 << lane)))
+      return false;
+    lanes_written |= 1 << lane;
+    fused.lane[lane] = op.kind == K_VCOMPMOV ? op.src1 : NULL;
+    fused.lane_imm[lane] = op.imm;
+  }
+  fused.dst = base;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Discover and translate the basic block starting at pc
+////////////////////////////////////////////////////////////////////////
+static Block *BuildBlock(const int pc)
+{
+  const int num_ops = g_machine->trace_ops.size();
+  Block *block = new Block;
+  vector<BlockOp> raw;
+
+  ///////////////////////////////////////////////////////////////
+  // Collect the straight-line body and classify the exit
+  ///////////////////////////////////////////////////////////////
+  int i = pc;
+  block->exit = X_FALLTHROUGH;
+  block->mask = 0;
+  block->target = 0;
+  block->src1 = NULL;
+  block->src2 = NULL;
+  block->imm = 0;
+  block->exec_count = 0;
+  block->native = NULL;
+  for (; i < num_ops && i - pc < MAX_BLOCK_SIZE; i++) {
+    BlockOp op;
+    op.pc = i;
+    if (TranslateBodyOp(g_machine->trace_ops[i], op)) {
+      raw.push_back(op);
+      continue;
+    }
+
+    const TraceOp &trace_op = g_machine->trace_ops[i];
+    const uint8_t *sr = trace_op.scalar_registers;
+    block->target = i + 1 + SignExtension(trace_op.int_value);
+    block->exit = X_GENERIC;
+    if (sr[0] != PC_IDX && sr[1] != PC_IDX && sr[2] != PC_IDX) {
+      switch ((uint8_t)trace_op.opcode) {
+        case OP_BRN:
+        case OP_BRZ:
+        case OP_BRP:
+        case OP_BRNZ:
+        case OP_BRNP:
+        case OP_BRZP:
+          block->exit = X_BR;
+          block->mask = BranchConditionMask(trace_op.opcode);
+          break;
+        case OP_BRNZP:
+          block->exit = X_BRA;
+          break;
+        case OP_JMP:
+          block->exit = X_JMP;
+          block->src1 = ScalarOperand(sr[0]);
+          break;
+        case OP_JSR:
+          block->exit = X_JSR;
+          break;
+        case OP_JSRR:
+          // ExecuteInstruction() reads the target after overwriting LR
+          if (sr[0] != LR_IDX) {
+            block->exit = X_JSRR;
+            block->src1 = ScalarOperand(sr[0]);
+          }
+          break;
+        case OP_HALT:
+          block->exit = X_HALT;
+          break;
+        default:
+          break;
+      }
+    }
+    break;
+  }
+  block->exit_pc = i;
+  block->num_insts = i - pc + (block->exit == X_FALLTHROUGH ? 0 : 1);
+
+  ///////////////////////////////////////////////////////////////
+  // Fuse a trailing compare into the branch
+  ///////////////////////////////////////////////////////////////
+  if (block->exit == X_BR && !raw.empty() &&
+      (raw.back().kind == K_CMP || raw.back().kind == K_CMPI)) {
+    block->exit = raw.back().kind == K_CMP ? X_CMP_BR : X_CMPI_BR;
+    block->src1 = raw.back().src1;
+    block->src2 = raw.back().src2;
+    block->imm = raw.back().imm;
+    raw.pop_back();
+  }
+
+  ///////////////////////////////////////////////////////////////
+  // Superinstructions
+  ///////////////////////////////////////////////////////////////
+  vector<BlockOp> &ops = block->ops;
+  ops.reserve(raw.size());
+  for (size_t j = 0; j < raw.size(); j++) {
+    BlockOp fused;
+    if (FuseVectorSet(raw, j, fused)) {
+      ops.push_back(fused);
+      j += NUM_VECTOR_ELEMENTS - 1;
+      continue;
+    }
+
+    const BlockOp &op = raw[j];
+    if (op.kind == K_ADDI && op.dst == op.src1 && !ops.empty()) {
+      BlockOp &prev = ops.back();
+      if (prev.kind == K_ADDI && prev.dst == op.dst && prev.src1 == op.dst) {
+        prev.imm = (int)((unsigned int)prev.imm + (unsigned int)op.imm);
+        continue;
+      }
+    }
+    ops.push_back(op);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  // Dead condition code elimination. Body ops never read the code, so
+  // only the last writer survives unless the exit overwrites it too. A
+  // memory access may fault and end the block, so the code is live
+  // before it.
+  ///////////////////////////////////////////////////////////////
+  bool cc_live = block->exit != X_CMP_BR && block->exit != X_CMPI_BR;
+  for (size_t j = ops.size(); j-- > 0; ) {
+    const bool may_fault = AccessesMemory(ops[j].kind);
+    if (SetsConditionCode(ops[j].kind)) {
+      if (!cc_live) {
+        if (ops[j].kind == K_CMP || ops[j].kind == K_CMPI)
+          ops.erase(ops.begin() + j);
+        else
+          ops[j].kind += 1;
+      }
+      cc_live = false;
+    }
+    if (may_fault)
+      cc_live = true;
+  }
+
+  for (size_t j = 0; j < ops.size(); j++) {
+    if (ops[j].kind != K_VSET4)
+      continue;
+    for (int lane = 0; lane < NUM_VECTOR_ELEMENTS; lane++)
+      if (ops[j].lane[lane] == NULL)
+        ops[j].lane[lane] = &ops[j].lane_imm[lane];
+  }
+
+  return block;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Interpret a block body. With LOG, the previous contents of every
+//       byte stored to are appended to undo.
+// output: index of the op whose memory access is out of range, which is
+//         not executed, or -1
+////////////////////////////////////////////////////////////////////////
+template <bool LOG>
+static inline int ExecuteBody(const Block *block, int &cc, UndoLog *undo)
+{
+  DataMemory &data_memory = g_machine->memory;
+  unsigned char *const memory = data_memory.bytes;
+  const unsigned int memory_size = data_memory.size;
+
+  const BlockOp *const begin = block->ops.empty() ? NULL : &block->ops[0];
+  const BlockOp *op = begin;
+  const BlockOp *const end = op + block->ops.size();
+  for (; op != end; op++) {
+    switch (op->kind) {
+      case K_ADD:       *op->dst = *op->src1 + *op->src2; cc = ConditionCode(*op->dst); break;
+      case K_ADD_NOCC:  *op->dst = *op->src1 + *op->src2; break;
+      case K_ADDI:      *op->dst = *op->src1 + op->imm; cc = ConditionCode(*op->dst); break;
+      case K_ADDI_NOCC: *op->dst = *op->src1 + op->imm; break;
+      case K_AND:       *op->dst = *op->src1 & *op->src2; cc = ConditionCode(*op->dst); break;
+      case K_AND_NOCC:  *op->dst = *op->src1 & *op->src2; break;
+      case K_ANDI:      *op->dst = *op->src1 & op->imm; cc = ConditionCode(*op->dst); break;
+      case K_ANDI_NOCC: *op->dst = *op->src1 & op->imm; break;
+      case K_MOV:       *op->dst = *op->src1; cc = ConditionCode(*op->dst); break;
+      case K_MOV_NOCC:  *op->dst = *op->src1; break;
+      case K_MOVI:      *op->dst = op->imm; cc = ConditionCode(op->imm); break;
+      case K_MOVI_NOCC: *op->dst = op->imm; break;
+      case K_ADD_F:       *op->dst = Fixed1114Add(*op->src1, *op->src2); cc = ConditionCode(*op->dst); break;
+      case K_ADD_F_NOCC:  *op->dst = Fixed1114Add(*op->src1, *op->src2); break;
+      case K_ADDI_F:      *op->dst = Fixed1114Add(*op->src1, op->imm); cc = ConditionCode(*op->dst); break;
+      case K_ADDI_F_NOCC: *op->dst = Fixed1114Add(*op->src1, op->imm); break;
+      case K_LDB:
+      case K_LDB_NOCC:
+        {
+          unsigned int address = *op->src1 + op->imm;
+          if (address > memory_size - 1)
+            return op - begin;
+          *op->dst = memory[address];
+          if (op->kind == K_LDB)
+            cc = ConditionCode(*op->dst);
+        }
+        break;
+      case K_LDW:
+      case K_LDW_NOCC:
+        {
+          unsigned int address = *op->src1 + op->imm;
+          if (address > memory_size - 2)
+            return op - begin;
+          *op->dst = memory[address + 1] << 8 | memory[address];
+          if (op->kind == K_LDW)
+            cc = ConditionCode(*op->dst);
+        }
+        break;
+      case K_CMP:
+        cc = *op->src1 < *op->src2 ? 4 : (*op->src1 == *op->src2 ? 2 : 1);
+        break;
+      case K_CMPI:
+        cc = *op->src1 < op->imm ? 4 : (*op->src1 == op->imm ? 2 : 1);
+        break;
+      case K_STB:
+        {
+          unsigned int address = *op->src1 + op->imm;
+          if (address > memory_size - 1)
+            return op - begin;
+          if (LOG)
+            undo->push_back(make_pair(address, memory[address]));
+          memory[address] = *op->src2;
+          MarkPageWritten(data_memory, address);
+        }
+        break;
+      case K_STW:
+        {
+          unsigned int address = *op->src1 + op->imm;
+          if (address > memory_size - 2)
+            return op - begin;
+          int value = *op->src2;
+          if (LOG) {
+            undo->push_back(make_pair(address + 1, memory[address + 1]));
+            undo->push_back(make_pair(address, memory[address]));
+          }
+          memory[address + 1] = value >> 8;
+          memory[address] = value & 0x00FF;
+          MarkPageWritten(data_memory, address);
+          MarkPageWritten(data_memory, address + 1);
+        }
+        break;
+      case K_VADD:
+        Fixed1114AddLanes(op->dst, op->src1, op->src2);
+        break;
+      case K_VMOV:
+        CopyLanes(op->dst, op->src1);
+        break;
+      case K_VMOVI:
+        FillLanes(op->dst, op->imm);
+        break;
+      case K_VCOMPMOV:
+        *op->dst = Fixed1114Bits(*op->src1);
+        break;
+      case K_VCOMPMOVI:
+        *op->dst = op->imm;
+        break;
+      case K_VSET4:
+        {
+          int v0 = Fixed1114Bits(*op->lane[0]), v1 = Fixed1114Bits(*op->lane[1]);
+          int v2 = Fixed1114Bits(*op->lane[2]), v3 = Fixed1114Bits(*op->lane[3]);
+          op->dst[0] = v0;
+          op->dst[1] = v1;
+          op->dst[2] = v2;
+          op->dst[3] = v3;
+        }
+        break;
+    }
+  }
+  return -1;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Run a compiled block body and the interpreter on the same state
+//       and compare registers, condition code, stored bytes and the
+//       faulting op. The native result is kept.
+// output: false on mismatch; fault: as ExecuteBody()
+////////////////////////////////////////////////////////////////////////
+static bool VerifyNativeBlock(const Block *block, const int pc, int &cc, int &fault)
+{
+  static thread_local ScalarRegister scalar_before[NUM_SCALAR_REGISTER], scalar_interp[NUM_SCALAR_REGISTER];
+  static thread_local VectorRegister vector_before[NUM_VECTOR_REGISTER], vector_interp[NUM_VECTOR_REGISTER];
+  static thread_local UndoLog undo;
+  static thread_local vector<unsigned char> memory_interp;
+
+  memcpy(scalar_before, g_machine->scalar_registers, sizeof(g_machine->scalar_registers));
+  memcpy(vector_before, g_machine->vector_registers, sizeof(g_machine->vector_registers));
+  const int cc_before = cc;
+
+  int cc_interp = cc;
+  undo.clear();
+  const int fault_interp = ExecuteBody<true>(block, cc_interp, &undo);
+  memcpy(scalar_interp, g_machine->scalar_registers, sizeof(g_machine->scalar_registers));
+  memcpy(vector_interp, g_machine->vector_registers, sizeof(g_machine->vector_registers));
+  memory_interp.resize(undo.size());
+  for (size_t i = 0; i < undo.size(); i++)
+    memory_interp[i] = g_machine->memory.bytes[undo[i].first];
+
+  for (size_t i = undo.size(); i-- > 0; )
+    g_machine->memory.bytes[undo[i].first] = undo[i].second;
+  memcpy(g_machine->scalar_registers, scalar_before, sizeof(g_machine->scalar_registers));
+  memcpy(g_machine->vector_registers, vector_before, sizeof(g_machine->vector_registers));
+
+  cc = cc_before;
+  fault = block->native(&cc);
+
+  bool ok = true;
+  if (fault != fault_interp) {
+    cerr << "  fault: interpreter op " << fault_interp << " native op " << fault << endl;
+    ok = false;
+  }
+  if (cc != cc_interp) {
+    cerr << "  CC: interpreter " << cc_interp << " native " << cc << endl;
+    ok = false;
+  }
+  for (int i = 0; i < NUM_SCALAR_REGISTER; i++) {
+    if (scalar_interp[i].int_value != g_machine->scalar_registers[i].int_value) {
+      cerr << "  R" << i << ": interpreter " << scalar_interp[i].int_value
+           << " native " << g_machine->scalar_registers[i].int_value << endl;
+      ok = false;
+    }
+  }
+  if (memcmp(vector_interp, g_machine->vector_registers, sizeof(g_machine->vector_registers)) != 0) {
+    cerr << "  vector registers differ" << endl;
+    ok = false;
+  }
+  for (size_t i = 0; i < undo.size(); i++) {
+    if (memory_interp[i] != g_machine->memory.bytes[undo[i].first]) {
+      cerr << "  MEM[" << undo[i].first << "]: interpreter " << (int)memory_interp[i]
+           << " native " << (int)g_machine->memory.bytes[undo[i].first] << endl;
+      ok = false;
+    }
+  }
+  if (!ok)
+    cerr << "JIT verify: block at " << pc << " differs from the interpreter" << endl;
+  return ok;
+}
+
+bool RunBlocks(const int jit_mode)
+{
+  const int num_ops = g_machine->trace_ops.size();
+  vector<Block *> cache(num_ops, (Block *)NULL);
+
+  int *const link = &g_machine->scalar_registers[LR_IDX].int_value;
+  int *const pc_reg = &g_machine->scalar_registers[PC_IDX].int_value;
+  int cc = g_machine->condition_code_register.int_value;
+  uint64_t count = 0;
+  // Instructions until the next checkpoint, which is taken between blocks
+  uint64_t checkpoint_budget = g_next_checkpoint - g_machine->instruction_count;
+  unsigned int num_verified = 0;
+  bool ok = true;
+  int pc = *pc_reg;
+
+  for (;;) {
+    if ((unsigned int)pc >= (unsigned int)num_ops) {
+      cerr << "Error: PC left the program (" << num_ops << " instructions)" << endl;
+      ok = false;
+      break;
+    }
+
+    if (count >= checkpoint_budget) {
+      *pc_reg = pc;
+      g_machine->condition_code_register.int_value = cc;
+      g_machine->instruction_count += count;
+      count = 0;
+      if (!WriteCheckpoint()) {
+        ok = false;
+        break;
+      }
+      checkpoint_budget = g_next_checkpoint - g_machine->instruction_count;
+    }
+
+    Block *block = cache[pc];
+    if (block == NULL)
+      block = cache[pc] = BuildBlock(pc);
+
+    if (jit_mode != JIT_OFF && block->native == NULL && !block->ops.empty() &&
+        ++block->exec_count == JIT_HOT_THRESHOLD)
+      block->native = JitCompileBlock(&block->ops[0], block->ops.size());
+
+    int fault;
+    if (block->native == NULL) {
+      fault = ExecuteBody<false>(block, cc, NULL);
+    }
+    else if (jit_mode == JIT_VERIFY) {
+      if (!VerifyNativeBlock(block, pc, cc, fault)) {
+        ok = false;
+        break;
+      }
+      num_verified++;
+    }
+    else {
+      fault = block->native(&cc);
+    }
+    if (fault != -1) {
+      const BlockOp &op = block->ops[fault];
+      count += op.pc - pc;
+      pc = *pc_reg = op.pc;
+      RaiseMemoryFault(op.pc, *op.src1 + op.imm);
+      ok = false;
+      break;
+    }
+    count += block->num_insts;
+
+    const int exit_pc = block->exit_pc;
+    switch (block->exit) {
+      case X_FALLTHROUGH:
+        pc = exit_pc;
+        continue;
+      case X_CMP_BR:
+        cc = *block->src1 < *block->src2 ? 4 : (*block->src1 == *block->src2 ? 2 : 1);
+        pc = (cc & block->mask) ? block->target : exit_pc + 1;
+        continue;
+      case X_CMPI_BR:
+        cc = *block->src1 < block->imm ? 4 : (*block->src1 == block->imm ? 2 : 1);
+        pc = (cc & block->mask) ? block->target : exit_pc + 1;
+        continue;
+      case X_BR:
+        pc = (cc & block->mask) ? block->target : exit_pc + 1;
+        continue;
+      case X_BRA:
+        pc = block->target;
+        continue;
+      case X_JMP:
+        pc = *block->src1 >> 2;
+        continue;
+      case X_JSR:
+        *link = (exit_pc + 1) << 2;
+        pc = block->target;
+        continue;
+      case X_JSRR:
+        pc = *block->src1 >> 2;
+        *link = (exit_pc + 1) << 2;
+        continue;
+      case X_HALT:
+        *pc_reg = exit_pc + 1;
+        g_machine->program_halt = 1;
+        break;
+      case X_GENERIC:
+        {
+          // Same sequence as the reference loop in main()
+          const TraceOp &trace_op = g_machine->trace_ops[exit_pc];
+          g_machine->condition_code_register.int_value = cc;
+          *pc_reg = exit_pc;
+          int idx = ExecuteInstruction(trace_op);
+          if (g_machine->fault != FAULT_NONE) {
+            ok = false;
+            break;
+          }
+          if (trace_op.opcode == OP_JSR || trace_op.opcode == OP_JSRR)
+            *link = (*pc_reg + 1) << 2;
+          *pc_reg += 1;
+          if (idx != -1) {
+            if (trace_op.opcode == OP_JMP || trace_op.opcode == OP_JSRR)
+              *pc_reg = idx;
+            else
+              *pc_reg += idx;
+          }
+          cc = g_machine->condition_code_register.int_value;
+          pc = *pc_reg;
+        }
+        if (g_machine->program_halt != 1)
+          continue;
+        break;
+    }
+    pc = exit_pc;
+    break;
+  }
+
+  for (size_t i = 0; i < cache.size(); i++)
+    delete cache[i];
+  JitReleaseCode();
+
+  if (jit_mode == JIT_VERIFY && ok)
+    cerr << "JIT verify: " << num_verified << " native block runs matched the interpreter" << endl;
+
+  g_machine->condition_code_register.int_value = cc;
+  g_machine->current_pc = pc;
+  g_machine->instruction_count += count;
+  return ok;
+}
@@ -0,0 +1,89 @@
+#ifndef __BLOCK_CACHE_H
+#define __BLOCK_CACHE_H
+
+#include "simulator.h"
+
+////////////////////////////////////////////////////////////////////////
+// Body operation kinds. Every kind that sets the condition code is
+// followed by a _NOCC variant used when that update is dead.
+////////////////////////////////////////////////////////////////////////
+enum BlockOpKind {
+  K_ADD = 0,
+  K_ADD_NOCC,
+  K_ADDI,
+  K_ADDI_NOCC,
+  K_AND,
+  K_AND_NOCC,
+  K_ANDI,
+  K_ANDI_NOCC,
+  K_MOV,
+  K_MOV_NOCC,
+  K_MOVI,
+  K_MOVI_NOCC,
+  K_ADD_F,      // 1.11.4, saturating
+  K_ADD_F_NOCC,
+  K_ADDI_F,
+  K_ADDI_F_NOCC,
+  K_LDB,
+  K_LDB_NOCC,
+  K_LDW,
+  K_LDW_NOCC,
+  K_CMP,
+  K_CMPI,
+  K_STB,
+  K_STW,
+  K_VADD,
+  K_VMOV,
+  K_VMOVI,
+  K_VCOMPMOV,
+  K_VCOMPMOVI,
+  K_VSET4,      // fused vcompmov/vcompmovi x4 writing every lane
+};
+
+////////////////////////////////////////////////////////////////////////
+// 1. kind: BlockOpKind
+// 2. imm: immediate value
+// 3. dst, src1, src2: operands resolved into the register file
+//                     (vector operands point at element 0)
+// 4. lane, lane_imm: per-lane sources of K_VSET4; immediate lanes point
+//                    into lane_imm
+// 5. pc: index of the (first) instruction the op was translated from
+////////////////////////////////////////////////////////////////////////
+typedef struct BlockOp_ {
+  int kind;
+  int imm;
+  int pc;
+  int *dst;
+  const int *src1;
+  const int *src2;
+  const int *lane[NUM_VECTOR_ELEMENTS];
+  int lane_imm[NUM_VECTOR_ELEMENTS];
+} BlockOp;
+
+enum JitMode {
+  JIT_OFF = 0,      // interpret every block
+  JIT_ON = 1,       // compile hot blocks to native code
+  JIT_VERIFY = 2,   // compile hot blocks and check each run against the interpreter
+};
+
+////////////////////////////////////////////////////////////////////////
+// desc: Execute g_machine's trace_ops one basic block at a time,
+//       starting at the instruction index held in R15, until HALT.
+//       A block is translated the first time control reaches its first
+//       instruction and cached by that index. Translation fuses
+//         - cmp/cmpi followed by a conditional branch,
+//         - runs of addi.d on the same register,
+//         - four vcompmov/vcompmovi filling every lane of one register,
+//       and drops condition code updates that are overwritten before the
+//       next branch or memory access in the block. An out-of-range
+//       access stops the block after the ops before it, leaving the same
+//       state as the interpreter.
+//       With the JIT enabled, a block body executed JIT_HOT_THRESHOLD
+//       times is compiled to native code (see jit_x86.h).
+// input: jit_mode: JitMode
+// output: false if the PC left the program, a memory access faulted or
+//         JIT verification failed
+////////////////////////////////////////////////////////////////////////
+bool RunBlocks(const int jit_mode);
+
+#endif // __BLOCK_CACHE_H
@@ -0,0 +1,373 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include "simulator.h"
+#include "program_image.h"
+#include "rasterizer.h"
+#include "render_pipeline.h"
+#include "checkpoint.h"
+
+using namespace std;
+
+uint64_t g_next_checkpoint = UINT64_MAX;
+
+static string g_checkpoint_path;
+static unsigned int g_checkpoint_interval = 0;
+static uint32_t g_checkpoint_code_count = 0;
+static uint32_t g_checkpoint_code_hash = 0;
+
+static uint32_t HashInstructions(const vector<uint32_t> &instructions)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < instructions.size(); i++)
+    for (int j = 0; j < 4; j++)
+      hash = (hash ^ ((instructions[i] >> (j * 8)) & 0xFF)) * 16777619u;
+  return hash;
+}
+
+static void ScheduleNextCheckpoint()
+{
+  const uint64_t count = g_machine->instruction_count;
+  if (count / g_checkpoint_interval >= UINT64_MAX / g_checkpoint_interval)
+    g_next_checkpoint = UINT64_MAX;
+  else
+    g_next_checkpoint = (count / g_checkpoint_interval + 1) * g_checkpoint_interval;
+}
+
+static void AppendLE32(vector<unsigned char> &out, const uint32_t value)
+{
+  unsigned char bytes[4];
+  WriteLE32(bytes, value);
+  out.insert(out.end(), bytes, bytes + 4);
+}
+
+static bool ReadNextLE32(const vector<unsigned char> &in, size_t &pos, uint32_t &value)
+{
+  if (in.size() - pos < 4)
+    return false;
+  value = ReadLE32(&in[pos]);
+  pos += 4;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Append the run-length encoding of data (format in checkpoint.h)
+////////////////////////////////////////////////////////////////////////
+static void EncodeRuns(const unsigned char *data, const size_t size, vector<unsigned char> &out)
+{
+  size_t i = 0;
+  while (i < size) {
+    size_t run = 1;
+    while (i + run < size && run < 128 && data[i + run] == data[i])
+      run++;
+    if (run >= 2) {
+      out.push_back(257 - run);
+      out.push_back(data[i]);
+      i += run;
+      continue;
+    }
+
+    // Literals up to the next pair of equal bytes
+    const size_t start = i;
+    while (i < size && i - start < 128 && !(i + 1 < size && data[i] == data[i + 1]))
+      i++;
+    out.push_back(i - start - 1);
+    out.insert(out.end(), data + start, data + i);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// output: false unless in decodes to exactly size bytes
+////////////////////////////////////////////////////////////////////////
+static bool DecodeRuns(const unsigned char *in, const size_t in_size, unsigned char *out,
+                       const size_t size)
+{
+  size_t i = 0, o = 0;
+  while (i < in_size) {
+    const unsigned int control = in[i++];
+    if (control < 128) {
+      const size_t length = control + 1;
+      if (length > in_size - i || length > size - o)
+        return false;
+      memcpy(out + o, in + i, length);
+      i += length;
+      o += length;
+    }
+    else if (control > 128) {
+      const size_t length = 257 - control;
+      if (i == in_size || length > size - o)
+        return false;
+      memset(out + o, in[i++], length);
+      o += length;
+    }
+    else
+      return false;
+  }
+  return o == size;
+}
+
+static void AppendEncodedBlock(vector<unsigned char> &out, const uint32_t index,
+                               const unsigned char *data, const size_t size)
+{
+  AppendLE32(out, index);
+  const size_t size_offset = out.size();
+  AppendLE32(out, 0);
+  EncodeRuns(data, size, out);
+  WriteLE32(&out[size_offset], out.size() - size_offset - 4);
+}
+
+void StartCheckpoints(const char *path, const unsigned int interval,
+                      const vector<uint32_t> &instructions)
+{
+  g_checkpoint_path = path;
+  g_checkpoint_interval = interval;
+  g_checkpoint_code_count = instructions.size();
+  g_checkpoint_code_hash = HashInstructions(instructions);
+  ScheduleNextCheckpoint();
+}
+
+bool WriteCheckpoint()
+{
+  ScheduleNextCheckpoint();
+  if (g_render_pipeline_active)
+    SyncRenderPipeline();
+
+  ///////////////////////////////////////////////////////////////
+  // Header and registers
+  ///////////////////////////////////////////////////////////////
+  vector<unsigned char> out(CHECKPOINT_HEADER_SIZE);
+  memcpy(&out[0], CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE);
+  WriteLE32(&out[8], CHECKPOINT_VERSION);
+  WriteLE32(&out[12], g_checkpoint_code_count);
+  WriteLE32(&out[16], g_checkpoint_code_hash);
+  WriteLE32(&out[20], g_machine->memory.size);
+  WriteLE32(&out[24], (uint32_t)g_machine->instruction_count);
+  WriteLE32(&out[28], (uint32_t)(g_machine->instruction_count >> 32));
+
+  AppendLE32(out, g_machine->condition_code_register.int_value);
+  for (int i = 0; i < NUM_SCALAR_REGISTER; i++)
+    AppendLE32(out, g_machine->scalar_registers[i].int_value);
+  for (int i = 0; i < NUM_VECTOR_REGISTER; i++)
+    for (int j = 0; j < NUM_VECTOR_ELEMENTS; j++)
+      AppendLE32(out, g_machine->vector_registers[i].element[j].int_value);
+  for (int i = 0; i < NUM_VERTEX_REGISTER; i++) {
+    const VertexRegister &vertex = g_machine->gpu_vertex_registers[i];
+    AppendLE32(out, vertex.x_value);
+    AppendLE32(out, vertex.y_value);
+    AppendLE32(out, vertex.z_value);
+    AppendLE32(out, vertex.r_value);
+    AppendLE32(out, vertex.g_value);
+    AppendLE32(out, vertex.b_value);
+  }
+  AppendLE32(out, g_machine->gpu_status_register.int_value);
+  AppendLE32(out, g_machine->active_vertex_reg);
+
+  const TransformStack &transform = g_machine->transform;
+  AppendLE32(out, transform.depth);
+  for (unsigned int level = 0; level <= transform.depth; level++)
+    for (int i = 0; i < 4; i++)
+      for (int j = 0; j < 4; j++)
+        AppendLE32(out, transform.matrix[level][i][j]);
+
+  ///////////////////////////////////////////////////////////////
+  // Non-zero memory pages
+  ///////////////////////////////////////////////////////////////
+  const DataMemory &memory = g_machine->memory;
+  const uint32_t num_pages = memory.size >> MEMORY_PAGE_SHIFT;
+  size_t count_offset = out.size();
+  uint32_t num_blocks = 0;
+  AppendLE32(out, 0);
+  for (uint32_t page = NextWrittenPage(memory, 0); page < num_pages;
+       page = NextWrittenPage(memory, page + 1)) {
+    const unsigned char *bytes = memory.bytes + ((size_t)page << MEMORY_PAGE_SHIFT);
+    int i = 0;
+    while (i < MEMORY_PAGE_SIZE && bytes[i] == 0)
+      i++;
+    if (i == MEMORY_PAGE_SIZE)
+      continue;
+    AppendEncodedBlock(out, page, bytes, MEMORY_PAGE_SIZE);
+    num_blocks++;
+  }
+  WriteLE32(&out[count_offset], num_blocks);
+
+  ///////////////////////////////////////////////////////////////
+  // Written framebuffer tiles
+  ///////////////////////////////////////////////////////////////
+  count_offset = out.size();
+  num_blocks = 0;
+  AppendLE32(out, 0);
+  if (g_machine->framebuffer != NULL) {
+    const Framebuffer &framebuffer = *g_machine->framebuffer;
+    for (int tile = 0; tile < NUM_TILES_X * NUM_TILES_Y; tile++) {
+      if (!framebuffer.tile_written[tile])
+        continue;
+      unsigned char pixels[TILE_PIXELS * 4];
+      for (int i = 0; i < TILE_PIXELS; i++)
+        WriteLE32(pixels + 4 * i, framebuffer.pixels[tile * TILE_PIXELS + i]);
+      AppendEncodedBlock(out, tile, pixels, sizeof(pixels));
+      num_blocks++;
+    }
+  }
+  WriteLE32(&out[count_offset], num_blocks);
+
+  ///////////////////////////////////////////////////////////////
+  // Replace the previous checkpoint
+  ///////////////////////////////////////////////////////////////
+  const string temp_path = g_checkpoint_path + ".tmp";
+  FILE *file = fopen(temp_path.c_str(), "wb");
+  if (file == NULL) {
+    cerr << "Error: cannot create checkpoint file " << temp_path << endl;
+    return false;
+  }
+  bool ok = fwrite(&out[0], 1, out.size(), file) == out.size();
+  if (fclose(file) != 0)
+    ok = false;
+  if (!ok || rename(temp_path.c_str(), g_checkpoint_path.c_str()) != 0) {
+    cerr << "Error: cannot write checkpoint file " << g_checkpoint_path << endl;
+    remove(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool RestoreCheckpoint(const char *path, const vector<uint32_t> &instructions)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    cerr << "Error: cannot open checkpoint file " << path << endl;
+    return false;
+  }
+  vector<unsigned char> in;
+  unsigned char buffer[64*1024];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    in.insert(in.end(), buffer, buffer + length);
+  fclose(file);
+
+  ///////////////////////////////////////////////////////////////
+  // Header
+  ///////////////////////////////////////////////////////////////
+  if (in.size() < CHECKPOINT_V2_HEADER_SIZE || memcmp(&in[0], CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE) != 0) {
+    cerr << "Error: " << path << " is not a checkpoint file" << endl;
+    return false;
+  }
+  const uint32_t version = ReadLE32(&in[8]);
+  if (version < 1 || version > CHECKPOINT_VERSION) {
+    cerr << "Error: unsupported checkpoint version " << version << " in " << path << endl;
+    return false;
+  }
+  const size_t header_size = version >= 3 ? CHECKPOINT_HEADER_SIZE : CHECKPOINT_V2_HEADER_SIZE;
+  if (in.size() < header_size) {
+    cerr << "Error: truncated checkpoint " << path << endl;
+    return false;
+  }
+  if (ReadLE32(&in[12]) != instructions.size() || ReadLE32(&in[16]) != HashInstructions(instructions)) {
+    cerr << "Error: checkpoint " << path << " was taken from a different program" << endl;
+    return false;
+  }
+  if (ReadLE32(&in[20]) != g_machine->memory.size) {
+    cerr << "Error: checkpoint " << path << " was taken with --memory-size=" << ReadLE32(&in[20])
+         << endl;
+    return false;
+  }
+
+  ///////////////////////////////////////////////////////////////
+  // Registers
+  ///////////////////////////////////////////////////////////////
+  const size_t register_words = 1 + NUM_SCALAR_REGISTER + NUM_VECTOR_REGISTER * NUM_VECTOR_ELEMENTS +
+                                NUM_VERTEX_REGISTER * 6 + 2;
+  if (in.size() - header_size < register_words * 4) {
+    cerr << "Error: truncated checkpoint " << path << endl;
+    return false;
+  }
+  const unsigned char *p = &in[header_size];
+  g_machine->condition_code_register.int_value = ReadLE32(p);
+  p += 4;
+  for (int i = 0; i < NUM_SCALAR_REGISTER; i++, p += 4)
+    g_machine->scalar_registers[i].int_value = ReadLE32(p);
+  for (int i = 0; i < NUM_VECTOR_REGISTER; i++)
+    for (int j = 0; j < NUM_VECTOR_ELEMENTS; j++, p += 4)
+      g_machine->vector_registers[i].element[j].int_value = Fixed1114Bits(ReadLE32(p));
+  for (int i = 0; i < NUM_VERTEX_REGISTER; i++, p += 24) {
+    VertexRegister &vertex = g_machine->gpu_vertex_registers[i];
+    vertex.x_value = ReadLE32(p);
+    vertex.y_value = ReadLE32(p + 4);
+    vertex.z_value = ReadLE32(p + 8);
+    vertex.r_value = ReadLE32(p + 12);
+    vertex.g_value = ReadLE32(p + 16);
+    vertex.b_value = ReadLE32(p + 20);
+  }
+  g_machine->gpu_status_register.int_value = ReadLE32(p);
+  g_machine->active_vertex_reg = ReadLE32(p + 4) % NUM_VERTEX_REGISTER;
+  g_machine->instruction_count = ReadLE32(&in[24]);
+  if (version >= 3)
+    g_machine->instruction_count |= (uint64_t)ReadLE32(&in[28]) << 32;
+  size_t pos = header_size + register_words * 4;
+
+  ///////////////////////////////////////////////////////////////
+  // Matrix stack
+  ///////////////////////////////////////////////////////////////
+  TransformStack &transform = g_machine->transform;
+  ResetTransform(transform);
+  if (version >= 2) {
+    uint32_t depth;
+    if (!ReadNextLE32(in, pos, depth) || depth >= TRANSFORM_STACK_DEPTH ||
+        in.size() - pos < (depth + 1) * 16 * 4) {
+      cerr << "Error: corrupt matrix stack in checkpoint " << path << endl;
+      return false;
+    }
+    for (uint32_t level = 0; level <= depth; level++)
+      for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++, pos += 4)
+          transform.matrix[level][i][j] = ReadLE32(&in[pos]);
+    transform.depth = depth;
+    UpdateTransform(transform);
+  }
+
+  ///////////////////////////////////////////////////////////////
+  // Memory pages, then framebuffer tiles
+  ///////////////////////////////////////////////////////////////
+  ClearDataMemory(g_machine->memory);
+  if (g_machine->framebuffer != NULL)
+    ClearFramebuffer(*g_machine->framebuffer);
+  for (int section = 0; section < 2; section++) {
+    const uint32_t num_blocks_limit = section == 0 ? g_machine->memory.size >> MEMORY_PAGE_SHIFT
+                                                   : NUM_TILES_X * NUM_TILES_Y;
+    const size_t block_size = section == 0 ? MEMORY_PAGE_SIZE : TILE_PIXELS * 4;
+    uint32_t num_blocks;
+    if (!ReadNextLE32(in, pos, num_blocks)) {
+      cerr << "Error: truncated checkpoint " << path << endl;
+      return false;
+    }
+    for (uint32_t i = 0; i < num_blocks; i++) {
+      uint32_t index, encoded_size;
+      unsigned char block[MEMORY_PAGE_SIZE];
+      if (!ReadNextLE32(in, pos, index) || !ReadNextLE32(in, pos, encoded_size) ||
+          encoded_size > in.size() - pos || index >= num_blocks_limit ||
+          !DecodeRuns(&in[pos], encoded_size, block, block_size)) {
+        cerr << "Error: corrupt " << (section == 0 ? "memory page" : "framebuffer tile")
+             << " in checkpoint " << path << endl;
+        return false;
+      }
+      pos += encoded_size;
+      if (section == 0) {
+        WriteDataMemory(g_machine->memory, index << MEMORY_PAGE_SHIFT, block, MEMORY_PAGE_SIZE);
+      }
+      else {
+        Framebuffer &framebuffer = MachineFramebuffer(*g_machine);
+        for (int j = 0; j < TILE_PIXELS; j++)
+          framebuffer.pixels[index * TILE_PIXELS + j] = ReadLE32(block + 4 * j);
+        framebuffer.tile_written[index] = true;
+      }
+    }
+  }
+  if (pos != in.size()) {
+    cerr << "Error: trailing data in checkpoint " << path << endl;
+    return false;
+  }
+
+  MarkAllDirty();
+  return true;
+}
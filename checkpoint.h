@@ -0,0 +1,75 @@
+#ifndef __CHECKPOINT_H
+#define __CHECKPOINT_H
+
+#include <stdint.h>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////
+// Checkpoint file written by --checkpoint-every and read by --restore
+//
+// Header (little-endian):
+//   [0:8)   magic "3220XCKP"
+//   [8:12)  format version
+//   [12:16) number of instruction words of the program
+//   [16:20) FNV-1a hash of the instruction words, so a checkpoint is only
+//           restored into the program it was taken from
+//   [20:24) data memory size in bytes
+//   [24:32) instruction count (u64; versions 1 and 2: [24:28), u32)
+//
+// Followed by the registers, all u32:
+//   condition code, 16 scalar registers, 64 x 4 vector elements,
+//   3 x { x, y, z, r, g, b } vertex registers, GPU status register,
+//   active vertex register
+//
+// Then the matrix stack (from version 2; version 1 files restore with the
+// identity):
+//   u32 index D of the current matrix
+//   (D + 1) x 16 u32 matrix entries, bottom of the stack first
+//
+// Then the non-zero data memory pages and written framebuffer tiles:
+//   u32 number of pages P
+//   P x { u32 page index, u32 encoded size E, E bytes }
+//   u32 number of tiles T
+//   T x { u32 tile index, u32 encoded size E, E bytes }
+//
+// Pages (MEMORY_PAGE_SIZE bytes) and tiles (TILE_PIXELS little-endian
+// u32 pixels) are run-length encoded: a control byte c < 128 is followed
+// by c + 1 literal bytes, c > 128 by one byte repeated 257 - c times.
+////////////////////////////////////////////////////////////////////////
+#define CHECKPOINT_MAGIC "3220XCKP"
+#define CHECKPOINT_MAGIC_SIZE 8
+#define CHECKPOINT_VERSION 3
+#define CHECKPOINT_HEADER_SIZE 32
+#define CHECKPOINT_V2_HEADER_SIZE 28  // versions 1 and 2
+
+// Instruction count at which engines call WriteCheckpoint(); UINT64_MAX
+// while checkpoints are off
+extern uint64_t g_next_checkpoint;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Write g_machine to path every interval instructions, replacing
+//       the previous checkpoint
+// input: output path, interval, instruction words of the program
+////////////////////////////////////////////////////////////////////////
+void StartCheckpoints(const char *path, const unsigned int interval,
+                      const std::vector<uint32_t> &instructions);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Write g_machine's state, which engines must have stored back
+//       (R15, condition code, instruction count), and schedule the next
+//       checkpoint. The file is written under a temporary name and
+//       renamed, so an interrupted run leaves the previous checkpoint.
+// output: false on a write error
+////////////////////////////////////////////////////////////////////////
+bool WriteCheckpoint();
+
+////////////////////////////////////////////////////////////////////////
+// desc: Replace g_machine's registers, memory, framebuffer and
+//       instruction count with a checkpoint of the same program
+// input: checkpoint path, instruction words of the loaded program
+// output: false if the file is unreadable, malformed or was taken from
+//         another program or memory size
+////////////////////////////////////////////////////////////////////////
+bool RestoreCheckpoint(const char *path, const std::vector<uint32_t> &instructions);
+
+#endif // __CHECKPOINT_H
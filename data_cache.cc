@@ -0,0 +1,325 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iomanip>
+#include <stdint.h>
+#include <stdlib.h>
+#include "simulator.h"
+#include "data_cache.h"
+
+using namespace std;
+
+bool g_data_cache_enabled = false;
+DataCache g_data_cache;
+static string g_data_cache_path;
+
+void DefaultDataCacheConfig(DataCacheConfig &config)
+{
+  config.size[0] = 8 * 1024;
+  config.ways[0] = 2;
+  config.size[1] = 64 * 1024;
+  config.ways[1] = 8;
+  config.line = 32;
+  config.write_back = true;
+  config.plru = false;
+}
+
+static bool IsPowerOfTwo(const uint64_t value)
+{
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+static int Log2(uint64_t value)
+{
+  int bits = 0;
+  while (value > 1) {
+    value >>= 1;
+    bits++;
+  }
+  return bits;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Parse bytes with an optional K suffix
+////////////////////////////////////////////////////////////////////////
+static bool ParseCacheSize(const string &text, uint32_t &size)
+{
+  char *end;
+  uint64_t value = strtoull(text.c_str(), &end, 10);
+  if (*end == 'K' || *end == 'k') {
+    value <<= 10;
+    end++;
+  }
+  if (end == text.c_str() || *end != '\0' || value > (1u << 30))
+    return false;
+  size = value;
+  return true;
+}
+
+bool ParseDataCacheConfig(const char *spec, DataCacheConfig &config)
+{
+  string rest = spec;
+  while (!rest.empty()) {
+    size_t comma = rest.find(',');
+    string item = rest.substr(0, comma);
+    rest = comma == string::npos ? "" : rest.substr(comma + 1);
+
+    size_t equals = item.find('=');
+    if (equals == string::npos || equals + 1 == item.size())
+      return false;
+    string key = item.substr(0, equals);
+    string value = item.substr(equals + 1);
+    uint32_t number;
+    if (key == "write" && (value == "back" || value == "through"))
+      config.write_back = value == "back";
+    else if (key == "replace" && (value == "lru" || value == "plru"))
+      config.plru = value == "plru";
+    else if (key == "l1" && ParseCacheSize(value, number))
+      config.size[0] = number;
+    else if (key == "l2" && ParseCacheSize(value, number))
+      config.size[1] = number;
+    else if (key == "line" && ParseCacheSize(value, number))
+      config.line = number;
+    else if (key == "l1_assoc" && ParseCacheSize(value, number))
+      config.ways[0] = number;
+    else if (key == "l2_assoc" && ParseCacheSize(value, number))
+      config.ways[1] = number;
+    else
+      return false;
+  }
+
+  if (!IsPowerOfTwo(config.line) || config.line < 2 || config.line > MEMORY_PAGE_SIZE)
+    return false;
+  for (int level = 0; level < CACHE_MAX_LEVELS; level++) {
+    if (level > 0 && config.size[level] == 0)
+      continue;
+    if (!IsPowerOfTwo(config.size[level]) || !IsPowerOfTwo(config.ways[level]) ||
+        config.ways[level] > CACHE_MAX_WAYS ||
+        config.size[level] < (uint64_t)config.line * config.ways[level])
+      return false;
+  }
+  return true;
+}
+
+void DataCacheStart(const char *path, const DataCacheConfig &config)
+{
+  DataCache &cache = g_data_cache;
+  cache.config = config;
+  cache.line_shift = Log2(config.line);
+  cache.num_levels = config.size[1] == 0 ? 1 : 2;
+  for (int i = 0; i < cache.num_levels; i++) {
+    CacheLevel &level = cache.levels[i];
+    const uint32_t sets = config.size[i] / config.line / config.ways[i];
+    level.ways = config.ways[i];
+    level.set_bits = Log2(sets);
+    level.set_mask = sets - 1;
+    level.tags.assign((size_t)sets * level.ways, 0);
+    // LRU starts as ways 0, 1, ... from most to least recently used
+    uint64_t order = 0;
+    if (!config.plru)
+      for (int way = level.ways - 1; way >= 0; way--)
+        order = (order << 4) | way;
+    level.order.assign(sets, order);
+    level.accesses[0] = level.accesses[1] = 0;
+    level.misses[0] = level.misses[1] = 0;
+    level.writebacks = 0;
+  }
+  cache.last_line = CACHE_NO_LINE;
+  cache.last_writable = false;
+  cache.loads = 0;
+  cache.stores = 0;
+  cache.memory_reads = 0;
+  cache.memory_writes = 0;
+  cache.pcs.assign(g_machine->trace_ops.size(), CacheCounters());
+  cache.pages.assign(g_machine->memory.size >> MEMORY_PAGE_SHIFT, CacheCounters());
+  g_data_cache_path = path;
+  g_data_cache_enabled = true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Make way the most recently used of the set's replacement state
+////////////////////////////////////////////////////////////////////////
+static uint64_t TouchWay(const uint64_t order, const int way, const int ways, const bool plru)
+{
+  if (plru) {
+    // Point every node on the path away from way
+    uint64_t bits = order;
+    for (int node = way + ways; node > 1; node >>= 1) {
+      if (node & 1)
+        bits &= ~(1ull << (node >> 1));
+      else
+        bits |= 1ull << (node >> 1);
+    }
+    return bits;
+  }
+
+  int position = 0;
+  while (((order >> (4 * position)) & 0xF) != (uint64_t)way)
+    position++;
+  if (position == 0)
+    return order;
+  const uint64_t newer = order & ((1ull << (4 * position)) - 1);
+  const uint64_t older = 4 * position + 4 < 64 ? order & ~((1ull << (4 * position + 4)) - 1) : 0;
+  return older | (newer << 4) | way;
+}
+
+static int VictimWay(const uint32_t *tags, const uint64_t order, const int ways, const bool plru)
+{
+  for (int way = 0; way < ways; way++)
+    if (!(tags[way] & CACHE_VALID))
+      return way;
+  if (!plru)
+    return (order >> (4 * (ways - 1))) & 0xF;
+  int node = 1;
+  while (node < ways)
+    node = 2 * node + ((order >> node) & 1);
+  return node - ways;
+}
+
+static int AccessLevel(const int index, const uint32_t line, const bool write)
+{
+  DataCache &cache = g_data_cache;
+  if (index == cache.num_levels) {
+    if (write)
+      cache.memory_writes++;
+    else
+      cache.memory_reads++;
+    return index;
+  }
+
+  CacheLevel &level = cache.levels[index];
+  const bool plru = cache.config.plru;
+  const uint32_t set = line & level.set_mask;
+  const uint32_t tag = line >> level.set_bits;
+  uint32_t *tags = &level.tags[(size_t)set * level.ways];
+  uint64_t &order = level.order[set];
+  level.accesses[write]++;
+
+  for (int way = 0; way < level.ways; way++) {
+    if ((tags[way] & CACHE_VALID) && tags[way] >> CACHE_TAG_SHIFT == tag) {
+      order = TouchWay(order, way, level.ways, plru);
+      if (write && cache.config.write_back)
+        tags[way] |= CACHE_DIRTY;
+      else if (write)
+        AccessLevel(index + 1, line, true);
+      if (index == 0) {
+        cache.last_line = line;
+        cache.last_writable = (tags[way] & CACHE_DIRTY) != 0;
+      }
+      return index;
+    }
+  }
+
+  level.misses[write]++;
+  if (write && !cache.config.write_back)
+    return AccessLevel(index + 1, line, true);
+
+  const int way = VictimWay(tags, order, level.ways, plru);
+  if (tags[way] & CACHE_DIRTY) {
+    level.writebacks++;
+    AccessLevel(index + 1, (tags[way] >> CACHE_TAG_SHIFT) << level.set_bits | set, true);
+  }
+  const int source = AccessLevel(index + 1, line, false);
+  tags[way] = tag << CACHE_TAG_SHIFT | CACHE_VALID | (write ? CACHE_DIRTY : 0);
+  order = TouchWay(order, way, level.ways, plru);
+  if (index == 0) {
+    cache.last_line = line;
+    cache.last_writable = write;
+  }
+  return source;
+}
+
+int DataCacheLookup(const uint32_t line, const bool write)
+{
+  return AccessLevel(0, line, write);
+}
+
+static bool ByCountDescending(const pair<uint64_t, int> &a, const pair<uint64_t, int> &b)
+{
+  return a.first != b.first ? a.first > b.first : a.second < b.second;
+}
+
+static double Percent(const uint64_t count, const uint64_t total)
+{
+  return total == 0 ? 0.0 : 100.0 * count / total;
+}
+
+static string SizeName(const uint32_t size)
+{
+  if (size % 1024 == 0)
+    return to_string(size / 1024) + " KiB";
+  return to_string(size) + " bytes";
+}
+
+bool DataCacheWrite()
+{
+  if (!g_data_cache_enabled)
+    return true;
+  g_data_cache_enabled = false;
+
+  const DataCache &cache = g_data_cache;
+  const DataCacheConfig &config = cache.config;
+  ofstream out(g_data_cache_path.c_str());
+  if (!out) {
+    cerr << "Error: cannot write cache report " << g_data_cache_path << endl;
+    return false;
+  }
+  out.setf(ios::fixed);
+  out.precision(2);
+  out << "Caches:";
+  for (int i = 0; i < cache.num_levels; i++)
+    out << " L" << i + 1 << " " << SizeName(config.size[i]) << " " << config.ways[i] << "-way,";
+  out << " " << config.line << "-byte lines, write-" << (config.write_back ? "back" : "through")
+      << ", " << (config.plru ? "PLRU" : "LRU") << "\n\n";
+  out << "Loads:  " << cache.loads << "\n";
+  out << "Stores: " << cache.stores << "\n";
+
+  out << "\nLevels:\n" << setw(6) << "" << setw(14) << "reads" << setw(14) << "read misses"
+      << setw(8) << "%" << setw(14) << "writes" << setw(14) << "write misses" << setw(8) << "%"
+      << setw(14) << "writebacks" << "\n";
+  for (int i = 0; i < cache.num_levels; i++) {
+    const CacheLevel &level = cache.levels[i];
+    out << setw(5) << "L" << i + 1 << setw(14) << level.accesses[0] << setw(14) << level.misses[0]
+        << setw(8) << Percent(level.misses[0], level.accesses[0]) << setw(14) << level.accesses[1]
+        << setw(14) << level.misses[1] << setw(8) << Percent(level.misses[1], level.accesses[1])
+        << setw(14) << level.writebacks << "\n";
+  }
+  out << "Memory: " << cache.memory_reads << " line reads, " << cache.memory_writes << " writes\n";
+
+  out << "\nMemory pages (" << MEMORY_PAGE_SIZE << " bytes):\n" << setw(8) << "page" << setw(12)
+      << "address" << setw(14) << "accesses" << setw(14) << "L1 misses" << setw(8) << "%"
+      << setw(14) << "memory" << "\n";
+  for (size_t page = 0; page < cache.pages.size(); page++) {
+    const CacheCounters &counters = cache.pages[page];
+    if (counters.accesses == 0)
+      continue;
+    out << setw(8) << page << "  0x" << hex << setw(8) << setfill('0') << (page << MEMORY_PAGE_SHIFT)
+        << dec << setfill(' ') << setw(14) << counters.accesses << setw(14) << counters.l1_misses
+        << setw(8) << Percent(counters.l1_misses, counters.accesses) << setw(14) << counters.memory
+        << "\n";
+  }
+
+  vector<pair<uint64_t, int> > rows;
+  for (size_t pc = 0; pc < cache.pcs.size(); pc++)
+    if (cache.pcs[pc].accesses > 0)
+      rows.push_back(make_pair(cache.pcs[pc].l1_misses, (int)pc));
+  sort(rows.begin(), rows.end(), ByCountDescending);
+  out << "\nLoads and stores by L1 misses:\n" << setw(8) << "pc" << setw(14) << "accesses"
+      << setw(14) << "L1 misses" << setw(8) << "%" << setw(14) << "memory" << "  opcode\n";
+  for (size_t i = 0; i < rows.size() && i < CACHE_TOP_PCS; i++) {
+    const CacheCounters &counters = cache.pcs[rows[i].second];
+    out << setw(8) << rows[i].second << setw(14) << counters.accesses << setw(14)
+        << counters.l1_misses << setw(8) << Percent(counters.l1_misses, counters.accesses)
+        << setw(14) << counters.memory << "  "
+        << OpcodeName(g_machine->trace_ops[rows[i].second].opcode) << "\n";
+  }
+
+  out.close();
+  if (out.fail()) {
+    cerr << "Error: cannot write cache report " << g_data_cache_path << endl;
+    return false;
+  }
+  return true;
+}
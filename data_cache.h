@@ -0,0 +1,158 @@
+#ifndef __DATA_CACHE_H
+#define __DATA_CACHE_H
+
+#include <stdint.h>
+#include <vector>
+#include "simulator.h"
+
+////////////////////////////////////////////////////////////////////////
+// Data cache simulation (--cache FILE, interp only)
+//
+// Models one or two levels of set-associative cache in front of data
+// memory. ExecuteInstruction() calls DataCacheAccess() for every
+// in-range ldb, ldw, stb and stw. A 2-byte access that straddles a line
+// counts as one access but touches both lines. The model only tracks
+// tags; data always comes from g_machine->memory.
+//
+// Every level has a tags array of one uint32_t per way: the tag shifted
+// left by two, a valid bit and a dirty bit. Each set also has one
+// uint64_t of replacement state: for LRU the ways from most to least
+// recently used, 4 bits each; for PLRU the bits of a binary tree, set
+// for "the victim is on the right". An invalid way is always filled
+// first. Repeated accesses to the most recently used L1 line, which
+// change no replacement state, are counted inline without a lookup.
+//
+// Write-back caches allocate on a store miss and write dirty lines to
+// the next level on eviction. Write-through caches pass every store on
+// and do not allocate on a store miss.
+//
+// --cache-config K=V,... configures it (sizes take a K suffix):
+//   l1=SIZE (8K)     l1_assoc=N (2)    l2=SIZE (64K, 0: no L2)
+//   l2_assoc=N (8)   line=N (32)       write=back|through (back)
+//   replace=lru|plru (lru)
+// Sizes, line size and associativity (up to 16) are powers of two.
+// DataCacheWrite() reports hits and misses per level, and accesses and
+// misses per memory page and for the PCs with the most L1 misses.
+////////////////////////////////////////////////////////////////////////
+#define CACHE_MAX_LEVELS 2
+#define CACHE_MAX_WAYS 16          // LRU state holds 16 4-bit way numbers
+#define CACHE_TOP_PCS 50           // PCs listed in the report
+#define CACHE_VALID 0x1
+#define CACHE_DIRTY 0x2
+#define CACHE_TAG_SHIFT 2
+#define CACHE_NO_LINE 0xFFFFFFFFu
+
+typedef struct DataCacheConfig_ {
+  uint32_t size[CACHE_MAX_LEVELS];    // bytes, 0: level not present (L2 only)
+  int ways[CACHE_MAX_LEVELS];
+  int line;                           // bytes, shared by all levels
+  bool write_back;
+  bool plru;
+} DataCacheConfig;
+
+typedef struct CacheLevel_ {
+  int ways;
+  int set_bits;
+  uint32_t set_mask;
+  std::vector<uint32_t> tags;         // ways entries per set
+  std::vector<uint64_t> order;        // replacement state per set
+  uint64_t accesses[2];               // reads, writes
+  uint64_t misses[2];
+  uint64_t writebacks;                // dirty lines written to the next level
+} CacheLevel;
+
+typedef struct CacheCounters_ {
+  uint64_t accesses;
+  uint64_t l1_misses;
+  uint64_t memory;                    // missed every level
+} CacheCounters;
+
+typedef struct DataCache_ {
+  DataCacheConfig config;
+  int line_shift;
+  int num_levels;
+  CacheLevel levels[CACHE_MAX_LEVELS];
+  uint32_t last_line;                 // most recently used L1 line, CACHE_NO_LINE if none
+  bool last_writable;                 // and a store to it changes nothing (dirty, write-back)
+  uint64_t loads;
+  uint64_t stores;
+  uint64_t memory_reads;              // lines
+  uint64_t memory_writes;             // lines written back, or stores written through
+  std::vector<CacheCounters> pcs;     // per instruction index
+  std::vector<CacheCounters> pages;   // per data memory page
+} DataCache;
+
+extern bool g_data_cache_enabled;
+extern DataCache g_data_cache;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Parse a --cache-config specification on top of the defaults
+// output: false if a key or value is invalid or the levels are
+//         inconsistent
+////////////////////////////////////////////////////////////////////////
+bool ParseDataCacheConfig(const char *spec, DataCacheConfig &config);
+void DefaultDataCacheConfig(DataCacheConfig &config);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Size the tag arrays and counters for g_machine and start
+//       simulating with every line invalid
+// input: path of the report
+////////////////////////////////////////////////////////////////////////
+void DataCacheStart(const char *path, const DataCacheConfig &config);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Access one line in the hierarchy
+// output: index of the level that had the line, num_levels for memory
+////////////////////////////////////////////////////////////////////////
+int DataCacheLookup(const uint32_t line, const bool write);
+
+static inline int DataCacheAccessLine(const uint32_t line, const bool write)
+{
+  if (line == g_data_cache.last_line && (!write || g_data_cache.last_writable)) {
+    g_data_cache.levels[0].accesses[write]++;
+    return 0;
+  }
+  return DataCacheLookup(line, write);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Simulate the width-byte load or store at address by the
+//       instruction at pc
+////////////////////////////////////////////////////////////////////////
+static inline void DataCacheAccess(const int pc, const unsigned int address, const int width,
+                                   const bool write)
+{
+  const uint32_t first = address >> g_data_cache.line_shift;
+  const uint32_t last = (address + width - 1) >> g_data_cache.line_shift;
+  int level = DataCacheAccessLine(first, write);
+  if (last != first) {
+    const int second = DataCacheAccessLine(last, write);
+    if (second > level)
+      level = second;
+  }
+  if (write)
+    g_data_cache.stores++;
+  else
+    g_data_cache.loads++;
+
+  CacheCounters &by_pc = g_data_cache.pcs[pc];
+  CacheCounters &by_page = g_data_cache.pages[address >> MEMORY_PAGE_SHIFT];
+  by_pc.accesses++;
+  by_page.accesses++;
+  if (level > 0) {
+    by_pc.l1_misses++;
+    by_page.l1_misses++;
+  }
+  if (level == g_data_cache.num_levels) {
+    by_pc.memory++;
+    by_page.memory++;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Write the cache report
+// output: false if the file cannot be written
+////////////////////////////////////////////////////////////////////////
+bool DataCacheWrite();
+
+#endif // __DATA_CACHE_H
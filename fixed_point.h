@@ -0,0 +1,97 @@
+#ifndef __FIXED_POINT_H
+#define __FIXED_POINT_H
+
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// 1.11.4 fixed point: a sign bit, 11 integer bits and 4 fraction bits,
+// -2048.0 to 2047.9375 in steps of 1/16. A register holds a value as
+// its 16-bit pattern, zero-extended; that is what movi.f, vmovi and ldw
+// load and what the dump prints. add.f, addi.f and vadd saturate at the
+// ends of the range instead of wrapping around.
+//
+// A vector register is four such 32-bit lanes, 16-byte aligned. Because
+// the upper half of every lane is zero, vadd is a single SSE2 paddsw
+// over the whole register: the low halves add with signed saturation
+// and the upper halves stay 0 + 0. Every instruction that writes a lane
+// must therefore store Fixed1114Bits() of its value.
+////////////////////////////////////////////////////////////////////////
+#define FIXED1114_FRACTION_BITS 4
+#define FIXED1114_MAX 0x7FFF       // 2047.9375
+#define FIXED1114_MIN (-0x8000)    // -2048.0
+
+#define FLOAT_TO_FIXED1114(n) ((int)((n) * (float)(1<<(4)))) & 0xffff
+#define FIXED_TO_FLOAT1114(n) ((float)(-1*((n>>15)&0x1)*(1<<11)) + (float)((n&(0x7fff)) / (float)(1<<4)))
+
+////////////////////////////////////////////////////////////////////////
+// desc: Register form of a fixed-point value; only its low 16 bits count
+////////////////////////////////////////////////////////////////////////
+static inline int Fixed1114Bits(const int value)
+{
+  return value & 0xFFFF;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Register form of value in 1/16 units, clamped to the range
+////////////////////////////////////////////////////////////////////////
+static inline int Fixed1114Saturate(const int value)
+{
+  if (value > FIXED1114_MAX)
+    return FIXED1114_MAX;
+  if (value < FIXED1114_MIN)
+    return FIXED1114_MIN & 0xFFFF;
+  return value & 0xFFFF;
+}
+
+static inline int Fixed1114Add(const int a, const int b)
+{
+  return Fixed1114Saturate((int16_t)a + (int16_t)b);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Integer part, rounded toward negative infinity
+////////////////////////////////////////////////////////////////////////
+static inline int Fixed1114ToInt(const int value)
+{
+  return (int16_t)value >> FIXED1114_FRACTION_BITS;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Lane-wise operations on the 4 elements of a VectorRegister;
+//       dst, a and b point at element 0
+////////////////////////////////////////////////////////////////////////
+static inline void Fixed1114AddLanes(int *dst, const int *a, const int *b)
+{
+#if defined(__SSE2__)
+  _mm_store_si128((__m128i *)dst, _mm_adds_epi16(_mm_load_si128((const __m128i *)a),
+                                                 _mm_load_si128((const __m128i *)b)));
+#else
+  for (int i = 0; i < 4; i++)
+    dst[i] = Fixed1114Add(a[i], b[i]);
+#endif
+}
+
+static inline void CopyLanes(int *dst, const int *src)
+{
+#if defined(__SSE2__)
+  _mm_store_si128((__m128i *)dst, _mm_load_si128((const __m128i *)src));
+#else
+  for (int i = 0; i < 4; i++)
+    dst[i] = src[i];
+#endif
+}
+
+static inline void FillLanes(int *dst, const int value)
+{
+#if defined(__SSE2__)
+  _mm_store_si128((__m128i *)dst, _mm_set1_epi32(value));
+#else
+  for (int i = 0; i < 4; i++)
+    dst[i] = value;
+#endif
+}
+
+#endif // __FIXED_POINT_H
@@ -0,0 +1,518 @@
+#include <iostream>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "simulator.h"
+#include "jit_x86.h"
+
+using namespace std;
+
+#if defined(__x86_64__)
+
+#define JIT_CHUNK_SIZE (1024*1024)
+
+////////////////////////////////////////////////////////////////////////
+// Register usage of generated code (System V ABI, all caller-saved)
+//   rdi: int *cc (argument)
+//   r8:  &g_machine->scalar_registers[0]
+//   r9:  &g_machine->vector_registers[0]
+//   r10: g_machine->memory.bytes
+//   r11: g_machine->memory.page_written
+//   eax, ecx, edx: scratch; eax is also the return value
+//   xmm0: scratch for vector registers
+////////////////////////////////////////////////////////////////////////
+enum X86Register {
+  EAX = 0,
+  ECX = 1,
+  EDX = 2,
+  R8 = 8,
+  R9 = 9,
+  R10 = 10,
+  R11 = 11,
+};
+
+typedef struct JitChunk_ {
+  unsigned char *base;
+  size_t size;
+  size_t used;
+} JitChunk;
+
+static thread_local vector<JitChunk> g_jit_chunks;  // per engine thread
+
+static inline void Emit8(vector<unsigned char> &code, const unsigned int value)
+{
+  code.push_back(value & 0xFF);
+}
+
+static inline void Emit32(vector<unsigned char> &code, const uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+    code.push_back((value >> (i * 8)) & 0xFF);
+}
+
+static inline void Emit64(vector<unsigned char> &code, const uint64_t value)
+{
+  for (int i = 0; i < 8; i++)
+    code.push_back((value >> (i * 8)) & 0xFF);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Map a register-file pointer to a base register and displacement
+// output: false if the pointer is outside the register files
+////////////////////////////////////////////////////////////////////////
+static bool ResolveOperand(const int *p, int &base, int32_t &disp)
+{
+  const char *scalar = (const char *)g_machine->scalar_registers;
+  const char *vectors = (const char *)g_machine->vector_registers;
+  const char *addr = (const char *)p;
+
+  if (addr >= scalar && addr < scalar + sizeof(g_machine->scalar_registers)) {
+    base = R8;
+    disp = addr - scalar;
+    return true;
+  }
+  if (addr >= vectors && addr < vectors + sizeof(g_machine->vector_registers)) {
+    base = R9;
+    disp = addr - vectors;
+    return true;
+  }
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: <opcode> reg32, [base + disp32] (or the reverse direction,
+//       depending on the opcode)
+////////////////////////////////////////////////////////////////////////
+static bool EmitMemOp(vector<unsigned char> &code, const unsigned int opcode, const int reg,
+                      const int *p)
+{
+  int base;
+  int32_t disp;
+  if (!ResolveOperand(p, base, disp))
+    return false;
+
+  Emit8(code, 0x41);                                  // REX.B
+  Emit8(code, opcode);
+  Emit8(code, 0x80 | ((reg & 7) << 3) | (base & 7));  // mod=10: [base + disp32]
+  Emit32(code, disp);
+  return true;
+}
+
+static bool EmitLoad(vector<unsigned char> &code, const int reg, const int *p)
+{
+  return EmitMemOp(code, 0x8B, reg, p);    // mov reg, [p]
+}
+
+static bool EmitStore(vector<unsigned char> &code, const int *p, const int reg)
+{
+  return EmitMemOp(code, 0x89, reg, p);    // mov [p], reg
+}
+
+static bool EmitStoreImm(vector<unsigned char> &code, const int *p, const int imm)
+{
+  if (!EmitMemOp(code, 0xC7, 0, p))        // mov dword [p], imm32
+    return false;
+  Emit32(code, imm);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: movsx reg, word [p], the signed 1.11.4 value held at p
+////////////////////////////////////////////////////////////////////////
+static bool EmitLoadFixed(vector<unsigned char> &code, const int reg, const int *p)
+{
+  int base;
+  int32_t disp;
+  if (!ResolveOperand(p, base, disp))
+    return false;
+
+  Emit8(code, 0x41);                                  // REX.B
+  Emit8(code, 0x0F);
+  Emit8(code, 0xBF);
+  Emit8(code, 0x80 | ((reg & 7) << 3) | (base & 7));  // mod=10: [base + disp32]
+  Emit32(code, disp);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: <66 0F opcode> xmm, [p]: an SSE2 operation on the 16-byte
+//       aligned vector register at p (or the reverse direction)
+////////////////////////////////////////////////////////////////////////
+static bool EmitVectorOp(vector<unsigned char> &code, const unsigned int opcode, const int xmm,
+                         const int *p)
+{
+  int base;
+  int32_t disp;
+  if (!ResolveOperand(p, base, disp))
+    return false;
+
+  Emit8(code, 0x66);
+  Emit8(code, 0x41);                                  // REX.B
+  Emit8(code, 0x0F);
+  Emit8(code, opcode);
+  Emit8(code, 0x80 | ((xmm & 7) << 3) | (base & 7));  // mod=10: [base + disp32]
+  Emit32(code, disp);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: eax = Fixed1114Saturate(eax)
+////////////////////////////////////////////////////////////////////////
+static void EmitSaturateFixed(vector<unsigned char> &code)
+{
+  static const unsigned char seq[] = {
+    0xBA, 0xFF, 0x7F, 0x00, 0x00,          // mov edx, FIXED1114_MAX
+    0x39, 0xD0,                            // cmp eax, edx
+    0x0F, 0x4F, 0xC2,                      // cmovg eax, edx
+    0xBA, 0x00, 0x80, 0xFF, 0xFF,          // mov edx, FIXED1114_MIN
+    0x39, 0xD0,                            // cmp eax, edx
+    0x0F, 0x4C, 0xC2,                      // cmovl eax, edx
+    0x0F, 0xB7, 0xC0,                      // movzx eax, ax
+  };
+  code.insert(code.end(), seq, seq + sizeof(seq));
+}
+
+static void EmitMovabs(vector<unsigned char> &code, const int reg, const void *p)
+{
+  Emit8(code, 0x49);                       // REX.W + REX.B
+  Emit8(code, 0xB8 + (reg & 7));
+  Emit64(code, (uint64_t)(uintptr_t)p);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: *cc = ConditionCode(eax)
+////////////////////////////////////////////////////////////////////////
+static void EmitConditionCodeFromResult(vector<unsigned char> &code)
+{
+  static const unsigned char seq[] = {
+    0x0F, 0xBF, 0xC0,                      // movsx eax, ax
+    0xB9, 0x01, 0x00, 0x00, 0x00,          // mov ecx, 1
+    0xBA, 0x02, 0x00, 0x00, 0x00,          // mov edx, 2
+    0x85, 0xC0,                            // test eax, eax
+    0x0F, 0x44, 0xCA,                      // cmovz ecx, edx
+    0xBA, 0x04, 0x00, 0x00, 0x00,          // mov edx, 4
+    0x0F, 0x48, 0xCA,                      // cmovs ecx, edx
+    0x89, 0x0F,                            // mov [rdi], ecx
+  };
+  code.insert(code.end(), seq, seq + sizeof(seq));
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: *cc from the flags of a preceding 32-bit signed cmp
+////////////////////////////////////////////////////////////////////////
+static void EmitConditionCodeFromCompare(vector<unsigned char> &code)
+{
+  static const unsigned char seq[] = {
+    0xB9, 0x01, 0x00, 0x00, 0x00,          // mov ecx, 1
+    0xBA, 0x02, 0x00, 0x00, 0x00,          // mov edx, 2
+    0x0F, 0x44, 0xCA,                      // cmove ecx, edx
+    0xBA, 0x04, 0x00, 0x00, 0x00,          // mov edx, 4
+    0x0F, 0x4C, 0xCA,                      // cmovl ecx, edx
+    0x89, 0x0F,                            // mov [rdi], ecx
+  };
+  code.insert(code.end(), seq, seq + sizeof(seq));
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: rax = sign-extended (*base + imm), the memory index
+////////////////////////////////////////////////////////////////////////
+static bool EmitAddress(vector<unsigned char> &code, const int *base, const int imm)
+{
+  if (!EmitLoad(code, EAX, base))
+    return false;
+  Emit8(code, 0x05);                       // add eax, imm32
+  Emit32(code, imm);
+  Emit8(code, 0x48);                       // movsxd rax, eax
+  Emit8(code, 0x63);
+  Emit8(code, 0xC0);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Return index from the block unless rax .. rax + width - 1 lies
+//       in data memory
+////////////////////////////////////////////////////////////////////////
+static void EmitBoundsCheck(vector<unsigned char> &code, const int width, const int index)
+{
+  Emit8(code, 0x48);                       // cmp rax, imm32
+  Emit8(code, 0x3D);
+  Emit32(code, g_machine->memory.size - width);
+  Emit8(code, 0x76);                       // jbe +6
+  Emit8(code, 0x06);
+  Emit8(code, 0xB8);                       // mov eax, index
+  Emit32(code, index);
+  Emit8(code, 0xC3);                       // ret
+}
+
+static bool EmitOp(vector<unsigned char> &code, const BlockOp &op, const int index)
+{
+  switch (op.kind) {
+    case K_ADD:
+    case K_ADD_NOCC:
+    case K_AND:
+    case K_AND_NOCC:
+      {
+        bool is_add = op.kind == K_ADD || op.kind == K_ADD_NOCC;
+        if (!EmitLoad(code, EAX, op.src1) ||
+            !EmitMemOp(code, is_add ? 0x03 : 0x23, EAX, op.src2) ||   // add/and eax, [src2]
+            !EmitStore(code, op.dst, EAX))
+          return false;
+        if (op.kind == K_ADD || op.kind == K_AND)
+          EmitConditionCodeFromResult(code);
+      }
+      return true;
+
+    case K_ADDI:
+    case K_ADDI_NOCC:
+    case K_ANDI:
+    case K_ANDI_NOCC:
+      {
+        bool is_add = op.kind == K_ADDI || op.kind == K_ADDI_NOCC;
+        if (!EmitLoad(code, EAX, op.src1))
+          return false;
+        Emit8(code, is_add ? 0x05 : 0x25);                            // add/and eax, imm32
+        Emit32(code, op.imm);
+        if (!EmitStore(code, op.dst, EAX))
+          return false;
+        if (op.kind == K_ADDI || op.kind == K_ANDI)
+          EmitConditionCodeFromResult(code);
+      }
+      return true;
+
+    case K_ADD_F:
+    case K_ADD_F_NOCC:
+    case K_ADDI_F:
+    case K_ADDI_F_NOCC:
+      if (!EmitLoadFixed(code, EAX, op.src1))
+        return false;
+      if (op.kind == K_ADD_F || op.kind == K_ADD_F_NOCC) {
+        if (!EmitLoadFixed(code, ECX, op.src2))
+          return false;
+        Emit8(code, 0x01);                 // add eax, ecx
+        Emit8(code, 0xC8);
+      }
+      else {
+        Emit8(code, 0x05);                 // add eax, imm32
+        Emit32(code, (int16_t)op.imm);
+      }
+      EmitSaturateFixed(code);
+      if (!EmitStore(code, op.dst, EAX))
+        return false;
+      if (op.kind == K_ADD_F || op.kind == K_ADDI_F)
+        EmitConditionCodeFromResult(code);
+      return true;
+
+    case K_MOV:
+    case K_MOV_NOCC:
+      if (!EmitLoad(code, EAX, op.src1) || !EmitStore(code, op.dst, EAX))
+        return false;
+      if (op.kind == K_MOV)
+        EmitConditionCodeFromResult(code);
+      return true;
+
+    case K_MOVI:
+    case K_MOVI_NOCC:
+      if (!EmitStoreImm(code, op.dst, op.imm))
+        return false;
+      if (op.kind == K_MOVI) {
+        Emit8(code, 0xC7);                 // mov dword [rdi], imm32
+        Emit8(code, 0x07);
+        Emit32(code, ConditionCode(op.imm));
+      }
+      return true;
+
+    case K_CMP:
+      if (!EmitLoad(code, EAX, op.src1) || !EmitMemOp(code, 0x3B, EAX, op.src2))  // cmp eax, [src2]
+        return false;
+      EmitConditionCodeFromCompare(code);
+      return true;
+
+    case K_CMPI:
+      if (!EmitLoad(code, EAX, op.src1))
+        return false;
+      Emit8(code, 0x3D);                   // cmp eax, imm32
+      Emit32(code, op.imm);
+      EmitConditionCodeFromCompare(code);
+      return true;
+
+    case K_LDB:
+    case K_LDB_NOCC:
+    case K_LDW:
+    case K_LDW_NOCC:
+      {
+        static const unsigned char load_byte[] = {
+          0x41, 0x0F, 0xB6, 0x0C, 0x02,    // movzx ecx, byte [r10 + rax]
+        };
+        static const unsigned char load_high_byte[] = {
+          0x41, 0x0F, 0xB6, 0x54, 0x02, 0x01,  // movzx edx, byte [r10 + rax + 1]
+          0xC1, 0xE2, 0x08,                // shl edx, 8
+          0x09, 0xD1,                      // or ecx, edx
+        };
+        if (!EmitAddress(code, op.src1, op.imm))
+          return false;
+        EmitBoundsCheck(code, op.kind == K_LDW || op.kind == K_LDW_NOCC ? 2 : 1, index);
+        code.insert(code.end(), load_byte, load_byte + sizeof(load_byte));
+        if (op.kind == K_LDW || op.kind == K_LDW_NOCC)
+          code.insert(code.end(), load_high_byte, load_high_byte + sizeof(load_high_byte));
+        if (!EmitStore(code, op.dst, ECX))
+          return false;
+        if (op.kind == K_LDB || op.kind == K_LDW) {
+          Emit8(code, 0x89);               // mov eax, ecx
+          Emit8(code, 0xC8);
+          EmitConditionCodeFromResult(code);
+        }
+      }
+      return true;
+
+    case K_STB:
+    case K_STW:
+      {
+        static const unsigned char store_byte[] = {
+          0x41, 0x88, 0x0C, 0x02,          // mov [r10 + rax], cl
+        };
+        static const unsigned char store_high_byte[] = {
+          0xC1, 0xF9, 0x08,                // sar ecx, 8
+          0x41, 0x88, 0x4C, 0x02, 0x01,    // mov [r10 + rax + 1], cl
+        };
+        static const unsigned char mark_page[] = {
+          0x48, 0xC1, 0xEA, MEMORY_PAGE_SHIFT,  // shr rdx, MEMORY_PAGE_SHIFT
+          0x41, 0xC6, 0x04, 0x13, PAGE_DIRTY,  // mov byte [r11 + rdx], PAGE_DIRTY
+        };
+        static const unsigned char address_low[] = {
+          0x48, 0x89, 0xC2,                // mov rdx, rax
+        };
+        static const unsigned char address_high[] = {
+          0x48, 0x8D, 0x50, 0x01,          // lea rdx, [rax + 1]
+        };
+        if (!EmitAddress(code, op.src1, op.imm))
+          return false;
+        EmitBoundsCheck(code, op.kind == K_STW ? 2 : 1, index);
+        code.insert(code.end(), address_low, address_low + sizeof(address_low));
+        code.insert(code.end(), mark_page, mark_page + sizeof(mark_page));
+        if (op.kind == K_STW) {
+          code.insert(code.end(), address_high, address_high + sizeof(address_high));
+          code.insert(code.end(), mark_page, mark_page + sizeof(mark_page));
+        }
+        if (!EmitLoad(code, ECX, op.src2))
+          return false;
+        code.insert(code.end(), store_byte, store_byte + sizeof(store_byte));
+        if (op.kind == K_STW)
+          code.insert(code.end(), store_high_byte, store_high_byte + sizeof(store_high_byte));
+      }
+      return true;
+
+    case K_VADD:
+      return EmitVectorOp(code, 0x6F, 0, op.src1) &&    // movdqa xmm0, [src1]
+             EmitVectorOp(code, 0xED, 0, op.src2) &&    // paddsw xmm0, [src2]
+             EmitVectorOp(code, 0x7F, 0, op.dst);       // movdqa [dst], xmm0
+
+    case K_VMOV:
+      return EmitVectorOp(code, 0x6F, 0, op.src1) && EmitVectorOp(code, 0x7F, 0, op.dst);
+
+    case K_VMOVI:
+      for (int i = 0; i < NUM_VECTOR_ELEMENTS; i++) {
+        if (!EmitStoreImm(code, op.dst + i, op.imm))
+          return false;
+      }
+      return true;
+
+    case K_VCOMPMOV:
+      if (!EmitLoad(code, EAX, op.src1))
+        return false;
+      Emit8(code, 0x0F);                   // movzx eax, ax
+      Emit8(code, 0xB7);
+      Emit8(code, 0xC0);
+      return EmitStore(code, op.dst, EAX);
+
+    case K_VCOMPMOVI:
+      return EmitStoreImm(code, op.dst, op.imm);
+
+    case K_VSET4:
+      for (int i = 0; i < NUM_VECTOR_ELEMENTS; i++) {
+        if (op.lane[i] == &op.lane_imm[i]) {
+          if (!EmitStoreImm(code, op.dst + i, op.lane_imm[i]))
+            return false;
+        }
+        else {
+          if (!EmitLoad(code, EAX, op.lane[i]))
+            return false;
+          Emit8(code, 0x0F);               // movzx eax, ax
+          Emit8(code, 0xB7);
+          Emit8(code, 0xC0);
+          if (!EmitStore(code, op.dst + i, EAX))
+            return false;
+        }
+      }
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Copy generated code into an executable chunk
+////////////////////////////////////////////////////////////////////////
+static void *InstallCode(const vector<unsigned char> &code)
+{
+  if (g_jit_chunks.empty() || g_jit_chunks.back().size - g_jit_chunks.back().used < code.size()) {
+    size_t size = code.size() > JIT_CHUNK_SIZE ? code.size() : JIT_CHUNK_SIZE;
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+      return NULL;
+    JitChunk chunk = { (unsigned char *)base, size, 0 };
+    g_jit_chunks.push_back(chunk);
+  }
+
+  JitChunk &chunk = g_jit_chunks.back();
+  if (mprotect(chunk.base, chunk.size, PROT_READ | PROT_WRITE) != 0)
+    return NULL;
+  unsigned char *entry = chunk.base + chunk.used;
+  memcpy(entry, &code[0], code.size());
+  chunk.used += (code.size() + 15) & ~(size_t)15;
+  if (chunk.used > chunk.size)
+    chunk.used = chunk.size;
+  if (mprotect(chunk.base, chunk.size, PROT_READ | PROT_EXEC) != 0)
+    return NULL;
+  return entry;
+}
+
+JitBlockFn JitCompileBlock(const BlockOp *ops, const int num_ops)
+{
+  vector<unsigned char> code;
+  code.reserve(64 + num_ops * 48);
+
+  EmitMovabs(code, R8, g_machine->scalar_registers);
+  EmitMovabs(code, R9, g_machine->vector_registers);
+  EmitMovabs(code, R10, g_machine->memory.bytes);
+  EmitMovabs(code, R11, g_machine->memory.page_written);
+  for (int i = 0; i < num_ops; i++)
+    if (!EmitOp(code, ops[i], i))
+      return NULL;
+  Emit8(code, 0xB8);                       // mov eax, -1
+  Emit32(code, -1);
+  Emit8(code, 0xC3);                       // ret
+
+  return (JitBlockFn)InstallCode(code);
+}
+
+void JitReleaseCode()
+{
+  for (size_t i = 0; i < g_jit_chunks.size(); i++)
+    munmap(g_jit_chunks[i].base, g_jit_chunks[i].size);
+  g_jit_chunks.clear();
+}
+
+#else // !__x86_64__
+
+JitBlockFn JitCompileBlock(const BlockOp *ops, const int num_ops)
+{
+  return NULL;
+}
+
+void JitReleaseCode()
+{
+}
+
+#endif // __x86_64__
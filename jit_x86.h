@@ -0,0 +1,29 @@
+#ifndef __JIT_X86_H
+#define __JIT_X86_H
+
+#include "block_cache.h"
+
+#define JIT_HOT_THRESHOLD 32
+
+////////////////////////////////////////////////////////////////////////
+// Native block body. The register files and memory of the machine it
+// was compiled for stay the architectural state; the condition code is
+// read and written through cc. Returns -1, or the index of the op whose
+// memory access is out of range, which is not executed.
+////////////////////////////////////////////////////////////////////////
+typedef int (*JitBlockFn)(int *cc);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Compile a straight-line block body to x86-64 code placed in an
+//       executable mapping
+// input: translated body ops of one block
+// output: entry point, or NULL if the host is not x86-64 or mapping failed
+////////////////////////////////////////////////////////////////////////
+JitBlockFn JitCompileBlock(const BlockOp *ops, const int num_ops);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Unmap all compiled code
+////////////////////////////////////////////////////////////////////////
+void JitReleaseCode();
+
+#endif // __JIT_X86_H
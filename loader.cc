@@ -0,0 +1,135 @@
+#include <iostream>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "program_image.h"
+#include "loader.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Decode a binary program image that is already mapped in memory
+////////////////////////////////////////////////////////////////////////
+static bool LoadBinaryImage(const char *path, const unsigned char *image, const size_t size,
+                            vector<uint32_t> &instructions,
+                            DataMemory &memory)
+{
+  if (size < PROGRAM_IMAGE_HEADER_SIZE) {
+    cerr << "Error: Truncated program image " << path << endl;
+    return false;
+  }
+
+  ProgramImageHeader header;
+  DecodeProgramImageHeader(image, header);
+
+  if (header.version != PROGRAM_IMAGE_VERSION) {
+    cerr << "Error: Unsupported program image version " << header.version
+         << " in " << path << endl;
+    return false;
+  }
+
+  if (header.code_offset > size || header.code_count > (size - header.code_offset) / 4) {
+    cerr << "Error: Code section exceeds file size in " << path << endl;
+    return false;
+  }
+
+  if (header.data_size != 0) {
+    if (header.data_offset > size || header.data_size > size - header.data_offset) {
+      cerr << "Error: Data section exceeds file size in " << path << endl;
+      return false;
+    }
+    if (!WriteDataMemory(memory, header.data_address, image + header.data_offset, header.data_size)) {
+      cerr << "Error: Data section does not fit in data memory in " << path << endl;
+      return false;
+    }
+  }
+
+  const unsigned char *code = image + header.code_offset;
+  instructions.resize(header.code_count);
+  for (uint32_t i = 0; i < header.code_count; i++)
+    instructions[i] = ReadLE32(code + i * 4);
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Parse the legacy text format: 32 ASCII '0'/'1' characters per
+//       instruction, whitespace ignored
+////////////////////////////////////////////////////////////////////////
+static bool LoadTextImage(const char *path, const unsigned char *image, const size_t size,
+                          vector<uint32_t> &instructions)
+{
+  instructions.reserve(size / 32);
+
+  uint32_t word = 0;
+  int num_bits = 0;
+  for (size_t i = 0; i < size; i++) {
+    unsigned char c = image[i];
+    if (c == '0' || c == '1') {
+      word = (word << 1) | (c - '0');
+      if (++num_bits == 32) {
+        instructions.push_back(word);
+        word = 0;
+        num_bits = 0;
+      }
+    }
+    else if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+      cerr << "Error: Invalid character at offset " << i << " in " << path << endl;
+      return false;
+    }
+  }
+
+  if (num_bits != 0) {
+    cerr << "Error: Trailing partial instruction in " << path << endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool LoadProgram(const char *path, vector<uint32_t> &instructions,
+                 DataMemory &memory)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    cerr << "Error: Failed to open input file " << path << endl;
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    cerr << "Error: Failed to stat input file " << path << endl;
+    close(fd);
+    return false;
+  }
+
+  size_t size = st.st_size;
+  instructions.clear();
+  if (size == 0) {
+    close(fd);
+    return true;
+  }
+
+  void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    cerr << "Error: Failed to map input file " << path << endl;
+    return false;
+  }
+  madvise(mapped, size, MADV_SEQUENTIAL);
+
+  const unsigned char *image = (const unsigned char *)mapped;
+  bool ok;
+  if (size >= PROGRAM_IMAGE_MAGIC_SIZE &&
+      memcmp(image, PROGRAM_IMAGE_MAGIC, PROGRAM_IMAGE_MAGIC_SIZE) == 0)
+    ok = LoadBinaryImage(path, image, size, instructions, memory);
+  else
+    ok = LoadTextImage(path, image, size, instructions);
+
+  munmap(mapped, size);
+  return ok;
+}
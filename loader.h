@@ -0,0 +1,18 @@
+#ifndef __LOADER_H
+#define __LOADER_H
+
+#include <stdint.h>
+#include <vector>
+#include "memory.h"
+
+////////////////////////////////////////////////////////////////////////
+// desc: Load a program from disk. Binary images (see program_image.h) are
+//       memory-mapped and their data section is copied into memory;
+//       anything else is parsed as the ASCII '0'/'1' text format.
+// input: path, data memory to fill
+// output: instruction words in program order; false on error
+////////////////////////////////////////////////////////////////////////
+bool LoadProgram(const char *path, std::vector<uint32_t> &instructions,
+                 DataMemory &memory);
+
+#endif // __LOADER_H
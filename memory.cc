@@ -0,0 +1,165 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "memory.h"
+
+using namespace std;
+
+static bool ValidMemorySize(const uint64_t size)
+{
+  return size >= MEMORY_PAGE_SIZE && size <= MAX_MEMORY_SIZE && size % MEMORY_PAGE_SIZE == 0;
+}
+
+bool MapDataMemory(DataMemory &memory, const uint32_t size)
+{
+  memory.bytes = NULL;
+  memory.size = 0;
+  memory.page_written = NULL;
+  memory.base = NULL;
+  if (!ValidMemorySize(size)) {
+    cerr << "Error: memory size must be a multiple of " << MEMORY_PAGE_SIZE
+         << " bytes up to " << MAX_MEMORY_SIZE << endl;
+    return false;
+  }
+
+  void *bytes = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (bytes == MAP_FAILED) {
+    cerr << "Error: cannot map " << size << " bytes of data memory" << endl;
+    return false;
+  }
+  memory.bytes = (unsigned char *)bytes;
+  memory.size = size;
+  memory.page_written = new unsigned char[size >> MEMORY_PAGE_SHIFT]();
+  return true;
+}
+
+void UnmapDataMemory(DataMemory &memory)
+{
+  if (memory.bytes != NULL)
+    munmap(memory.bytes, memory.size);
+  delete [] memory.page_written;
+  memory.bytes = NULL;
+  memory.size = 0;
+  memory.page_written = NULL;
+  memory.base = NULL;
+}
+
+uint32_t NextWrittenPage(const DataMemory &memory, uint32_t page)
+{
+  const uint32_t num_pages = memory.size >> MEMORY_PAGE_SHIFT;
+  const unsigned char *flags = memory.page_written;
+  while (page < num_pages && (page & 7) != 0 && flags[page] == PAGE_ZERO)
+    page++;
+  // Skip eight clean pages per load; a sweep writes only a few pages of a
+  // large memory
+  for (; page + 8 <= num_pages; page += 8) {
+    uint64_t word;
+    memcpy(&word, flags + page, 8);
+    if (word != 0)
+      break;
+  }
+  while (page < num_pages && flags[page] == PAGE_ZERO)
+    page++;
+  return page;
+}
+
+void ClearDataMemory(DataMemory &memory)
+{
+  const uint32_t num_pages = memory.size >> MEMORY_PAGE_SHIFT;
+  for (uint32_t page = NextWrittenPage(memory, 0); page < num_pages;
+       page = NextWrittenPage(memory, page + 1)) {
+    memset(memory.bytes + ((size_t)page << MEMORY_PAGE_SHIFT), 0x00, MEMORY_PAGE_SIZE);
+    memory.page_written[page] = PAGE_ZERO;
+  }
+  memory.base = NULL;
+}
+
+bool WriteDataMemory(DataMemory &memory, const uint32_t address, const void *data,
+                     const uint32_t size)
+{
+  if (address > memory.size || size > memory.size - address)
+    return false;
+  if (size == 0)
+    return true;
+  memcpy(memory.bytes + address, data, size);
+  for (uint32_t page = address >> MEMORY_PAGE_SHIFT; page <= (address + size - 1) >> MEMORY_PAGE_SHIFT; page++)
+    memory.page_written[page] = PAGE_DIRTY;
+  return true;
+}
+
+void SaveDataMemory(const DataMemory &memory, MemoryImage &image)
+{
+  const uint32_t num_pages = memory.size >> MEMORY_PAGE_SHIFT;
+  image.pages.clear();
+  image.contents.clear();
+  for (uint32_t page = NextWrittenPage(memory, 0); page < num_pages;
+       page = NextWrittenPage(memory, page + 1)) {
+    const unsigned char *p = memory.bytes + ((size_t)page << MEMORY_PAGE_SHIFT);
+    image.pages.push_back(page);
+    image.contents.insert(image.contents.end(), p, p + MEMORY_PAGE_SIZE);
+  }
+}
+
+void RestoreDataMemory(DataMemory &memory, const MemoryImage &image)
+{
+  ClearDataMemory(memory);
+  for (size_t i = 0; i < image.pages.size(); i++)
+    WriteDataMemory(memory, image.pages[i] << MEMORY_PAGE_SHIFT,
+                    &image.contents[i * MEMORY_PAGE_SIZE], MEMORY_PAGE_SIZE);
+}
+
+void ForkDataMemory(DataMemory &memory, const MemoryImage &image)
+{
+  if (memory.base != &image) {
+    ClearDataMemory(memory);
+    for (size_t i = 0; i < image.pages.size(); i++) {
+      memcpy(memory.bytes + ((size_t)image.pages[i] << MEMORY_PAGE_SHIFT),
+             &image.contents[i * MEMORY_PAGE_SIZE], MEMORY_PAGE_SIZE);
+      memory.page_written[image.pages[i]] = PAGE_FORKED;
+    }
+    memory.base = &image;
+    return;
+  }
+
+  const uint32_t num_pages = memory.size >> MEMORY_PAGE_SHIFT;
+  for (uint32_t page = NextWrittenPage(memory, 0); page < num_pages;
+       page = NextWrittenPage(memory, page + 1)) {
+    if (memory.page_written[page] != PAGE_DIRTY)
+      continue;
+    unsigned char *p = memory.bytes + ((size_t)page << MEMORY_PAGE_SHIFT);
+    vector<uint32_t>::const_iterator it = lower_bound(image.pages.begin(), image.pages.end(), page);
+    if (it != image.pages.end() && *it == page) {
+      memcpy(p, &image.contents[(it - image.pages.begin()) * MEMORY_PAGE_SIZE], MEMORY_PAGE_SIZE);
+      memory.page_written[page] = PAGE_FORKED;
+    }
+    else {
+      memset(p, 0x00, MEMORY_PAGE_SIZE);
+      memory.page_written[page] = PAGE_ZERO;
+    }
+  }
+}
+
+bool ParseMemorySize(const char *text, uint32_t &size)
+{
+  char *end;
+  uint64_t value = strtoull(text, &end, 10);
+  int shift = 0;
+  if (*end == 'K' || *end == 'k')
+    shift = 10;
+  else if (*end == 'M' || *end == 'm')
+    shift = 20;
+  else if (*end == 'G' || *end == 'g')
+    shift = 30;
+  if (shift != 0)
+    end++;
+  if (end == text || *end != '\0' || value > (MAX_MEMORY_SIZE >> shift) ||
+      !ValidMemorySize(value << shift))
+    return false;
+  size = value << shift;
+  return true;
+}
@@ -0,0 +1,104 @@
+#ifndef __MEMORY_H
+#define __MEMORY_H
+
+#include <stdint.h>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////
+// Data memory is one anonymous private mapping: pages the program never
+// touches are never allocated and read as zero. Every store marks its
+// 4 KiB page in page_written, so clearing, saving and comparing memory
+// only visit pages that can be non-zero.
+//
+// Memory forked from a MemoryImage (ForkDataMemory()) remembers it as
+// base; forking from the same image again only restores the pages
+// stored to since, which is what makes repeated runs cheap to reset.
+////////////////////////////////////////////////////////////////////////
+#define MEMORY_PAGE_SHIFT 12
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_SHIFT)
+#define DEFAULT_MEMORY_SIZE (1024*1024)
+#define MAX_MEMORY_SIZE (1u << 31)   // addresses are non-negative ints
+
+enum PageState {
+  PAGE_ZERO = 0,      // never written since the last clear (and absent from base)
+  PAGE_DIRTY = 1,     // stored to since the last clear or fork
+  PAGE_FORKED = 2,    // unmodified copy of the page of base
+};
+
+////////////////////////////////////////////////////////////////////////
+// Written pages of a DataMemory, in ascending page order
+////////////////////////////////////////////////////////////////////////
+typedef struct MemoryImage_ {
+  std::vector<uint32_t> pages;
+  std::vector<unsigned char> contents;   // MEMORY_PAGE_SIZE bytes per page
+} MemoryImage;
+
+typedef struct DataMemory_ {
+  unsigned char *bytes;
+  uint32_t size;                  // bytes, a multiple of MEMORY_PAGE_SIZE
+  unsigned char *page_written;    // PageState per page; PAGE_ZERO pages read as zero
+  const MemoryImage *base;        // image last forked from, NULL after a clear
+} DataMemory;
+
+////////////////////////////////////////////////////////////////////////
+// desc: True if [address, address + width) lies inside memory
+////////////////////////////////////////////////////////////////////////
+static inline bool MemoryInRange(const DataMemory &memory, const int address, const int width)
+{
+  return (unsigned int)address <= memory.size - width;
+}
+
+static inline void MarkPageWritten(DataMemory &memory, const unsigned int address)
+{
+  memory.page_written[address >> MEMORY_PAGE_SHIFT] = PAGE_DIRTY;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Reserve size bytes of zeroed memory
+// output: false if size is not a multiple of MEMORY_PAGE_SIZE in
+//         [MEMORY_PAGE_SIZE, MAX_MEMORY_SIZE] or the mapping failed
+////////////////////////////////////////////////////////////////////////
+bool MapDataMemory(DataMemory &memory, const uint32_t size);
+
+void UnmapDataMemory(DataMemory &memory);
+
+////////////////////////////////////////////////////////////////////////
+// desc: First page at or after page that is not PAGE_ZERO
+// output: that page, or the number of pages if there is none
+////////////////////////////////////////////////////////////////////////
+uint32_t NextWrittenPage(const DataMemory &memory, uint32_t page);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Zero every written page
+////////////////////////////////////////////////////////////////////////
+void ClearDataMemory(DataMemory &memory);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Copy size bytes to address, e.g. a loaded data section
+// output: false if the range does not fit
+////////////////////////////////////////////////////////////////////////
+bool WriteDataMemory(DataMemory &memory, const uint32_t address, const void *data,
+                     const uint32_t size);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Copy the written pages into image / make memory equal to image
+////////////////////////////////////////////////////////////////////////
+void SaveDataMemory(const DataMemory &memory, MemoryImage &image);
+void RestoreDataMemory(DataMemory &memory, const MemoryImage &image);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Make memory equal to image. If memory was last forked from the
+//       same image only its PAGE_DIRTY pages are copied back or zeroed,
+//       otherwise it is cleared and every page of image copied in.
+//       image must stay unchanged while it is memory's base.
+////////////////////////////////////////////////////////////////////////
+void ForkDataMemory(DataMemory &memory, const MemoryImage &image);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Parse a memory size option: bytes with an optional K, M or G
+//       suffix
+// output: false if malformed or out of range (see MapDataMemory())
+////////////////////////////////////////////////////////////////////////
+bool ParseMemorySize(const char *text, uint32_t &size);
+
+#endif // __MEMORY_H
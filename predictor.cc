@@ -0,0 +1,288 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iomanip>
+#include <stdint.h>
+#include <stdlib.h>
+#include "simulator.h"
+#include "predictor.h"
+
+using namespace std;
+
+bool g_predictor_enabled = false;
+Predictor g_predictor;
+static string g_predictor_path;
+static int g_predictor_branch_penalty;
+
+void DefaultPredictorConfig(PredictorConfig &config)
+{
+  config.direction = PREDICT_GSHARE;
+  config.bits = 12;
+  config.ras = 16;
+}
+
+bool ParsePredictorConfig(const char *spec, PredictorConfig &config)
+{
+  string rest = spec;
+  while (!rest.empty()) {
+    size_t comma = rest.find(',');
+    string item = rest.substr(0, comma);
+    rest = comma == string::npos ? "" : rest.substr(comma + 1);
+
+    size_t equals = item.find('=');
+    if (equals == string::npos || equals + 1 == item.size())
+      return false;
+    string key = item.substr(0, equals);
+    string value = item.substr(equals + 1);
+    if (key == "direction") {
+      if (value == "static")
+        config.direction = PREDICT_STATIC;
+      else if (value == "bimodal")
+        config.direction = PREDICT_BIMODAL;
+      else if (value == "gshare")
+        config.direction = PREDICT_GSHARE;
+      else
+        return false;
+      continue;
+    }
+
+    char *end;
+    long number = strtol(value.c_str(), &end, 10);
+    if (*end != '\0')
+      return false;
+    if (key == "bits" && number >= 1 && number <= PREDICTOR_MAX_BITS)
+      config.bits = number;
+    else if (key == "ras" && number >= 0 && number <= 1024)
+      config.ras = number;
+    else
+      return false;
+  }
+  return true;
+}
+
+static uint8_t ClassifyBranch(const TraceOp &trace_op)
+{
+  switch (trace_op.opcode) {
+    case OP_BRN:
+    case OP_BRZ:
+    case OP_BRP:
+    case OP_BRNZ:
+    case OP_BRNP:
+    case OP_BRZP:
+      return BRANCH_CONDITIONAL;
+    case OP_BRNZP:
+      return BRANCH_DIRECT;
+    case OP_JSR:
+      return BRANCH_DIRECT | BRANCH_CALL;
+    case OP_JSRR:
+      return BRANCH_INDIRECT | BRANCH_CALL;
+    case OP_JMP:
+      return trace_op.scalar_registers[0] == LR_IDX ? BRANCH_RETURN : BRANCH_INDIRECT;
+    default:
+      return BRANCH_DIRECT;   // not a control instruction, never recorded
+  }
+}
+
+void PredictorStart(const char *path, const PredictorConfig &config, const int branch_penalty)
+{
+  const vector<TraceOp> &trace_ops = g_machine->trace_ops;
+  g_predictor.config = config;
+  g_predictor.batch_size = 0;
+  g_predictor.classes.resize(trace_ops.size());
+  for (size_t pc = 0; pc < trace_ops.size(); pc++)
+    g_predictor.classes[pc] = ClassifyBranch(trace_ops[pc]);
+  g_predictor.outcomes.assign(trace_ops.size() * PREDICTOR_OUTCOMES, 0);
+  // Weakly not taken
+  g_predictor.table.assign(config.direction == PREDICT_STATIC ? 0 : 1 << config.bits, 1);
+  g_predictor.history = 0;
+  g_predictor.return_stack.assign(config.ras, 0);
+  g_predictor.return_top = 0;
+  g_predictor.return_count = 0;
+  g_predictor_path = path;
+  g_predictor_branch_penalty = branch_penalty;
+  g_predictor_enabled = true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Predict a return, direct or indirect control instruction, and
+//       push the return address of a call
+// output: true if mispredicted
+////////////////////////////////////////////////////////////////////////
+__attribute__((noinline))
+static bool PredictTarget(Predictor &p, const uint32_t pc, const uint32_t next_pc,
+                          const uint8_t branch_class)
+{
+  const int ras = p.config.ras;
+  bool mispredict;
+  switch (branch_class & BRANCH_CLASS_MASK) {
+    case BRANCH_RETURN:
+      mispredict = p.return_count == 0 || p.return_stack[p.return_top] != next_pc;
+      if (p.return_count > 0) {
+        p.return_top = (p.return_top + ras - 1) % ras;
+        p.return_count--;
+      }
+      break;
+    case BRANCH_DIRECT:
+      mispredict = false;
+      break;
+    default:
+      mispredict = true;
+      break;
+  }
+  if ((branch_class & BRANCH_CALL) && ras > 0) {
+    p.return_top = (p.return_top + 1) % ras;
+    p.return_stack[p.return_top] = pc + 1;
+    if (p.return_count < ras)
+      p.return_count++;
+  }
+  return mispredict;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Predict the batch, conditional branches with the DIRECTION
+//       predictor. The loop only handles conditional branches itself, so
+//       that its state stays in registers.
+////////////////////////////////////////////////////////////////////////
+template <int DIRECTION>
+static void PredictBatch(Predictor &p)
+{
+  const uint32_t mask = (1u << p.config.bits) - 1;
+  // Held in locals: a store to a uint8_t counter may alias any member of
+  // g_predictor, which would otherwise be reloaded for every event
+  const uint8_t *classes = p.classes.data();
+  uint8_t *table = p.table.data();
+  uint64_t *outcomes = p.outcomes.data();
+  uint32_t history = p.history;
+  const BranchEvent *const end = p.batch + p.batch_size;
+  for (const BranchEvent *event = p.batch; event != end; event++) {
+    const uint32_t pc = event->pc;
+    const uint32_t next_pc = event->next_pc;
+    const uint8_t branch_class = classes[pc];
+    const bool redirected = next_pc != pc + 1;
+    bool mispredict;
+
+    if (branch_class != BRANCH_CONDITIONAL) {
+      mispredict = PredictTarget(p, pc, next_pc, branch_class);
+    } else if (DIRECTION == PREDICT_STATIC) {
+      mispredict = redirected;
+    } else {
+      const uint32_t idx = DIRECTION == PREDICT_GSHARE ? (pc ^ history) & mask : pc & mask;
+      const uint8_t counter = table[idx];
+      mispredict = (counter >= 2) != redirected;
+      table[idx] = redirected ? counter + (counter < 3) : counter - (counter > 0);
+      if (DIRECTION == PREDICT_GSHARE)
+        history = ((history << 1) | redirected) & mask;
+    }
+    outcomes[pc * PREDICTOR_OUTCOMES + (redirected << 1 | mispredict)]++;
+  }
+  p.history = history;
+}
+
+void PredictorFlush()
+{
+  switch (g_predictor.config.direction) {
+    case PREDICT_STATIC:
+      PredictBatch<PREDICT_STATIC>(g_predictor);
+      break;
+    case PREDICT_BIMODAL:
+      PredictBatch<PREDICT_BIMODAL>(g_predictor);
+      break;
+    default:
+      PredictBatch<PREDICT_GSHARE>(g_predictor);
+      break;
+  }
+  g_predictor.batch_size = 0;
+}
+
+static bool ByCountDescending(const pair<uint64_t, int> &a, const pair<uint64_t, int> &b)
+{
+  return a.first != b.first ? a.first > b.first : a.second < b.second;
+}
+
+static double Percent(const uint64_t count, const uint64_t total)
+{
+  return total == 0 ? 0.0 : 100.0 * count / total;
+}
+
+bool PredictorWrite()
+{
+  if (!g_predictor_enabled)
+    return true;
+  PredictorFlush();
+  g_predictor_enabled = false;
+
+  static const char *direction_names[] = {"static not-taken", "bimodal", "gshare"};
+  static const char *class_names[NUM_BRANCH_CLASSES] = {"conditional", "return", "direct", "indirect"};
+  const PredictorConfig &config = g_predictor.config;
+  const uint64_t *outcomes = g_predictor.outcomes.data();
+  vector<BranchCounters> counters(g_predictor.classes.size());
+  BranchCounters total = {0, 0, 0};
+  BranchCounters by_class[NUM_BRANCH_CLASSES] = {};
+  vector<pair<uint64_t, int> > rows;
+  for (size_t pc = 0; pc < counters.size(); pc++) {
+    for (int outcome = 0; outcome < PREDICTOR_OUTCOMES; outcome++) {
+      const uint64_t count = outcomes[pc * PREDICTOR_OUTCOMES + outcome];
+      counters[pc].executions += count;
+      counters[pc].redirects += outcome & 2 ? count : 0;
+      counters[pc].mispredicts += outcome & 1 ? count : 0;
+    }
+    if (counters[pc].executions == 0)
+      continue;
+    BranchCounters &row = by_class[g_predictor.classes[pc] & BRANCH_CLASS_MASK];
+    row.executions += counters[pc].executions;
+    row.redirects += counters[pc].redirects;
+    row.mispredicts += counters[pc].mispredicts;
+    total.executions += counters[pc].executions;
+    total.redirects += counters[pc].redirects;
+    total.mispredicts += counters[pc].mispredicts;
+    if (counters[pc].mispredicts > 0)
+      rows.push_back(make_pair(counters[pc].mispredicts, (int)pc));
+  }
+
+  ofstream out(g_predictor_path.c_str());
+  if (!out) {
+    cerr << "Error: cannot write predictor report " << g_predictor_path << endl;
+    return false;
+  }
+  out.setf(ios::fixed);
+  out.precision(2);
+  out << "Branch predictor: " << direction_names[config.direction];
+  if (config.direction != PREDICT_STATIC)
+    out << ", " << (1 << config.bits) << " counters";
+  out << ", " << config.ras << "-entry return-address stack\n\n";
+  out << "Control instructions: " << total.executions << "\n";
+  out << "Mispredicts:          " << total.mispredicts << " ("
+      << Percent(total.mispredicts, total.executions) << "%)\n";
+  out << "Control stall cycles at branch penalty " << g_predictor_branch_penalty << ": "
+      << total.mispredicts * g_predictor_branch_penalty << " (" << total.redirects * g_predictor_branch_penalty
+      << " stalling on every taken branch, as --timing does)\n";
+
+  out << "\nBy class:\n" << setw(14) << "executed" << setw(14) << "taken" << setw(14)
+      << "mispredicts" << setw(8) << "rate%" << "  class\n";
+  for (int i = 0; i < NUM_BRANCH_CLASSES; i++)
+    out << setw(14) << by_class[i].executions << setw(14) << by_class[i].redirects << setw(14)
+        << by_class[i].mispredicts << setw(8) << Percent(by_class[i].mispredicts, by_class[i].executions)
+        << "  " << class_names[i] << "\n";
+
+  sort(rows.begin(), rows.end(), ByCountDescending);
+  out << "\nControl instructions by mispredicts:\n" << setw(8) << "pc" << setw(14) << "executed"
+      << setw(8) << "taken%" << setw(14) << "mispredicts" << setw(8) << "rate%" << "  opcode  class\n";
+  for (size_t i = 0; i < rows.size() && i < PREDICTOR_TOP_PCS; i++) {
+    const BranchCounters &row = counters[rows[i].second];
+    out << setw(8) << rows[i].second << setw(14) << row.executions << setw(8)
+        << Percent(row.redirects, row.executions) << setw(14) << row.mispredicts << setw(8)
+        << Percent(row.mispredicts, row.executions) << "  "
+        << OpcodeName(g_machine->trace_ops[rows[i].second].opcode) << "  "
+        << class_names[g_predictor.classes[rows[i].second] & BRANCH_CLASS_MASK]
+        << (g_predictor.classes[rows[i].second] & BRANCH_CALL ? " call" : "") << "\n";
+  }
+
+  out.close();
+  if (out.fail()) {
+    cerr << "Error: cannot write predictor report " << g_predictor_path << endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,127 @@
+#ifndef __PREDICTOR_H
+#define __PREDICTOR_H
+
+#include <stdint.h>
+#include <vector>
+#include "simulator.h"
+
+////////////////////////////////////////////////////////////////////////
+// Branch predictor simulation (--predict FILE, interp only)
+//
+// The interpreter appends every executed branch, jump and call to a
+// batch of PREDICTOR_BATCH_SIZE (pc, next pc) events. PredictorFlush()
+// runs each full batch through the predictor, so the interpreter loop
+// itself only pays for a store. Control instructions are predicted by
+// class:
+//
+//   conditional  brn ... brzp: direction from the selected predictor
+//                  static   always not taken
+//                  bimodal  2^bits 2-bit counters indexed by PC
+//                  gshare   2^bits 2-bit counters indexed by PC xor the
+//                           last bits branch outcomes
+//   return       jmp r7 (ret): target popped from a return-address stack
+//                of ras entries pushed by jsr and jsrr; a wrong target
+//                or an empty stack is a mispredict
+//   direct       brnzp, jsr: target known at decode, never mispredicted
+//   indirect     jsrr, and jmp through a register other than r7: there
+//                is no target predictor, so always mispredicted
+//
+// --predictor K=V,... configures it: direction=static|bimodal|gshare
+// (gshare), bits=N (12), ras=N (16; 0 disables the stack).
+// PredictorWrite() reports mispredict rates overall and per class, and
+// for the PREDICTOR_TOP_PCS control PCs with the most mispredicts, each
+// with its class. It also gives the control stall cycles at the
+// --pipeline branch_penalty, next to those of --timing, which stalls on
+// every taken branch or jump.
+////////////////////////////////////////////////////////////////////////
+#define PREDICTOR_BATCH_SIZE 4096
+#define PREDICTOR_TOP_PCS 50       // control PCs listed in the report
+#define PREDICTOR_MAX_BITS 24
+#define PREDICTOR_OUTCOMES 4
+
+enum PredictorDirection {
+  PREDICT_STATIC = 0,
+  PREDICT_BIMODAL,
+  PREDICT_GSHARE
+};
+
+enum BranchClass {
+  BRANCH_CONDITIONAL = 0,
+  BRANCH_RETURN,
+  BRANCH_DIRECT,
+  BRANCH_INDIRECT,
+  NUM_BRANCH_CLASSES
+};
+
+#define BRANCH_CLASS_MASK 0x7
+#define BRANCH_CALL 0x8            // also pushes the return address
+
+typedef struct PredictorConfig_ {
+  int direction;
+  int bits;
+  int ras;
+} PredictorConfig;
+
+typedef struct BranchEvent_ {
+  uint32_t pc;
+  uint32_t next_pc;
+} BranchEvent;
+
+typedef struct BranchCounters_ {
+  uint64_t executions;
+  uint64_t redirects;              // next PC was not pc + 1
+  uint64_t mispredicts;
+} BranchCounters;
+
+typedef struct Predictor_ {
+  PredictorConfig config;
+  BranchEvent batch[PREDICTOR_BATCH_SIZE];
+  int batch_size;
+  std::vector<uint8_t> classes;           // per instruction index
+  // Per instruction index, PREDICTOR_OUTCOMES event counts indexed by
+  // redirected << 1 | mispredict: one increment per event
+  std::vector<uint64_t> outcomes;
+  std::vector<uint8_t> table;             // 2-bit saturating counters
+  uint32_t history;                       // gshare outcomes, newest in bit 0
+  std::vector<uint32_t> return_stack;     // circular, oldest entries overwritten
+  int return_top;
+  int return_count;
+} Predictor;
+
+extern bool g_predictor_enabled;
+extern Predictor g_predictor;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Parse a --predictor specification on top of the defaults
+// output: false if a key or value is invalid
+////////////////////////////////////////////////////////////////////////
+bool ParsePredictorConfig(const char *spec, PredictorConfig &config);
+void DefaultPredictorConfig(PredictorConfig &config);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Classify g_machine's control instructions and start predicting
+// input: path of the report; branch_penalty: cycles per mispredict
+////////////////////////////////////////////////////////////////////////
+void PredictorStart(const char *path, const PredictorConfig &config, const int branch_penalty);
+
+void PredictorFlush();
+
+////////////////////////////////////////////////////////////////////////
+// desc: Record the control instruction at pc, which has just executed
+////////////////////////////////////////////////////////////////////////
+static inline void PredictorRecord(const int pc, const int next_pc)
+{
+  BranchEvent &event = g_predictor.batch[g_predictor.batch_size++];
+  event.pc = pc;
+  event.next_pc = next_pc;
+  if (g_predictor.batch_size == PREDICTOR_BATCH_SIZE)
+    PredictorFlush();
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Predict the last batch and write the report
+// output: false if the file cannot be written
+////////////////////////////////////////////////////////////////////////
+bool PredictorWrite();
+
+#endif // __PREDICTOR_H
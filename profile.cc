@@ -0,0 +1,213 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <iomanip>
+#include <stdint.h>
+#include "simulator.h"
+#include "profile.h"
+
+using namespace std;
+
+bool g_profile_enabled = false;
+Profile g_profile;
+static string g_profile_path;
+
+void ProfileStart(const char *path)
+{
+  const size_t num_ops = g_machine->trace_ops.size();
+  const size_t num_pages = g_machine->memory.size >> MEMORY_PAGE_SHIFT;
+  g_profile.executions.assign(num_ops, 0);
+  g_profile.taken.assign(num_ops, 0);
+  g_profile.calls.assign(num_ops, 0);
+  g_profile.page_loads.assign(num_pages, 0);
+  g_profile.page_stores.assign(num_pages, 0);
+  g_profile.root.parent = NULL;
+  g_profile.root.function = -1;
+  g_profile.root.depth = 0;
+  g_profile.root.instructions = 0;
+  g_profile.frame = &g_profile.root;
+  g_profile.start_count = g_machine->instruction_count;
+  g_profile.frame_start = g_machine->instruction_count;
+  g_profile_path = path;
+  g_profile_enabled = true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Charge the current frame with the instructions since it was
+//       entered, up to and including the executing call or return
+////////////////////////////////////////////////////////////////////////
+static void ChargeFrame()
+{
+  const uint64_t now = g_machine->instruction_count + 1;
+  g_profile.frame->instructions += now - g_profile.frame_start;
+  g_profile.frame_start = now;
+}
+
+void ProfileCall(const int target)
+{
+  if (target < 0 || (size_t)target >= g_profile.calls.size())
+    return;   // the interpreter stops on the jump
+  g_profile.calls[target]++;
+
+  ProfileFrame *frame = g_profile.frame;
+  if (frame->depth >= PROFILE_MAX_DEPTH)
+    return;
+  ChargeFrame();
+  map<int, ProfileFrame *>::iterator it = frame->callees.find(target);
+  if (it != frame->callees.end()) {
+    g_profile.frame = it->second;
+    return;
+  }
+  ProfileFrame *callee = new ProfileFrame;
+  callee->parent = frame;
+  callee->function = target;
+  callee->depth = frame->depth + 1;
+  callee->instructions = 0;
+  frame->callees[target] = callee;
+  g_profile.frame = callee;
+}
+
+void ProfileReturn()
+{
+  if (g_profile.frame->parent != NULL) {
+    ChargeFrame();
+    g_profile.frame = g_profile.frame->parent;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Write one collapsed stack line per frame with instructions,
+//       then free the callees
+////////////////////////////////////////////////////////////////////////
+static void WriteFolded(ostream &out, ProfileFrame *frame, const string &stack)
+{
+  string name = stack;
+  if (frame->function < 0)
+    name += "main";
+  else {
+    ostringstream function;
+    function << ";sub_" << frame->function;
+    name += function.str();
+  }
+  if (frame->instructions > 0)
+    out << name << " " << frame->instructions << "\n";
+  for (map<int, ProfileFrame *>::iterator it = frame->callees.begin(); it != frame->callees.end(); it++) {
+    WriteFolded(out, it->second, name);
+    delete it->second;
+  }
+  frame->callees.clear();
+}
+
+static bool ByCountDescending(const pair<uint64_t, int> &a, const pair<uint64_t, int> &b)
+{
+  return a.first != b.first ? a.first > b.first : a.second < b.second;
+}
+
+static double Percent(const uint64_t count, const uint64_t total)
+{
+  return total == 0 ? 0.0 : 100.0 * count / total;
+}
+
+bool ProfileWrite()
+{
+  if (!g_profile_enabled)
+    return true;
+  g_profile_enabled = false;
+
+  const vector<TraceOp> &ops = g_machine->trace_ops;
+  uint64_t total = 0;
+  vector<uint64_t> opcode_counts(256, 0);
+  for (size_t pc = 0; pc < ops.size(); pc++) {
+    total += g_profile.executions[pc];
+    opcode_counts[ops[pc].opcode] += g_profile.executions[pc];
+  }
+  // The rest of the run, including a faulting instruction, which
+  // instruction_count does not count
+  g_profile.frame->instructions += total - (g_profile.frame_start - g_profile.start_count);
+  g_profile.frame_start = g_profile.start_count + total;
+
+  ofstream out(g_profile_path.c_str());
+  if (!out) {
+    cerr << "Error: cannot write profile " << g_profile_path << endl;
+    return false;
+  }
+  out.setf(ios::fixed);
+  out.precision(2);
+  out << "Flat profile: " << total << " instructions\n";
+
+  vector<pair<uint64_t, int> > rows;
+  for (int opcode = 0; opcode < 256; opcode++)
+    if (opcode_counts[opcode] > 0)
+      rows.push_back(make_pair(opcode_counts[opcode], opcode));
+  sort(rows.begin(), rows.end(), ByCountDescending);
+  out << "\nOpcodes:\n" << setw(14) << "executed" << setw(8) << "%" << "  opcode\n";
+  for (size_t i = 0; i < rows.size(); i++)
+    out << setw(14) << rows[i].first << setw(8) << Percent(rows[i].first, total) << "  "
+        << OpcodeName(rows[i].second) << "\n";
+
+  rows.clear();
+  for (size_t pc = 0; pc < ops.size(); pc++)
+    if (g_profile.executions[pc] > 0)
+      rows.push_back(make_pair(g_profile.executions[pc], (int)pc));
+  sort(rows.begin(), rows.end(), ByCountDescending);
+  out << "\nHottest PCs (instruction index):\n" << setw(8) << "pc" << setw(14) << "executed"
+      << setw(8) << "%" << "  opcode\n";
+  for (size_t i = 0; i < rows.size() && i < PROFILE_TOP_PCS; i++)
+    out << setw(8) << rows[i].second << setw(14) << rows[i].first << setw(8)
+        << Percent(rows[i].first, total) << "  " << OpcodeName(ops[rows[i].second].opcode) << "\n";
+
+  out << "\nBranches:\n" << setw(8) << "pc" << setw(8) << "opcode" << setw(14) << "executed"
+      << setw(14) << "taken" << setw(14) << "not taken" << setw(8) << "taken%" << "\n";
+  for (size_t pc = 0; pc < ops.size(); pc++) {
+    if (BranchConditionMask(ops[pc].opcode) == 0 && ops[pc].opcode != OP_BRNZP)
+      continue;
+    const uint64_t executed = g_profile.executions[pc];
+    if (executed == 0)
+      continue;
+    out << setw(8) << pc << setw(8) << OpcodeName(ops[pc].opcode) << setw(14) << executed
+        << setw(14) << g_profile.taken[pc] << setw(14) << executed - g_profile.taken[pc]
+        << setw(8) << Percent(g_profile.taken[pc], executed) << "\n";
+  }
+
+  rows.clear();
+  for (size_t pc = 0; pc < ops.size(); pc++)
+    if (g_profile.calls[pc] > 0)
+      rows.push_back(make_pair(g_profile.calls[pc], (int)pc));
+  sort(rows.begin(), rows.end(), ByCountDescending);
+  out << "\nCall targets:\n" << setw(14) << "target" << setw(14) << "calls" << "\n";
+  for (size_t i = 0; i < rows.size(); i++) {
+    ostringstream target;
+    target << "sub_" << rows[i].second;
+    out << setw(14) << target.str() << setw(14) << rows[i].first << "\n";
+  }
+
+  out << "\nMemory pages (" << MEMORY_PAGE_SIZE << " bytes):\n" << setw(8) << "page" << setw(12)
+      << "address" << setw(14) << "loads" << setw(14) << "stores" << "\n";
+  for (size_t page = 0; page < g_profile.page_loads.size(); page++) {
+    if (g_profile.page_loads[page] == 0 && g_profile.page_stores[page] == 0)
+      continue;
+    out << setw(8) << page << "  0x" << hex << setw(8) << setfill('0') << (page << MEMORY_PAGE_SHIFT)
+        << dec << setfill(' ') << setw(14) << g_profile.page_loads[page] << setw(14)
+        << g_profile.page_stores[page] << "\n";
+  }
+  out.close();
+  if (out.fail()) {
+    cerr << "Error: cannot write profile " << g_profile_path << endl;
+    return false;
+  }
+
+  string folded_path = g_profile_path + ".folded";
+  ofstream folded(folded_path.c_str());
+  if (folded)
+    WriteFolded(folded, &g_profile.root, "");
+  folded.close();
+  if (folded.fail()) {
+    cerr << "Error: cannot write profile " << folded_path << endl;
+    return false;
+  }
+  return true;
+}
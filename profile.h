@@ -0,0 +1,125 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include "simulator.h"
+
+////////////////////////////////////////////////////////////////////////
+// Execution profile (--profile FILE, interp only)
+//
+// The interpreter calls ProfileInstruction() before executing every
+// instruction. It only bumps counters: executions per PC (per opcode is
+// derived from them at the end), taken branches per PC, calls per JSR /
+// JSRR target and loads and stores per memory page. Instructions per
+// call stack are charged from g_machine->instruction_count when a call
+// or return switches frames, so plain instructions cost one increment.
+// Nothing is written until ProfileWrite() at the end of the run, which
+// produces
+//
+//   FILE         flat profile: opcodes, hottest PCs, branches, call
+//                targets and memory pages, by decreasing count
+//   FILE.folded  collapsed stacks "main;sub_12;sub_40 <instructions>",
+//                one line per call stack, for flamegraph.pl and similar
+//
+// A call stack frame is pushed by JSR/JSRR and popped by "ret" (JMP
+// through LR); frames are named sub_<instruction index of the target>.
+// The call is charged to the caller and the return to the callee.
+////////////////////////////////////////////////////////////////////////
+#define PROFILE_MAX_DEPTH 256      // deeper calls are charged to the deepest frame
+#define PROFILE_TOP_PCS 50         // hottest PCs listed in the flat profile
+
+////////////////////////////////////////////////////////////////////////
+// Node of the call tree: one per distinct call stack
+////////////////////////////////////////////////////////////////////////
+typedef struct ProfileFrame_ {
+  struct ProfileFrame_ *parent;
+  int function;                    // instruction index of the callee, -1 for main
+  int depth;
+  uint64_t instructions;           // executed with exactly this stack
+  std::map<int, struct ProfileFrame_ *> callees;
+} ProfileFrame;
+
+typedef struct Profile_ {
+  std::vector<uint64_t> executions;   // per instruction index
+  std::vector<uint64_t> taken;        // per instruction index, branches only
+  std::vector<uint64_t> calls;        // per call target index
+  std::vector<uint64_t> page_loads;   // per data memory page
+  std::vector<uint64_t> page_stores;
+  ProfileFrame root;
+  ProfileFrame *frame;                // current call stack
+  uint64_t start_count;               // instruction count when profiling started
+  uint64_t frame_start;               // instruction count when frame was entered
+} Profile;
+
+extern bool g_profile_enabled;
+extern Profile g_profile;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Size the counters for g_machine's program and memory and start
+//       profiling
+// input: path of the flat profile
+////////////////////////////////////////////////////////////////////////
+void ProfileStart(const char *path);
+
+void ProfileCall(const int target);
+void ProfileReturn();
+
+////////////////////////////////////////////////////////////////////////
+// desc: Count the instruction at pc, which is about to execute
+////////////////////////////////////////////////////////////////////////
+static inline void ProfileInstruction(const int pc, const TraceOp &op)
+{
+  g_profile.executions[pc]++;
+  switch (op.opcode) {
+    case OP_LDB:
+    case OP_LDW:
+    case OP_STB:
+    case OP_STW: {
+      const int address = g_machine->scalar_registers[op.scalar_registers[1]].int_value + op.int_value;
+      const int width = op.opcode == OP_LDB || op.opcode == OP_STB ? 1 : 2;
+      if (!MemoryInRange(g_machine->memory, address, width))
+        break;
+      if (op.opcode == OP_LDB || op.opcode == OP_LDW)
+        g_profile.page_loads[address >> MEMORY_PAGE_SHIFT]++;
+      else
+        g_profile.page_stores[address >> MEMORY_PAGE_SHIFT]++;
+      break;
+    }
+    case OP_BRN:
+    case OP_BRZ:
+    case OP_BRP:
+    case OP_BRNZ:
+    case OP_BRNP:
+    case OP_BRZP:
+      if (g_machine->condition_code_register.int_value & BranchConditionMask(op.opcode))
+        g_profile.taken[pc]++;
+      break;
+    case OP_BRNZP:
+      g_profile.taken[pc]++;
+      break;
+    case OP_JSR:
+      ProfileCall(pc + 1 + SignExtension(op.int_value));
+      break;
+    case OP_JSRR:
+      // ExecuteInstruction() reads the target after storing R15 in LR
+      if (op.scalar_registers[0] == LR_IDX)
+        ProfileCall(pc >> 2);
+      else
+        ProfileCall(g_machine->scalar_registers[op.scalar_registers[0]].int_value >> 2);
+      break;
+    case OP_JMP:
+      if (op.scalar_registers[0] == LR_IDX)
+        ProfileReturn();
+      break;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Write the flat profile and the collapsed stacks
+// output: false if a file cannot be written
+////////////////////////////////////////////////////////////////////////
+bool ProfileWrite();
+
+#endif // __PROFILE_H
@@ -0,0 +1,75 @@
+#ifndef __PROGRAM_IMAGE_H
+#define __PROGRAM_IMAGE_H
+
+#include <stdint.h>
+
+////////////////////////////////////////////////////////////////////////
+// Binary program image shared by the assembler and the simulator.
+// All fields are little-endian.
+//
+//   offset  size  field
+//   0       8     magic "3220XIMG"
+//   8       4     version (PROGRAM_IMAGE_VERSION)
+//   12      4     code_offset: byte offset of the first instruction word
+//   16      4     code_count: number of 32-bit instruction words
+//   20      4     data_offset: byte offset of the data section (0 if none)
+//   24      4     data_size: size of the data section in bytes
+//   28      4     data_address: data memory address the section is loaded at
+//
+// The text format (a stream of ASCII '0'/'1' characters, 32 per
+// instruction) is still accepted by the simulator.
+////////////////////////////////////////////////////////////////////////
+
+#define PROGRAM_IMAGE_MAGIC "3220XIMG"
+#define PROGRAM_IMAGE_MAGIC_SIZE 8
+#define PROGRAM_IMAGE_VERSION 1
+#define PROGRAM_IMAGE_HEADER_SIZE 32
+
+typedef struct ProgramImageHeader_ {
+  char magic[PROGRAM_IMAGE_MAGIC_SIZE];
+  uint32_t version;
+  uint32_t code_offset;
+  uint32_t code_count;
+  uint32_t data_offset;
+  uint32_t data_size;
+  uint32_t data_address;
+} ProgramImageHeader;
+
+static inline uint32_t ReadLE32(const unsigned char *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void WriteLE32(unsigned char *p, const uint32_t value)
+{
+  p[0] = value & 0xFF;
+  p[1] = (value >> 8) & 0xFF;
+  p[2] = (value >> 16) & 0xFF;
+  p[3] = (value >> 24) & 0xFF;
+}
+
+static inline void EncodeProgramImageHeader(const ProgramImageHeader &header, unsigned char *out)
+{
+  for (int i = 0; i < PROGRAM_IMAGE_MAGIC_SIZE; i++)
+    out[i] = header.magic[i];
+  WriteLE32(out + 8, header.version);
+  WriteLE32(out + 12, header.code_offset);
+  WriteLE32(out + 16, header.code_count);
+  WriteLE32(out + 20, header.data_offset);
+  WriteLE32(out + 24, header.data_size);
+  WriteLE32(out + 28, header.data_address);
+}
+
+static inline void DecodeProgramImageHeader(const unsigned char *in, ProgramImageHeader &header)
+{
+  for (int i = 0; i < PROGRAM_IMAGE_MAGIC_SIZE; i++)
+    header.magic[i] = in[i];
+  header.version = ReadLE32(in + 8);
+  header.code_offset = ReadLE32(in + 12);
+  header.code_count = ReadLE32(in + 16);
+  header.data_offset = ReadLE32(in + 20);
+  header.data_size = ReadLE32(in + 24);
+  header.data_address = ReadLE32(in + 28);
+}
+
+#endif // __PROGRAM_IMAGE_H
@@ -0,0 +1,406 @@
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include "simulator.h"
+#include "rasterizer.h"
+#include "render_pipeline.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RASTERIZER_X86
+#endif
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////
+// Edge function e(x, y) = a * x + b * y + c, >= 0 on the inner side of
+// a counter-clockwise edge
+////////////////////////////////////////////////////////////////////////
+typedef struct Edge_ {
+  int a;
+  int b;
+  int c;
+} Edge;
+
+static inline int Clamp(const int value, const int low, const int high)
+{
+  return value < low ? low : (value > high ? high : value);
+}
+
+static inline void PlotPixel(Framebuffer &framebuffer, const int x, const int y, const uint32_t color)
+{
+  FramebufferTile(framebuffer, x / TILE_SIZE, y / TILE_SIZE)[(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE] = color;
+  framebuffer.tile_written[(y / TILE_SIZE) * NUM_TILES_X + x / TILE_SIZE] = true;
+}
+
+static inline Edge SetupEdge(const int x0, const int y0, const int x1, const int y1)
+{
+  Edge edge;
+  edge.a = y0 - y1;
+  edge.b = x1 - x0;
+  edge.c = -(edge.a * x0 + edge.b * y0);
+  return edge;
+}
+
+static inline int EvaluateEdge(const Edge &edge, const int x, const int y)
+{
+  return edge.a * x + edge.b * y + edge.c;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Bresenham line from (x0, y0) to (x1, y1), both ends included.
+//       Steps along the major axis are limited to the part of the line
+//       that lies inside clip; the minor coordinate of step i is
+//       round(i * dn / dm), carried incrementally from the first step,
+//       so every clip rectangle plots the same pixels of the line.
+////////////////////////////////////////////////////////////////////////
+static void RasterizeLine(Framebuffer &framebuffer, const int x0, const int y0,
+                          const int x1, const int y1, const uint32_t color, const ClipRect &clip)
+{
+  const bool steep = (y1 > y0 ? y1 - y0 : y0 - y1) > (x1 > x0 ? x1 - x0 : x0 - x1);
+  const int m0 = steep ? y0 : x0;
+  const int n0 = steep ? x0 : y0;
+  int dm = steep ? y1 - y0 : x1 - x0;
+  int dn = steep ? x1 - x0 : y1 - y0;
+  const int sm = dm < 0 ? -1 : 1;
+  const int sn = dn < 0 ? -1 : 1;
+  dm *= sm;
+  dn *= sn;
+  const int low_m = steep ? clip.min_y : clip.min_x;
+  const int high_m = steep ? clip.max_y : clip.max_x;
+  const int low_n = steep ? clip.min_x : clip.min_y;
+  const int high_n = steep ? clip.max_x : clip.max_y;
+
+  int first, last;
+  if (sm > 0) {
+    first = m0 < low_m ? low_m - m0 : 0;
+    last = high_m - m0 < dm ? high_m - m0 : dm;
+  } else {
+    first = m0 > high_m ? m0 - high_m : 0;
+    last = m0 - low_m < dm ? m0 - low_m : dm;
+  }
+  if (first > last)
+    return;
+
+  if (dm == 0) {
+    if (n0 >= low_n && n0 <= high_n)
+      PlotPixel(framebuffer, x0, y0, color);
+    return;
+  }
+
+  int numerator = 2 * first * dn + dm;
+  int quotient = numerator / (2 * dm);
+  int remainder = numerator % (2 * dm);
+  for (int i = first; i <= last; i++) {
+    int m = m0 + sm * i;
+    int n = n0 + sn * quotient;
+    if (n >= low_n && n <= high_n) {
+      if (steep)
+        PlotPixel(framebuffer, n, m, color);
+      else
+        PlotPixel(framebuffer, m, n, color);
+    }
+    remainder += 2 * dn;
+    if (remainder >= 2 * dm) {
+      remainder -= 2 * dm;
+      quotient++;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Partially covered tile: origin[i] is edge i at the tile's first pixel.
+// A pixel is covered when all three edge values are >= 0, i.e. when the
+// sign bit of their OR is clear.
+////////////////////////////////////////////////////////////////////////
+typedef void (*PartialTileFn)(const Edge *edges, const int *origin, uint32_t *tile,
+                              const uint32_t color);
+
+static void RasterizePartialTileScalar(const Edge *edges, const int *origin, uint32_t *tile,
+                                       const uint32_t color)
+{
+  for (int row = 0; row < TILE_SIZE; row++) {
+    int e0 = origin[0] + edges[0].b * row;
+    int e1 = origin[1] + edges[1].b * row;
+    int e2 = origin[2] + edges[2].b * row;
+    for (int col = 0; col < TILE_SIZE; col++) {
+      if ((e0 | e1 | e2) >= 0)
+        tile[row * TILE_SIZE + col] = color;
+      e0 += edges[0].a;
+      e1 += edges[1].a;
+      e2 += edges[2].a;
+    }
+  }
+}
+
+#ifdef RASTERIZER_X86
+////////////////////////////////////////////////////////////////////////
+// 4 pixels per step: each tile row is two halves
+////////////////////////////////////////////////////////////////////////
+__attribute__((target("sse2")))
+static void RasterizePartialTileSSE(const Edge *edges, const int *origin, uint32_t *tile,
+                                    const uint32_t color)
+{
+  __m128i left[3], right[3], down[3];
+  for (int i = 0; i < 3; i++) {
+    const int a = edges[i].a;
+    left[i] = _mm_add_epi32(_mm_set1_epi32(origin[i]), _mm_setr_epi32(0, a, 2 * a, 3 * a));
+    right[i] = _mm_add_epi32(left[i], _mm_set1_epi32(4 * a));
+    down[i] = _mm_set1_epi32(edges[i].b);
+  }
+  const __m128i fill = _mm_set1_epi32(color);
+  const __m128i minus_one = _mm_set1_epi32(-1);
+
+  for (int row = 0; row < TILE_SIZE; row++) {
+    __m128i *pixels = (__m128i *)(tile + row * TILE_SIZE);
+    __m128i covered = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(left[0], left[1]), left[2]), minus_one);
+    _mm_storeu_si128(pixels, _mm_or_si128(_mm_and_si128(covered, fill),
+                                          _mm_andnot_si128(covered, _mm_loadu_si128(pixels))));
+    covered = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(right[0], right[1]), right[2]), minus_one);
+    _mm_storeu_si128(pixels + 1, _mm_or_si128(_mm_and_si128(covered, fill),
+                                              _mm_andnot_si128(covered, _mm_loadu_si128(pixels + 1))));
+    for (int i = 0; i < 3; i++) {
+      left[i] = _mm_add_epi32(left[i], down[i]);
+      right[i] = _mm_add_epi32(right[i], down[i]);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// 8 pixels per step: one tile row
+////////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2")))
+static void RasterizePartialTileAVX2(const Edge *edges, const int *origin, uint32_t *tile,
+                                     const uint32_t color)
+{
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i value[3], down[3];
+  for (int i = 0; i < 3; i++) {
+    value[i] = _mm256_add_epi32(_mm256_set1_epi32(origin[i]),
+                                _mm256_mullo_epi32(_mm256_set1_epi32(edges[i].a), lane));
+    down[i] = _mm256_set1_epi32(edges[i].b);
+  }
+  const __m256i fill = _mm256_set1_epi32(color);
+  const __m256i minus_one = _mm256_set1_epi32(-1);
+
+  for (int row = 0; row < TILE_SIZE; row++) {
+    __m256i covered = _mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(value[0], value[1]), value[2]),
+                                         minus_one);
+    _mm256_maskstore_epi32((int *)(tile + row * TILE_SIZE), covered, fill);
+    value[0] = _mm256_add_epi32(value[0], down[0]);
+    value[1] = _mm256_add_epi32(value[1], down[1]);
+    value[2] = _mm256_add_epi32(value[2], down[2]);
+  }
+}
+#endif // RASTERIZER_X86
+
+static PartialTileFn g_partial_tile_fn = NULL;
+
+bool SelectRasterizerPath(const char *name)
+{
+  bool automatic = strcmp(name, "auto") == 0;
+#ifdef RASTERIZER_X86
+  __builtin_cpu_init();
+  if (automatic || strcmp(name, "avx2") == 0) {
+    if (__builtin_cpu_supports("avx2")) {
+      g_partial_tile_fn = RasterizePartialTileAVX2;
+      return true;
+    }
+    if (!automatic) {
+      cerr << "Error: this CPU does not support AVX2" << endl;
+      return false;
+    }
+  }
+  if (automatic || strcmp(name, "sse") == 0) {
+    if (__builtin_cpu_supports("sse2")) {
+      g_partial_tile_fn = RasterizePartialTileSSE;
+      return true;
+    }
+    if (!automatic) {
+      cerr << "Error: this CPU does not support SSE2" << endl;
+      return false;
+    }
+  }
+#else
+  if (strcmp(name, "avx2") == 0 || strcmp(name, "sse") == 0) {
+    cerr << "Error: " << name << " rasterization needs an x86 host" << endl;
+    return false;
+  }
+#endif // RASTERIZER_X86
+  if (automatic || strcmp(name, "scalar") == 0) {
+    g_partial_tile_fn = RasterizePartialTileScalar;
+    return true;
+  }
+  cerr << "Error: unknown rasterizer " << name << endl;
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Fill one 8x8 tile: reject it or fill it whole from the edge values
+//       at its corners, and only evaluate partially covered tiles per pixel
+////////////////////////////////////////////////////////////////////////
+static void RasterizeTile(Framebuffer &framebuffer, const Edge *edges, const int tile_x,
+                          const int tile_y, const uint32_t color)
+{
+  const int x = tile_x * TILE_SIZE;
+  const int y = tile_y * TILE_SIZE;
+  const int span = TILE_SIZE - 1;
+
+  int origin[3];
+  bool inside = true;
+  for (int i = 0; i < 3; i++) {
+    origin[i] = EvaluateEdge(edges[i], x, y);
+    int low = origin[i] + (edges[i].a < 0 ? edges[i].a * span : 0) + (edges[i].b < 0 ? edges[i].b * span : 0);
+    int high = origin[i] + (edges[i].a > 0 ? edges[i].a * span : 0) + (edges[i].b > 0 ? edges[i].b * span : 0);
+    if (high < 0)
+      return;
+    if (low < 0)
+      inside = false;
+  }
+
+  uint32_t *tile = FramebufferTile(framebuffer, tile_x, tile_y);
+  framebuffer.tile_written[tile_y * NUM_TILES_X + tile_x] = true;
+  if (inside) {
+    for (int i = 0; i < TILE_PIXELS; i++)
+      tile[i] = color;
+    return;
+  }
+
+  g_partial_tile_fn(edges, origin, tile, color);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Fill the part of a triangle inside clip: every pixel on or inside
+//       all three edges
+////////////////////////////////////////////////////////////////////////
+static void RasterizeTriangle(Framebuffer &framebuffer, int x0, int y0, int x1, int y1,
+                              int x2, int y2, const uint32_t color, const ClipRect &clip)
+{
+  int area = (x1 - x0) * (y2 - y0) - (y1 - y0) * (x2 - x0);
+  if (area == 0)
+    return;
+  if (area < 0) {
+    int t = x1; x1 = x2; x2 = t;
+    t = y1; y1 = y2; y2 = t;
+  }
+
+  int min_x = x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2);
+  int max_x = x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2);
+  int min_y = y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2);
+  int max_y = y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2);
+  min_x = Clamp(min_x, clip.min_x, clip.max_x);
+  max_x = Clamp(max_x, clip.min_x, clip.max_x);
+  min_y = Clamp(min_y, clip.min_y, clip.max_y);
+  max_y = Clamp(max_y, clip.min_y, clip.max_y);
+  if (min_x > max_x || min_y > max_y)
+    return;
+
+  Edge edges[3];
+  edges[0] = SetupEdge(x0, y0, x1, y1);
+  edges[1] = SetupEdge(x1, y1, x2, y2);
+  edges[2] = SetupEdge(x2, y2, x0, y0);
+
+  for (int tile_y = min_y / TILE_SIZE; tile_y <= max_y / TILE_SIZE; tile_y++)
+    for (int tile_x = min_x / TILE_SIZE; tile_x <= max_x / TILE_SIZE; tile_x++)
+      RasterizeTile(framebuffer, edges, tile_x, tile_y, color);
+}
+
+void ExecuteRenderCommand(const RenderCommand &command, const ClipRect &clip)
+{
+  if (command.type == RENDER_TRIANGLE)
+    RasterizeTriangle(*command.framebuffer, command.x[0], command.y[0], command.x[1], command.y[1],
+                      command.x[2], command.y[2], command.color, clip);
+  else if (command.type == RENDER_LINE)
+    RasterizeLine(*command.framebuffer, command.x[0], command.y[0], command.x[1], command.y[1],
+                  command.color, clip);
+}
+
+Framebuffer *NewFramebuffer()
+{
+  Framebuffer *framebuffer = new Framebuffer;
+  memset(framebuffer, 0x00, sizeof(Framebuffer));
+  return framebuffer;
+}
+
+Framebuffer &MachineFramebuffer(Machine &machine)
+{
+  if (machine.framebuffer == NULL)
+    machine.framebuffer = NewFramebuffer();
+  return *machine.framebuffer;
+}
+
+void ClearFramebuffer(Framebuffer &framebuffer)
+{
+  if (g_render_pipeline_active)
+    SyncRenderPipeline();
+
+  for (int i = 0; i < NUM_TILES_X * NUM_TILES_Y; i++) {
+    if (framebuffer.tile_written[i]) {
+      memset(&framebuffer.pixels[i * TILE_PIXELS], 0x00, TILE_PIXELS * sizeof(uint32_t));
+      framebuffer.tile_written[i] = false;
+    }
+  }
+}
+
+void DrawPrimitive(Framebuffer &framebuffer, const VertexRegister *vertices, const int gpu_status)
+{
+  RenderCommand command;
+  command.framebuffer = &framebuffer;
+  // BEGINPRIMITIVE sets GSR[2] for triangles and GSR[3] for lines
+  if (gpu_status & (1 << PRIM_TYPE0))
+    command.type = RENDER_TRIANGLE;
+  else if (gpu_status & (1 << PRIM_TYPE1))
+    command.type = RENDER_LINE;
+  else
+    return;
+
+  for (int i = 0; i < NUM_VERTEX_REGISTER; i++) {
+    command.x[i] = Clamp(vertices[i].x_value, -GUARD_BAND, GUARD_BAND);
+    command.y[i] = Clamp(vertices[i].y_value, -GUARD_BAND, GUARD_BAND);
+  }
+  command.color = Clamp(vertices[0].r_value, 0, 255) << 16
+                | Clamp(vertices[0].g_value, 0, 255) << 8
+                | Clamp(vertices[0].b_value, 0, 255);
+
+  if (g_partial_tile_fn == NULL)
+    SelectRasterizerPath("auto");
+
+  if (g_render_pipeline_active) {
+    SubmitRenderCommand(command);
+  } else {
+    const ClipRect screen = {0, 0, FRAMEBUFFER_WIDTH - 1, FRAMEBUFFER_HEIGHT - 1};
+    ExecuteRenderCommand(command, screen);
+  }
+}
+
+bool WriteFramebufferPPM(const Framebuffer &framebuffer, const char *path)
+{
+  if (g_render_pipeline_active)
+    SyncRenderPipeline();
+
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    cerr << "Error: cannot create " << path << endl;
+    return false;
+  }
+
+  fprintf(file, "P6\n%d %d\n255\n", FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT);
+  vector<unsigned char> row(FRAMEBUFFER_WIDTH * 3);
+  bool ok = true;
+  for (int y = FRAMEBUFFER_HEIGHT - 1; y >= 0 && ok; y--) {
+    for (int x = 0; x < FRAMEBUFFER_WIDTH; x++) {
+      uint32_t pixel = framebuffer.pixels[((y / TILE_SIZE) * NUM_TILES_X + x / TILE_SIZE) * TILE_PIXELS
+                                          + (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE];
+      row[3 * x] = pixel >> 16;
+      row[3 * x + 1] = pixel >> 8;
+      row[3 * x + 2] = pixel;
+    }
+    ok = fwrite(&row[0], 1, row.size(), file) == row.size();
+  }
+  if (fclose(file) != 0)
+    ok = false;
+  if (!ok)
+    cerr << "Error: failed to write " << path << endl;
+  return ok;
+}
@@ -0,0 +1,111 @@
+#ifndef __RASTERIZER_H
+#define __RASTERIZER_H
+
+#include <stdint.h>
+#include "simulator.h"
+
+#define FRAMEBUFFER_WIDTH 640
+#define FRAMEBUFFER_HEIGHT 480
+
+////////////////////////////////////////////////////////////////////////
+// The framebuffer is stored as 8x8 pixel tiles, row-major within a tile
+// and tiles row-major across the screen, so a triangle touches a few
+// contiguous 256-byte blocks instead of one cache line per scanline.
+// Pixels are 0x00RRGGBB; y = 0 is the bottom row.
+////////////////////////////////////////////////////////////////////////
+#define TILE_SIZE 8
+#define TILE_PIXELS (TILE_SIZE * TILE_SIZE)
+#define NUM_TILES_X (FRAMEBUFFER_WIDTH / TILE_SIZE)
+#define NUM_TILES_Y (FRAMEBUFFER_HEIGHT / TILE_SIZE)
+
+// Triangle vertices are clamped to +/-GUARD_BAND so edge functions fit in 32 bits
+#define GUARD_BAND 8192
+
+typedef struct Framebuffer_ {
+  uint32_t pixels[NUM_TILES_X * NUM_TILES_Y * TILE_PIXELS];
+  bool tile_written[NUM_TILES_X * NUM_TILES_Y];  // since the last ClearFramebuffer()
+} Framebuffer;
+
+static inline uint32_t *FramebufferTile(Framebuffer &framebuffer, const int tile_x, const int tile_y)
+{
+  return &framebuffer.pixels[(tile_y * NUM_TILES_X + tile_x) * TILE_PIXELS];
+}
+
+////////////////////////////////////////////////////////////////////////
+// One primitive to rasterize into framebuffer: vertex coordinates
+// already clamped to the guard band, color as 0x00RRGGBB
+////////////////////////////////////////////////////////////////////////
+enum RenderCommandType {
+  RENDER_LINE = 0,
+  RENDER_TRIANGLE = 1,
+  RENDER_FENCE = 2,     // render pipeline only: complete everything before
+  RENDER_STOP = 3,      // render pipeline only: shut the workers down
+};
+
+typedef struct RenderCommand_ {
+  int type;
+  Framebuffer *framebuffer;
+  int x[NUM_VERTEX_REGISTER];
+  int y[NUM_VERTEX_REGISTER];
+  uint32_t color;
+} RenderCommand;
+
+////////////////////////////////////////////////////////////////////////
+// Inclusive pixel rectangle; triangle clips must be tile aligned
+////////////////////////////////////////////////////////////////////////
+typedef struct ClipRect_ {
+  int min_x;
+  int min_y;
+  int max_x;
+  int max_y;
+} ClipRect;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Rasterize the part of one line or triangle that lies inside clip.
+//       Rendering disjoint clips of the same command on different
+//       threads is safe.
+////////////////////////////////////////////////////////////////////////
+void ExecuteRenderCommand(const RenderCommand &command, const ClipRect &clip);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Choose how partially covered triangle tiles are evaluated:
+//       "avx2" (8 pixels per step), "sse" (4), "scalar", or "auto" to
+//       pick the widest one CPUID reports. Without a call, the first
+//       triangle selects "auto".
+// output: false if the name is unknown or the CPU lacks the extension
+////////////////////////////////////////////////////////////////////////
+bool SelectRasterizerPath(const char *name);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Allocate a black framebuffer
+////////////////////////////////////////////////////////////////////////
+Framebuffer *NewFramebuffer();
+
+////////////////////////////////////////////////////////////////////////
+// desc: The machine's framebuffer, allocated on first use
+////////////////////////////////////////////////////////////////////////
+Framebuffer &MachineFramebuffer(Machine &machine);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Clear the framebuffer to black (OP_FLUSH). Only tiles written
+//       since the last clear are touched. With the render pipeline
+//       running, waits for every submitted primitive first.
+////////////////////////////////////////////////////////////////////////
+void ClearFramebuffer(Framebuffer &framebuffer);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Rasterize the primitive selected by BEGINPRIMITIVE (OP_DRAW):
+//       a line from vertex 0 to vertex 1, or the triangle of all three
+//       vertices, filled with the flat color set by SETCOLOR. With the
+//       render pipeline running, the primitive is only queued.
+// input: target framebuffer, GPU vertex registers and status register
+////////////////////////////////////////////////////////////////////////
+void DrawPrimitive(Framebuffer &framebuffer, const VertexRegister *vertices, const int gpu_status);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Write the framebuffer as a binary PPM (P6) image
+// output: false on error
+////////////////////////////////////////////////////////////////////////
+bool WriteFramebufferPPM(const Framebuffer &framebuffer, const char *path);
+
+#endif // __RASTERIZER_H
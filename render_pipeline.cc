@@ -0,0 +1,274 @@
+#include <iostream>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include "rasterizer.h"
+#include "render_pipeline.h"
+
+using namespace std;
+
+bool g_render_pipeline_active = false;
+
+///////////////////////////////////
+/// command queue (SPSC ring)   ///
+///////////////////////////////////
+
+static RenderCommand g_render_queue[RENDER_QUEUE_SIZE];
+static size_t g_render_queue_head = 0;      // next slot to fill, simulating thread
+static size_t g_render_queue_tail = 0;      // next slot to read, binner
+static bool g_binner_sleeping = false;
+static unsigned int g_fences_issued = 0;    // simulating thread only
+static unsigned int g_fences_completed = 0; // guarded by g_render_lock
+
+static pthread_mutex_t g_render_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_render_queue_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_render_fence_done = PTHREAD_COND_INITIALIZER;
+
+///////////////////////////////////
+/// binned batch                ///
+///////////////////////////////////
+
+static vector<RenderCommand> g_batch;
+static vector<int> g_bins[NUM_BINS_X * NUM_BINS_Y];  // indexes into g_batch
+static vector<int> g_active_bins;                    // bins with work, in first-use order
+static int g_next_bin = 0;                           // next entry of g_active_bins to take
+
+static pthread_t g_binner;
+static vector<pthread_t> g_render_workers;
+static unsigned int g_batch_generation = 0;  // guarded by g_worker_lock
+static int g_workers_busy = 0;               // guarded by g_worker_lock
+static bool g_workers_stop = false;          // guarded by g_worker_lock
+static pthread_mutex_t g_worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_batch_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_batch_done = PTHREAD_COND_INITIALIZER;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Take the next command, sleeping while the queue is empty
+////////////////////////////////////////////////////////////////////////
+static RenderCommand PopRenderCommand()
+{
+  const size_t tail = g_render_queue_tail;
+  if (__atomic_load_n(&g_render_queue_head, __ATOMIC_ACQUIRE) == tail) {
+    pthread_mutex_lock(&g_render_lock);
+    __atomic_store_n(&g_binner_sleeping, true, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&g_render_queue_head, __ATOMIC_SEQ_CST) == tail)
+      pthread_cond_wait(&g_render_queue_ready, &g_render_lock);
+    __atomic_store_n(&g_binner_sleeping, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&g_render_lock);
+  }
+
+  RenderCommand command = g_render_queue[tail & (RENDER_QUEUE_SIZE - 1)];
+  __atomic_store_n(&g_render_queue_tail, tail + 1, __ATOMIC_RELEASE);
+  return command;
+}
+
+void SubmitRenderCommand(const RenderCommand &command)
+{
+  const size_t head = g_render_queue_head;
+  while (head - __atomic_load_n(&g_render_queue_tail, __ATOMIC_ACQUIRE) == RENDER_QUEUE_SIZE)
+    sched_yield();
+
+  g_render_queue[head & (RENDER_QUEUE_SIZE - 1)] = command;
+  // Pairs with the binner publishing g_binner_sleeping before re-reading
+  // the head: at least one side sees the other's store
+  __atomic_store_n(&g_render_queue_head, head + 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&g_binner_sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&g_render_lock);
+    pthread_cond_signal(&g_render_queue_ready);
+    pthread_mutex_unlock(&g_render_lock);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Append a primitive to the batch and to every bin its bounding
+//       box overlaps
+////////////////////////////////////////////////////////////////////////
+static void BinCommand(const RenderCommand &command)
+{
+  const int num_vertices = command.type == RENDER_TRIANGLE ? 3 : 2;
+  int min_x = command.x[0], max_x = command.x[0];
+  int min_y = command.y[0], max_y = command.y[0];
+  for (int i = 1; i < num_vertices; i++) {
+    min_x = command.x[i] < min_x ? command.x[i] : min_x;
+    max_x = command.x[i] > max_x ? command.x[i] : max_x;
+    min_y = command.y[i] < min_y ? command.y[i] : min_y;
+    max_y = command.y[i] > max_y ? command.y[i] : max_y;
+  }
+  if (max_x < 0 || max_y < 0 || min_x >= FRAMEBUFFER_WIDTH || min_y >= FRAMEBUFFER_HEIGHT)
+    return;
+  min_x = min_x < 0 ? 0 : min_x;
+  min_y = min_y < 0 ? 0 : min_y;
+  max_x = max_x >= FRAMEBUFFER_WIDTH ? FRAMEBUFFER_WIDTH - 1 : max_x;
+  max_y = max_y >= FRAMEBUFFER_HEIGHT ? FRAMEBUFFER_HEIGHT - 1 : max_y;
+
+  const int index = g_batch.size();
+  g_batch.push_back(command);
+  for (int bin_y = min_y / BIN_SIZE; bin_y <= max_y / BIN_SIZE; bin_y++) {
+    for (int bin_x = min_x / BIN_SIZE; bin_x <= max_x / BIN_SIZE; bin_x++) {
+      vector<int> &bin = g_bins[bin_y * NUM_BINS_X + bin_x];
+      if (bin.empty())
+        g_active_bins.push_back(bin_y * NUM_BINS_X + bin_x);
+      bin.push_back(index);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Render bins of the current batch until none are left; run by the
+//       binner and every worker
+////////////////////////////////////////////////////////////////////////
+static void RenderBins()
+{
+  const int num_active = g_active_bins.size();
+  for (;;) {
+    int i = __atomic_fetch_add(&g_next_bin, 1, __ATOMIC_RELAXED);
+    if (i >= num_active)
+      break;
+
+    const int bin = g_active_bins[i];
+    ClipRect clip;
+    clip.min_x = (bin % NUM_BINS_X) * BIN_SIZE;
+    clip.min_y = (bin / NUM_BINS_X) * BIN_SIZE;
+    clip.max_x = clip.min_x + BIN_SIZE - 1 < FRAMEBUFFER_WIDTH ? clip.min_x + BIN_SIZE - 1 : FRAMEBUFFER_WIDTH - 1;
+    clip.max_y = clip.min_y + BIN_SIZE - 1 < FRAMEBUFFER_HEIGHT ? clip.min_y + BIN_SIZE - 1 : FRAMEBUFFER_HEIGHT - 1;
+
+    const vector<int> &commands = g_bins[bin];
+    for (size_t j = 0; j < commands.size(); j++)
+      ExecuteRenderCommand(g_batch[commands[j]], clip);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Render the batch with every worker and wait until all of them
+//       are done with it
+////////////////////////////////////////////////////////////////////////
+static void RenderBatch()
+{
+  if (g_batch.empty())
+    return;
+
+  g_next_bin = 0;
+  pthread_mutex_lock(&g_worker_lock);
+  g_batch_generation++;
+  g_workers_busy = g_render_workers.size();
+  pthread_cond_broadcast(&g_batch_ready);
+  pthread_mutex_unlock(&g_worker_lock);
+
+  RenderBins();
+
+  pthread_mutex_lock(&g_worker_lock);
+  while (g_workers_busy > 0)
+    pthread_cond_wait(&g_batch_done, &g_worker_lock);
+  pthread_mutex_unlock(&g_worker_lock);
+
+  for (size_t i = 0; i < g_active_bins.size(); i++)
+    g_bins[g_active_bins[i]].clear();
+  g_active_bins.clear();
+  g_batch.clear();
+}
+
+static void *RenderWorkerMain(void *)
+{
+  unsigned int generation = 0;
+  pthread_mutex_lock(&g_worker_lock);
+  for (;;) {
+    while (g_batch_generation == generation && !g_workers_stop)
+      pthread_cond_wait(&g_batch_ready, &g_worker_lock);
+    if (g_workers_stop)
+      break;
+    generation = g_batch_generation;
+    pthread_mutex_unlock(&g_worker_lock);
+
+    RenderBins();
+
+    pthread_mutex_lock(&g_worker_lock);
+    if (--g_workers_busy == 0)
+      pthread_cond_signal(&g_batch_done);
+  }
+  pthread_mutex_unlock(&g_worker_lock);
+  return NULL;
+}
+
+static void *BinnerMain(void *)
+{
+  for (;;) {
+    RenderCommand command = PopRenderCommand();
+    if (command.type == RENDER_FENCE || command.type == RENDER_STOP) {
+      RenderBatch();
+      pthread_mutex_lock(&g_render_lock);
+      g_fences_completed++;
+      pthread_cond_broadcast(&g_render_fence_done);
+      pthread_mutex_unlock(&g_render_lock);
+      if (command.type == RENDER_STOP)
+        break;
+      continue;
+    }
+
+    BinCommand(command);
+    if (g_batch.size() >= RENDER_BATCH_SIZE)
+      RenderBatch();
+  }
+  return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Queue a fence or stop command and wait until the binner has
+//       rendered everything before it
+////////////////////////////////////////////////////////////////////////
+static void WaitForFence(const int type)
+{
+  RenderCommand fence;
+  fence.type = type;
+  unsigned int id = ++g_fences_issued;
+  SubmitRenderCommand(fence);
+
+  pthread_mutex_lock(&g_render_lock);
+  while (g_fences_completed < id)
+    pthread_cond_wait(&g_render_fence_done, &g_render_lock);
+  pthread_mutex_unlock(&g_render_lock);
+}
+
+bool StartRenderPipeline(const int num_threads)
+{
+  g_batch.reserve(RENDER_BATCH_SIZE);
+  g_workers_stop = false;
+  for (int i = 1; i < num_threads; i++) {
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, RenderWorkerMain, NULL) != 0) {
+      cerr << "Error: cannot start rasterizer worker threads" << endl;
+      StopRenderPipeline();
+      return false;
+    }
+    g_render_workers.push_back(worker);
+  }
+  if (pthread_create(&g_binner, NULL, BinnerMain, NULL) != 0) {
+    cerr << "Error: cannot start the binner thread" << endl;
+    StopRenderPipeline();
+    return false;
+  }
+
+  g_render_pipeline_active = true;
+  return true;
+}
+
+void SyncRenderPipeline()
+{
+  WaitForFence(RENDER_FENCE);
+}
+
+void StopRenderPipeline()
+{
+  if (g_render_pipeline_active) {
+    WaitForFence(RENDER_STOP);
+    pthread_join(g_binner, NULL);
+    g_render_pipeline_active = false;
+  }
+
+  pthread_mutex_lock(&g_worker_lock);
+  g_workers_stop = true;
+  pthread_cond_broadcast(&g_batch_ready);
+  pthread_mutex_unlock(&g_worker_lock);
+  for (size_t i = 0; i < g_render_workers.size(); i++)
+    pthread_join(g_render_workers[i], NULL);
+  g_render_workers.clear();
+}
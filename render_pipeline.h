@@ -0,0 +1,48 @@
+#ifndef __RENDER_PIPELINE_H
+#define __RENDER_PIPELINE_H
+
+#include "rasterizer.h"
+
+////////////////////////////////////////////////////////////////////////
+// Threaded rendering (--render-threads=N)
+//
+// The simulating thread pushes RenderCommands into a single-producer /
+// single-consumer ring and keeps executing. A binner thread pops them,
+// sorts each primitive into the screen bins (BIN_SIZE x BIN_SIZE pixel
+// groups of tiles) its bounding box touches and, once a batch is full or
+// a fence arrives, has the binner plus N-1 workers render the bins in
+// parallel. Primitives within a bin keep submission order, so the image
+// matches serial rendering exactly.
+////////////////////////////////////////////////////////////////////////
+
+#define RENDER_QUEUE_SIZE 16384   // commands, must be a power of two
+#define RENDER_BATCH_SIZE 4096    // primitives binned before rendering
+#define BIN_SIZE 64               // pixels, a multiple of TILE_SIZE
+#define NUM_BINS_X ((FRAMEBUFFER_WIDTH + BIN_SIZE - 1) / BIN_SIZE)
+#define NUM_BINS_Y ((FRAMEBUFFER_HEIGHT + BIN_SIZE - 1) / BIN_SIZE)
+
+extern bool g_render_pipeline_active;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Start the binner and num_threads - 1 rasterizer workers
+// output: false if a thread could not be created
+////////////////////////////////////////////////////////////////////////
+bool StartRenderPipeline(const int num_threads);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Queue one primitive. Only waits if the queue is full.
+////////////////////////////////////////////////////////////////////////
+void SubmitRenderCommand(const RenderCommand &command);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Barrier: return once every submitted primitive is in the
+//       framebuffer (OP_FLUSH, halt)
+////////////////////////////////////////////////////////////////////////
+void SyncRenderPipeline();
+
+////////////////////////////////////////////////////////////////////////
+// desc: Render what is left and join all threads
+////////////////////////////////////////////////////////////////////////
+void StopRenderPipeline();
+
+#endif // __RENDER_PIPELINE_H
@@ -7,43 +7,45 @@
 #include <string.h> 
 #include <cstring> 
 #include <limits.h> 
+#include <stdlib.h>
 // #include <cstdint> 
 #include "simulator.h"
+#include "loader.h"
+#include "threaded.h"
+#include "block_cache.h"
+#include "jit_x86.h"
+#include "trace.h"
+#include "trace_format.h"
+#include "rasterizer.h"
+#include "render_pipeline.h"
+#include "batch.h"
+#include "bench.h"
+#include "profile.h"
+#include "timing.h"
+#include "predictor.h"
+#include "data_cache.h"
+#include "checkpoint.h"
 
 
-#define FLOAT_TO_FIXED1114(n) ((int)((n) * (float)(1<<(4)))) & 0xffff
-#define FIXED_TO_FLOAT1114(n) ((float)(-1*((n>>15)&0x1)*(1<<11)) + (float)((n&(0x7fff)) / (float)(1<<4)))
-#define FIXED1114_TO_INT(n) (( (n>>15)&0x1) ?  ((n>>4)|0xf000) : (n>>4)) 
-#define DEBUG
-
 using namespace std;
 
 ///////////////////////////////////
 ///  architectural structures /// 
 ///////////////////////////////////
 
+__thread Machine *g_machine = NULL; // machine the engines on this thread run
 
-ScalarRegister g_condition_code_register; // store conditional code 
-ScalarRegister g_scalar_registers[NUM_SCALAR_REGISTER];  
-VectorRegister g_vector_registers[NUM_VECTOR_REGISTER];
-
-VertexRegister g_gpu_vertex_registers[NUM_VERTEX_REGISTER]; 
-ScalarRegister g_gpu_status_register; 
- 
-unsigned char g_memory[MEMORY_SIZE]; // data memory 
-
-////////////////////////////////////
+enum DumpMode {
+  DUMP_NONE = 0,
+  DUMP_FULL = 1,    // --dump: PrintContext() after every instruction
+  DUMP_DELTA = 2,   // --dump-delta: PrintContextDelta() after every instruction
+};
 
-vector<TraceOp> g_trace_ops;
-
-unsigned int g_instruction_count = 0;
-unsigned int g_vertex_id = 0; 
-unsigned int g_current_pc = 0; 
-unsigned int g_program_halt = 0; 
-unsigned int active_vertex_reg = 0;
+int g_dump_mode = DUMP_NONE;
+unsigned int g_dump_checkpoint_interval = 1000; // full context every N instructions in DUMP_DELTA
 
 ////////////////////////////////////////////////////////////////////////
-// desc: Set g_condition_code_register depending on the values of val1 and val2
+// desc: Set g_machine->condition_code_register depending on the values of val1 and val2
 // hint: bit0 (N) is set only when val1 < val2
 // bit 2: negative 
 // bit 1: zero
@@ -51,29 +53,108 @@ unsigned int active_vertex_reg = 0;
 ////////////////////////////////////////////////////////////////////////
 void SetConditionCodeInt(const int16_t val1, const int16_t val2) 
 {
+  g_machine->dirty_flags |= DIRTY_CC;
   if(val1 < val2) {
-    g_condition_code_register.int_value = 4;
+    g_machine->condition_code_register.int_value = 4;
   }
   else if(val1 == val2) {
-    g_condition_code_register.int_value = 2;
+    g_machine->condition_code_register.int_value = 2;
   }
   else {
-    g_condition_code_register.int_value = 1;
+    g_machine->condition_code_register.int_value = 1;
   }
 }
 
-////////////////////////////////////////////////////////////////////////
-// Initialize global variables
-////////////////////////////////////////////////////////////////////////
-void InitializeGlobalVariables() 
+Machine *NewMachine(const uint32_t memory_size)
+{
+  Machine *machine = new Machine;
+  machine->framebuffer = NULL;
+  if (!MapDataMemory(machine->memory, memory_size)) {
+    delete machine;
+    return NULL;
+  }
+  ResetMachine(*machine);
+  return machine;
+}
+
+void ResetMachine(Machine &machine)
+{
+  memset(&machine.condition_code_register, 0x00, sizeof(ScalarRegister));
+  memset(&machine.gpu_status_register, 0x00, sizeof(ScalarRegister));
+  memset(machine.scalar_registers, 0x00, sizeof(ScalarRegister) * NUM_SCALAR_REGISTER);
+  memset(machine.vector_registers, 0x00, sizeof(VectorRegister) * NUM_VECTOR_REGISTER);
+  memset(machine.gpu_vertex_registers, 0x00, sizeof(VertexRegister) * NUM_VERTEX_REGISTER);
+  ClearDataMemory(machine.memory);
+  machine.active_vertex_reg = 0;
+  ResetTransform(machine.transform);
+  machine.trace_ops.clear();
+  machine.base = NULL;
+  machine.instruction_count = 0;
+  machine.current_pc = 0;
+  machine.program_halt = 0;
+  machine.fault = FAULT_NONE;
+  machine.fault_pc = 0;
+  machine.fault_address = 0;
+  machine.dirty_scalar_mask = 0;
+  machine.dirty_vector_mask = 0;
+  machine.dirty_flags = 0;
+  if (machine.framebuffer != NULL)
+    ClearFramebuffer(*machine.framebuffer);
+}
+
+void TakeSnapshot(const Machine &machine, MachineSnapshot &snapshot)
+{
+  snapshot.condition_code_register = machine.condition_code_register;
+  memcpy(snapshot.scalar_registers, machine.scalar_registers, sizeof(snapshot.scalar_registers));
+  memcpy(snapshot.vector_registers, machine.vector_registers, sizeof(snapshot.vector_registers));
+  memcpy(snapshot.gpu_vertex_registers, machine.gpu_vertex_registers, sizeof(snapshot.gpu_vertex_registers));
+  snapshot.gpu_status_register = machine.gpu_status_register;
+  snapshot.active_vertex_reg = machine.active_vertex_reg;
+  snapshot.trace_ops = machine.trace_ops;
+  SaveDataMemory(machine.memory, snapshot.memory);
+}
+
+void ForkMachine(Machine &machine, const MachineSnapshot &snapshot)
+{
+  machine.condition_code_register = snapshot.condition_code_register;
+  memcpy(machine.scalar_registers, snapshot.scalar_registers, sizeof(machine.scalar_registers));
+  memcpy(machine.vector_registers, snapshot.vector_registers, sizeof(machine.vector_registers));
+  memcpy(machine.gpu_vertex_registers, snapshot.gpu_vertex_registers, sizeof(machine.gpu_vertex_registers));
+  machine.gpu_status_register = snapshot.gpu_status_register;
+  machine.active_vertex_reg = snapshot.active_vertex_reg;
+  ResetTransform(machine.transform);
+  ForkDataMemory(machine.memory, snapshot.memory);
+  if (machine.base != &snapshot) {
+    machine.trace_ops = snapshot.trace_ops;
+    machine.base = &snapshot;
+  }
+  machine.instruction_count = 0;
+  machine.current_pc = 0;
+  machine.program_halt = 0;
+  machine.fault = FAULT_NONE;
+  machine.fault_pc = 0;
+  machine.fault_address = 0;
+  machine.dirty_scalar_mask = 0;
+  machine.dirty_vector_mask = 0;
+  machine.dirty_flags = 0;
+  if (machine.framebuffer != NULL)
+    ClearFramebuffer(*machine.framebuffer);
+}
+
+void DeleteMachine(Machine *machine)
 {
-  g_vertex_id = 0;  // internal setting variables 
-  memset(&g_condition_code_register, 0x00, sizeof(ScalarRegister));
-  memset(&g_gpu_status_register, 0x00, sizeof(ScalarRegister));
-  memset(g_scalar_registers, 0x00, sizeof(ScalarRegister) * NUM_SCALAR_REGISTER);
-  memset(g_vector_registers, 0x00, sizeof(VectorRegister) * NUM_VECTOR_REGISTER);
-  memset(g_gpu_vertex_registers, 0x00, sizeof(VertexRegister) * NUM_VERTEX_REGISTER);
-  memset(g_memory, 0x00, sizeof(unsigned char) * MEMORY_SIZE);
+  UnmapDataMemory(machine->memory);
+  delete machine->framebuffer;
+  delete machine;
+}
+
+void RaiseMemoryFault(const int pc, const int address)
+{
+  g_machine->fault = FAULT_MEMORY;
+  g_machine->fault_pc = pc;
+  g_machine->fault_address = address;
+  cerr << "Error: data access out of range at PC " << pc << ": address " << address
+       << ", memory size " << g_machine->memory.size << endl;
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -326,7 +407,7 @@ TraceOp DecodeInstruction(const uint32_t instruction)
     }
     break;
 
-    case OP_ROTATE:  // optional 
+    case OP_ROTATE:
     {
       int destination_register_idx = (instruction & 0x003F0000) >> 16;
       ret_trace_op.vector_registers[0] = destination_register_idx;
@@ -340,15 +421,15 @@ TraceOp DecodeInstruction(const uint32_t instruction)
     }
     break;
 
-    case OP_SCALE:  // optional 
+    case OP_SCALE:
     {
       int destination_register_idx = (instruction & 0x003F0000) >> 16;
       ret_trace_op.vector_registers[0] = destination_register_idx;
     }
     break;
     
-    case OP_PUSHMATRIX:       // deprecated 
-    case OP_POPMATRIX:   // deprecated 
+    case OP_PUSHMATRIX:
+    case OP_POPMATRIX:
     case OP_BEGINPRIMITIVE: 
     {
       int prim = (instruction & 0x000F0000) >> 16;
@@ -357,7 +438,7 @@ TraceOp DecodeInstruction(const uint32_t instruction)
     break;
 
     case OP_ENDPRIMITIVE:  //deprecated
-    case OP_LOADIDENTITY:  // deprecated 
+    case OP_LOADIDENTITY:
     case OP_FLUSH: 
     case OP_DRAW: 
     case OP_BRN: 
@@ -452,11 +533,12 @@ int ExecuteInstruction(const TraceOp &trace_op)
   switch (opcode) {
     case OP_ADD_D: 
       {
-      int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
-      int source_value_2 = g_scalar_registers[trace_op.scalar_registers[2]].int_value;
-      g_scalar_registers[trace_op.scalar_registers[0]].int_value = 
+      int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
+      int source_value_2 = g_machine->scalar_registers[trace_op.scalar_registers[2]].int_value;
+      g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value = 
         source_value_1 + source_value_2;
-      SetConditionCodeInt(g_scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
+      MarkScalarDirty(trace_op.scalar_registers[0]);
+      SetConditionCodeInt(g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
     }
 
     break;
@@ -466,75 +548,79 @@ int ExecuteInstruction(const TraceOp &trace_op)
 
     case OP_ADD_F:
       {
-      int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
-      int source_value_2 = g_scalar_registers[trace_op.scalar_registers[2]].int_value;
+      int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
+      int source_value_2 = g_machine->scalar_registers[trace_op.scalar_registers[2]].int_value;
 
-      g_scalar_registers[trace_op.scalar_registers[0]].int_value = 
-        source_value_1 + source_value_2;
-      SetConditionCodeInt(g_scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
+      g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value = 
+        Fixed1114Add(source_value_1, source_value_2);
+      MarkScalarDirty(trace_op.scalar_registers[0]);
+      SetConditionCodeInt(g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
       }  
       break;
     case OP_ADDI_D:
       {
-        int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
+        int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
         int source_value_2 = trace_op.int_value;
-        g_scalar_registers[trace_op.scalar_registers[0]].int_value = 
+        g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value = 
           source_value_1 + source_value_2;
-        SetConditionCodeInt(g_scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
+        MarkScalarDirty(trace_op.scalar_registers[0]);
+        SetConditionCodeInt(g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
       }
 
       break;
     case OP_ADDI_F: 
     {
-      int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
+      int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
         int source_value_2 = trace_op.int_value;
 
 
-        g_scalar_registers[trace_op.scalar_registers[0]].int_value = 
-          source_value_1 + source_value_2;
-        SetConditionCodeInt(g_scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
+        g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value = 
+          Fixed1114Add(source_value_1, source_value_2);
+        MarkScalarDirty(trace_op.scalar_registers[0]);
+        SetConditionCodeInt(g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
     }
     break;
     case OP_VADD:
     {
-      for(int count = 0; count < 4; count++) {
-          int source_value_1 = g_vector_registers[trace_op.vector_registers[1]].element[count].int_value;
-          int source_value_2 = g_vector_registers[trace_op.vector_registers[2]].element[count].int_value;
-          g_vector_registers[trace_op.vector_registers[0]].element[count].int_value = 
-            source_value_1 + source_value_2;
-        }
+      Fixed1114AddLanes(&g_machine->vector_registers[trace_op.vector_registers[0]].element[0].int_value,
+                        &g_machine->vector_registers[trace_op.vector_registers[1]].element[0].int_value,
+                        &g_machine->vector_registers[trace_op.vector_registers[2]].element[0].int_value);
+      MarkVectorDirty(trace_op.vector_registers[0]);
     }
 
     break;
 
     case OP_AND_D:
     {
-      int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
-      int source_value_2 = g_scalar_registers[trace_op.scalar_registers[2]].int_value;
-      g_scalar_registers[trace_op.scalar_registers[0]].int_value = 
+      int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
+      int source_value_2 = g_machine->scalar_registers[trace_op.scalar_registers[2]].int_value;
+      g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value = 
         source_value_1 & source_value_2;
-      SetConditionCodeInt(g_scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
+      MarkScalarDirty(trace_op.scalar_registers[0]);
+      SetConditionCodeInt(g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
     }
 
     break;
 
     case OP_ANDI_D:
     {
-      int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
+      int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
       int source_value_2 = trace_op.int_value;
-      g_scalar_registers[trace_op.scalar_registers[0]].int_value = 
+      g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value = 
         source_value_1 & source_value_2;
-      SetConditionCodeInt(g_scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
+      MarkScalarDirty(trace_op.scalar_registers[0]);
+      SetConditionCodeInt(g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
     }
 
     break;
 
     case OP_MOV:
     {
-      int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
-      g_scalar_registers[trace_op.scalar_registers[0]].int_value = source_value_1;
+      int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
+      g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value = source_value_1;
+      MarkScalarDirty(trace_op.scalar_registers[0]);
 
-      SetConditionCodeInt(g_scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
+      SetConditionCodeInt(g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
     }
 
     break;
@@ -542,31 +628,28 @@ int ExecuteInstruction(const TraceOp &trace_op)
     case OP_MOVI_D:
     {
       int source_value_1 = trace_op.int_value;
-      g_scalar_registers[trace_op.scalar_registers[0]].int_value = source_value_1;
+      g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value = source_value_1;
+      MarkScalarDirty(trace_op.scalar_registers[0]);
 
-      SetConditionCodeInt(g_scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
+      SetConditionCodeInt(g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
     }
 
     break;
     case OP_MOVI_F: 
     {
       int source_value_1 = trace_op.int_value;
-      g_scalar_registers[trace_op.scalar_registers[0]].int_value = source_value_1;
+      g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value = source_value_1;
+      MarkScalarDirty(trace_op.scalar_registers[0]);
 
-      SetConditionCodeInt(g_scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
+      SetConditionCodeInt(g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
     }
+    break;
     case OP_VMOV:
     {
-      // int idxD = trace_op.vector_registers[0];
-      // int idx = trace_op.vector_registers[1];
-      // ScalarRegister* dest = g_vector_registers[idxD].element;
-      // ScalarRegister* src = g_vector_registers[idx].element;
-
-      // memcpy(dest, src, sizeof(ScalarRegister)*4);
       int idx = trace_op.vector_registers[0];
-      for(int count = 0; count < 4; count++) {
-           g_vector_registers[idx].element[count].int_value = g_vector_registers[trace_op.vector_registers[1]].element[count].int_value;
-      }
+      CopyLanes(&g_machine->vector_registers[idx].element[0].int_value,
+                &g_machine->vector_registers[trace_op.vector_registers[1]].element[0].int_value);
+      MarkVectorDirty(idx);
     } 
 
     break;
@@ -574,17 +657,16 @@ int ExecuteInstruction(const TraceOp &trace_op)
     case OP_VMOVI: 
     {
       int idx = trace_op.vector_registers[0];
-      for(int count = 0; count < 4; count++) {
-           g_vector_registers[idx].element[count].int_value = trace_op.int_value;
-        }
+      FillLanes(&g_machine->vector_registers[idx].element[0].int_value, trace_op.int_value);
+      MarkVectorDirty(idx);
     }
 
     break;
 
     case OP_CMP:
     {
-      int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
-      int source_value_2 = g_scalar_registers[trace_op.scalar_registers[2]].int_value;
+      int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
+      int source_value_2 = g_machine->scalar_registers[trace_op.scalar_registers[2]].int_value;
 
       int value = 0;
 
@@ -601,7 +683,7 @@ int ExecuteInstruction(const TraceOp &trace_op)
     break;
     case OP_CMPI:
     {
-      int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
+      int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
       int source_value_2 = trace_op.int_value;
 
       int value = 0;
@@ -620,9 +702,10 @@ int ExecuteInstruction(const TraceOp &trace_op)
     case OP_VCOMPMOV: 
     {
       int idx = trace_op.vector_registers[0];
-      int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
-      g_vector_registers[idx].element[trace_op.idx].int_value = 
-        source_value_1;
+      int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
+      g_machine->vector_registers[idx].element[trace_op.idx].int_value = 
+        Fixed1114Bits(source_value_1);
+      MarkVectorDirty(idx);
     }
 
     break;
@@ -631,140 +714,192 @@ int ExecuteInstruction(const TraceOp &trace_op)
     {
       int source_value_1 = trace_op.int_value;
       int idx = trace_op.vector_registers[0];
-      g_vector_registers[idx].element[trace_op.idx].int_value = 
+      g_machine->vector_registers[idx].element[trace_op.idx].int_value = 
         source_value_1;
+      MarkVectorDirty(idx);
     }
 
     break;
 
     case OP_LDB:
     {
-      int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
+      int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
       int source_value_2 = trace_op.int_value;
-      g_scalar_registers[trace_op.scalar_registers[0]].int_value = g_memory[source_value_1 + source_value_2];
+      int address = source_value_1 + source_value_2;
+      if (!MemoryInRange(g_machine->memory, address, 1)) {
+        RaiseMemoryFault(g_machine->scalar_registers[PC_IDX].int_value, address);
+        break;
+      }
+      if (g_data_cache_enabled)
+        DataCacheAccess(g_machine->scalar_registers[PC_IDX].int_value, address, 1, false);
+      g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value = g_machine->memory.bytes[address];
+      MarkScalarDirty(trace_op.scalar_registers[0]);
 
-      SetConditionCodeInt(g_scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
+      SetConditionCodeInt(g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
     }
 
     break;
 
     case OP_LDW:
     {
-      int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
+      int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
       int source_value_2 = trace_op.int_value;
-      int dest = g_memory[source_value_1 + source_value_2 + 1] << 8 | g_memory[source_value_1 + source_value_2];
-      g_scalar_registers[trace_op.scalar_registers[0]].int_value = dest;
+      int address = source_value_1 + source_value_2;
+      if (!MemoryInRange(g_machine->memory, address, 2)) {
+        RaiseMemoryFault(g_machine->scalar_registers[PC_IDX].int_value, address);
+        break;
+      }
+      if (g_data_cache_enabled)
+        DataCacheAccess(g_machine->scalar_registers[PC_IDX].int_value, address, 2, false);
+      int dest = g_machine->memory.bytes[address + 1] << 8 | g_machine->memory.bytes[address];
+      g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value = dest;
+      MarkScalarDirty(trace_op.scalar_registers[0]);
       
-      SetConditionCodeInt(g_scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
+      SetConditionCodeInt(g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value, 0);
     }
 
     break;
 
     case OP_STB:
     {
-      int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
+      int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
       int source_value_2 = trace_op.int_value;
-      g_memory[source_value_1 + source_value_2] = g_scalar_registers[trace_op.scalar_registers[0]].int_value;
+      int address = source_value_1 + source_value_2;
+      if (!MemoryInRange(g_machine->memory, address, 1)) {
+        RaiseMemoryFault(g_machine->scalar_registers[PC_IDX].int_value, address);
+        break;
+      }
+      if (g_data_cache_enabled)
+        DataCacheAccess(g_machine->scalar_registers[PC_IDX].int_value, address, 1, true);
+      g_machine->memory.bytes[address] = g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value;
+      MarkPageWritten(g_machine->memory, address);
     }
 
     break;
 
     case OP_STW:
     {
-      int source_value_1 = g_scalar_registers[trace_op.scalar_registers[1]].int_value;
+      int source_value_1 = g_machine->scalar_registers[trace_op.scalar_registers[1]].int_value;
       int source_value_2 = trace_op.int_value;
-      int value = g_scalar_registers[trace_op.scalar_registers[0]].int_value;
-      g_memory[source_value_1 + source_value_2 + 1]  = value >> 8;
-      g_memory[source_value_1 + source_value_2]  = value & 0x00FF;
+      int address = source_value_1 + source_value_2;
+      if (!MemoryInRange(g_machine->memory, address, 2)) {
+        RaiseMemoryFault(g_machine->scalar_registers[PC_IDX].int_value, address);
+        break;
+      }
+      if (g_data_cache_enabled)
+        DataCacheAccess(g_machine->scalar_registers[PC_IDX].int_value, address, 2, true);
+      int value = g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value;
+      g_machine->memory.bytes[address + 1]  = value >> 8;
+      g_machine->memory.bytes[address]  = value & 0x00FF;
+      MarkPageWritten(g_machine->memory, address);
+      MarkPageWritten(g_machine->memory, address + 1);
     }
 
     break;
 
     case OP_SETVERTEX: 
     {
-      int x = g_vector_registers[trace_op.vector_registers[0]].element[1].int_value;
-      int y = g_vector_registers[trace_op.vector_registers[0]].element[2].int_value;
-      int z = g_vector_registers[trace_op.vector_registers[0]].element[3].int_value;
-
-
-      g_gpu_vertex_registers[active_vertex_reg].x_value = x >> 4;
-      g_gpu_vertex_registers[active_vertex_reg].y_value = y >> 4;
-      g_gpu_vertex_registers[active_vertex_reg].z_value = z >> 4;
-      active_vertex_reg ++;
-      if(active_vertex_reg > 2)
+      int x = g_machine->vector_registers[trace_op.vector_registers[0]].element[1].int_value;
+      int y = g_machine->vector_registers[trace_op.vector_registers[0]].element[2].int_value;
+      int z = g_machine->vector_registers[trace_op.vector_registers[0]].element[3].int_value;
+      int position[3];
+      TransformVertex(g_machine->transform, x, y, z, position);
+
+      g_machine->gpu_vertex_registers[g_machine->active_vertex_reg].x_value = position[0];
+      g_machine->gpu_vertex_registers[g_machine->active_vertex_reg].y_value = position[1];
+      g_machine->gpu_vertex_registers[g_machine->active_vertex_reg].z_value = position[2];
+      g_machine->active_vertex_reg ++;
+      if(g_machine->active_vertex_reg > 2)
       {
-        active_vertex_reg = 0;
+        g_machine->active_vertex_reg = 0;
       }
+      g_machine->dirty_flags |= DIRTY_VERTEX;
 
     }
     break;
     case OP_SETCOLOR:
     {
-      int r = g_vector_registers[trace_op.vector_registers[0]].element[0].int_value;
-      int g = g_vector_registers[trace_op.vector_registers[0]].element[1].int_value;
-      int b = g_vector_registers[trace_op.vector_registers[0]].element[2].int_value;
+      int r = g_machine->vector_registers[trace_op.vector_registers[0]].element[0].int_value;
+      int g = g_machine->vector_registers[trace_op.vector_registers[0]].element[1].int_value;
+      int b = g_machine->vector_registers[trace_op.vector_registers[0]].element[2].int_value;
 
 
-      g_gpu_vertex_registers[0].r_value = (r >> 4);
-      g_gpu_vertex_registers[0].g_value = (g >> 4);
-      g_gpu_vertex_registers[0].b_value = (b >> 4);
+      g_machine->gpu_vertex_registers[0].r_value = Fixed1114ToInt(r);
+      g_machine->gpu_vertex_registers[0].g_value = Fixed1114ToInt(g);
+      g_machine->gpu_vertex_registers[0].b_value = Fixed1114ToInt(b);
+      g_machine->dirty_flags |= DIRTY_VERTEX;
     }
     break;
-    case OP_ROTATE:  // optional 
+    // Transforms compose into the current matrix; vertices already set
+    // are not moved (see transform.h)
+    case OP_ROTATE:
+    {
+      const VectorRegister &angle = g_machine->vector_registers[trace_op.vector_registers[0]];
+      RotateMatrix(g_machine->transform, angle.element[0].int_value);
+    }
     break;
     case OP_TRANSLATE:
     {
-      g_gpu_vertex_registers[0].x_value += FIXED1114_TO_INT(g_vector_registers[trace_op.vector_registers[0]].element[1].int_value);
-      g_gpu_vertex_registers[0].y_value += FIXED1114_TO_INT(g_vector_registers[trace_op.vector_registers[0]].element[2].int_value);
-
-      g_gpu_vertex_registers[1].x_value += FIXED1114_TO_INT(g_vector_registers[trace_op.vector_registers[0]].element[1].int_value);
-      g_gpu_vertex_registers[1].y_value += FIXED1114_TO_INT(g_vector_registers[trace_op.vector_registers[0]].element[2].int_value);
-
-      g_gpu_vertex_registers[2].x_value += FIXED1114_TO_INT(g_vector_registers[trace_op.vector_registers[0]].element[1].int_value);
-      g_gpu_vertex_registers[2].y_value += FIXED1114_TO_INT(g_vector_registers[trace_op.vector_registers[0]].element[2].int_value);
+      const VectorRegister &offset = g_machine->vector_registers[trace_op.vector_registers[0]];
+      TranslateMatrix(g_machine->transform, offset.element[1].int_value, offset.element[2].int_value,
+                      offset.element[3].int_value);
     }
     break;
-    case OP_SCALE:  // optional 
+    case OP_SCALE:
+    {
+      const VectorRegister &factor = g_machine->vector_registers[trace_op.vector_registers[0]];
+      ScaleMatrix(g_machine->transform, factor.element[1].int_value, factor.element[2].int_value,
+                  factor.element[3].int_value);
+    }
     break;
-    case OP_PUSHMATRIX:       // deprecated 
+    case OP_PUSHMATRIX:
+      PushMatrix(g_machine->transform);
     break;
-    case OP_POPMATRIX:   // deprecated 
+    case OP_POPMATRIX:
+      PopMatrix(g_machine->transform);
     break;
     case OP_BEGINPRIMITIVE: 
     {
       if(trace_op.primitive_type == 0){//line
-        g_gpu_status_register.int_value |= 8;
-        g_gpu_status_register.int_value &= ~(4); // clear the primitive bit
+        g_machine->gpu_status_register.int_value |= 8;
+        g_machine->gpu_status_register.int_value &= ~(4); // clear the primitive bit
       }
       else//triangle
       {
-        g_gpu_status_register.int_value |= 4;
-        g_gpu_status_register.int_value &= ~(8); 
+        g_machine->gpu_status_register.int_value |= 4;
+        g_machine->gpu_status_register.int_value &= ~(8); 
       }
+      g_machine->dirty_flags |= DIRTY_GSR;
       
     }
     break;
     case OP_ENDPRIMITIVE: //deprecated
     break;
-    case OP_LOADIDENTITY:  // deprecated 
+    case OP_LOADIDENTITY:
+      LoadIdentityMatrix(g_machine->transform);
     break;
     case OP_FLUSH: 
     {
-      g_gpu_status_register.int_value |= 2;
-      g_gpu_status_register.int_value &= ~(1);
+      g_machine->gpu_status_register.int_value |= 2;
+      g_machine->gpu_status_register.int_value &= ~(1);
+      g_machine->dirty_flags |= DIRTY_GSR;
+      ClearFramebuffer(MachineFramebuffer(*g_machine));
       
     }
     break;
     case OP_DRAW: 
     {
-      g_gpu_status_register.int_value |= 1;
-      g_gpu_status_register.int_value &= ~(2);
+      g_machine->gpu_status_register.int_value |= 1;
+      g_machine->gpu_status_register.int_value &= ~(2);
+      g_machine->dirty_flags |= DIRTY_GSR;
+      DrawPrimitive(MachineFramebuffer(*g_machine), g_machine->gpu_vertex_registers,
+                    g_machine->gpu_status_register.int_value);
       
     }
     break;
     case OP_BRN: 
     {
-      if(g_condition_code_register.int_value == 4)
+      if(g_machine->condition_code_register.int_value == 4)
       {
         ret_next_instruction_idx = SignExtension(trace_op.int_value);
       }
@@ -776,7 +911,7 @@ int ExecuteInstruction(const TraceOp &trace_op)
     break; 
     case OP_BRZ:
     {
-      if(g_condition_code_register.int_value == 2)
+      if(g_machine->condition_code_register.int_value == 2)
       {
         ret_next_instruction_idx = SignExtension(trace_op.int_value);
       }
@@ -788,7 +923,7 @@ int ExecuteInstruction(const TraceOp &trace_op)
     break; 
     case OP_BRP:
     {
-      if(g_condition_code_register.int_value == 1)
+      if(g_machine->condition_code_register.int_value == 1)
       {
         ret_next_instruction_idx = SignExtension(trace_op.int_value);
       }
@@ -801,7 +936,7 @@ int ExecuteInstruction(const TraceOp &trace_op)
 
     case OP_BRNZ:
     {
-      if(g_condition_code_register.int_value == 2 | g_condition_code_register.int_value == 4)
+      if(g_machine->condition_code_register.int_value == 2 | g_machine->condition_code_register.int_value == 4)
       {
         ret_next_instruction_idx = SignExtension(trace_op.int_value);
       }
@@ -814,7 +949,7 @@ int ExecuteInstruction(const TraceOp &trace_op)
 
     case OP_BRNP:
     {
-      if(g_condition_code_register.int_value == 1 | g_condition_code_register.int_value == 4)
+      if(g_machine->condition_code_register.int_value == 1 | g_machine->condition_code_register.int_value == 4)
       {
         ret_next_instruction_idx = SignExtension(trace_op.int_value);
       }
@@ -827,7 +962,7 @@ int ExecuteInstruction(const TraceOp &trace_op)
 
     case OP_BRZP:
     {
-      if(g_condition_code_register.int_value == 2 | g_condition_code_register.int_value == 1)
+      if(g_machine->condition_code_register.int_value == 2 | g_machine->condition_code_register.int_value == 1)
       {
         ret_next_instruction_idx = SignExtension(trace_op.int_value);
       }
@@ -844,25 +979,27 @@ int ExecuteInstruction(const TraceOp &trace_op)
 
     case OP_JMP:
     {
-      ret_next_instruction_idx = g_scalar_registers[trace_op.scalar_registers[0]].int_value >> 2;//trace_op.scalar_registers[0].int_value;
+      ret_next_instruction_idx = g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value >> 2;//trace_op.scalar_registers[0].int_value;
     }
     break;
     case OP_JSR:
     {
-      g_scalar_registers[LR_IDX].int_value = g_scalar_registers[PC_IDX].int_value;
+      g_machine->scalar_registers[LR_IDX].int_value = g_machine->scalar_registers[PC_IDX].int_value;
+      MarkScalarDirty(LR_IDX);
       ret_next_instruction_idx = SignExtension(trace_op.int_value);
     }
     break; 
     case OP_JSRR: 
     {
-      g_scalar_registers[LR_IDX].int_value = g_scalar_registers[PC_IDX].int_value;
-      ret_next_instruction_idx = g_scalar_registers[trace_op.scalar_registers[0]].int_value >> 2;//trace_op.scalar_registers[0].int_value;
+      g_machine->scalar_registers[LR_IDX].int_value = g_machine->scalar_registers[PC_IDX].int_value;
+      MarkScalarDirty(LR_IDX);
+      ret_next_instruction_idx = g_machine->scalar_registers[trace_op.scalar_registers[0]].int_value >> 2;//trace_op.scalar_registers[0].int_value;
     }
     break; 
       
 
     case OP_HALT: 
-    g_program_halt = 1; 
+    g_machine->program_halt = 1; 
     break; 
 
     default:
@@ -872,19 +1009,73 @@ int ExecuteInstruction(const TraceOp &trace_op)
   return ret_next_instruction_idx;
 }
 
+const char *OpcodeName(const int opcode)
+{
+  switch (opcode) {
+    case OP_ADD_D:          return "add.d";
+    case OP_ADDI_D:         return "addi.d";
+    case OP_ADD_F:          return "add.f";
+    case OP_ADDI_F:         return "addi.f";
+    case OP_VADD:           return "vadd";
+    case OP_AND_D:          return "and.d";
+    case OP_ANDI_D:         return "andi.d";
+    case OP_MOV:            return "mov";
+    case OP_MOVI_D:         return "movi.d";
+    case OP_MOVI_F:         return "movi.f";
+    case OP_VMOV:           return "vmov";
+    case OP_VMOVI:          return "vmovi";
+    case OP_CMP:            return "cmp";
+    case OP_CMPI:           return "cmpi";
+    case OP_VCOMPMOV:       return "vcompmov";
+    case OP_VCOMPMOVI:      return "vcompmovi";
+    case OP_LDB:            return "ldb";
+    case OP_LDW:            return "ldw";
+    case OP_STB:            return "stb";
+    case OP_STW:            return "stw";
+    case OP_SETVERTEX:      return "setvertex";
+    case OP_SETCOLOR:       return "setcolor";
+    case OP_ROTATE:         return "rotate";
+    case OP_TRANSLATE:      return "translate";
+    case OP_SCALE:          return "scale";
+    case OP_PUSHMATRIX:     return "pushmatrix";
+    case OP_POPMATRIX:      return "popmatrix";
+    case OP_BEGINPRIMITIVE: return "beginprimitive";
+    case OP_ENDPRIMITIVE:   return "endprimitive";
+    case OP_LOADIDENTITY:   return "loadidentity";
+    case OP_FLUSH:          return "flush";
+    case OP_DRAW:           return "draw";
+    case OP_BRN:            return "brn";
+    case OP_BRZ:            return "brz";
+    case OP_BRP:            return "brp";
+    case OP_BRNZ:           return "brnz";
+    case OP_BRNP:           return "brnp";
+    case OP_BRZP:           return "brzp";
+    case OP_BRNZP:          return "brnzp";
+    case OP_JMP:            return "jmp";
+    case OP_JSR:            return "jsr";
+    case OP_JSRR:           return "jsrr";
+    case OP_HALT:           return "halt";
+    default:                return "unknown";
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////
 // desc: Dump given trace_op
 ////////////////////////////////////////////////////////////////////////
 void PrintTraceOp(const TraceOp &trace_op) 
 {  
+  // Register slots and idx/primitive_type share storage; print the
+  // operands the opcode does not use as 0
+  const int vector_slots = VectorOperandSlots(trace_op.opcode);
+  const bool primitive = trace_op.opcode == OP_BEGINPRIMITIVE;
   cout << "  opcode: " << SignExtension(trace_op.opcode);
-  cout << ", scalar_register[0]: " << (int) trace_op.scalar_registers[0];
-  cout << ", scalar_register[1]: " << (int) trace_op.scalar_registers[1];
-  cout << ", scalar_register[2]: " << (int) trace_op.scalar_registers[2];
-  cout << ", vector_register[0]: " << (int) trace_op.vector_registers[0];
-  cout << ", vector_register[1]: " << (int) trace_op.vector_registers[1];
-  cout << ", idx: " << (int) trace_op.idx;
-  cout << ", primitive_index: " << (int) trace_op.primitive_type;
+  cout << ", scalar_register[0]: " << (vector_slots > 0 ? 0 : (int) trace_op.scalar_registers[0]);
+  cout << ", scalar_register[1]: " << (vector_slots > 1 ? 0 : (int) trace_op.scalar_registers[1]);
+  cout << ", scalar_register[2]: " << (vector_slots > 2 ? 0 : (int) trace_op.scalar_registers[2]);
+  cout << ", vector_register[0]: " << (vector_slots > 0 ? (int) trace_op.vector_registers[0] : 0);
+  cout << ", vector_register[1]: " << (vector_slots > 1 ? (int) trace_op.vector_registers[1] : 0);
+  cout << ", idx: " << (primitive ? 0 : (int) trace_op.idx);
+  cout << ", primitive_index: " << (primitive ? (int) trace_op.primitive_type : 0);
   cout << ", int_value: " << (int) SignExtension(trace_op.int_value) << endl; 
   //c  cout << ", float_value: " << (float) trace_op.float_value << endl;
 }
@@ -895,152 +1086,602 @@ void PrintTraceOp(const TraceOp &trace_op)
 ////////////////////////////////////////////////////////////////////////
 void PrintContext(const TraceOp &current_op)
 {
+  static TraceState state;
+  state.condition_code_register = g_machine->condition_code_register;
+  memcpy(state.scalar_registers, g_machine->scalar_registers, sizeof(g_machine->scalar_registers));
+  memcpy(state.vector_registers, g_machine->vector_registers, sizeof(g_machine->vector_registers));
+  memcpy(state.gpu_vertex_registers, g_machine->gpu_vertex_registers, sizeof(g_machine->gpu_vertex_registers));
+  state.gpu_status_register = g_machine->gpu_status_register;
+
+  unsigned int next_pc = g_machine->scalar_registers[PC_IDX].int_value;
+  int next_opcode = next_pc < g_machine->trace_ops.size() ? g_machine->trace_ops[next_pc].opcode : 0;
+  WriteContext(cout, g_machine->instruction_count, g_machine->current_pc, current_op.opcode, next_opcode, state);
+}
 
-  cout << "--------------------------------------------------" << endl;
-  cout << "3220X-Instruction Count: " << g_instruction_count
-       << " C_PC: " << (g_current_pc *4)
-       << " C_PC_IND: " << g_current_pc 
-       << ", Curr_Opcode: " << current_op.opcode
-       << " NEXT_PC: " << ((g_scalar_registers[PC_IDX].int_value)<<2) 
-       << " NEXT_PC_IND: " << (g_scalar_registers[PC_IDX].int_value)
-       << ", Next_Opcode: " << g_trace_ops[g_scalar_registers[PC_IDX].int_value].opcode 
-       << endl;
-  cout <<"3220X-"; 
-  for (int srIdx = 0; srIdx < NUM_SCALAR_REGISTER; srIdx++) {
-    cout << "R" << srIdx << ":" 
-         << ((srIdx < 8 || srIdx == 15) ? SignExtension(g_scalar_registers[srIdx].int_value) : (float) FIXED_TO_FLOAT1114(g_scalar_registers[srIdx].int_value)) 
-         << (srIdx == NUM_SCALAR_REGISTER-1 ? "" : ", ");
+////////////////////////////////////////////////////////////////////////
+// desc: Delta form of PrintContext(): print only the registers marked
+//       dirty by the last instruction, and the full context every
+//       g_dump_checkpoint_interval instructions (see WriteContextDelta())
+////////////////////////////////////////////////////////////////////////
+void PrintContextDelta(const TraceOp &current_op)
+{
+  static TraceState state; // last printed state
+
+  if ((g_machine->instruction_count - 1) % g_dump_checkpoint_interval == 0) {
+    unsigned int next_pc = g_machine->scalar_registers[PC_IDX].int_value;
+    int next_opcode = next_pc < g_machine->trace_ops.size() ? g_machine->trace_ops[next_pc].opcode : 0;
+    state.condition_code_register = g_machine->condition_code_register;
+    memcpy(state.scalar_registers, g_machine->scalar_registers, sizeof(g_machine->scalar_registers));
+    memcpy(state.vector_registers, g_machine->vector_registers, sizeof(g_machine->vector_registers));
+    memcpy(state.gpu_vertex_registers, g_machine->gpu_vertex_registers, sizeof(g_machine->gpu_vertex_registers));
+    state.gpu_status_register = g_machine->gpu_status_register;
+    WriteContext(cout, g_machine->instruction_count, g_machine->current_pc, current_op.opcode, next_opcode, state);
+    return;
   }
 
-  cout << " CC :N: " << ((g_condition_code_register.int_value &0x4) >>2) << " Z: " 
-       << ((g_condition_code_register.int_value &0x2) >>1) << " P: " << (g_condition_code_register.int_value &0x1) << "  "; 
-  cout << " draw: " << (g_gpu_status_register.int_value &0x01) << " fush: " << ((g_gpu_status_register.int_value & 0x2)>>1) ;
-  cout << " prim_type: "<< ((g_gpu_status_register.int_value & 0x4) >> 2)  << " "; 
-   
-  cout << endl;
-  
-  // for (int vrIdx = 0; vrIdx < NUM_VECTOR_REGISTER; vrIdx++) {
-  
-  for (int vrIdx = 0; vrIdx < 6; vrIdx++) {
-    cout <<"3220X-"; 
-    cout << "V" << vrIdx << ":";
-    for (int elmtIdx = 0; elmtIdx < NUM_VECTOR_ELEMENTS; elmtIdx++) { 
-      cout << "Element[" << elmtIdx << "] = " 
-           << (float)FIXED_TO_FLOAT1114(g_vector_registers[vrIdx].element[elmtIdx].int_value) 
-           << (elmtIdx == NUM_VECTOR_ELEMENTS-1 ? "" : ",");
-    }
-    cout << endl;
+  for (uint32_t mask = g_machine->dirty_scalar_mask; mask != 0; mask &= mask - 1)
+    state.scalar_registers[__builtin_ctz(mask)] = g_machine->scalar_registers[__builtin_ctz(mask)];
+  for (uint64_t mask = g_machine->dirty_vector_mask; mask != 0; mask &= mask - 1)
+    state.vector_registers[__builtin_ctzll(mask)] = g_machine->vector_registers[__builtin_ctzll(mask)];
+  if (g_machine->dirty_flags & DIRTY_CC)
+    state.condition_code_register = g_machine->condition_code_register;
+  if (g_machine->dirty_flags & DIRTY_GSR)
+    state.gpu_status_register = g_machine->gpu_status_register;
+  if (g_machine->dirty_flags & DIRTY_VERTEX)
+    memcpy(state.gpu_vertex_registers, g_machine->gpu_vertex_registers, sizeof(g_machine->gpu_vertex_registers));
+  WriteContextDelta(cout, g_machine->instruction_count, g_machine->current_pc, current_op.opcode, state,
+                    g_machine->dirty_scalar_mask, g_machine->dirty_vector_mask, g_machine->dirty_flags);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Copy of the architectural state, used to validate alternative engines
+// against the reference interpreter
+////////////////////////////////////////////////////////////////////////
+typedef struct ArchState_ {
+  ScalarRegister condition_code_register;
+  ScalarRegister scalar_registers[NUM_SCALAR_REGISTER];
+  VectorRegister vector_registers[NUM_VECTOR_REGISTER];
+  VertexRegister gpu_vertex_registers[NUM_VERTEX_REGISTER];
+  ScalarRegister gpu_status_register;
+  unsigned int active_vertex_reg;
+  TransformStack transform;
+  unsigned int program_halt;
+  int fault;
+  MemoryImage memory;
+} ArchState;
+
+void SaveArchState(ArchState &state)
+{
+  state.condition_code_register = g_machine->condition_code_register;
+  memcpy(state.scalar_registers, g_machine->scalar_registers, sizeof(g_machine->scalar_registers));
+  memcpy(state.vector_registers, g_machine->vector_registers, sizeof(g_machine->vector_registers));
+  memcpy(state.gpu_vertex_registers, g_machine->gpu_vertex_registers, sizeof(g_machine->gpu_vertex_registers));
+  state.gpu_status_register = g_machine->gpu_status_register;
+  state.active_vertex_reg = g_machine->active_vertex_reg;
+  state.transform = g_machine->transform;
+  state.program_halt = g_machine->program_halt;
+  state.fault = g_machine->fault;
+  SaveDataMemory(g_machine->memory, state.memory);
+}
+
+void RestoreArchState(const ArchState &state)
+{
+  g_machine->condition_code_register = state.condition_code_register;
+  memcpy(g_machine->scalar_registers, state.scalar_registers, sizeof(g_machine->scalar_registers));
+  memcpy(g_machine->vector_registers, state.vector_registers, sizeof(g_machine->vector_registers));
+  memcpy(g_machine->gpu_vertex_registers, state.gpu_vertex_registers, sizeof(g_machine->gpu_vertex_registers));
+  g_machine->gpu_status_register = state.gpu_status_register;
+  g_machine->active_vertex_reg = state.active_vertex_reg;
+  g_machine->transform = state.transform;
+  g_machine->program_halt = state.program_halt;
+  g_machine->fault = state.fault;
+  RestoreDataMemory(g_machine->memory, state.memory);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Compare two saved states and report the first few differences
+// output: true if identical
+////////////////////////////////////////////////////////////////////////
+bool CompareArchState(const ArchState &expected, const ArchState &actual)
+{
+  int num_diffs = 0;
+  const int max_diffs = 10;
+
+  if (expected.condition_code_register.int_value != actual.condition_code_register.int_value) {
+    cerr << "  CC: expected " << expected.condition_code_register.int_value
+         << " got " << actual.condition_code_register.int_value << endl;
+    num_diffs++;
+  }
+  for (int i = 0; i < NUM_SCALAR_REGISTER; i++) {
+    if (expected.scalar_registers[i].int_value != actual.scalar_registers[i].int_value) {
+      if (num_diffs++ < max_diffs)
+        cerr << "  R" << i << ": expected " << expected.scalar_registers[i].int_value
+             << " got " << actual.scalar_registers[i].int_value << endl;
+    }
+  }
+  for (int i = 0; i < NUM_VECTOR_REGISTER; i++) {
+    for (int j = 0; j < NUM_VECTOR_ELEMENTS; j++) {
+      if (expected.vector_registers[i].element[j].int_value != actual.vector_registers[i].element[j].int_value) {
+        if (num_diffs++ < max_diffs)
+          cerr << "  V" << i << "[" << j << "]: expected " << expected.vector_registers[i].element[j].int_value
+               << " got " << actual.vector_registers[i].element[j].int_value << endl;
+      }
+    }
   }
-  cout << endl;
-  cout <<"3220X-"; 
-  cout <<" vertices P1_X: " << g_gpu_vertex_registers[0].x_value; 
-  cout <<" vertices P1_Y: " << g_gpu_vertex_registers[0].y_value; 
-  cout <<" r: " << g_gpu_vertex_registers[0].r_value; 
-  cout <<" g: " << g_gpu_vertex_registers[0].g_value; 
-  cout <<" b: " << g_gpu_vertex_registers[0].b_value; 
-  cout <<" P2_X: " << g_gpu_vertex_registers[1].x_value; 
-  cout <<" P2_Y: " << g_gpu_vertex_registers[1].y_value; 
-  cout <<" r: " << g_gpu_vertex_registers[1].r_value; 
-  cout <<" g: " << g_gpu_vertex_registers[1].g_value; 
-  cout <<" b: " << g_gpu_vertex_registers[1].b_value; 
-  cout <<" P3_X: " << g_gpu_vertex_registers[2].x_value; 
-  cout <<" P3_Y: " << g_gpu_vertex_registers[2].y_value; 
-  cout <<" r: " << g_gpu_vertex_registers[2].r_value; 
-  cout <<" g: " << g_gpu_vertex_registers[2].g_value; 
-  cout <<" b: " << g_gpu_vertex_registers[2].b_value << endl; 
-  
-  cout << "--------------------------------------------------" << endl;
+  if (memcmp(expected.gpu_vertex_registers, actual.gpu_vertex_registers, sizeof(expected.gpu_vertex_registers)) != 0 ||
+      expected.gpu_status_register.int_value != actual.gpu_status_register.int_value ||
+      expected.active_vertex_reg != actual.active_vertex_reg) {
+    if (num_diffs++ < max_diffs)
+      cerr << "  GPU registers differ" << endl;
+  }
+  if (expected.transform.depth != actual.transform.depth ||
+      memcmp(expected.transform.matrix, actual.transform.matrix,
+             sizeof(expected.transform.matrix[0]) * (expected.transform.depth + 1)) != 0) {
+    if (num_diffs++ < max_diffs)
+      cerr << "  matrix stack differs" << endl;
+  }
+  if (expected.program_halt != actual.program_halt) {
+    if (num_diffs++ < max_diffs)
+      cerr << "  halt: expected " << expected.program_halt << " got " << actual.program_halt << endl;
+  }
+  if (expected.fault != actual.fault) {
+    if (num_diffs++ < max_diffs)
+      cerr << "  fault: expected " << expected.fault << " got " << actual.fault << endl;
+  }
+
+  // Walk the written pages of both; a page missing from one side is zero
+  static const unsigned char zero_page[MEMORY_PAGE_SIZE] = {0};
+  size_t e = 0, a = 0;
+  while (e < expected.memory.pages.size() || a < actual.memory.pages.size()) {
+    uint32_t expected_page = e < expected.memory.pages.size() ? expected.memory.pages[e] : UINT32_MAX;
+    uint32_t actual_page = a < actual.memory.pages.size() ? actual.memory.pages[a] : UINT32_MAX;
+    uint32_t page = expected_page < actual_page ? expected_page : actual_page;
+    const unsigned char *expected_bytes = zero_page, *actual_bytes = zero_page;
+    if (expected_page == page)
+      expected_bytes = &expected.memory.contents[e++ * MEMORY_PAGE_SIZE];
+    if (actual_page == page)
+      actual_bytes = &actual.memory.contents[a++ * MEMORY_PAGE_SIZE];
+    for (int i = 0; i < MEMORY_PAGE_SIZE; i++) {
+      if (expected_bytes[i] != actual_bytes[i]) {
+        if (num_diffs++ < max_diffs)
+          cerr << "  MEM[" << (page << MEMORY_PAGE_SHIFT) + i << "]: expected " << (int)expected_bytes[i]
+               << " got " << (int)actual_bytes[i] << endl;
+      }
+    }
+  }
+
+  return num_diffs == 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Reference engine: execute g_machine's trace_ops one TraceOp at a time
+//       through ExecuteInstruction() until HALT
+// output: false if the PC left the program
+////////////////////////////////////////////////////////////////////////
+bool RunInterpreter()
+{
+  for (;;) {
+    if ((unsigned int)g_machine->scalar_registers[PC_IDX].int_value >= g_machine->trace_ops.size()) {
+      cerr << "Error: PC left the program (" << g_machine->trace_ops.size() << " instructions)" << endl;
+      return false;
+    }
+    TraceOp current_op = g_machine->trace_ops[g_machine->scalar_registers[PC_IDX].int_value];
+    if (g_profile_enabled)
+      ProfileInstruction(g_machine->scalar_registers[PC_IDX].int_value, current_op);
+    int idx = ExecuteInstruction(current_op);
+    if (g_machine->fault != FAULT_NONE)
+      return false;
+    g_machine->current_pc = g_machine->scalar_registers[PC_IDX].int_value; // debugging purpose only 
+    if (current_op.opcode == OP_JSR || current_op.opcode == OP_JSRR)
+      g_machine->scalar_registers[LR_IDX].int_value = (g_machine->scalar_registers[PC_IDX].int_value + 1) << 2 ;
+
+
+    
+    g_machine->scalar_registers[PC_IDX].int_value += 1; 
+    if (idx != -1) { // Branch
+      if (current_op.opcode == OP_JMP || current_op.opcode == OP_JSRR) // Absolute addressing
+        g_machine->scalar_registers[PC_IDX].int_value = idx; 
+      else // PC-relative addressing (OP_JSR || OP_BRXXX)
+        g_machine->scalar_registers[PC_IDX].int_value += idx; 
+    }
+    MarkScalarDirty(PC_IDX);
+    if (g_timing_enabled)
+      TimingRecord(g_machine->current_pc);
+    if (g_predictor_enabled && current_op.opcode >= OP_BRP)   // branches, jumps and calls
+      PredictorRecord(g_machine->current_pc, g_machine->scalar_registers[PC_IDX].int_value);
+
+    g_machine->instruction_count++;
+    if (g_trace_enabled)
+      TraceRecord(g_machine->current_pc, current_op.opcode);
+    if (g_dump_mode == DUMP_FULL)
+      PrintContext(current_op);
+    else if (g_dump_mode == DUMP_DELTA)
+      PrintContextDelta(current_op);
+    ClearDirtyState();
+
+    if (g_machine->program_halt == 1) 
+      return true;
+    if (g_machine->instruction_count >= g_next_checkpoint && !WriteCheckpoint())
+      return false;
+  }
+}
+
+bool RunEngine(const Engine engine, const bool jit_verify)
+{
+  if (engine != ENGINE_INTERP) {
+    bool ok;
+    if (engine == ENGINE_THREADED)
+      ok = RunThreaded();
+    else if (engine == ENGINE_BLOCK)
+      ok = RunBlocks(JIT_OFF);
+    else
+      ok = RunBlocks(jit_verify ? JIT_VERIFY : JIT_ON);
+    if (ok && g_dump_mode != DUMP_NONE)
+      PrintContext(g_machine->trace_ops[g_machine->current_pc]);
+    return ok;
+  }
+
+  return RunInterpreter();
+}
+
+bool VerifyEngine(const Engine engine, const bool jit_verify)
+{
+  ArchState initial_state, expected_state, actual_state;
+  SaveArchState(initial_state);
+  const uint64_t initial_count = g_machine->instruction_count;
+  const bool interp_ok = RunInterpreter();
+  SaveArchState(expected_state);
+
+  RestoreArchState(initial_state);
+  if (g_machine->framebuffer != NULL)
+    ClearFramebuffer(*g_machine->framebuffer);
+  g_machine->instruction_count = initial_count;
+  const bool engine_ok = RunEngine(engine, jit_verify);
+  SaveArchState(actual_state);
+  if (interp_ok != engine_ok || (!interp_ok && expected_state.fault == FAULT_NONE))
+    return false;
+  return CompareArchState(expected_state, actual_state);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Engine named by an --engine= option
+// output: false if the name is unknown
+////////////////////////////////////////////////////////////////////////
+static bool ParseEngine(const char *name, Engine &engine)
+{
+  if (strcmp(name, "interp") == 0)
+    engine = ENGINE_INTERP;
+  else if (strcmp(name, "threaded") == 0)
+    engine = ENGINE_THREADED;
+  else if (strcmp(name, "block") == 0)
+    engine = ENGINE_BLOCK;
+  else if (strcmp(name, "jit") == 0)
+    engine = ENGINE_JIT;
+  else
+    return false;
+  return true;
+}
+
+void PrintUsage(const char *name)
+{
+  cerr << "Usage: " << name << " [options] <input>" << endl;
+  cerr << "       " << name << " [options] --batch MANIFEST" << endl;
+  cerr << "       " << name << " [--engine=E] --bench" << endl;
+  cerr << "  --engine=interp    reference switch-based interpreter (default)" << endl;
+  cerr << "  --engine=threaded  predecoded direct-threaded interpreter" << endl;
+  cerr << "  --engine=block     cached basic blocks with fused superinstructions" << endl;
+  cerr << "  --engine=jit       basic blocks, hot blocks compiled to x86-64" << endl;
+  cerr << "  --jit-verify       with --engine=jit, check every native block run against" << endl;
+  cerr << "                     the interpreter" << endl;
+  cerr << "  --verify           also run the reference interpreter and compare final state" << endl;
+  cerr << "  --dump             print the full register context after every instruction" << endl;
+  cerr << "                     (final context only for engines other than interp)" << endl;
+  cerr << "  --dump-delta[=N]   like --dump, but print only the state each instruction" << endl;
+  cerr << "                     changed, with a full context every N (1000) instructions" << endl;
+  cerr << "  --trace FILE       record a binary per-instruction trace to FILE (interp only);" << endl;
+  cerr << "                     render it with trace_dump" << endl;
+  cerr << "  --profile FILE     count executions per opcode and PC, branch outcomes, call" << endl;
+  cerr << "                     targets and memory pages (interp only); write a flat" << endl;
+  cerr << "                     profile to FILE and collapsed stacks to FILE.folded" << endl;
+  cerr << "  --timing FILE      model a 5-stage pipeline (interp only) and write cycles, CPI" << endl;
+  cerr << "                     and stalls per PC to FILE (see timing.h)" << endl;
+  cerr << "  --pipeline K=V,... pipeline parameters for --timing: forwarding, load_use," << endl;
+  cerr << "                     branch_penalty, gpu, draw" << endl;
+  cerr << "  --predict FILE     simulate branch prediction (interp only) and write" << endl;
+  cerr << "                     mispredict rates per branch PC to FILE (see predictor.h)" << endl;
+  cerr << "  --predictor K=V,.. predictor for --predict: direction=static|bimodal|gshare," << endl;
+  cerr << "                     bits, ras" << endl;
+  cerr << "  --cache FILE       simulate L1/L2 data caches (interp only) and write hits and" << endl;
+  cerr << "                     misses per level, memory page and PC to FILE (see data_cache.h)" << endl;
+  cerr << "  --cache-config K=V caches for --cache: l1, l1_assoc, l2, l2_assoc, line," << endl;
+  cerr << "                     write=back|through, replace=lru|plru" << endl;
+  cerr << "  --ppm FILE         write the framebuffer to FILE as a PPM image at halt" << endl;
+  cerr << "  --raster=PATH      triangle tile evaluation: auto (default), avx2, sse, scalar" << endl;
+  cerr << "  --render-threads=N rasterize on N threads behind a command queue instead of" << endl;
+  cerr << "                     inline (0, the default)" << endl;
+  cerr << "  --batch MANIFEST   run every program listed in MANIFEST, one isolated machine" << endl;
+  cerr << "                     per worker thread, and print per-run results (see batch.h)" << endl;
+  cerr << "  --jobs=N           batch worker threads (default: online CPUs)" << endl;
+  cerr << "  --bench            time generated workloads and single opcodes on every engine" << endl;
+  cerr << "                     (or the one given by --engine) and print JSON (see bench.h)" << endl;
+  cerr << "  --memory-size=N    data memory in bytes, with optional K, M or G suffix;" << endl;
+  cerr << "                     a multiple of 4K (default 1M)" << endl;
+  cerr << "  --checkpoint-every N" << endl;
+  cerr << "                     write the machine state every N instructions (at the next" << endl;
+  cerr << "                     jump or block boundary for threaded, block and jit)" << endl;
+  cerr << "  --checkpoint FILE  checkpoint file (default: <input>.ckpt)" << endl;
+  cerr << "  --restore FILE     resume the program from a checkpoint" << endl;
 }
 
 int main(int argc, char **argv) 
 {
-  ///////////////////////////////////////////////////////////////
-  // Initialize Global Variables
-  ///////////////////////////////////////////////////////////////
-  //
-  InitializeGlobalVariables();
+  // Context dumps are written with '\n' into cout's own buffer
+  ios::sync_with_stdio(false);
 
   ///////////////////////////////////////////////////////////////
   // Load Program
   ///////////////////////////////////////////////////////////////
   //
-  if (argc != 2) {
-    cerr << "Usage: " << argv[0] << " <input>" << endl;
+  Engine engine = ENGINE_INTERP;
+  bool engine_selected = false;
+  bool verify = false;
+  bool jit_verify = false;
+  const char *trace_path = NULL;
+  const char *profile_path = NULL;
+  const char *timing_path = NULL;
+  PipelineConfig pipeline;
+  DefaultPipelineConfig(pipeline);
+  const char *predict_path = NULL;
+  PredictorConfig predictor;
+  DefaultPredictorConfig(predictor);
+  const char *cache_path = NULL;
+  DataCacheConfig cache_config;
+  DefaultDataCacheConfig(cache_config);
+  const char *ppm_path = NULL;
+  int render_threads = 0;
+  const char *batch_path = NULL;
+  int batch_jobs = 0;
+  bool bench = false;
+  bool raster_selected = false;
+  uint32_t memory_size = DEFAULT_MEMORY_SIZE;
+  unsigned int checkpoint_interval = 0;
+  const char *checkpoint_path = NULL;
+  const char *restore_path = NULL;
+  const char *input = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--engine=", 9) == 0 && ParseEngine(argv[i] + 9, engine))
+      engine_selected = true;
+    else if (strcmp(argv[i], "--jit-verify") == 0)
+      jit_verify = true;
+    else if (strcmp(argv[i], "--verify") == 0)
+      verify = true;
+    else if (strcmp(argv[i], "--dump") == 0)
+      g_dump_mode = DUMP_FULL;
+    else if (strcmp(argv[i], "--dump-delta") == 0)
+      g_dump_mode = DUMP_DELTA;
+    else if (strncmp(argv[i], "--dump-delta=", 13) == 0 && atoi(argv[i] + 13) > 0) {
+      g_dump_mode = DUMP_DELTA;
+      g_dump_checkpoint_interval = atoi(argv[i] + 13);
+    }
+    else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+      trace_path = argv[++i];
+    else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+      profile_path = argv[++i];
+    else if (strcmp(argv[i], "--timing") == 0 && i + 1 < argc)
+      timing_path = argv[++i];
+    else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc) {
+      if (!ParsePipelineConfig(argv[++i], pipeline)) {
+        cerr << "Error: invalid --pipeline " << argv[i] << endl;
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--predict") == 0 && i + 1 < argc)
+      predict_path = argv[++i];
+    else if (strcmp(argv[i], "--predictor") == 0 && i + 1 < argc) {
+      if (!ParsePredictorConfig(argv[++i], predictor)) {
+        cerr << "Error: invalid --predictor " << argv[i] << endl;
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+      cache_path = argv[++i];
+    else if (strcmp(argv[i], "--cache-config") == 0 && i + 1 < argc) {
+      if (!ParseDataCacheConfig(argv[++i], cache_config)) {
+        cerr << "Error: invalid --cache-config " << argv[i] << endl;
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--ppm") == 0 && i + 1 < argc)
+      ppm_path = argv[++i];
+    else if (strncmp(argv[i], "--raster=", 9) == 0) {
+      if (!SelectRasterizerPath(argv[i] + 9))
+        return 1;
+      raster_selected = true;
+    }
+    else if (strncmp(argv[i], "--render-threads=", 17) == 0 && atoi(argv[i] + 17) >= 0)
+      render_threads = atoi(argv[i] + 17);
+    else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+      batch_path = argv[++i];
+    else if (strcmp(argv[i], "--bench") == 0)
+      bench = true;
+    else if (strncmp(argv[i], "--jobs=", 7) == 0 && atoi(argv[i] + 7) > 0)
+      batch_jobs = atoi(argv[i] + 7);
+    else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+      checkpoint_interval = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+      checkpoint_path = argv[++i];
+    else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc)
+      restore_path = argv[++i];
+    else if (strncmp(argv[i], "--memory-size=", 14) == 0) {
+      if (!ParseMemorySize(argv[i] + 14, memory_size)) {
+        cerr << "Error: invalid memory size " << argv[i] + 14 << endl;
+        return 1;
+      }
+    }
+    else if (argv[i][0] != '-' && input == NULL)
+      input = argv[i];
+    else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (bench) {
+    if (input != NULL || batch_path != NULL || verify || g_dump_mode != DUMP_NONE ||
+        trace_path != NULL || profile_path != NULL || timing_path != NULL || predict_path != NULL ||
+        cache_path != NULL || ppm_path != NULL || render_threads > 0 || checkpoint_interval > 0 ||
+        restore_path != NULL) {
+      cerr << "Error: --bench runs generated programs and cannot be combined with an input,"
+           << " --batch, --verify, --dump, --trace, --profile, --timing, --predict, --cache, --ppm,"
+           << " --render-threads, --checkpoint-every or --restore" << endl;
+      return 1;
+    }
+    vector<Engine> engines;
+    if (engine_selected)
+      engines.push_back(engine);
+    else {
+      engines.push_back(ENGINE_INTERP);
+      engines.push_back(ENGINE_THREADED);
+      engines.push_back(ENGINE_BLOCK);
+      engines.push_back(ENGINE_JIT);
+    }
+    return RunBench(engines) ? 0 : 1;
+  }
+  if (batch_path != NULL) {
+    if (input != NULL || g_dump_mode != DUMP_NONE || trace_path != NULL || profile_path != NULL ||
+        timing_path != NULL || predict_path != NULL || cache_path != NULL || ppm_path != NULL ||
+        render_threads > 0 || checkpoint_interval > 0 || restore_path != NULL) {
+      cerr << "Error: --batch runs the programs listed in its manifest and cannot be combined with"
+           << " an input, --dump, --trace, --profile, --timing, --predict, --cache, --ppm, --render-threads,"
+           << " --checkpoint-every or --restore" << endl;
+      return 1;
+    }
+    // Workers must not race on the lazy choice in DrawPrimitive()
+    if (!raster_selected)
+      SelectRasterizerPath("auto");
+    BatchOptions options;
+    options.engine = engine;
+    options.verify = verify && engine != ENGINE_INTERP;
+    options.jit_verify = jit_verify;
+    options.num_threads = batch_jobs;
+    options.memory_size = memory_size;
+    return RunBatch(batch_path, options) ? 0 : 1;
+  }
+  if (input == NULL) {
+    PrintUsage(argv[0]);
     return 1;
   }
-
-  ifstream infile(argv[1]);
-  if (!infile) {
-    cerr << "Error: Failed to open input file " << argv[1] << endl;
+  if (trace_path != NULL && engine != ENGINE_INTERP) {
+    cerr << "Error: --trace records per-instruction state and needs --engine=interp" << endl;
+    return 1;
+  }
+  if (profile_path != NULL && engine != ENGINE_INTERP) {
+    cerr << "Error: --profile counts every instruction and needs --engine=interp" << endl;
+    return 1;
+  }
+  if (timing_path != NULL && engine != ENGINE_INTERP) {
+    cerr << "Error: --timing models every instruction and needs --engine=interp" << endl;
     return 1;
   }
-  vector< bitset<sizeof(uint32_t)*CHAR_BIT> > instructions;
-  while (!infile.eof()) {
-    bitset<sizeof(uint32_t)*CHAR_BIT> bits;
-    infile >> bits;
-    if (infile.eof())  break;
-    instructions.push_back(bits);
+  if (predict_path != NULL && engine != ENGINE_INTERP) {
+    cerr << "Error: --predict follows every branch and needs --engine=interp" << endl;
+    return 1;
   }
-  
-  infile.close();
-
-#ifdef DEBUG
-  cout << "The contents of the instruction vectors are :" << endl;
-  for (vector< bitset<sizeof(uint32_t)*CHAR_BIT> >::iterator ii =
-      instructions.begin(); ii != instructions.end(); ii++) {
-    cout << "  " << *ii << endl;
+  if (cache_path != NULL && engine != ENGINE_INTERP) {
+    cerr << "Error: --cache follows every load and store and needs --engine=interp" << endl;
+    return 1;
+  }
+  if (checkpoint_interval > 0 && verify && engine != ENGINE_INTERP) {
+    cerr << "Error: --checkpoint-every cannot be combined with --verify" << endl;
+    return 1;
   }
-#endif // DEBUG
 
   ///////////////////////////////////////////////////////////////
-  // Decode instructions into g_trace_ops
+  // Create the machine
   ///////////////////////////////////////////////////////////////
   //
-  for (vector< bitset<sizeof(uint32_t)*CHAR_BIT> >::iterator ii =
-      instructions.begin(); ii != instructions.end(); ii++) {
-    uint32_t inst = (uint32_t) ((*ii).to_ulong());
-    TraceOp trace_op = DecodeInstruction(inst);
-    g_trace_ops.push_back(trace_op);
-  }
+  g_machine = NewMachine(memory_size);
+  if (g_machine == NULL)
+    return 1;
 
-#ifdef DEBUG
-  cout << "The contents of the g_trace_ops vectors are :" << endl;
-  for (vector<TraceOp>::iterator ii = g_trace_ops.begin();
-      ii != g_trace_ops.end(); ii++) {
-    PrintTraceOp(*ii);
+  vector<uint32_t> instructions;
+  if (!LoadProgram(input, instructions, g_machine->memory))
+    return 1;
+
+  if (g_dump_mode != DUMP_NONE) {
+    cout << "The contents of the instruction vectors are :" << endl;
+    for (vector<uint32_t>::iterator ii = instructions.begin(); ii != instructions.end(); ii++) {
+      cout << "  " << bitset<sizeof(uint32_t)*CHAR_BIT>(*ii) << endl;
+    }
   }
-#endif // DEBUG
 
   ///////////////////////////////////////////////////////////////
-  // Execute 
+  // Decode instructions into trace_ops
   ///////////////////////////////////////////////////////////////
   //
-  g_scalar_registers[PC_IDX].int_value = 0;
-  for (;;) {
-    TraceOp current_op = g_trace_ops[g_scalar_registers[PC_IDX].int_value];
-    int idx = ExecuteInstruction(current_op);
-    g_current_pc = g_scalar_registers[PC_IDX].int_value; // debugging purpose only 
-    if (current_op.opcode == OP_JSR || current_op.opcode == OP_JSRR)
-      g_scalar_registers[LR_IDX].int_value = (g_scalar_registers[PC_IDX].int_value + 1) << 2 ;
-
+  g_machine->trace_ops.reserve(instructions.size());
+  for (vector<uint32_t>::iterator ii = instructions.begin(); ii != instructions.end(); ii++) {
+    TraceOp trace_op = DecodeInstruction(*ii);
+    g_machine->trace_ops.push_back(trace_op);
+  }
 
-    
-    g_scalar_registers[PC_IDX].int_value += 1; 
-    if (idx != -1) { // Branch
-      if (current_op.opcode == OP_JMP || current_op.opcode == OP_JSRR) // Absolute addressing
-        g_scalar_registers[PC_IDX].int_value = idx; 
-      else // PC-relative addressing (OP_JSR || OP_BRXXX)
-        g_scalar_registers[PC_IDX].int_value += idx; 
+  if (g_dump_mode != DUMP_NONE) {
+    cout << "The contents of the g_trace_ops vectors are :" << endl;
+    for (vector<TraceOp>::iterator ii = g_machine->trace_ops.begin();
+        ii != g_machine->trace_ops.end(); ii++) {
+      PrintTraceOp(*ii);
     }
+  }
 
-#ifdef DEBUG
-    g_instruction_count++;
-    PrintContext(current_op);
-#endif // DEBUG
+  if (trace_path != NULL && !TraceOpen(trace_path, instructions))
+    return 1;
+  if (render_threads > 0 && !StartRenderPipeline(render_threads))
+    return 1;
 
-    if (g_program_halt == 1) 
-      break;
+  ///////////////////////////////////////////////////////////////
+  // Execute 
+  ///////////////////////////////////////////////////////////////
+  //
+  g_machine->scalar_registers[PC_IDX].int_value = 0;
+  if (restore_path != NULL && !RestoreCheckpoint(restore_path, instructions))
+    return 1;
+  string default_checkpoint_path = string(input) + ".ckpt";
+  if (checkpoint_interval > 0)
+    StartCheckpoints(checkpoint_path != NULL ? checkpoint_path : default_checkpoint_path.c_str(),
+                     checkpoint_interval, instructions);
+  if (profile_path != NULL)
+    ProfileStart(profile_path);
+  if (timing_path != NULL)
+    TimingStart(timing_path, pipeline);
+  if (predict_path != NULL)
+    PredictorStart(predict_path, predictor, pipeline.branch_penalty);
+  if (cache_path != NULL)
+    DataCacheStart(cache_path, cache_config);
+
+  if (verify && engine != ENGINE_INTERP) {
+    bool ok = VerifyEngine(engine, jit_verify);
+    StopRenderPipeline();
+    if (!ok) {
+      cerr << "Verify: engine state differs from the reference interpreter" << endl;
+      return 1;
+    }
+    cerr << "Verify: OK" << endl;
+    return g_machine->fault == FAULT_NONE ? 0 : 1;
   }
 
-  return 0;
+  bool ok = RunEngine(engine, jit_verify);
+  if (!TraceClose())
+    ok = false;
+  if (!ProfileWrite())
+    ok = false;
+  if (!TimingWrite())
+    ok = false;
+  if (!PredictorWrite())
+    ok = false;
+  if (!DataCacheWrite())
+    ok = false;
+  if (ok && ppm_path != NULL && !WriteFramebufferPPM(MachineFramebuffer(*g_machine), ppm_path))
+    ok = false;
+  StopRenderPipeline();
+
+  return ok ? 0 : 1;
 }
@@ -2,12 +2,16 @@
 #define __SIMULATOR_H
 
 #include <string>
+#include <vector>
+#include <stdint.h>
+#include "memory.h"
+#include "fixed_point.h"
+#include "transform.h"
 
 #define PC_IDX 15
 #define LR_IDX 7
 
 #define NUM_VECTOR_ELEMENTS 4
-#define MEMORY_SIZE (1024*1024)
 
 #define NUM_SCALAR_REGISTER 16
 #define NUM_VECTOR_REGISTER 64
@@ -73,9 +77,10 @@ typedef struct ScalarRegister_ {
 ////////////////////////////////////////////////////////////////////////
 // In this course we will use vector registers only for graphics operations.
 // Do not bother to use int_value field.
+// Elements are 1.11.4 lanes, aligned for SSE (see fixed_point.h)
 ////////////////////////////////////////////////////////////////////////
 typedef struct VectorRegister_ {
-  ScalarRegister element[NUM_VECTOR_ELEMENTS]; 
+  alignas(16) ScalarRegister element[NUM_VECTOR_ELEMENTS]; 
 } VectorRegister;
 
 
@@ -93,23 +98,32 @@ typedef struct VertexRegister_ {
 
 
 ////////////////////////////////////////////////////////////////////////
+// Decoded instruction, 8 bytes so that large programs stay cache
+// resident in the interpreter loop
 // 1. opcode
-// 2. scalar_registers: If instruction has dest, src1, src2 registers
-//                      then each register's index will be stored in scalar_registers
-// 3. vector_registers: 
-// 4. idx: This field is for VCOMPMOV instruction
-// 5. primitive_type: This field is for BEGINPRIMITIVE instruction
-// 6. int_value: This field is for integer immediate value 
+// 2. scalar_registers / vector_registers: register indexes of dest, src1,
+//    src2. Both name the same three slots; VectorOperandSlots() gives how
+//    many leading slots hold vector registers (VCOMPMOV: v in slot 0,
+//    r in slot 1)
+// 3. idx: This field is for VCOMPMOV instruction
+//    primitive_type: This field is for BEGINPRIMITIVE instruction
+// 4. int_value: raw 16-bit immediate, zero-extended
 ////////////////////////////////////////////////////////////////////////
 typedef struct TraceOp_ {
-  int16_t opcode;
-  int16_t scalar_registers[3];
-  int64_t vector_registers[3];
-  int idx;
-  int primitive_type;
-  int int_value;
+  uint8_t opcode;
+  union {
+    uint8_t scalar_registers[3];
+    uint8_t vector_registers[3];
+  };
+  union {
+    uint8_t idx;
+    uint8_t primitive_type;
+  };
+  uint16_t int_value;
 } TraceOp;
 
+static_assert(sizeof(TraceOp) == 8, "TraceOp must stay packed");
+
 ////////////////////////////////////////////////////////////////////////
 // GPU Status Register 
 // GSR[0]: draw 
@@ -125,4 +139,211 @@ enum GSR_BITS{
   PRIM_TYPE1 = 3, 
 }; 
 
+////////////////////////////////////////////////////////////////////////
+// Registers written since the last ClearDirtyState(). ExecuteInstruction()
+// marks what it writes; the interpreter loop marks R15 and the JSR link.
+// Used by --dump-delta and --trace to emit only changed state.
+////////////////////////////////////////////////////////////////////////
+enum DirtyFlags {
+  DIRTY_CC = 0x1,
+  DIRTY_GSR = 0x2,
+  DIRTY_VERTEX = 0x4,
+};
+
+enum MachineFault {
+  FAULT_NONE = 0,
+  FAULT_MEMORY = 1,   // LDB/LDW/STB/STW outside data memory
+};
+
+struct Framebuffer_;
+
+////////////////////////////////////////////////////////////////////////
+// One simulated machine: architectural state plus the decoded program
+// and run bookkeeping. Every engine works on g_machine, the machine
+// current on the calling thread, so batch workers (see batch.h) can run
+// programs side by side.
+////////////////////////////////////////////////////////////////////////
+typedef struct Machine_ {
+  ScalarRegister condition_code_register;
+  ScalarRegister scalar_registers[NUM_SCALAR_REGISTER];
+  VectorRegister vector_registers[NUM_VECTOR_REGISTER];
+  VertexRegister gpu_vertex_registers[NUM_VERTEX_REGISTER];
+  ScalarRegister gpu_status_register;
+  unsigned int active_vertex_reg;   // next vertex register SETVERTEX fills
+  TransformStack transform;         // matrix stack of ROTATE, SCALE, TRANSLATE
+  DataMemory memory;
+
+  std::vector<TraceOp> trace_ops;
+  const struct MachineSnapshot_ *base; // snapshot trace_ops were last forked from, NULL after a reset
+  uint64_t instruction_count;
+  unsigned int current_pc;
+  unsigned int program_halt;
+  int fault;                        // MachineFault; the faulting instruction has no effect
+  int fault_pc;
+  int fault_address;
+
+  uint32_t dirty_scalar_mask;
+  uint64_t dirty_vector_mask;
+  unsigned int dirty_flags;
+
+  struct Framebuffer_ *framebuffer; // allocated by the first FLUSH or DRAW
+} Machine;
+
+extern __thread Machine *g_machine;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Allocate a machine in the reset state with memory_size bytes of
+//       data memory
+// output: NULL if the memory cannot be mapped
+////////////////////////////////////////////////////////////////////////
+Machine *NewMachine(const uint32_t memory_size);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Zero every register and memory, drop the program and clear the
+//       framebuffer, keeping allocations for the next run
+////////////////////////////////////////////////////////////////////////
+void ResetMachine(Machine &machine);
+
+void DeleteMachine(Machine *machine);
+
+////////////////////////////////////////////////////////////////////////
+// Starting state of a machine with its program loaded and decoded, from
+// which any number of runs can be forked (see ForkMachine())
+////////////////////////////////////////////////////////////////////////
+typedef struct MachineSnapshot_ {
+  ScalarRegister condition_code_register;
+  ScalarRegister scalar_registers[NUM_SCALAR_REGISTER];
+  VectorRegister vector_registers[NUM_VECTOR_REGISTER];
+  VertexRegister gpu_vertex_registers[NUM_VERTEX_REGISTER];
+  ScalarRegister gpu_status_register;
+  unsigned int active_vertex_reg;
+  std::vector<TraceOp> trace_ops;
+  MemoryImage memory;
+} MachineSnapshot;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Capture the registers, decoded program and written memory pages
+//       of machine
+////////////////////////////////////////////////////////////////////////
+void TakeSnapshot(const Machine &machine, MachineSnapshot &snapshot);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Reset machine to the state captured in snapshot. Memory is
+//       forked with ForkDataMemory(): after the first fork only pages the
+//       previous run stored to are restored. Decoded ops never change
+//       after loading, so they are only copied on the first fork. The snapshot is only read,
+//       so machines on several threads may fork from it at once.
+////////////////////////////////////////////////////////////////////////
+void ForkMachine(Machine &machine, const MachineSnapshot &snapshot);
+
+enum Engine {
+  ENGINE_INTERP = 0,
+  ENGINE_THREADED = 1,
+  ENGINE_BLOCK = 2,
+  ENGINE_JIT = 3,
+};
+
+////////////////////////////////////////////////////////////////////////
+// desc: Run the selected engine on g_machine from its current state
+// output: false if the engine stopped abnormally
+////////////////////////////////////////////////////////////////////////
+bool RunEngine(const Engine engine, const bool jit_verify);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Run the reference interpreter, then the selected engine from the
+//       same starting state, and compare the final states (--verify).
+//       Differences are reported on cerr.
+// output: true if both halted, or stopped on the same memory fault, and
+//         their states match
+////////////////////////////////////////////////////////////////////////
+bool VerifyEngine(const Engine engine, const bool jit_verify);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Stop g_machine on an out-of-range data access by the instruction
+//       at pc and report it on cerr. Engines check fault and return false.
+////////////////////////////////////////////////////////////////////////
+void RaiseMemoryFault(const int pc, const int address);
+
+int SignExtension(const int16_t value);
+TraceOp DecodeInstruction(const uint32_t instruction);
+int ExecuteInstruction(const TraceOp &trace_op);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Assembler mnemonic of opcode ("jmp" for JMP/RET), or "unknown"
+////////////////////////////////////////////////////////////////////////
+const char *OpcodeName(const int opcode);
+
+static inline void MarkScalarDirty(const int idx)
+{
+  g_machine->dirty_scalar_mask |= 1u << idx;
+}
+
+static inline void MarkVectorDirty(const int idx)
+{
+  g_machine->dirty_vector_mask |= (uint64_t)1 << idx;
+}
+
+static inline void MarkAllDirty()
+{
+  g_machine->dirty_scalar_mask = (1u << NUM_SCALAR_REGISTER) - 1;
+  g_machine->dirty_vector_mask = ~(uint64_t)0;
+  g_machine->dirty_flags = DIRTY_CC | DIRTY_GSR | DIRTY_VERTEX;
+}
+
+static inline void ClearDirtyState()
+{
+  g_machine->dirty_scalar_mask = 0;
+  g_machine->dirty_vector_mask = 0;
+  g_machine->dirty_flags = 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Condition code SetConditionCodeInt(value, 0) would produce
+////////////////////////////////////////////////////////////////////////
+static inline int ConditionCode(const int16_t value)
+{
+  return value < 0 ? 4 : (value == 0 ? 2 : 1);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Condition code bits tested by a conditional branch (BRN..BRZP)
+//       BRNZP is unconditional and also taken when no code is set
+////////////////////////////////////////////////////////////////////////
+static inline int BranchConditionMask(const int opcode)
+{
+  switch (opcode) {
+    case OP_BRN:  return 4;
+    case OP_BRZ:  return 2;
+    case OP_BRP:  return 1;
+    case OP_BRNZ: return 6;
+    case OP_BRNP: return 5;
+    case OP_BRZP: return 3;
+    default:      return 0;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Number of leading TraceOp register slots that hold vector
+//       registers; the remaining slots hold scalar registers
+////////////////////////////////////////////////////////////////////////
+static inline int VectorOperandSlots(const int opcode)
+{
+  switch (opcode) {
+    case OP_VADD:
+    case OP_VMOV:
+    case OP_VMOVI:
+    case OP_SETVERTEX:
+    case OP_SETCOLOR:
+    case OP_ROTATE:
+    case OP_TRANSLATE:
+    case OP_SCALE:
+      return 3;
+    case OP_VCOMPMOV:
+    case OP_VCOMPMOVI:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
 #endif // __SIMULATOR_H
\ No newline at end of file
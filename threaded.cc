@@ -0,0 +1,449 @@
+#include <iostream>
+#include <vector>
+#include <stdint.h>
+#include "simulator.h"
+#include "checkpoint.h"
+#include "threaded.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////
+// Handler kinds. The order must match the label table in RunThreaded().
+////////////////////////////////////////////////////////////////////////
+enum ThreadedHandler {
+  H_ADD = 0,
+  H_ADDI,
+  H_ADD_F,
+  H_ADDI_F,
+  H_AND,
+  H_ANDI,
+  H_MOV,
+  H_MOVI,
+  H_CMP,
+  H_CMPI,
+  H_VADD,
+  H_VMOV,
+  H_VMOVI,
+  H_VCOMPMOV,
+  H_VCOMPMOVI,
+  H_LDB,
+  H_LDW,
+  H_STB,
+  H_STW,
+  H_BR,
+  H_BRA,
+  H_JMP,
+  H_JSR,
+  H_JSRR,
+  H_HALT,
+  H_GENERIC,
+  H_OUT_OF_RANGE,
+  NUM_THREADED_HANDLERS,
+};
+
+////////////////////////////////////////////////////////////////////////
+// 1. handler: address of the label executing this instruction
+// 2. dst, src1, src2: operands resolved into the machine's scalar_registers,
+//                     vector_registers (element 0) or memory
+// 3. imm: immediate value, or condition code mask for conditional branches
+// 4. target: absolute instruction index of a PC-relative branch
+////////////////////////////////////////////////////////////////////////
+typedef struct ThreadedOp_ {
+  const void *handler;
+  int *dst;
+  const int *src1;
+  const int *src2;
+  int imm;
+  int target;
+} ThreadedOp;
+
+static inline int *ScalarOperand(const int idx)
+{
+  return &g_machine->scalar_registers[idx].int_value;
+}
+
+static inline int *VectorOperand(const int idx)
+{
+  return &g_machine->vector_registers[idx].element[0].int_value;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Translate one TraceOp into a ThreadedOp
+// input: instruction index, its TraceOp, number of instructions
+////////////////////////////////////////////////////////////////////////
+static ThreadedHandler PredecodeOp(const int pc, const TraceOp &trace_op, const int num_ops,
+                                   ThreadedOp &op)
+{
+  op.dst = NULL;
+  op.src1 = NULL;
+  op.src2 = NULL;
+  op.imm = trace_op.int_value;
+  op.target = pc + 1 + SignExtension(trace_op.int_value);
+  if (op.target < 0 || op.target > num_ops)
+    op.target = num_ops;
+
+  // R15 is only kept up to date around generic instructions, and writing
+  // it acts as a jump; leave anything touching it to ExecuteInstruction().
+  for (int i = VectorOperandSlots(trace_op.opcode); i < 3; i++)
+    if (trace_op.scalar_registers[i] == PC_IDX)
+      return H_GENERIC;
+
+  const uint8_t *sr = trace_op.scalar_registers;
+  const uint8_t *vr = trace_op.vector_registers;
+
+  switch ((uint8_t)trace_op.opcode) {
+    case OP_ADD_D:
+    case OP_ADD_F:
+      op.dst = ScalarOperand(sr[0]);
+      op.src1 = ScalarOperand(sr[1]);
+      op.src2 = ScalarOperand(sr[2]);
+      return trace_op.opcode == OP_ADD_D ? H_ADD : H_ADD_F;
+
+    case OP_ADDI_D:
+    case OP_ADDI_F:
+      op.dst = ScalarOperand(sr[0]);
+      op.src1 = ScalarOperand(sr[1]);
+      return trace_op.opcode == OP_ADDI_D ? H_ADDI : H_ADDI_F;
+
+    case OP_AND_D:
+      op.dst = ScalarOperand(sr[0]);
+      op.src1 = ScalarOperand(sr[1]);
+      op.src2 = ScalarOperand(sr[2]);
+      return H_AND;
+
+    case OP_ANDI_D:
+      op.dst = ScalarOperand(sr[0]);
+      op.src1 = ScalarOperand(sr[1]);
+      return H_ANDI;
+
+    case OP_MOV:
+      op.dst = ScalarOperand(sr[0]);
+      op.src1 = ScalarOperand(sr[1]);
+      return H_MOV;
+
+    case OP_MOVI_D:
+    case OP_MOVI_F:
+      op.dst = ScalarOperand(sr[0]);
+      return H_MOVI;
+
+    case OP_CMP:
+      op.src1 = ScalarOperand(sr[1]);
+      op.src2 = ScalarOperand(sr[2]);
+      return H_CMP;
+
+    case OP_CMPI:
+      op.src1 = ScalarOperand(sr[1]);
+      return H_CMPI;
+
+    case OP_VADD:
+      op.dst = VectorOperand(vr[0]);
+      op.src1 = VectorOperand(vr[1]);
+      op.src2 = VectorOperand(vr[2]);
+      return H_VADD;
+
+    case OP_VMOV:
+      op.dst = VectorOperand(vr[0]);
+      op.src1 = VectorOperand(vr[1]);
+      return H_VMOV;
+
+    case OP_VMOVI:
+      op.dst = VectorOperand(vr[0]);
+      return H_VMOVI;
+
+    case OP_VCOMPMOV:
+      op.dst = VectorOperand(vr[0]) + trace_op.idx;
+      op.src1 = ScalarOperand(sr[1]);
+      return H_VCOMPMOV;
+
+    case OP_VCOMPMOVI:
+      op.dst = VectorOperand(vr[0]) + trace_op.idx;
+      return H_VCOMPMOVI;
+
+    case OP_LDB:
+    case OP_LDW:
+      op.dst = ScalarOperand(sr[0]);
+      op.src1 = ScalarOperand(sr[1]);
+      return trace_op.opcode == OP_LDB ? H_LDB : H_LDW;
+
+    case OP_STB:
+    case OP_STW:
+      op.src1 = ScalarOperand(sr[1]);
+      op.src2 = ScalarOperand(sr[0]);
+      return trace_op.opcode == OP_STB ? H_STB : H_STW;
+
+    case OP_BRN:
+    case OP_BRZ:
+    case OP_BRP:
+    case OP_BRNZ:
+    case OP_BRNP:
+    case OP_BRZP:
+      op.imm = BranchConditionMask(trace_op.opcode);
+      return H_BR;
+
+    case OP_BRNZP:
+      return H_BRA;
+
+    case OP_JMP:
+      op.src1 = ScalarOperand(sr[0]);
+      return H_JMP;
+
+    case OP_JSR:
+      return H_JSR;
+
+    case OP_JSRR:
+      // ExecuteInstruction() reads the target after overwriting LR
+      if (sr[0] == LR_IDX)
+        return H_GENERIC;
+      op.src1 = ScalarOperand(sr[0]);
+      return H_JSRR;
+
+    case OP_HALT:
+      return H_HALT;
+
+    default:
+      return H_GENERIC;
+  }
+}
+
+bool RunThreaded()
+{
+  static const void *const handlers[NUM_THREADED_HANDLERS] = {
+    &&do_add, &&do_addi, &&do_add_f, &&do_addi_f, &&do_and, &&do_andi, &&do_mov, &&do_movi,
+    &&do_cmp, &&do_cmpi, &&do_vadd, &&do_vmov, &&do_vmovi,
+    &&do_vcompmov, &&do_vcompmovi, &&do_ldb, &&do_ldw, &&do_stb, &&do_stw,
+    &&do_br, &&do_bra, &&do_jmp, &&do_jsr, &&do_jsrr, &&do_halt,
+    &&do_generic, &&do_out_of_range,
+  };
+
+  ///////////////////////////////////////////////////////////////
+  // Predecode; the extra trailing entry catches PCs that leave the program
+  ///////////////////////////////////////////////////////////////
+  const int num_ops = g_machine->trace_ops.size();
+  vector<ThreadedOp> ops(num_ops + 1);
+  for (int pc = 0; pc < num_ops; pc++)
+    ops[pc].handler = handlers[PredecodeOp(pc, g_machine->trace_ops[pc], num_ops, ops[pc])];
+  ops[num_ops].handler = handlers[H_OUT_OF_RANGE];
+
+  ThreadedOp *const base = &ops[0];
+  unsigned char *const memory = g_machine->memory.bytes;
+  const unsigned int memory_size = g_machine->memory.size;
+  int *const link = &g_machine->scalar_registers[LR_IDX].int_value;
+  int *const pc_reg = &g_machine->scalar_registers[PC_IDX].int_value;
+  int cc = g_machine->condition_code_register.int_value;
+  uint64_t count = 0;
+  // Instructions until the next checkpoint, which is taken at a jump
+  uint64_t checkpoint_budget = g_next_checkpoint - g_machine->instruction_count;
+  bool in_range = true;
+
+  const ThreadedOp *op;
+  int pc = *pc_reg;
+  op = base + ((unsigned int)pc < (unsigned int)num_ops ? pc : num_ops);
+
+#define DISPATCH() do { count++; goto *op->handler; } while (0)
+#define NEXT() do { op++; DISPATCH(); } while (0)
+#define JUMP_ABSOLUTE(t) do { \
+    int target_ = (t); \
+    op = base + ((unsigned int)target_ < (unsigned int)num_ops ? target_ : num_ops); \
+    if (count >= checkpoint_budget) \
+      goto checkpoint; \
+    DISPATCH(); \
+  } while (0)
+
+  DISPATCH();
+
+do_add:
+  *op->dst = *op->src1 + *op->src2;
+  cc = ConditionCode(*op->dst);
+  NEXT();
+
+do_addi:
+  *op->dst = *op->src1 + op->imm;
+  cc = ConditionCode(*op->dst);
+  NEXT();
+
+do_add_f:
+  *op->dst = Fixed1114Add(*op->src1, *op->src2);
+  cc = ConditionCode(*op->dst);
+  NEXT();
+
+do_addi_f:
+  *op->dst = Fixed1114Add(*op->src1, op->imm);
+  cc = ConditionCode(*op->dst);
+  NEXT();
+
+do_and:
+  *op->dst = *op->src1 & *op->src2;
+  cc = ConditionCode(*op->dst);
+  NEXT();
+
+do_andi:
+  *op->dst = *op->src1 & op->imm;
+  cc = ConditionCode(*op->dst);
+  NEXT();
+
+do_mov:
+  *op->dst = *op->src1;
+  cc = ConditionCode(*op->dst);
+  NEXT();
+
+do_movi:
+  *op->dst = op->imm;
+  cc = ConditionCode(op->imm);
+  NEXT();
+
+do_cmp:
+  cc = *op->src1 < *op->src2 ? 4 : (*op->src1 == *op->src2 ? 2 : 1);
+  NEXT();
+
+do_cmpi:
+  cc = *op->src1 < op->imm ? 4 : (*op->src1 == op->imm ? 2 : 1);
+  NEXT();
+
+do_vadd:
+  Fixed1114AddLanes(op->dst, op->src1, op->src2);
+  NEXT();
+
+do_vmov:
+  CopyLanes(op->dst, op->src1);
+  NEXT();
+
+do_vmovi:
+  FillLanes(op->dst, op->imm);
+  NEXT();
+
+do_vcompmov:
+  *op->dst = Fixed1114Bits(*op->src1);
+  NEXT();
+
+do_vcompmovi:
+  *op->dst = op->imm;
+  NEXT();
+
+// Out-of-range accesses take the generic path, which raises the fault
+do_ldb:
+  {
+    unsigned int address = *op->src1 + op->imm;
+    if (address > memory_size - 1)
+      goto do_generic;
+    *op->dst = memory[address];
+    cc = ConditionCode(*op->dst);
+  }
+  NEXT();
+
+do_ldw:
+  {
+    unsigned int address = *op->src1 + op->imm;
+    if (address > memory_size - 2)
+      goto do_generic;
+    *op->dst = memory[address + 1] << 8 | memory[address];
+    cc = ConditionCode(*op->dst);
+  }
+  NEXT();
+
+do_stb:
+  {
+    unsigned int address = *op->src1 + op->imm;
+    if (address > memory_size - 1)
+      goto do_generic;
+    memory[address] = *op->src2;
+    MarkPageWritten(g_machine->memory, address);
+  }
+  NEXT();
+
+do_stw:
+  {
+    unsigned int address = *op->src1 + op->imm;
+    if (address > memory_size - 2)
+      goto do_generic;
+    int value = *op->src2;
+    memory[address + 1] = value >> 8;
+    memory[address] = value & 0x00FF;
+    MarkPageWritten(g_machine->memory, address);
+    MarkPageWritten(g_machine->memory, address + 1);
+  }
+  NEXT();
+
+do_br:
+  if (cc & op->imm)
+    JUMP_ABSOLUTE(op->target);
+  NEXT();
+
+do_bra:
+  JUMP_ABSOLUTE(op->target);
+
+do_jmp:
+  JUMP_ABSOLUTE(*op->src1 >> 2);
+
+do_jsr:
+  *link = (op - base + 1) << 2;
+  JUMP_ABSOLUTE(op->target);
+
+do_jsrr:
+  {
+    int target = *op->src1 >> 2;
+    *link = (op - base + 1) << 2;
+    JUMP_ABSOLUTE(target);
+  }
+
+do_generic:
+  {
+    // Same sequence as the reference loop in main()
+    pc = op - base;
+    const TraceOp &trace_op = g_machine->trace_ops[pc];
+    g_machine->condition_code_register.int_value = cc;
+    *pc_reg = pc;
+    int idx = ExecuteInstruction(trace_op);
+    if (g_machine->fault != FAULT_NONE) {
+      count--;
+      in_range = false;
+      goto done;
+    }
+    if (trace_op.opcode == OP_JSR || trace_op.opcode == OP_JSRR)
+      *link = (*pc_reg + 1) << 2;
+    *pc_reg += 1;
+    if (idx != -1) {
+      if (trace_op.opcode == OP_JMP || trace_op.opcode == OP_JSRR)
+        *pc_reg = idx;
+      else
+        *pc_reg += idx;
+    }
+    cc = g_machine->condition_code_register.int_value;
+    if (g_machine->program_halt == 1)
+      goto done;
+    JUMP_ABSOLUTE(*pc_reg);
+  }
+
+do_halt:
+  pc = op - base;
+  *pc_reg = pc + 1;
+  g_machine->program_halt = 1;
+  goto done;
+
+checkpoint:
+  *pc_reg = op - base;
+  g_machine->condition_code_register.int_value = cc;
+  g_machine->instruction_count += count;
+  count = 0;
+  if (!WriteCheckpoint()) {
+    in_range = false;
+    goto done;
+  }
+  checkpoint_budget = g_next_checkpoint - g_machine->instruction_count;
+  DISPATCH();
+
+do_out_of_range:
+  count--;
+  in_range = false;
+  cerr << "Error: PC left the program (" << num_ops << " instructions)" << endl;
+  goto done;
+
+#undef JUMP_ABSOLUTE
+#undef NEXT
+#undef DISPATCH
+
+done:
+  g_machine->condition_code_register.int_value = cc;
+  g_machine->current_pc = pc;
+  g_machine->instruction_count += count;
+  return in_range;
+}
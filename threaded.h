@@ -0,0 +1,16 @@
+#ifndef __THREADED_H
+#define __THREADED_H
+
+////////////////////////////////////////////////////////////////////////
+// desc: Execute g_machine's trace_ops with the direct-threaded engine,
+//       starting at the instruction index held in R15, until HALT.
+//       trace_ops is predecoded into handler addresses with operand
+//       pointers resolved into the register file and branch targets
+//       resolved to absolute indices. Instructions without a fast
+//       handler (graphics ops, anything touching R15) go through
+//       ExecuteInstruction().
+// output: false if the PC left the program
+////////////////////////////////////////////////////////////////////////
+bool RunThreaded();
+
+#endif // __THREADED_H
@@ -0,0 +1,445 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iomanip>
+#include <stdint.h>
+#include <cstring>
+#include <stdlib.h>
+#include "simulator.h"
+#include "timing.h"
+
+using namespace std;
+
+bool g_timing_enabled = false;
+Timing g_timing;
+static string g_timing_path;
+
+void DefaultPipelineConfig(PipelineConfig &config)
+{
+  config.forwarding = true;
+  config.load_use = 1;
+  config.branch_penalty = 2;
+  config.gpu = 2;
+  config.draw = 8;
+}
+
+bool ParsePipelineConfig(const char *spec, PipelineConfig &config)
+{
+  string rest = spec;
+  while (!rest.empty()) {
+    size_t comma = rest.find(',');
+    string item = rest.substr(0, comma);
+    rest = comma == string::npos ? "" : rest.substr(comma + 1);
+
+    size_t equals = item.find('=');
+    if (equals == string::npos || equals + 1 == item.size())
+      return false;
+    string key = item.substr(0, equals);
+    char *end;
+    long value = strtol(item.c_str() + equals + 1, &end, 10);
+    if (*end != '\0' || value < 0 || value > 64)
+      return false;
+
+    if (key == "forwarding" && value <= 1)
+      config.forwarding = value == 1;
+    else if (key == "load_use")
+      config.load_use = value;
+    else if (key == "branch_penalty")
+      config.branch_penalty = value;
+    else if (key == "gpu" && value >= 1)
+      config.gpu = value;
+    else if (key == "draw" && value >= 1)
+      config.draw = value;
+    else
+      return false;
+  }
+  return true;
+}
+
+static uint8_t ScalarSource(const int reg)
+{
+  return reg == PC_IDX ? TIMING_NO_SOURCE : reg;
+}
+
+static uint8_t ScalarDest(const int reg)
+{
+  return reg == PC_IDX ? TIMING_NO_DEST : reg;
+}
+
+static uint8_t VectorResource(const int reg)
+{
+  return NUM_SCALAR_REGISTER + reg;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Registers read and written by trace_op and its pipeline timing
+////////////////////////////////////////////////////////////////////////
+static TimingOp DecodeTimingOp(const TraceOp &trace_op, const PipelineConfig &config)
+{
+  TimingOp op;
+  memset(op.sources, TIMING_NO_SOURCE, sizeof(op.sources));
+  memset(op.dests, TIMING_NO_DEST, sizeof(op.dests));
+  bool from_load = false;
+  op.ex_cycles = 1;
+  const uint8_t *sr = trace_op.scalar_registers;
+  const uint8_t *vr = trace_op.vector_registers;
+
+  switch (trace_op.opcode) {
+    case OP_ADD_D:
+    case OP_ADD_F:
+    case OP_AND_D:
+      op.sources[1] = ScalarSource(sr[2]);
+      // fall through
+    case OP_ADDI_D:
+    case OP_ADDI_F:
+    case OP_ANDI_D:
+    case OP_MOV:
+      op.sources[0] = ScalarSource(sr[1]);
+      // fall through
+    case OP_MOVI_D:
+    case OP_MOVI_F:
+      op.dests[0] = ScalarDest(sr[0]);
+      op.dests[1] = TIMING_CC_RESOURCE;
+      break;
+    case OP_LDB:
+    case OP_LDW:
+      op.sources[0] = ScalarSource(sr[1]);
+      op.dests[0] = ScalarDest(sr[0]);
+      op.dests[1] = TIMING_CC_RESOURCE;
+      from_load = true;
+      break;
+    case OP_STB:
+    case OP_STW:
+      op.sources[0] = ScalarSource(sr[0]);
+      op.sources[1] = ScalarSource(sr[1]);
+      break;
+    case OP_CMP:
+      op.sources[1] = ScalarSource(sr[2]);
+      // fall through
+    case OP_CMPI:
+      op.sources[0] = ScalarSource(sr[1]);
+      op.dests[0] = TIMING_CC_RESOURCE;
+      break;
+    case OP_VADD:
+      op.sources[1] = VectorResource(vr[2]);
+      // fall through
+    case OP_VMOV:
+      op.sources[0] = VectorResource(vr[1]);
+      // fall through
+    case OP_VMOVI:
+    case OP_VCOMPMOVI:
+      op.dests[0] = VectorResource(vr[0]);
+      break;
+    case OP_VCOMPMOV:
+      op.sources[0] = ScalarSource(sr[1]);
+      op.dests[0] = VectorResource(vr[0]);
+      break;
+    case OP_SETVERTEX:
+    case OP_SETCOLOR:
+    case OP_ROTATE:
+    case OP_TRANSLATE:
+    case OP_SCALE:
+      op.sources[0] = VectorResource(vr[0]);
+      op.ex_cycles = config.gpu;
+      break;
+    case OP_PUSHMATRIX:
+    case OP_POPMATRIX:
+    case OP_BEGINPRIMITIVE:
+    case OP_ENDPRIMITIVE:
+    case OP_LOADIDENTITY:
+      op.ex_cycles = config.gpu;
+      break;
+    case OP_FLUSH:
+    case OP_DRAW:
+      op.ex_cycles = config.draw;
+      break;
+    case OP_BRN:
+    case OP_BRZ:
+    case OP_BRP:
+    case OP_BRNZ:
+    case OP_BRNP:
+    case OP_BRZP:
+      op.sources[0] = TIMING_CC_RESOURCE;
+      break;
+    case OP_JSRR:
+      op.dests[0] = ScalarDest(LR_IDX);
+      // fall through
+    case OP_JMP:
+      op.sources[0] = ScalarSource(sr[0]);
+      break;
+    case OP_JSR:
+      op.dests[0] = ScalarDest(LR_IDX);
+      break;
+  }
+
+  // Forwarded results feed the next EX; otherwise they are read in ID
+  // during the producer's WB
+  const int result_delay = !config.forwarding ? 3 : 1 + (from_load ? config.load_use : 0);
+  op.result = (result_delay << 1) | from_load;
+  return op;
+}
+
+void TimingStart(const char *path, const PipelineConfig &config)
+{
+  const vector<TraceOp> &trace_ops = g_machine->trace_ops;
+  g_timing.config = config;
+  g_timing.ops.resize(trace_ops.size());
+  for (size_t pc = 0; pc < trace_ops.size(); pc++)
+    g_timing.ops[pc] = DecodeTimingOp(trace_ops[pc], config);
+  g_timing.counters.assign(trace_ops.size(), TimingCounters());
+  g_timing.blocks.assign(trace_ops.size(), TimingBlock());
+  g_timing.batch_size = 0;
+  g_timing.block_start = true;
+  g_timing.ready_max = 0;
+  for (int i = 0; i < TIMING_NUM_RESOURCES; i++)
+    g_timing.ready[i] = 0;
+  // The first instruction is fetched in cycle 0 and reaches EX in cycle 2
+  g_timing.next_ex = 2;
+  g_timing.ex_end = 2;
+  g_timing_path = path;
+  g_timing_enabled = true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Time op, which enters EX at next_ex or when its sources are
+//       ready, and write its results to ready
+// output: stall cycles and their kind
+////////////////////////////////////////////////////////////////////////
+static inline uint64_t TimeOp(const TimingOp &op, const bool redirected, const uint64_t branch_penalty,
+                              uint64_t *ready, uint64_t &ready_max, uint64_t &next_ex,
+                              uint64_t &ex_end, int &kind)
+{
+  uint64_t ex = next_ex;
+  uint64_t stall = 0;
+  // Ready words above limit are for a cycle after next_ex. Testing all
+  // sources at once keeps the usual no-stall case to one branch.
+  const uint64_t limit = (next_ex << 1) | 1;
+  if ((ready[op.sources[0]] > limit) | (ready[op.sources[1]] > limit) |
+      (ready[op.sources[2]] > limit)) {
+    // The first source that is ready last gives the stall kind
+    uint64_t word = 0;
+    for (int j = 0; j < 3; j++) {
+      if ((ready[op.sources[j]] >> 1) > ex) {
+        word = ready[op.sources[j]];
+        ex = word >> 1;
+      }
+    }
+    kind = (word & 1) ? STALL_LOAD_USE : STALL_DATA;
+    stall = ex - next_ex;
+  }
+  const uint64_t result = (ex << 1) + op.result;
+  ready[op.dests[0]] = result;
+  ready[op.dests[1]] = result;
+  ready_max = max(ready_max, result);
+  ex_end = ex + op.ex_cycles;
+  next_ex = ex_end + (redirected ? branch_penalty : 0);
+  return stall;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Model the block of length instructions at start from a state
+//       with no result pending
+////////////////////////////////////////////////////////////////////////
+static void ModelBlock(TimingBlock &block, const uint32_t start, const uint32_t length)
+{
+  uint64_t ready[TIMING_NUM_RESOURCES] = {0};
+  uint64_t ready_max = 0, next_ex = 0, ex_end = 0;
+  block.stalls.clear();
+  for (uint32_t k = 0; k < length; k++) {
+    int kind;
+    const uint64_t stall = TimeOp(g_timing.ops[start + k], k + 1 == length, g_timing.config.branch_penalty,
+                                  ready, ready_max, next_ex, ex_end, kind);
+    if (stall > 0) {
+      TimingBlockStall block_stall = {start + k, (uint32_t)kind, stall};
+      block.stalls.push_back(block_stall);
+    }
+  }
+  block.length = length;
+  block.memoized = ready_max <= ((next_ex << 1) | 1);
+  block.hits = 0;
+  block.misses = 0;
+  block.cycles = next_ex;
+  block.ex_end = ex_end;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Add the memoized runs of the block at start to the counters
+////////////////////////////////////////////////////////////////////////
+static void CountBlockUses(TimingBlock &block, const uint32_t start)
+{
+  if (block.uses == 0)
+    return;
+  vector<TimingCounters> &counters = g_timing.counters;
+  for (uint32_t k = 0; k < block.length; k++)
+    counters[start + k].executions += block.uses;
+  counters[start + block.length - 1].redirects += block.uses;
+  for (size_t i = 0; i < block.stalls.size(); i++)
+    counters[block.stalls[i].pc].stalls[block.stalls[i].kind] += block.stalls[i].cycles * block.uses;
+  block.uses = 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// output: true if the length PCs at pcs run straight and the last one
+//         redirects
+////////////////////////////////////////////////////////////////////////
+static inline bool IsBlockRun(const uint32_t *pcs, const int length)
+{
+  bool straight = true;
+  for (int k = 0; k + 1 < length; k++)
+    straight &= pcs[k + 1] == pcs[k] + 1;
+  return straight && pcs[length] != pcs[length - 1] + 1;
+}
+
+void TimingFlush()
+{
+  Timing &t = g_timing;
+  const uint32_t *const batch = t.batch;
+  const int size = t.batch_size;
+  TimingCounters *const counters = &t.counters[0];
+  const uint64_t branch_penalty = t.config.branch_penalty;
+  uint64_t next_ex = t.next_ex;
+  uint64_t ex_end = t.ex_end;
+  uint64_t ready_max = t.ready_max;
+  bool block_start = t.block_start;
+  // The instruction after the last one in the batch is the current PC
+  t.batch[size] = g_machine->scalar_registers[PC_IDX].int_value;
+  int i = 0;
+  while (i < size) {
+    const uint32_t pc = batch[i];
+    if (block_start && ready_max <= ((next_ex << 1) | 1)) {
+      TimingBlock &block = t.blocks[pc];
+      const int length = block.length;
+      if (length > 0 && length <= size - i && IsBlockRun(batch + i, length)) {
+        block.hits++;
+        if (block.memoized) {
+          block.uses++;
+          ex_end = next_ex + block.ex_end;
+          next_ex += block.cycles;
+          i += length;
+          continue;
+        }
+      }
+      else {
+        // Model the run as it is now if it ends in this batch, unless
+        // the block usually has the length it was modelled with
+        int end = i;
+        while (end < size && batch[end + 1] == batch[end] + 1)
+          end++;
+        if (end < size && (length == 0 || ++block.misses > block.hits)) {
+          CountBlockUses(block, pc);
+          ModelBlock(block, pc, end - i + 1);
+          continue;
+        }
+      }
+    }
+
+    const bool redirected = batch[i + 1] != pc + 1;
+    int kind;
+    const uint64_t stall = TimeOp(t.ops[pc], redirected, branch_penalty, t.ready, ready_max, next_ex,
+                                  ex_end, kind);
+    TimingCounters &pc_counters = counters[pc];
+    if (stall > 0)
+      pc_counters.stalls[kind] += stall;
+    pc_counters.executions++;
+    pc_counters.redirects += redirected;
+    block_start = redirected;
+    i++;
+  }
+  t.next_ex = next_ex;
+  t.ex_end = ex_end;
+  t.ready_max = ready_max;
+  t.block_start = block_start;
+  t.batch_size = 0;
+}
+
+static bool ByCountDescending(const pair<uint64_t, int> &a, const pair<uint64_t, int> &b)
+{
+  return a.first != b.first ? a.first > b.first : a.second < b.second;
+}
+
+static double Percent(const uint64_t count, const uint64_t total)
+{
+  return total == 0 ? 0.0 : 100.0 * count / total;
+}
+
+static double Ratio(const uint64_t count, const uint64_t total)
+{
+  return total == 0 ? 0.0 : (double)count / total;
+}
+
+bool TimingWrite()
+{
+  if (!g_timing_enabled)
+    return true;
+  TimingFlush();
+  g_timing_enabled = false;
+
+  static const char *stall_names[NUM_STALL_KINDS] = {"data", "load-use", "control", "gpu"};
+  const vector<TraceOp> &ops = g_machine->trace_ops;
+  vector<TimingCounters> &counters = g_timing.counters;
+  for (size_t pc = 0; pc < counters.size(); pc++)
+    CountBlockUses(g_timing.blocks[pc], pc);
+  for (size_t pc = 0; pc < counters.size(); pc++) {
+    counters[pc].stalls[STALL_CONTROL] = counters[pc].redirects * g_timing.config.branch_penalty;
+    counters[pc].stalls[STALL_GPU] = counters[pc].executions * (g_timing.ops[pc].ex_cycles - 1);
+  }
+  uint64_t instructions = 0;
+  uint64_t stalls[NUM_STALL_KINDS] = {0};
+  vector<pair<uint64_t, int> > rows;
+  for (size_t pc = 0; pc < counters.size(); pc++) {
+    instructions += counters[pc].executions;
+    uint64_t pc_stalls = 0;
+    for (int kind = 0; kind < NUM_STALL_KINDS; kind++) {
+      stalls[kind] += counters[pc].stalls[kind];
+      pc_stalls += counters[pc].stalls[kind];
+    }
+    if (pc_stalls > 0)
+      rows.push_back(make_pair(pc_stalls, (int)pc));
+  }
+  // MEM and WB of the last instruction
+  const uint64_t cycles = instructions == 0 ? 0 : g_timing.ex_end + 2;
+
+  ofstream out(g_timing_path.c_str());
+  if (!out) {
+    cerr << "Error: cannot write timing report " << g_timing_path << endl;
+    return false;
+  }
+  const PipelineConfig &config = g_timing.config;
+  out.setf(ios::fixed);
+  out.precision(2);
+  out << "Pipeline: 5-stage in-order, forwarding " << (config.forwarding ? "on" : "off")
+      << ", load-use " << config.load_use << ", branch penalty " << config.branch_penalty
+      << ", gpu " << config.gpu << ", draw " << config.draw << "\n\n";
+  out << "Instructions: " << instructions << "\n";
+  out << "Cycles:       " << cycles << "\n";
+  out << "CPI:          " << Ratio(cycles, instructions) << "\n";
+
+  out << "\nStalls:\n" << setw(14) << "cycles" << setw(8) << "%" << "  kind\n";
+  for (int kind = 0; kind < NUM_STALL_KINDS; kind++)
+    out << setw(14) << stalls[kind] << setw(8) << Percent(stalls[kind], cycles) << "  "
+        << stall_names[kind] << "\n";
+
+  sort(rows.begin(), rows.end(), ByCountDescending);
+  out << "\nStalls by PC (instruction index):\n" << setw(8) << "pc" << setw(14) << "executed"
+      << setw(8) << "CPI";
+  for (int kind = 0; kind < NUM_STALL_KINDS; kind++)
+    out << setw(12) << stall_names[kind];
+  out << "  opcode\n";
+  for (size_t i = 0; i < rows.size() && i < TIMING_TOP_PCS; i++) {
+    const TimingCounters &pc_counters = counters[rows[i].second];
+    out << setw(8) << rows[i].second << setw(14) << pc_counters.executions << setw(8)
+        << Ratio(pc_counters.executions + rows[i].first, pc_counters.executions);
+    for (int kind = 0; kind < NUM_STALL_KINDS; kind++)
+      out << setw(12) << pc_counters.stalls[kind];
+    out << "  " << OpcodeName(ops[rows[i].second].opcode) << "\n";
+  }
+
+  out.close();
+  if (out.fail()) {
+    cerr << "Error: cannot write timing report " << g_timing_path << endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,161 @@
+#ifndef __TIMING_H
+#define __TIMING_H
+
+#include <stdint.h>
+#include <vector>
+#include "simulator.h"
+
+////////////////////////////////////////////////////////////////////////
+// Pipeline timing model (--timing FILE, interp only)
+//
+// A cycle-approximate model of an in-order, single-issue 5-stage
+// pipeline (IF ID EX MEM WB) of the 3220X core, layered on the
+// instructions the interpreter executes. TimingStart() predecodes every
+// TraceOp into the registers it reads and writes. The interpreter only
+// appends the PC of each executed instruction to a batch of
+// TIMING_BATCH_SIZE; TimingFlush() runs each full batch through the
+// model, taking an instruction as redirected when the next PC in the
+// batch is not pc + 1, and reusing the timing of blocks it has seen (see
+// TimingBlock). For each instruction the model only advances the cycle
+// in which the next instruction may enter EX, delayed by
+//
+//   data      a source register is not ready yet. With forwarding a result
+//             can feed the next instruction's EX; without it, only from WB,
+//             two cycles later. Registers are R0-R14, V0-V63 and the
+//             condition codes; R15 (PC) is always ready.
+//   load-use  the same for a load result, which with forwarding is ready
+//             load_use cycles later than an ALU result
+//   control   a taken branch or jump is resolved in EX: the
+//             branch_penalty instructions fetched behind it are squashed
+//   gpu       GPU instructions hold EX for gpu cycles (draw and flush:
+//             draw cycles)
+//
+// A program of N instructions without stalls takes N + 4 cycles.
+// TimingWrite() reports cycles, CPI and the stall breakdown, in total
+// and for the PCs with the most stall cycles.
+//
+// --pipeline KEY=VALUE[,KEY=VALUE...] configures the model:
+//   forwarding=0|1 (1)   load_use=N (1)   branch_penalty=N (2)
+//   gpu=N (2)            draw=N (8)
+////////////////////////////////////////////////////////////////////////
+#define TIMING_BATCH_SIZE 4096
+#define TIMING_TOP_PCS 50          // PCs listed in the report
+#define TIMING_CC_RESOURCE (NUM_SCALAR_REGISTER + NUM_VECTOR_REGISTER)
+#define TIMING_NO_SOURCE (TIMING_CC_RESOURCE + 1)   // never written, always ready
+#define TIMING_NO_DEST (TIMING_CC_RESOURCE + 2)     // written, never read
+#define TIMING_NUM_RESOURCES (TIMING_CC_RESOURCE + 3)
+
+enum TimingStall {
+  STALL_DATA = 0,
+  STALL_LOAD_USE,
+  STALL_CONTROL,
+  STALL_GPU,
+  NUM_STALL_KINDS
+};
+
+typedef struct PipelineConfig_ {
+  bool forwarding;
+  int load_use;
+  int branch_penalty;
+  int gpu;
+  int draw;
+} PipelineConfig;
+
+////////////////////////////////////////////////////////////////////////
+// Predecoded instruction: resources are scalar registers 0-15, vector
+// registers at NUM_SCALAR_REGISTER and the condition codes at
+// TIMING_CC_RESOURCE
+////////////////////////////////////////////////////////////////////////
+typedef struct TimingOp_ {
+  uint8_t sources[3];
+  uint8_t dests[2];
+  uint8_t result;                    // added to EX cycle << 1 to give the ready word
+  uint8_t ex_cycles;                 // cycles the instruction holds EX
+} TimingOp;
+
+////////////////////////////////////////////////////////////////////////
+// Per-PC counters. Only data and load-use stalls depend on the run;
+// TimingWrite() derives control stalls from redirects and gpu stalls
+// from executions, so the hot path does not add them up.
+////////////////////////////////////////////////////////////////////////
+typedef struct TimingCounters_ {
+  uint64_t executions;
+  uint64_t redirects;                // times the next PC was not pc + 1
+  uint64_t stalls[NUM_STALL_KINDS];
+} TimingCounters;
+
+////////////////////////////////////////////////////////////////////////
+// A block is the run from the target of a redirect up to and including
+// the next redirect. Entered with no result pending, its timing does not
+// depend on what ran before, so it is modelled once and then only
+// counted; its uses are added to the per-PC counters when it is
+// remodelled and by TimingWrite().
+////////////////////////////////////////////////////////////////////////
+typedef struct TimingBlockStall_ {
+  uint32_t pc;
+  uint32_t kind;
+  uint64_t cycles;
+} TimingBlockStall;
+
+typedef struct TimingBlock_ {
+  uint32_t length;                   // instructions, 0 until modelled
+  bool memoized;                     // false if results are still pending at its end
+  uint64_t uses;                     // memoized runs not yet in the counters
+  uint64_t hits;                     // runs of length instructions since modelled
+  uint64_t misses;                   // runs of another length since modelled
+  uint64_t cycles;                   // next_ex advance, branch penalty included
+  uint64_t ex_end;                   // ex_end relative to next_ex at entry
+  std::vector<TimingBlockStall> stalls;
+} TimingBlock;
+
+typedef struct Timing_ {
+  PipelineConfig config;
+  uint32_t batch[TIMING_BATCH_SIZE + 1];   // executed PCs, then the next PC
+  int batch_size;
+  bool block_start;                        // the next PC recorded starts a block
+  std::vector<TimingOp> ops;               // per instruction index
+  std::vector<TimingCounters> counters;    // per instruction index
+  std::vector<TimingBlock> blocks;         // per first instruction index
+  // First cycle a reader can be in EX << 1, | 1 if the value is loaded
+  uint64_t ready[TIMING_NUM_RESOURCES];
+  uint64_t ready_max;                      // no ready word is above it
+  uint64_t next_ex;                        // first cycle the next instruction can be in EX
+  uint64_t ex_end;                         // cycle after the last instruction left EX
+} Timing;
+
+extern bool g_timing_enabled;
+extern Timing g_timing;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Parse a --pipeline specification on top of the defaults
+// output: false if a key or value is invalid
+////////////////////////////////////////////////////////////////////////
+bool ParsePipelineConfig(const char *spec, PipelineConfig &config);
+void DefaultPipelineConfig(PipelineConfig &config);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Predecode g_machine's program and start timing
+// input: path of the report
+////////////////////////////////////////////////////////////////////////
+void TimingStart(const char *path, const PipelineConfig &config);
+
+void TimingFlush();
+
+////////////////////////////////////////////////////////////////////////
+// desc: Record the instruction at pc, which has just executed; the PC
+//       register must already hold the next PC
+////////////////////////////////////////////////////////////////////////
+static inline void TimingRecord(const int pc)
+{
+  g_timing.batch[g_timing.batch_size++] = pc;
+  if (g_timing.batch_size == TIMING_BATCH_SIZE)
+    TimingFlush();
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Write the timing report
+// output: false if the file cannot be written
+////////////////////////////////////////////////////////////////////////
+bool TimingWrite();
+
+#endif // __TIMING_H
@@ -0,0 +1,227 @@
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "simulator.h"
+#include "program_image.h"
+#include "trace_format.h"
+#include "trace.h"
+
+using namespace std;
+
+bool g_trace_enabled = false;
+
+static FILE *g_trace_file = NULL;
+static unsigned char *g_trace_ring = NULL;
+
+// Ring positions are byte counts since TraceOpen(); the ring offset is
+// position & (TRACE_RING_SIZE - 1).
+static size_t g_trace_head = 0;        // producer only
+static size_t g_trace_limit = 0;       // producer's cached consumed + TRACE_RING_SIZE
+static size_t g_trace_published = 0;   // guarded by g_trace_lock
+static size_t g_trace_consumed = 0;    // guarded by g_trace_lock
+static bool g_trace_closing = false;   // guarded by g_trace_lock
+static bool g_trace_write_error = false;
+
+static pthread_t g_trace_writer;
+static pthread_mutex_t g_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_trace_data_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_trace_space_ready = PTHREAD_COND_INITIALIZER;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Background writer: copy published ring bytes to the file until
+//       TraceClose() asks it to stop and everything has been written
+////////////////////////////////////////////////////////////////////////
+static void *TraceWriterMain(void *)
+{
+  pthread_mutex_lock(&g_trace_lock);
+  for (;;) {
+    while (g_trace_published == g_trace_consumed && !g_trace_closing)
+      pthread_cond_wait(&g_trace_data_ready, &g_trace_lock);
+    if (g_trace_published == g_trace_consumed)
+      break;
+
+    size_t begin = g_trace_consumed;
+    size_t end = g_trace_published;
+    pthread_mutex_unlock(&g_trace_lock);
+
+    while (begin != end) {
+      size_t offset = begin & (TRACE_RING_SIZE - 1);
+      size_t length = end - begin;
+      if (length > TRACE_RING_SIZE - offset)
+        length = TRACE_RING_SIZE - offset;
+      if (!g_trace_write_error &&
+          fwrite(g_trace_ring + offset, 1, length, g_trace_file) != length)
+        g_trace_write_error = true;
+      begin += length;
+    }
+
+    pthread_mutex_lock(&g_trace_lock);
+    g_trace_consumed = end;
+    pthread_cond_signal(&g_trace_space_ready);
+  }
+  pthread_mutex_unlock(&g_trace_lock);
+  return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Hand everything encoded so far to the writer
+////////////////////////////////////////////////////////////////////////
+static void TracePublish()
+{
+  pthread_mutex_lock(&g_trace_lock);
+  g_trace_published = g_trace_head;
+  pthread_cond_signal(&g_trace_data_ready);
+  pthread_mutex_unlock(&g_trace_lock);
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: Block until the ring has room for size more bytes
+////////////////////////////////////////////////////////////////////////
+static void TraceReserve(const size_t size)
+{
+  if (g_trace_head + size <= g_trace_limit)
+    return;
+
+  TracePublish();
+  pthread_mutex_lock(&g_trace_lock);
+  while (g_trace_head + size > g_trace_consumed + TRACE_RING_SIZE)
+    pthread_cond_wait(&g_trace_space_ready, &g_trace_lock);
+  g_trace_limit = g_trace_consumed + TRACE_RING_SIZE;
+  pthread_mutex_unlock(&g_trace_lock);
+}
+
+bool TraceOpen(const char *path, const vector<uint32_t> &instructions)
+{
+  g_trace_file = fopen(path, "wb");
+  if (g_trace_file == NULL) {
+    cerr << "Error: cannot create trace file " << path << endl;
+    return false;
+  }
+
+  vector<unsigned char> header(TRACE_HEADER_SIZE + 4 * instructions.size());
+  memcpy(&header[0], TRACE_MAGIC, TRACE_MAGIC_SIZE);
+  WriteLE32(&header[8], TRACE_VERSION);
+  WriteLE32(&header[12], instructions.size());
+  for (size_t i = 0; i < instructions.size(); i++)
+    WriteLE32(&header[TRACE_HEADER_SIZE + 4 * i], instructions[i]);
+  if (fwrite(&header[0], 1, header.size(), g_trace_file) != header.size()) {
+    cerr << "Error: cannot write trace file " << path << endl;
+    fclose(g_trace_file);
+    g_trace_file = NULL;
+    return false;
+  }
+
+  g_trace_ring = new unsigned char[TRACE_RING_SIZE];
+  g_trace_head = 0;
+  g_trace_limit = TRACE_RING_SIZE;
+  g_trace_published = 0;
+  g_trace_consumed = 0;
+  g_trace_closing = false;
+  g_trace_write_error = false;
+  if (pthread_create(&g_trace_writer, NULL, TraceWriterMain, NULL) != 0) {
+    cerr << "Error: cannot start the trace writer" << endl;
+    delete [] g_trace_ring;
+    g_trace_ring = NULL;
+    fclose(g_trace_file);
+    g_trace_file = NULL;
+    return false;
+  }
+
+  // The first record carries the complete state
+  MarkAllDirty();
+  g_trace_enabled = true;
+  return true;
+}
+
+void TraceRecord(const unsigned int pc, const int opcode)
+{
+  unsigned char record[TRACE_MAX_RECORD_SIZE];
+  unsigned char *p = record + TRACE_RECORD_HEADER_SIZE;
+  int flags = 0;
+  int num_scalar = 0;
+  int num_vector = 0;
+
+  for (uint32_t mask = g_machine->dirty_scalar_mask; mask != 0; mask &= mask - 1) {
+    int i = __builtin_ctz(mask);
+    p[0] = i;
+    WriteLE32(p + 1, g_machine->scalar_registers[i].int_value);
+    p += TRACE_SCALAR_ENTRY_SIZE;
+    num_scalar++;
+  }
+  for (uint64_t mask = g_machine->dirty_vector_mask; mask != 0; mask &= mask - 1) {
+    int i = __builtin_ctzll(mask);
+    p[0] = i;
+    for (int j = 0; j < NUM_VECTOR_ELEMENTS; j++)
+      WriteLE32(p + 1 + 4 * j, g_machine->vector_registers[i].element[j].int_value);
+    p += TRACE_VECTOR_ENTRY_SIZE;
+    num_vector++;
+  }
+  if (g_machine->dirty_flags & DIRTY_CC) {
+    *p++ = g_machine->condition_code_register.int_value;
+    flags |= TRACE_RECORD_CC;
+  }
+  if (g_machine->dirty_flags & DIRTY_GSR) {
+    WriteLE32(p, g_machine->gpu_status_register.int_value);
+    p += 4;
+    flags |= TRACE_RECORD_GSR;
+  }
+  if (g_machine->dirty_flags & DIRTY_VERTEX) {
+    for (int i = 0; i < NUM_VERTEX_REGISTER; i++) {
+      const VertexRegister &vertex = g_machine->gpu_vertex_registers[i];
+      WriteLE32(p, vertex.x_value);
+      WriteLE32(p + 4, vertex.y_value);
+      WriteLE32(p + 8, vertex.z_value);
+      WriteLE32(p + 12, vertex.r_value);
+      WriteLE32(p + 16, vertex.g_value);
+      WriteLE32(p + 20, vertex.b_value);
+      p += 24;
+    }
+    flags |= TRACE_RECORD_VERTEX;
+  }
+
+  record[0] = flags;
+  record[1] = opcode;
+  record[2] = num_scalar;
+  record[3] = num_vector;
+  WriteLE32(record + 4, pc);
+
+  ///////////////////////////////////////////////////////////////
+  // Append to the ring, wrapping around its end
+  ///////////////////////////////////////////////////////////////
+  size_t size = p - record;
+  TraceReserve(size);
+  size_t offset = g_trace_head & (TRACE_RING_SIZE - 1);
+  size_t first = size < TRACE_RING_SIZE - offset ? size : TRACE_RING_SIZE - offset;
+  memcpy(g_trace_ring + offset, record, first);
+  memcpy(g_trace_ring, record + first, size - first);
+  g_trace_head += size;
+
+  if (g_trace_head - g_trace_published >= TRACE_PUBLISH_SIZE)
+    TracePublish();
+}
+
+bool TraceClose()
+{
+  if (!g_trace_enabled)
+    return true;
+  g_trace_enabled = false;
+
+  pthread_mutex_lock(&g_trace_lock);
+  g_trace_published = g_trace_head;
+  g_trace_closing = true;
+  pthread_cond_signal(&g_trace_data_ready);
+  pthread_mutex_unlock(&g_trace_lock);
+  pthread_join(g_trace_writer, NULL);
+
+  bool ok = !g_trace_write_error;
+  if (fclose(g_trace_file) != 0)
+    ok = false;
+  if (!ok)
+    cerr << "Error: failed to write the trace file" << endl;
+  g_trace_file = NULL;
+  delete [] g_trace_ring;
+  g_trace_ring = NULL;
+  return ok;
+}
@@ -0,0 +1,41 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdint.h>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////
+// Runtime execution trace (--trace FILE)
+//
+// Records are encoded into a fixed-size ring buffer on the simulating
+// thread and written to FILE by a background thread, so the interpreter
+// only pays for encoding the registers ExecuteInstruction() marked dirty
+// and a memcpy per instruction. The file format is described in
+// trace_format.h; trace_dump renders it as the "3220X-" context dump.
+////////////////////////////////////////////////////////////////////////
+
+#define TRACE_RING_SIZE (4*1024*1024)     // must be a power of two
+#define TRACE_PUBLISH_SIZE (64*1024)      // bytes handed to the writer at once
+
+extern bool g_trace_enabled;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Create the trace file, write its header and start the writer
+// input: output path, instruction words of the program
+// output: false on error
+////////////////////////////////////////////////////////////////////////
+bool TraceOpen(const char *path, const std::vector<uint32_t> &instructions);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Record one executed instruction with the registers it changed
+// input: index and opcode of the executed instruction
+////////////////////////////////////////////////////////////////////////
+void TraceRecord(const unsigned int pc, const int opcode);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Drain the ring buffer, stop the writer and close the file
+// output: false if any write failed
+////////////////////////////////////////////////////////////////////////
+bool TraceClose();
+
+#endif // __TRACE_H
@@ -0,0 +1,93 @@
+#include <iostream>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "simulator.h"
+#include "program_image.h"
+#include "trace_format.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////
+// trace_dump: render a binary trace written by "simulator --trace" as the
+// "3220X-" per-instruction context dump
+////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv)
+{
+  if (argc != 2) {
+    cerr << "Usage: " << argv[0] << " <trace>" << endl;
+    return 1;
+  }
+
+  int fd = open(argv[1], O_RDONLY);
+  if (fd < 0) {
+    cerr << "Error: cannot open " << argv[1] << endl;
+    return 1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < TRACE_HEADER_SIZE) {
+    cerr << "Error: " << argv[1] << " is not a trace file" << endl;
+    close(fd);
+    return 1;
+  }
+  const size_t size = st.st_size;
+  void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    cerr << "Error: cannot map " << argv[1] << endl;
+    return 1;
+  }
+  const unsigned char *data = (const unsigned char *)mapping;
+
+  ///////////////////////////////////////////////////////////////
+  // Header and program
+  ///////////////////////////////////////////////////////////////
+  if (memcmp(data, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0 ||
+      ReadLE32(data + 8) != TRACE_VERSION) {
+    cerr << "Error: " << argv[1] << " is not a version " << TRACE_VERSION << " trace file" << endl;
+    munmap(mapping, size);
+    return 1;
+  }
+  const uint32_t num_words = ReadLE32(data + 12);
+  if (num_words > (size - TRACE_HEADER_SIZE) / 4) {
+    cerr << "Error: truncated trace header" << endl;
+    munmap(mapping, size);
+    return 1;
+  }
+  vector<int> opcodes(num_words);
+  for (uint32_t i = 0; i < num_words; i++)
+    opcodes[i] = ReadLE32(data + TRACE_HEADER_SIZE + 4 * i) >> 24;
+
+  ///////////////////////////////////////////////////////////////
+  // Replay records
+  ///////////////////////////////////////////////////////////////
+  TraceState state;
+  memset(&state, 0x00, sizeof(state));
+  size_t position = TRACE_HEADER_SIZE + 4 * (size_t)num_words;
+  unsigned int instruction_count = 0;
+  int status = 0;
+  while (position < size) {
+    unsigned int pc;
+    int opcode;
+    size_t length = ApplyTraceRecord(data + position, size - position, state, pc, opcode);
+    if (length == 0) {
+      cerr << "Error: malformed trace record at offset " << position << endl;
+      status = 1;
+      break;
+    }
+    position += length;
+    instruction_count++;
+
+    unsigned int next_pc = state.scalar_registers[PC_IDX].int_value;
+    int next_opcode = next_pc < num_words ? opcodes[next_pc] : 0;
+    WriteContext(cout, instruction_count, pc, opcode, next_opcode, state);
+  }
+
+  munmap(mapping, size);
+  cout.flush();
+  return status;
+}
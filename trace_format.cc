@@ -0,0 +1,188 @@
+#include <iostream>
+#include <string.h>
+#include "simulator.h"
+#include "program_image.h"
+#include "trace_format.h"
+
+using namespace std;
+
+size_t ApplyTraceRecord(const unsigned char *record, const size_t size, TraceState &state,
+                        unsigned int &pc, int &opcode)
+{
+  if (size < TRACE_RECORD_HEADER_SIZE)
+    return 0;
+
+  const int flags = record[0];
+  const int num_scalar = record[2];
+  const int num_vector = record[3];
+  size_t length = TRACE_RECORD_HEADER_SIZE
+                + num_scalar * TRACE_SCALAR_ENTRY_SIZE
+                + num_vector * TRACE_VECTOR_ENTRY_SIZE
+                + ((flags & TRACE_RECORD_CC) ? 1 : 0)
+                + ((flags & TRACE_RECORD_GSR) ? 4 : 0)
+                + ((flags & TRACE_RECORD_VERTEX) ? TRACE_VERTEX_SIZE : 0);
+  if (length > size)
+    return 0;
+
+  opcode = record[1];
+  pc = ReadLE32(record + 4);
+
+  const unsigned char *p = record + TRACE_RECORD_HEADER_SIZE;
+  for (int i = 0; i < num_scalar; i++, p += TRACE_SCALAR_ENTRY_SIZE) {
+    if (p[0] >= NUM_SCALAR_REGISTER)
+      return 0;
+    state.scalar_registers[p[0]].int_value = ReadLE32(p + 1);
+  }
+  for (int i = 0; i < num_vector; i++, p += TRACE_VECTOR_ENTRY_SIZE) {
+    if (p[0] >= NUM_VECTOR_REGISTER)
+      return 0;
+    for (int j = 0; j < NUM_VECTOR_ELEMENTS; j++)
+      state.vector_registers[p[0]].element[j].int_value = ReadLE32(p + 1 + 4 * j);
+  }
+  if (flags & TRACE_RECORD_CC)
+    state.condition_code_register.int_value = *p++;
+  if (flags & TRACE_RECORD_GSR) {
+    state.gpu_status_register.int_value = ReadLE32(p);
+    p += 4;
+  }
+  if (flags & TRACE_RECORD_VERTEX) {
+    for (int i = 0; i < NUM_VERTEX_REGISTER; i++) {
+      VertexRegister &vertex = state.gpu_vertex_registers[i];
+      vertex.x_value = ReadLE32(p);
+      vertex.y_value = ReadLE32(p + 4);
+      vertex.z_value = ReadLE32(p + 8);
+      vertex.r_value = ReadLE32(p + 12);
+      vertex.g_value = ReadLE32(p + 16);
+      vertex.b_value = ReadLE32(p + 20);
+      p += 24;
+    }
+  }
+
+  return length;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Pieces of the context dump shared by WriteContext() and
+// WriteContextDelta()
+////////////////////////////////////////////////////////////////////////
+static void WriteHeaderLine(ostream &out, const uint64_t instruction_count,
+                            const unsigned int current_pc, const int current_opcode,
+                            const int next_opcode, const TraceState &state)
+{
+  const int next_pc = state.scalar_registers[PC_IDX].int_value;
+  out << "3220X-Instruction Count: " << instruction_count
+      << " C_PC: " << (current_pc *4)
+      << " C_PC_IND: " << current_pc
+      << ", Curr_Opcode: " << current_opcode
+      << " NEXT_PC: " << (next_pc<<2)
+      << " NEXT_PC_IND: " << next_pc
+      << ", Next_Opcode: " << next_opcode
+      << '\n';
+}
+
+static void WriteScalar(ostream &out, const int srIdx, const int value)
+{
+  out << "R" << srIdx << ":";
+  if (srIdx < 8 || srIdx == 15)
+    out << (int)(int16_t)value;
+  else
+    out << (float)FIXED_TO_FLOAT1114(value);
+}
+
+static void WriteConditionCode(ostream &out, const int cc)
+{
+  out << " CC :N: " << ((cc &0x4) >>2) << " Z: " << ((cc &0x2) >>1) << " P: " << (cc &0x1) << "  ";
+}
+
+static void WriteStatus(ostream &out, const int gsr)
+{
+  out << " draw: " << (gsr &0x01) << " fush: " << ((gsr & 0x2)>>1);
+  out << " prim_type: "<< ((gsr & 0x4) >> 2)  << " ";
+}
+
+static void WriteVector(ostream &out, const char *prefix, const int vrIdx, const VectorRegister &vector)
+{
+  out << prefix;
+  out << "V" << vrIdx << ":";
+  for (int elmtIdx = 0; elmtIdx < NUM_VECTOR_ELEMENTS; elmtIdx++) {
+    out << "Element[" << elmtIdx << "] = "
+        << (float)FIXED_TO_FLOAT1114(vector.element[elmtIdx].int_value)
+        << (elmtIdx == NUM_VECTOR_ELEMENTS-1 ? "" : ",");
+  }
+  out << '\n';
+}
+
+static void WriteVertices(ostream &out, const char *prefix, const VertexRegister *vertices)
+{
+  out << prefix;
+  out << " vertices P1_X: " << vertices[0].x_value;
+  out << " vertices P1_Y: " << vertices[0].y_value;
+  out << " r: " << vertices[0].r_value;
+  out << " g: " << vertices[0].g_value;
+  out << " b: " << vertices[0].b_value;
+  out << " P2_X: " << vertices[1].x_value;
+  out << " P2_Y: " << vertices[1].y_value;
+  out << " r: " << vertices[1].r_value;
+  out << " g: " << vertices[1].g_value;
+  out << " b: " << vertices[1].b_value;
+  out << " P3_X: " << vertices[2].x_value;
+  out << " P3_Y: " << vertices[2].y_value;
+  out << " r: " << vertices[2].r_value;
+  out << " g: " << vertices[2].g_value;
+  out << " b: " << vertices[2].b_value << '\n';
+}
+
+void WriteContext(ostream &out, const uint64_t instruction_count,
+                  const unsigned int current_pc, const int current_opcode,
+                  const int next_opcode, const TraceState &state)
+{
+  out << "--------------------------------------------------\n";
+  WriteHeaderLine(out, instruction_count, current_pc, current_opcode, next_opcode, state);
+  out << "3220X-";
+  for (int srIdx = 0; srIdx < NUM_SCALAR_REGISTER; srIdx++) {
+    WriteScalar(out, srIdx, state.scalar_registers[srIdx].int_value);
+    out << (srIdx == NUM_SCALAR_REGISTER-1 ? "" : ", ");
+  }
+  WriteConditionCode(out, state.condition_code_register.int_value);
+  WriteStatus(out, state.gpu_status_register.int_value);
+  out << '\n';
+
+  for (int vrIdx = 0; vrIdx < 6; vrIdx++)
+    WriteVector(out, "3220X-", vrIdx, state.vector_registers[vrIdx]);
+  out << '\n';
+
+  WriteVertices(out, "3220X-", state.gpu_vertex_registers);
+  out << "--------------------------------------------------\n";
+}
+
+void WriteContextDelta(ostream &out, const uint64_t instruction_count,
+                       const unsigned int current_pc, const int current_opcode,
+                       const TraceState &state, const uint32_t scalar_mask, const uint64_t vector_mask,
+                       const unsigned int flags)
+{
+  out << "3220D-#" << instruction_count << " PC:" << current_pc << " OP:" << current_opcode << '\n';
+
+  if (scalar_mask != 0 || (flags & (DIRTY_CC | DIRTY_GSR))) {
+    out << "3220D-";
+    bool first = true;
+    for (int srIdx = 0; srIdx < NUM_SCALAR_REGISTER; srIdx++) {
+      if (scalar_mask & (1u << srIdx)) {
+        if (!first)
+          out << ", ";
+        WriteScalar(out, srIdx, state.scalar_registers[srIdx].int_value);
+        first = false;
+      }
+    }
+    if (flags & DIRTY_CC)
+      WriteConditionCode(out, state.condition_code_register.int_value);
+    if (flags & DIRTY_GSR)
+      WriteStatus(out, state.gpu_status_register.int_value);
+    out << '\n';
+  }
+
+  for (uint64_t mask = vector_mask; mask != 0; mask &= mask - 1)
+    WriteVector(out, "3220D-", __builtin_ctzll(mask), state.vector_registers[__builtin_ctzll(mask)]);
+
+  if (flags & DIRTY_VERTEX)
+    WriteVertices(out, "3220D-", state.gpu_vertex_registers);
+}
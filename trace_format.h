@@ -0,0 +1,101 @@
+#ifndef __TRACE_FORMAT_H
+#define __TRACE_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ostream>
+#include "simulator.h"
+
+////////////////////////////////////////////////////////////////////////
+// Binary execution trace written by --trace (see trace.h)
+//
+// Header (little-endian):
+//   [0:8)   magic "3220XTRC"
+//   [8:12)  format version
+//   [12:16) number of instruction words N
+//   [16:16+4N) instruction words, so the trace can be rendered without
+//              the program
+//
+// Followed by one record per executed instruction:
+//   u8  flags (TRACE_RECORD_*)
+//   u8  opcode
+//   u8  number of scalar register entries S
+//   u8  number of vector register entries V
+//   u32 index of the executed instruction
+//   S x { u8 register index, u32 value }
+//   V x { u8 register index, 4 x u32 element value }
+//   u8  condition code          if TRACE_RECORD_CC
+//   u32 GPU status register     if TRACE_RECORD_GSR
+//   3 x 6 u32 vertex registers  if TRACE_RECORD_VERTEX
+//
+// A record only carries the state written since the previous record;
+// all registers are zero before the first one.
+////////////////////////////////////////////////////////////////////////
+#define TRACE_MAGIC "3220XTRC"
+#define TRACE_MAGIC_SIZE 8
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 16
+
+enum TraceRecordFlags {
+  TRACE_RECORD_CC = 0x1,
+  TRACE_RECORD_GSR = 0x2,
+  TRACE_RECORD_VERTEX = 0x4,
+};
+
+#define TRACE_RECORD_HEADER_SIZE 8
+#define TRACE_SCALAR_ENTRY_SIZE 5
+#define TRACE_VECTOR_ENTRY_SIZE (1 + 4 * NUM_VECTOR_ELEMENTS)
+#define TRACE_VERTEX_SIZE (NUM_VERTEX_REGISTER * 6 * 4)
+#define TRACE_MAX_RECORD_SIZE (TRACE_RECORD_HEADER_SIZE + \
+                               NUM_SCALAR_REGISTER * TRACE_SCALAR_ENTRY_SIZE + \
+                               NUM_VECTOR_REGISTER * TRACE_VECTOR_ENTRY_SIZE + \
+                               1 + 4 + TRACE_VERTEX_SIZE)
+
+////////////////////////////////////////////////////////////////////////
+// Register state shown by the context dump
+////////////////////////////////////////////////////////////////////////
+typedef struct TraceState_ {
+  ScalarRegister condition_code_register;
+  ScalarRegister scalar_registers[NUM_SCALAR_REGISTER];
+  VectorRegister vector_registers[NUM_VECTOR_REGISTER];
+  VertexRegister gpu_vertex_registers[NUM_VERTEX_REGISTER];
+  ScalarRegister gpu_status_register;
+} TraceState;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Decode one record and apply it to state
+// input: record bytes and how many are available
+// output: size of the record, or 0 if it is truncated or malformed;
+//         pc and opcode of the executed instruction
+////////////////////////////////////////////////////////////////////////
+size_t ApplyTraceRecord(const unsigned char *record, const size_t size, TraceState &state,
+                        unsigned int &pc, int &opcode);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Write the "3220X-" context dump of one executed instruction
+// input: output stream, instruction count, index and opcode of the
+//        executed instruction, opcode at the next PC, register state
+////////////////////////////////////////////////////////////////////////
+void WriteContext(std::ostream &out, const uint64_t instruction_count,
+                  const unsigned int current_pc, const int current_opcode,
+                  const int next_opcode, const TraceState &state);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Write the "3220D-" delta dump of one executed instruction: a
+//       short header, then only the state named by the dirty masks
+//         3220D-#12 PC:3 OP:1                       count, C_PC_IND, Curr_Opcode
+//         3220D-R2:5, R15:9 CC :N: 0 Z: 0 P: 1     changed scalars, CC, GSR
+//         3220D-V7:Element[0] = ...                 one line per changed vector
+//         3220D- vertices P1_X: ...                 if any vertex changed
+//       R15 is always written, so NEXT_PC follows from the scalar line and
+//       Next_Opcode from the program. Applying every delta to the last
+//       full "3220X-" context rebuilds the full dump.
+// input: as WriteContext() without next_opcode, plus the dirty masks
+//        (see DirtyFlags)
+////////////////////////////////////////////////////////////////////////
+void WriteContextDelta(std::ostream &out, const uint64_t instruction_count,
+                       const unsigned int current_pc, const int current_opcode,
+                       const TraceState &state, const uint32_t scalar_mask,
+                       const uint64_t vector_mask, const unsigned int flags);
+
+#endif // __TRACE_FORMAT_H
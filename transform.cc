@@ -0,0 +1,121 @@
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include "transform.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////
+// desc: sin() in 16.16 of every 1.11.4 angle in [0, 360) degrees
+////////////////////////////////////////////////////////////////////////
+static vector<int32_t> BuildSineTable()
+{
+  vector<int32_t> table(ANGLE_STEPS);
+  for (int i = 0; i < ANGLE_STEPS; i++)
+    table[i] = (int32_t)lround(sin(i * M_PI / (ANGLE_STEPS / 2)) * TRANSFORM_ONE);
+  return table;
+}
+
+static const vector<int32_t> g_sine_table = BuildSineTable();
+
+static int32_t SaturateFixed(const int64_t value)
+{
+  return value > INT32_MAX ? INT32_MAX : value < INT32_MIN ? INT32_MIN : (int32_t)value;
+}
+
+////////////////////////////////////////////////////////////////////////
+// desc: 16.16 product of a 16.16 value and a factor with factor_bits
+//       fraction bits, rounded to nearest and saturated
+////////////////////////////////////////////////////////////////////////
+static int32_t MultiplyFixed(const int64_t value, const int64_t factor, const int factor_bits)
+{
+  return SaturateFixed((value * factor + (1ll << (factor_bits - 1))) >> factor_bits);
+}
+
+void UpdateTransform(TransformStack &stack)
+{
+  const int32_t (&matrix)[4][4] = stack.matrix[stack.depth];
+  stack.identity = true;
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      stack.columns[j][i] = (float)matrix[i][j] / TRANSFORM_ONE;
+      if (matrix[i][j] != (i == j ? TRANSFORM_ONE : 0))
+        stack.identity = false;
+    }
+  }
+}
+
+void LoadIdentityMatrix(TransformStack &stack)
+{
+  memset(stack.matrix[stack.depth], 0, sizeof(stack.matrix[stack.depth]));
+  for (int i = 0; i < 4; i++)
+    stack.matrix[stack.depth][i][i] = TRANSFORM_ONE;
+  UpdateTransform(stack);
+}
+
+void ResetTransform(TransformStack &stack)
+{
+  stack.depth = 0;
+  LoadIdentityMatrix(stack);
+}
+
+void PushMatrix(TransformStack &stack)
+{
+  if (stack.depth + 1 >= TRANSFORM_STACK_DEPTH)
+    return;
+  memcpy(stack.matrix[stack.depth + 1], stack.matrix[stack.depth], sizeof(stack.matrix[0]));
+  stack.depth++;
+}
+
+void PopMatrix(TransformStack &stack)
+{
+  if (stack.depth == 0)
+    return;
+  stack.depth--;
+  UpdateTransform(stack);
+}
+
+void RotateMatrix(TransformStack &stack, const int angle)
+{
+  int index = (int16_t)angle % ANGLE_STEPS;
+  if (index < 0)
+    index += ANGLE_STEPS;
+  const int64_t sine = g_sine_table[index];
+  const int64_t cosine = g_sine_table[(index + ANGLE_STEPS / 4) % ANGLE_STEPS];
+
+  // M * R: column 0 becomes c * col0 + s * col1, column 1 c * col1 - s * col0
+  int32_t (&matrix)[4][4] = stack.matrix[stack.depth];
+  for (int i = 0; i < 3; i++) {
+    const int64_t x = matrix[i][0];
+    const int64_t y = matrix[i][1];
+    matrix[i][0] = SaturateFixed((x * cosine + y * sine + (1ll << (TRANSFORM_FRACTION_BITS - 1)))
+                                 >> TRANSFORM_FRACTION_BITS);
+    matrix[i][1] = SaturateFixed((y * cosine - x * sine + (1ll << (TRANSFORM_FRACTION_BITS - 1)))
+                                 >> TRANSFORM_FRACTION_BITS);
+  }
+  UpdateTransform(stack);
+}
+
+void ScaleMatrix(TransformStack &stack, const int x, const int y, const int z)
+{
+  const int16_t factors[3] = {(int16_t)x, (int16_t)y, (int16_t)z};
+  int32_t (&matrix)[4][4] = stack.matrix[stack.depth];
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      matrix[i][j] = MultiplyFixed(matrix[i][j], factors[j], FIXED1114_FRACTION_BITS);
+  UpdateTransform(stack);
+}
+
+void TranslateMatrix(TransformStack &stack, const int x, const int y, const int z)
+{
+  const int16_t offsets[3] = {(int16_t)x, (int16_t)y, (int16_t)z};
+  int32_t (&matrix)[4][4] = stack.matrix[stack.depth];
+  for (int i = 0; i < 3; i++) {
+    int64_t sum = matrix[i][3];
+    for (int j = 0; j < 3; j++)
+      sum += MultiplyFixed(matrix[i][j], offsets[j], FIXED1114_FRACTION_BITS);
+    matrix[i][3] = SaturateFixed(sum);
+  }
+  UpdateTransform(stack);
+}
@@ -0,0 +1,112 @@
+#ifndef __TRANSFORM_H
+#define __TRANSFORM_H
+
+#include <stdint.h>
+#include "fixed_point.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Vertex transform stage
+//
+// The GPU keeps a current matrix on a stack of TRANSFORM_STACK_DEPTH
+// entries. rotate, scale and translate multiply it on the right, as in
+// OpenGL, so the transform listed last applies to a vertex first. A
+// chain of them only updates the matrix; setvertex then maps its
+// (x, y, z, 1) through the matrix once. pushmatrix copies the current
+// matrix one level up, popmatrix returns to the one below and
+// loadidentity resets it. A push onto a full stack and a pop of the
+// last entry are ignored.
+//
+// Operands are 1.11.4 vector lanes, like setvertex:
+//   rotate v     v[0] degrees counterclockwise about the z axis
+//   scale v      by v[1], v[2], v[3] along x, y and z
+//   translate v  by v[1], v[2], v[3]
+//
+// Matrices are 4x4, row-major, in 16.16 fixed point; composing rounds
+// each entry to nearest and saturates. Sines come from a table over
+// every 1.11.4 angle in [0, 360). Only affine transforms can be built,
+// so the bottom row stays 0 0 0 1.
+//
+// For setvertex the current matrix is also kept as four float columns:
+// the vertex, in 1/16 units, is broadcast against them and summed in
+// SSE lanes, clamped to the 1.11.4 range and floored to integers. While
+// the matrix is the identity setvertex skips the multiply; both give
+// exactly Fixed1114ToInt() of the input there.
+////////////////////////////////////////////////////////////////////////
+#define TRANSFORM_STACK_DEPTH 16
+#define TRANSFORM_FRACTION_BITS 16
+#define TRANSFORM_ONE (1 << TRANSFORM_FRACTION_BITS)
+#define ANGLE_STEPS (360 << FIXED1114_FRACTION_BITS)   // sine table entries
+
+typedef struct TransformStack_ {
+  alignas(16) float columns[4][4];  // current matrix by column, for TransformVertex()
+  bool identity;                    // current matrix is the identity
+  unsigned int depth;               // index of the current matrix
+  int32_t matrix[TRANSFORM_STACK_DEPTH][4][4];
+} TransformStack;
+
+////////////////////////////////////////////////////////////////////////
+// desc: Empty the stack, leaving the identity as the current matrix
+////////////////////////////////////////////////////////////////////////
+void ResetTransform(TransformStack &stack);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Refresh the float columns and the identity flag after the
+//       current matrix was written directly (checkpoint restore)
+////////////////////////////////////////////////////////////////////////
+void UpdateTransform(TransformStack &stack);
+
+void LoadIdentityMatrix(TransformStack &stack);
+void PushMatrix(TransformStack &stack);
+void PopMatrix(TransformStack &stack);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Compose a transform into the current matrix
+// input: 1.11.4 register values (see above)
+////////////////////////////////////////////////////////////////////////
+void RotateMatrix(TransformStack &stack, const int angle);
+void ScaleMatrix(TransformStack &stack, const int x, const int y, const int z);
+void TranslateMatrix(TransformStack &stack, const int x, const int y, const int z);
+
+////////////////////////////////////////////////////////////////////////
+// desc: Integer coordinates of the 1.11.4 point (x, y, z) under the
+//       current matrix
+// output: out[0..2]
+////////////////////////////////////////////////////////////////////////
+static inline void TransformVertex(const TransformStack &stack, const int x, const int y,
+                                   const int z, int *out)
+{
+  if (stack.identity) {
+    out[0] = Fixed1114ToInt(x);
+    out[1] = Fixed1114ToInt(y);
+    out[2] = Fixed1114ToInt(z);
+    return;
+  }
+
+  // Floor by truncating a value made non-negative by the bias
+  const float bias = -FIXED1114_MIN;
+#if defined(__SSE2__)
+  __m128 sum = _mm_mul_ps(_mm_load_ps(stack.columns[0]), _mm_set1_ps((int16_t)x));
+  sum = _mm_add_ps(sum, _mm_mul_ps(_mm_load_ps(stack.columns[1]), _mm_set1_ps((int16_t)y)));
+  sum = _mm_add_ps(sum, _mm_mul_ps(_mm_load_ps(stack.columns[2]), _mm_set1_ps((int16_t)z)));
+  sum = _mm_add_ps(sum, _mm_mul_ps(_mm_load_ps(stack.columns[3]), _mm_set1_ps(1 << FIXED1114_FRACTION_BITS)));
+  sum = _mm_min_ps(_mm_max_ps(sum, _mm_set1_ps(FIXED1114_MIN)), _mm_set1_ps(FIXED1114_MAX));
+  alignas(16) int lanes[4];
+  _mm_store_si128((__m128i *)lanes, _mm_cvttps_epi32(_mm_add_ps(sum, _mm_set1_ps(bias))));
+  for (int i = 0; i < 3; i++)
+    out[i] = (lanes[i] >> FIXED1114_FRACTION_BITS) - (-FIXED1114_MIN >> FIXED1114_FRACTION_BITS);
+#else
+  for (int i = 0; i < 3; i++) {
+    float sum = stack.columns[0][i] * (int16_t)x;
+    sum += stack.columns[1][i] * (int16_t)y;
+    sum += stack.columns[2][i] * (int16_t)z;
+    sum += stack.columns[3][i] * (1 << FIXED1114_FRACTION_BITS);
+    sum = sum < FIXED1114_MIN ? FIXED1114_MIN : sum > FIXED1114_MAX ? FIXED1114_MAX : sum;
+    out[i] = ((int)(sum + bias) >> FIXED1114_FRACTION_BITS) - (-FIXED1114_MIN >> FIXED1114_FRACTION_BITS);
+  }
+#endif
+}
+
+#endif // __TRANSFORM_H